@@ -10,9 +10,10 @@ FIntVector2 USimplexNoiseVoxelWorldGenerator::GetWantedWorldSizeVoxels() const
 	return WorldSize;
 }
 
-void USimplexNoiseVoxelWorldGenerator::GenerateWorld(AVoxelWorld* VoxelWorld, const FVoxelWorlGenerationFinished& Callback)
+void USimplexNoiseVoxelWorldGenerator::GenerateChunk(AVoxelWorld* VoxelWorld, UVoxelChunk* Chunk)
 {
 	check(VoxelWorld);
+	check(Chunk);
 
     UVoxelTypeSet* VoxelTypeSet = VoxelWorld->GetVoxelTypeSet();
     check(VoxelTypeSet);
@@ -23,43 +24,63 @@ void USimplexNoiseVoxelWorldGenerator::GenerateWorld(AVoxelWorld* VoxelWorld, co
     check(DirtType != EmptyVoxelType);
     check(StoneType != EmptyVoxelType);
 
-	FIntVector WorldSizeActual = VoxelWorld->GetWorldSizeVoxel();
-    for (int X = 0; X < WorldSizeActual.X; X++)
+    FIntVector ChunkMin;
+    FIntVector ChunkMax;
+    Chunk->GetVoxelBoundingBox(ChunkMin, ChunkMax);
+    int32 ChunkSide = VoxelWorld->GetChunkSide();
+    int32 WorldHeight = VoxelWorld->GetWorldHeight();
+
+    // Chunk storage starts empty, so only solid voxels are written.
+    // Stone below the lowest dirt of the chunk is filled in bulk, which keeps whole sections uniform.
+    TArray<int32> ColumnHeights;
+    ColumnHeights.SetNumUninitialized(ChunkSide * ChunkSide);
+    int32 LowestDirt = WorldHeight;
+    for (int Y = 0; Y < ChunkSide; Y++)
     {
-        for (int Y = 0; Y < WorldSizeActual.Y; Y++)
+        for (int X = 0; X < ChunkSide; X++)
         {
-            FVector WorldPos2D = VoxelWorld->GetVoxelCenterWorld(FIntVector(X, Y, 0));
+            FVector WorldPos2D = VoxelWorld->GetVoxelCenterWorld(ChunkMin + FIntVector(X, Y, 0));
             float NoiseValue = USimplexNoise::Noise(WorldPos2D.X * NoiseScale, WorldPos2D.Y * NoiseScale);
-
             int32 Height = TerrainAverageHeight + NoiseValue * HeightAmplitude;
+            ColumnHeights[Y * ChunkSide + X] = Height;
+            LowestDirt = FMath::Min(LowestDirt, Height - GrassThickness - DirthThickness);
+        }
+    }
+
+    int32 StoneFillTop = FMath::Clamp(LowestDirt + 1, 0, WorldHeight);
+    Chunk->FillVoxels(FIntVector(0, 0, 0), FIntVector(ChunkSide, ChunkSide, StoneFillTop), StoneType);
+
+    for (int Y = 0; Y < ChunkSide; Y++)
+    {
+        for (int X = 0; X < ChunkSide; X++)
+        {
+            int32 Height = ColumnHeights[Y * ChunkSide + X];
             int32 DirtLowest = Height - GrassThickness - DirthThickness;
             int32 GrassLowest = Height - GrassThickness;
+            int32 ColumnTop = FMath::Min(Height + 1, WorldHeight);
 
-            for (int Z = 0; Z < WorldSizeActual.Z; Z++)
+            for (int Z = StoneFillTop; Z < ColumnTop; Z++)
             {
-                FIntVector VoxelCoord(X, Y, Z);
-                Voxel& Voxel = VoxelWorld->GetVoxel(VoxelCoord);
-
+                VoxelType VoxelTypeId;
                 if (Z <= DirtLowest)
                 {
-                    Voxel.VoxelTypeId = StoneType;
+                    VoxelTypeId = StoneType;
                 }
                 else if (Z < GrassLowest)
                 {
-                    Voxel.VoxelTypeId = DirtType;
-                }
-                else if (Z <= Height)
-                {
-                    Voxel.VoxelTypeId = GrassType;
+                    VoxelTypeId = DirtType;
                 }
                 else
                 {
-                    Voxel.VoxelTypeId = EmptyVoxelType;
+                    VoxelTypeId = GrassType;
                 }
+                Chunk->SetVoxel(FIntVector(X, Y, Z), VoxelTypeId);
             }
         }
     }
-
-    Callback.ExecuteIfBound();
 }
 
+bool USimplexNoiseVoxelWorldGenerator::CanGenerateChunksInParallel() const
+{
+	return true;
+}
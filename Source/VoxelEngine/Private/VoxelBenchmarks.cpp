@@ -0,0 +1,820 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VoxelBenchmarks.h"
+#include "VoxelWorld.h"
+#include "SimplexNoise.h"
+#include "HAL/PlatformTime.h"
+#include "VoxelPalettedStorage.h"
+#include "VoxelIndexing.h"
+#include "VoxelRunLengthCodec.h"
+#include "Math/RandomStream.h"
+#include "VoxelEngine/VoxelEngine.h"
+#include <atomic>
+
+namespace
+{
+	constexpr VoxelType BenchmarkSolidVoxelType = 1;
+
+	// Layout used before chunks owned their voxels: one array of atomic voxel types for the whole world, Z-major
+	struct FGlobalZMajorLayout
+	{
+		FIntVector Size;
+		int32 ChunkSide;
+		TUniquePtr<std::atomic<VoxelType>[]> Voxels;
+
+		FGlobalZMajorLayout(const FIntVector& InSize, int32 InChunkSide) : Size(InSize), ChunkSide(InChunkSide)
+		{
+			Voxels = MakeUnique<std::atomic<VoxelType>[]>(static_cast<SIZE_T>(Size.X) * Size.Y * Size.Z);
+		}
+
+		FORCEINLINE std::atomic<VoxelType>& At(int32 X, int32 Y, int32 Z)
+		{
+			return Voxels[static_cast<SIZE_T>(Z) * Size.X * Size.Y + static_cast<SIZE_T>(Y) * Size.X + X];
+		}
+
+		FORCEINLINE VoxelType Get(int32 X, int32 Y, int32 Z)
+		{
+			return At(X, Y, Z).load(std::memory_order_relaxed);
+		}
+
+		FORCEINLINE void Set(int32 X, int32 Y, int32 Z, VoxelType Type)
+		{
+			At(X, Y, Z).store(Type);
+		}
+
+		SIZE_T GetAllocatedSize() const
+		{
+			return static_cast<SIZE_T>(Size.X) * Size.Y * Size.Z * sizeof(std::atomic<VoxelType>);
+		}
+	};
+
+	// One contiguous Z-major block of atomic voxel types per chunk
+	struct FChunkMajorLayout
+	{
+		FIntVector Size;
+		int32 ChunkSide;
+		TArray<TUniquePtr<std::atomic<VoxelType>[]>> Chunks;
+
+		FChunkMajorLayout(const FIntVector& InSize, int32 InChunkSide) : Size(InSize), ChunkSide(InChunkSide)
+		{
+			int32 ChunksNum = (Size.X / ChunkSide) * (Size.Y / ChunkSide);
+			for (int32 I = 0; I < ChunksNum; I++)
+			{
+				Chunks.Add(MakeUnique<std::atomic<VoxelType>[]>(static_cast<SIZE_T>(ChunkSide) * ChunkSide * Size.Z));
+			}
+		}
+
+		FORCEINLINE std::atomic<VoxelType>& At(int32 X, int32 Y, int32 Z)
+		{
+			int32 ChunkCoordX = X / ChunkSide;
+			int32 ChunkCoordY = Y / ChunkSide;
+			int32 LocalX = X - ChunkCoordX * ChunkSide;
+			int32 LocalY = Y - ChunkCoordY * ChunkSide;
+			return Chunks[ChunkCoordY * (Size.X / ChunkSide) + ChunkCoordX][static_cast<SIZE_T>(Z) * ChunkSide * ChunkSide + LocalY * ChunkSide + LocalX];
+		}
+
+		FORCEINLINE VoxelType Get(int32 X, int32 Y, int32 Z)
+		{
+			return At(X, Y, Z).load(std::memory_order_relaxed);
+		}
+
+		FORCEINLINE void Set(int32 X, int32 Y, int32 Z, VoxelType Type)
+		{
+			At(X, Y, Z).store(Type);
+		}
+
+		SIZE_T GetAllocatedSize() const
+		{
+			return static_cast<SIZE_T>(Size.X) * Size.Y * Size.Z * sizeof(std::atomic<VoxelType>);
+		}
+	};
+
+	// Chunk-major palette-compressed storage, as used by UVoxelChunk
+	template<typename InVoxelType>
+	struct TChunkMajorPalettedLayout
+	{
+		FIntVector Size;
+		int32 ChunkSide;
+		TArray<TUniquePtr<TVoxelPalettedStorage<InVoxelType>>> Chunks;
+
+		TChunkMajorPalettedLayout(const FIntVector& InSize, int32 InChunkSide) : Size(InSize), ChunkSide(InChunkSide)
+		{
+			int32 ChunksNum = (Size.X / ChunkSide) * (Size.Y / ChunkSide);
+			for (int32 I = 0; I < ChunksNum; I++)
+			{
+				TUniquePtr<TVoxelPalettedStorage<InVoxelType>>& Chunk = Chunks.Add_GetRef(MakeUnique<TVoxelPalettedStorage<InVoxelType>>());
+				Chunk->Initialize(ChunkSide * ChunkSide * Size.Z, EmptyVoxelType);
+			}
+		}
+
+		FORCEINLINE TVoxelPalettedStorage<InVoxelType>& GetChunk(int32 X, int32 Y, int32 Z, int32& OutIndex)
+		{
+			int32 ChunkCoordX = X / ChunkSide;
+			int32 ChunkCoordY = Y / ChunkSide;
+			int32 LocalX = X - ChunkCoordX * ChunkSide;
+			int32 LocalY = Y - ChunkCoordY * ChunkSide;
+			OutIndex = Z * ChunkSide * ChunkSide + LocalY * ChunkSide + LocalX;
+			return *Chunks[ChunkCoordY * (Size.X / ChunkSide) + ChunkCoordX];
+		}
+
+		FORCEINLINE InVoxelType Get(int32 X, int32 Y, int32 Z)
+		{
+			int32 Index;
+			TVoxelPalettedStorage<InVoxelType>& Chunk = GetChunk(X, Y, Z, Index);
+			return Chunk.Get(Index);
+		}
+
+		FORCEINLINE void Set(int32 X, int32 Y, int32 Z, InVoxelType Type)
+		{
+			int32 Index;
+			TVoxelPalettedStorage<InVoxelType>& Chunk = GetChunk(X, Y, Z, Index);
+			Chunk.Set(Index, Type);
+		}
+
+		SIZE_T GetAllocatedSize() const
+		{
+			SIZE_T AllocatedSize = 0;
+			for (const TUniquePtr<TVoxelPalettedStorage<InVoxelType>>& Chunk : Chunks)
+			{
+				AllocatedSize += Chunk->GetAllocatedSize();
+			}
+			return AllocatedSize;
+		}
+	};
+
+	using FChunkMajorPalettedLayout = TChunkMajorPalettedLayout<VoxelType>;
+
+	template<typename TLayout>
+	FORCEINLINE bool IsTransparent(TLayout& Layout, int32 X, int32 Y, int32 Z)
+	{
+		if (X < 0 || Y < 0 || Z < 0 || X >= Layout.Size.X || Y >= Layout.Size.Y || Z >= Layout.Size.Z)
+		{
+			return true;
+		}
+		return Layout.Get(X, Y, Z) == EmptyVoxelType;
+	}
+
+	// Same traversal order as USimplexNoiseVoxelWorldGenerator
+	template<typename TLayout>
+	double RunGeneration(TLayout& Layout, const TArray<int32>& Heights)
+	{
+		double StartTime = FPlatformTime::Seconds();
+		for (int32 X = 0; X < Layout.Size.X; X++)
+		{
+			for (int32 Y = 0; Y < Layout.Size.Y; Y++)
+			{
+				int32 Height = Heights[Y * Layout.Size.X + X];
+				for (int32 Z = 0; Z < Layout.Size.Z; Z++)
+				{
+					Layout.Set(X, Y, Z, Z <= Height ? BenchmarkSolidVoxelType : EmptyVoxelType);
+				}
+			}
+		}
+		return FPlatformTime::Seconds() - StartTime;
+	}
+
+	// Per-chunk six-neighbour visibility pass, the layout-dependent part of UVoxelChunk::ProcessVoxels
+	template<typename TLayout>
+	double RunVisibilityPass(TLayout& Layout, int64& OutVisibleFaces)
+	{
+		double StartTime = FPlatformTime::Seconds();
+		int64 VisibleFaces = 0;
+		for (int32 ChunkY = 0; ChunkY < Layout.Size.Y / Layout.ChunkSide; ChunkY++)
+		{
+			for (int32 ChunkX = 0; ChunkX < Layout.Size.X / Layout.ChunkSide; ChunkX++)
+			{
+				int32 MinX = ChunkX * Layout.ChunkSide;
+				int32 MinY = ChunkY * Layout.ChunkSide;
+				for (int32 Z = 0; Z < Layout.Size.Z; Z++)
+				{
+					for (int32 Y = MinY; Y < MinY + Layout.ChunkSide; Y++)
+					{
+						for (int32 X = MinX; X < MinX + Layout.ChunkSide; X++)
+						{
+							if (IsTransparent(Layout, X, Y, Z))
+							{
+								continue;
+							}
+							VisibleFaces += IsTransparent(Layout, X, Y, Z + 1);
+							VisibleFaces += IsTransparent(Layout, X, Y, Z - 1);
+							VisibleFaces += IsTransparent(Layout, X + 1, Y, Z);
+							VisibleFaces += IsTransparent(Layout, X - 1, Y, Z);
+							VisibleFaces += IsTransparent(Layout, X, Y - 1, Z);
+							VisibleFaces += IsTransparent(Layout, X, Y + 1, Z);
+						}
+					}
+				}
+			}
+		}
+		OutVisibleFaces = VisibleFaces;
+		return FPlatformTime::Seconds() - StartTime;
+	}
+
+	struct FLinearSectionIndexing
+	{
+		static FORCEINLINE int32 Encode(int32 X, int32 Y, int32 Z, int32 SideLog2)
+		{
+			return (((Z << SideLog2) + Y) << SideLog2) + X;
+		}
+
+		static FORCEINLINE void Decode(int32 Index, int32 SideLog2, int32& OutX, int32& OutY, int32& OutZ)
+		{
+			int32 SideMask = (1 << SideLog2) - 1;
+			OutX = Index & SideMask;
+			OutY = (Index >> SideLog2) & SideMask;
+			OutZ = Index >> (SideLog2 * 2);
+		}
+	};
+
+	struct FMortonSectionIndexing
+	{
+		static FORCEINLINE int32 Encode(int32 X, int32 Y, int32 Z, int32 SideLog2)
+		{
+			return FVoxelMorton::Encode(X, Y, Z);
+		}
+
+		static FORCEINLINE void Decode(int32 Index, int32 SideLog2, int32& OutX, int32& OutY, int32& OutZ)
+		{
+			FVoxelMorton::Decode(Index, OutX, OutY, OutZ);
+		}
+	};
+
+	// Grid of cubic paletted sections, as stored by UVoxelChunk
+	template<typename TIndexing>
+	struct FSectionedVolume
+	{
+		FIntVector Size;
+		FIntVector SectionsDim;
+		int32 Side;
+		int32 SideLog2;
+		TArray<TUniquePtr<FVoxelPalettedStorage>> Sections;
+
+		FSectionedVolume(const FIntVector& InSectionsDim, int32 InSide) : SectionsDim(InSectionsDim), Side(InSide)
+		{
+			SideLog2 = FMath::FloorLog2(Side);
+			Size = SectionsDim * Side;
+			for (int32 I = 0; I < SectionsDim.X * SectionsDim.Y * SectionsDim.Z; I++)
+			{
+				TUniquePtr<FVoxelPalettedStorage>& Section = Sections.Add_GetRef(MakeUnique<FVoxelPalettedStorage>());
+				Section->Initialize(Side * Side * Side, EmptyVoxelType);
+			}
+		}
+
+		FORCEINLINE bool IsInside(int32 X, int32 Y, int32 Z) const
+		{
+			return X >= 0 && Y >= 0 && Z >= 0 && X < Size.X && Y < Size.Y && Z < Size.Z;
+		}
+
+		FORCEINLINE FVoxelPalettedStorage& GetSection(int32 X, int32 Y, int32 Z, int32& OutIndex) const
+		{
+			int32 SideMask = Side - 1;
+			OutIndex = TIndexing::Encode(X & SideMask, Y & SideMask, Z & SideMask, SideLog2);
+			int32 SectionIndex = ((Z >> SideLog2) * SectionsDim.Y + (Y >> SideLog2)) * SectionsDim.X + (X >> SideLog2);
+			return *Sections[SectionIndex];
+		}
+
+		FORCEINLINE VoxelType Get(int32 X, int32 Y, int32 Z) const
+		{
+			if (!IsInside(X, Y, Z))
+			{
+				return EmptyVoxelType;
+			}
+			int32 Index;
+			FVoxelPalettedStorage& Section = GetSection(X, Y, Z, Index);
+			return Section.Get(Index);
+		}
+
+		FORCEINLINE void Set(int32 X, int32 Y, int32 Z, VoxelType Type)
+		{
+			int32 Index;
+			FVoxelPalettedStorage& Section = GetSection(X, Y, Z, Index);
+			Section.Set(Index, Type);
+		}
+	};
+
+	// Storage-order walk over every section with six neighbour reads per solid voxel, like UVoxelChunk::ProcessVoxels
+	template<typename TIndexing>
+	double RunSectionVisibilityPass(const FSectionedVolume<TIndexing>& Volume, int64& OutVisibleFaces)
+	{
+		double StartTime = FPlatformTime::Seconds();
+		int64 VisibleFaces = 0;
+		int32 SectionVoxelsNum = Volume.Side * Volume.Side * Volume.Side;
+		for (int32 SectionZ = 0; SectionZ < Volume.SectionsDim.Z; SectionZ++)
+		{
+			for (int32 SectionY = 0; SectionY < Volume.SectionsDim.Y; SectionY++)
+			{
+				for (int32 SectionX = 0; SectionX < Volume.SectionsDim.X; SectionX++)
+				{
+					FIntVector SectionMin = FIntVector(SectionX, SectionY, SectionZ) * Volume.Side;
+					for (int32 Index = 0; Index < SectionVoxelsNum; Index++)
+					{
+						int32 X;
+						int32 Y;
+						int32 Z;
+						TIndexing::Decode(Index, Volume.SideLog2, X, Y, Z);
+						X += SectionMin.X;
+						Y += SectionMin.Y;
+						Z += SectionMin.Z;
+						if (Volume.Get(X, Y, Z) == EmptyVoxelType)
+						{
+							continue;
+						}
+						VisibleFaces += Volume.Get(X, Y, Z + 1) == EmptyVoxelType;
+						VisibleFaces += Volume.Get(X, Y, Z - 1) == EmptyVoxelType;
+						VisibleFaces += Volume.Get(X + 1, Y, Z) == EmptyVoxelType;
+						VisibleFaces += Volume.Get(X - 1, Y, Z) == EmptyVoxelType;
+						VisibleFaces += Volume.Get(X, Y - 1, Z) == EmptyVoxelType;
+						VisibleFaces += Volume.Get(X, Y + 1, Z) == EmptyVoxelType;
+					}
+				}
+			}
+		}
+		OutVisibleFaces = VisibleFaces;
+		return FPlatformTime::Seconds() - StartTime;
+	}
+
+	// Same traversal order as UVoxelQueryUtils::VoxelBoxOverlapFilterMulti: X, then Y, then Z innermost
+	template<typename TIndexing>
+	double RunBoxOverlaps(const FSectionedVolume<TIndexing>& Volume, const TArray<FIntVector>& BoxMins, int32 BoxSide, int64& OutSolidVoxels)
+	{
+		double StartTime = FPlatformTime::Seconds();
+		int64 SolidVoxels = 0;
+		for (const FIntVector& BoxMin : BoxMins)
+		{
+			for (int32 X = BoxMin.X; X < BoxMin.X + BoxSide; X++)
+			{
+				for (int32 Y = BoxMin.Y; Y < BoxMin.Y + BoxSide; Y++)
+				{
+					for (int32 Z = BoxMin.Z; Z < BoxMin.Z + BoxSide; Z++)
+					{
+						SolidVoxels += Volume.Get(X, Y, Z) != EmptyVoxelType;
+					}
+				}
+			}
+		}
+		OutSolidVoxels = SolidVoxels;
+		return FPlatformTime::Seconds() - StartTime;
+	}
+
+	// Moves a pawn-sized box one voxel at a time and reads every voxel it overlaps, like a movement collision sweep
+	template<typename TIndexing>
+	double RunCollisionSweeps(const FSectionedVolume<TIndexing>& Volume, const TArray<FIntVector>& SweepStarts, const TArray<FIntVector>& SweepSteps, int32 StepsNum, int64& OutBlockedSteps)
+	{
+		constexpr int32 PawnWidth = 2;
+		constexpr int32 PawnHeight = 3;
+		double StartTime = FPlatformTime::Seconds();
+		int64 BlockedSteps = 0;
+		for (int32 SweepIndex = 0; SweepIndex < SweepStarts.Num(); SweepIndex++)
+		{
+			FIntVector Position = SweepStarts[SweepIndex];
+			for (int32 Step = 0; Step < StepsNum; Step++)
+			{
+				Position += SweepSteps[SweepIndex];
+				bool bIsBlocked = false;
+				for (int32 Z = Position.Z; Z < Position.Z + PawnHeight; Z++)
+				{
+					for (int32 Y = Position.Y; Y < Position.Y + PawnWidth; Y++)
+					{
+						for (int32 X = Position.X; X < Position.X + PawnWidth; X++)
+						{
+							bIsBlocked |= Volume.Get(X, Y, Z) != EmptyVoxelType;
+						}
+					}
+				}
+				BlockedSteps += bIsBlocked;
+			}
+		}
+		OutBlockedSteps = BlockedSteps;
+		return FPlatformTime::Seconds() - StartTime;
+	}
+
+	template<typename TIndexing>
+	void BenchmarkIndexing(const TCHAR* IndexingName, const FIntVector& SectionsDim, int32 Side, const TArray<int32>& Heights, const TArray<FIntVector>& BoxMins, int32 BoxSide, const TArray<FIntVector>& SweepStarts, const TArray<FIntVector>& SweepSteps, int32 SweepStepsNum, int32 Iterations)
+	{
+		FSectionedVolume<TIndexing> Volume(SectionsDim, Side);
+		for (int32 Y = 0; Y < Volume.Size.Y; Y++)
+		{
+			for (int32 X = 0; X < Volume.Size.X; X++)
+			{
+				int32 Height = FMath::Min(Heights[Y * Volume.Size.X + X], Volume.Size.Z - 1);
+				for (int32 Z = 0; Z <= Height; Z++)
+				{
+					// Three solid types keep the palette at 2 bits per voxel, like generated terrain
+					Volume.Set(X, Y, Z, Z == Height ? 1 : (Z > Height - 3 ? 2 : 3));
+				}
+			}
+		}
+
+		double VisibilityTime = 0;
+		double OverlapTime = 0;
+		double SweepTime = 0;
+		int64 VisibleFaces = 0;
+		int64 OverlappedSolidVoxels = 0;
+		int64 BlockedSteps = 0;
+		for (int32 I = 0; I < Iterations; I++)
+		{
+			VisibilityTime += RunSectionVisibilityPass(Volume, VisibleFaces);
+			OverlapTime += RunBoxOverlaps(Volume, BoxMins, BoxSide, OverlappedSolidVoxels);
+			SweepTime += RunCollisionSweeps(Volume, SweepStarts, SweepSteps, SweepStepsNum, BlockedSteps);
+		}
+
+		UE_LOG(LogVoxelEngine, Display, TEXT("[%s] visibility pass %3.2f ms (%lld visible faces), box overlaps %3.2f ms (%lld solid voxels), collision sweeps %3.2f ms (%lld blocked steps)"),
+			IndexingName, VisibilityTime * 1000 / Iterations, VisibleFaces, OverlapTime * 1000 / Iterations, OverlappedSolidVoxels, SweepTime * 1000 / Iterations, BlockedSteps);
+	}
+
+	template<typename TLayout>
+	void BenchmarkLayout(const TCHAR* LayoutName, const FIntVector& Size, int32 ChunkSide, const TArray<int32>& Heights, int32 Iterations)
+	{
+		double AllocStartTime = FPlatformTime::Seconds();
+		TLayout Layout(Size, ChunkSide);
+		double AllocTime = FPlatformTime::Seconds() - AllocStartTime;
+
+		double GenerationTime = 0;
+		double VisibilityTime = 0;
+		int64 VisibleFaces = 0;
+		for (int32 I = 0; I < Iterations; I++)
+		{
+			GenerationTime += RunGeneration(Layout, Heights);
+			VisibilityTime += RunVisibilityPass(Layout, VisibleFaces);
+		}
+
+		UE_LOG(LogVoxelEngine, Display, TEXT("[%s] allocation %3.2f ms, generation %3.2f ms, full-chunk visibility pass %3.2f ms (%lld visible faces), memory %3.2f MB"),
+			LayoutName, AllocTime * 1000, GenerationTime * 1000 / Iterations, VisibilityTime * 1000 / Iterations, VisibleFaces, Layout.GetAllocatedSize() / (1024.0 * 1024.0));
+	}
+
+	// Terrain layers as the world generator writes them: surface, subsurface and stone
+	template<typename InVoxelType>
+	double RunLayeredGeneration(TChunkMajorPalettedLayout<InVoxelType>& Layout, const TArray<int32>& Heights, const InVoxelType (&LayerTypes)[3])
+	{
+		double StartTime = FPlatformTime::Seconds();
+		for (int32 X = 0; X < Layout.Size.X; X++)
+		{
+			for (int32 Y = 0; Y < Layout.Size.Y; Y++)
+			{
+				int32 Height = Heights[Y * Layout.Size.X + X];
+				for (int32 Z = 0; Z < Layout.Size.Z; Z++)
+				{
+					InVoxelType Type = EmptyVoxelType;
+					if (Z <= Height)
+					{
+						Type = Z == Height ? LayerTypes[0] : (Z > Height - 3 ? LayerTypes[1] : LayerTypes[2]);
+					}
+					Layout.Set(X, Y, Z, Type);
+				}
+			}
+		}
+		return FPlatformTime::Seconds() - StartTime;
+	}
+
+	// Six-neighbour pass that resolves transparency through a per-type flag table, like meshing does through UVoxelTypeSet
+	template<typename InVoxelType>
+	double RunFlaggedVisibilityPass(TChunkMajorPalettedLayout<InVoxelType>& Layout, const TArray<uint8>& TransparentTypes, int64& OutVisibleFaces)
+	{
+		auto IsTransparentAt = [&Layout, &TransparentTypes](int32 X, int32 Y, int32 Z)
+		{
+			if (X < 0 || Y < 0 || Z < 0 || X >= Layout.Size.X || Y >= Layout.Size.Y || Z >= Layout.Size.Z)
+			{
+				return true;
+			}
+			return TransparentTypes[Layout.Get(X, Y, Z)] != 0;
+		};
+
+		double StartTime = FPlatformTime::Seconds();
+		int64 VisibleFaces = 0;
+		for (int32 ChunkY = 0; ChunkY < Layout.Size.Y / Layout.ChunkSide; ChunkY++)
+		{
+			for (int32 ChunkX = 0; ChunkX < Layout.Size.X / Layout.ChunkSide; ChunkX++)
+			{
+				int32 MinX = ChunkX * Layout.ChunkSide;
+				int32 MinY = ChunkY * Layout.ChunkSide;
+				for (int32 Z = 0; Z < Layout.Size.Z; Z++)
+				{
+					for (int32 Y = MinY; Y < MinY + Layout.ChunkSide; Y++)
+					{
+						for (int32 X = MinX; X < MinX + Layout.ChunkSide; X++)
+						{
+							if (IsTransparentAt(X, Y, Z))
+							{
+								continue;
+							}
+							VisibleFaces += IsTransparentAt(X, Y, Z + 1);
+							VisibleFaces += IsTransparentAt(X, Y, Z - 1);
+							VisibleFaces += IsTransparentAt(X + 1, Y, Z);
+							VisibleFaces += IsTransparentAt(X - 1, Y, Z);
+							VisibleFaces += IsTransparentAt(X, Y - 1, Z);
+							VisibleFaces += IsTransparentAt(X, Y + 1, Z);
+						}
+					}
+				}
+			}
+		}
+		OutVisibleFaces = VisibleFaces;
+		return FPlatformTime::Seconds() - StartTime;
+	}
+
+	template<typename InVoxelType>
+	void BenchmarkTypeWidth(const TCHAR* WidthName, const FIntVector& Size, int32 ChunkSide, const TArray<int32>& Heights, const InVoxelType (&LayerTypes)[3], int32 Iterations)
+	{
+		TArray<uint8> TransparentTypes;
+		TransparentTypes.Init(1, TVoxelPalettedStorage<InVoxelType>::MaxPaletteSize);
+		for (InVoxelType Type : LayerTypes)
+		{
+			TransparentTypes[Type] = 0;
+		}
+
+		TChunkMajorPalettedLayout<InVoxelType> Layout(Size, ChunkSide);
+		double GenerationTime = 0;
+		double VisibilityTime = 0;
+		int64 VisibleFaces = 0;
+		for (int32 I = 0; I < Iterations; I++)
+		{
+			GenerationTime += RunLayeredGeneration(Layout, Heights, LayerTypes);
+			VisibilityTime += RunFlaggedVisibilityPass(Layout, TransparentTypes, VisibleFaces);
+		}
+
+		UE_LOG(LogVoxelEngine, Display, TEXT("[%s] generation %3.2f ms, visibility pass %3.2f ms (%lld visible faces), memory %3.2f MB"),
+			WidthName, GenerationTime * 1000 / Iterations, VisibilityTime * 1000 / Iterations, VisibleFaces, Layout.GetAllocatedSize() / (1024.0 * 1024.0));
+	}
+}
+
+void FVoxelBenchmarks::BenchmarkStorageLayout(const AVoxelWorld* VoxelWorld, int32 Iterations)
+{
+	check(VoxelWorld);
+	Iterations = FMath::Max(Iterations, 1);
+
+	int32 ChunkSide = VoxelWorld->GetChunkSide();
+	FIntVector Size = VoxelWorld->GetWorldSizeVoxel();
+	if (Size.X <= 0 || Size.Y <= 0 || Size.Z <= 0)
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("BenchmarkStorageLayout failed: Voxel World is not initialized or streams chunks"));
+		return;
+	}
+
+	TArray<int32> Heights;
+	Heights.SetNumUninitialized(Size.X * Size.Y);
+	for (int32 Y = 0; Y < Size.Y; Y++)
+	{
+		for (int32 X = 0; X < Size.X; X++)
+		{
+			float NoiseValue = USimplexNoise::Noise(X * 0.01f, Y * 0.01f);
+			Heights[Y * Size.X + X] = Size.Z / 2 + NoiseValue * Size.Z / 4;
+		}
+	}
+
+	UE_LOG(LogVoxelEngine, Display, TEXT("Storage layout benchmark: %d x %d x %d voxels, chunk side %d, %d iterations"), Size.X, Size.Y, Size.Z, ChunkSide, Iterations);
+	BenchmarkLayout<FGlobalZMajorLayout>(TEXT("Global Z-major"), Size, ChunkSide, Heights, Iterations);
+	BenchmarkLayout<FChunkMajorLayout>(TEXT("Chunk-major"), Size, ChunkSide, Heights, Iterations);
+	BenchmarkLayout<FChunkMajorPalettedLayout>(TEXT("Chunk-major paletted"), Size, ChunkSide, Heights, Iterations);
+}
+
+void FVoxelBenchmarks::BenchmarkChunkMeshing(AVoxelWorld* VoxelWorld, int32 Iterations)
+{
+	check(VoxelWorld);
+	Iterations = FMath::Max(Iterations, 1);
+
+	TArray<UVoxelChunk*> Chunks;
+	VoxelWorld->GetLoadedChunks(Chunks);
+
+	double MeshingTime = 0;
+	for (int32 I = 0; I < Iterations; I++)
+	{
+		double StartTime = FPlatformTime::Seconds();
+		for (UVoxelChunk* Chunk : Chunks)
+		{
+			check(Chunk);
+			Chunk->GenerateMesh();
+		}
+		MeshingTime += FPlatformTime::Seconds() - StartTime;
+	}
+
+	int64 TrianglesNum = 0;
+	int64 PerFaceTrianglesNum = 0;
+	for (const UVoxelChunk* Chunk : Chunks)
+	{
+		int32 ChunkTrianglesNum;
+		int32 ChunkPerFaceTrianglesNum;
+		Chunk->GetMeshTrianglesNum(ChunkTrianglesNum, ChunkPerFaceTrianglesNum);
+		TrianglesNum += ChunkTrianglesNum;
+		PerFaceTrianglesNum += ChunkPerFaceTrianglesNum;
+	}
+
+	int32 ChunksNum = Chunks.Num();
+	double AverageMs = MeshingTime * 1000 / Iterations;
+	UE_LOG(LogVoxelEngine, Display, TEXT("Chunk meshing benchmark: %d chunks, %3.2f ms per pass, %3.3f ms per chunk"), ChunksNum, AverageMs, ChunksNum > 0 ? AverageMs / ChunksNum : 0.0);
+	UE_LOG(LogVoxelEngine, Display, TEXT("  %s meshing: %lld triangles, %lld with per-face meshing (%3.1fx)"),
+		VoxelWorld->GetMeshingMode() == EVoxelMeshingMode::Greedy ? TEXT("Greedy") : TEXT("Per-face"), TrianglesNum, PerFaceTrianglesNum,
+		static_cast<double>(PerFaceTrianglesNum) / FMath::Max(TrianglesNum, int64(1)));
+}
+
+void FVoxelBenchmarks::BenchmarkVoxelIndexing(const AVoxelWorld* VoxelWorld, int32 Iterations)
+{
+	check(VoxelWorld);
+	Iterations = FMath::Max(Iterations, 1);
+
+	constexpr int32 SectionsPerSide = 4;
+	constexpr int32 BoxesNum = 4096;
+	constexpr int32 BoxSide = 8;
+	constexpr int32 SweepsNum = 1024;
+	constexpr int32 SweepStepsNum = 64;
+
+	int32 Side = FMath::RoundUpToPowerOfTwo(FMath::Max(VoxelWorld->GetChunkSide(), 2));
+	if (Side > (1 << FVoxelMorton::MaxBitsPerAxis))
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("BenchmarkVoxelIndexing failed: ChunkSide %d is too large for Morton indexing"), VoxelWorld->GetChunkSide());
+		return;
+	}
+	int32 SectionsZ = FMath::Max(FMath::DivideAndRoundUp(VoxelWorld->GetWorldHeight(), Side), 1);
+	FIntVector SectionsDim(SectionsPerSide, SectionsPerSide, SectionsZ);
+	FIntVector Size = SectionsDim * Side;
+
+	TArray<int32> Heights;
+	Heights.SetNumUninitialized(Size.X * Size.Y);
+	for (int32 Y = 0; Y < Size.Y; Y++)
+	{
+		for (int32 X = 0; X < Size.X; X++)
+		{
+			float NoiseValue = USimplexNoise::Noise(X * 0.01f, Y * 0.01f);
+			Heights[Y * Size.X + X] = Size.Z / 2 + NoiseValue * Size.Z / 4;
+		}
+	}
+
+	// Queries are concentrated around the surface, where gameplay queries happen
+	FRandomStream RandomStream(1337);
+	TArray<FIntVector> BoxMins;
+	for (int32 I = 0; I < BoxesNum; I++)
+	{
+		int32 X = RandomStream.RandRange(0, Size.X - BoxSide);
+		int32 Y = RandomStream.RandRange(0, Size.Y - BoxSide);
+		int32 Z = FMath::Clamp(Heights[Y * Size.X + X] - BoxSide / 2, 0, FMath::Max(Size.Z - BoxSide, 0));
+		BoxMins.Emplace(X, Y, Z);
+	}
+
+	TArray<FIntVector> SweepStarts;
+	TArray<FIntVector> SweepSteps;
+	for (int32 I = 0; I < SweepsNum; I++)
+	{
+		int32 X = RandomStream.RandRange(0, Size.X - 1);
+		int32 Y = RandomStream.RandRange(0, Size.Y - 1);
+		SweepStarts.Emplace(X, Y, Heights[Y * Size.X + X]);
+		SweepSteps.Emplace(RandomStream.RandRange(-1, 1), RandomStream.RandRange(-1, 1), RandomStream.RandRange(-1, 1));
+	}
+
+	UE_LOG(LogVoxelEngine, Display, TEXT("Voxel indexing benchmark: %d x %d x %d voxels, section side %d, %d iterations"), Size.X, Size.Y, Size.Z, Side, Iterations);
+	BenchmarkIndexing<FLinearSectionIndexing>(TEXT("Linear"), SectionsDim, Side, Heights, BoxMins, BoxSide, SweepStarts, SweepSteps, SweepStepsNum, Iterations);
+	BenchmarkIndexing<FMortonSectionIndexing>(TEXT("Morton"), SectionsDim, Side, Heights, BoxMins, BoxSide, SweepStarts, SweepSteps, SweepStepsNum, Iterations);
+}
+
+void FVoxelBenchmarks::BenchmarkRunLengthCodec(const AVoxelWorld* VoxelWorld, int32 Iterations)
+{
+	check(VoxelWorld);
+	Iterations = FMath::Max(Iterations, 1);
+
+	TArray<UVoxelChunk*> Chunks;
+	VoxelWorld->GetLoadedChunks(Chunks);
+	if (Chunks.IsEmpty())
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("BenchmarkRunLengthCodec failed: no chunks are loaded"));
+		return;
+	}
+
+	SIZE_T PalettedSize = 0;
+	for (const UVoxelChunk* Chunk : Chunks)
+	{
+		PalettedSize += Chunk->GetVoxelsAllocatedSize();
+	}
+
+	TArray<uint8> Encoded;
+	TArray<VoxelType> Decoded;
+	int64 VoxelsNum = 0;
+	double EncodeTime = 0;
+	double DecodeTime = 0;
+	for (int32 I = 0; I < Iterations; I++)
+	{
+		Encoded.Reset();
+		double EncodeStartTime = FPlatformTime::Seconds();
+		{
+			FVoxelRunLengthEncoder Encoder(Encoded);
+			for (const UVoxelChunk* Chunk : Chunks)
+			{
+				Chunk->EncodeColumns(Encoder);
+			}
+			Encoder.Flush();
+			VoxelsNum = Encoder.GetEncodedVoxelsNum();
+		}
+		EncodeTime += FPlatformTime::Seconds() - EncodeStartTime;
+
+		// Decoding into a plain buffer measures the codec alone, decoding into chunks would also re-pack sections
+		check(VoxelsNum <= MAX_int32);
+		Decoded.SetNumUninitialized(static_cast<int32>(VoxelsNum));
+		double DecodeStartTime = FPlatformTime::Seconds();
+		FVoxelRunLengthDecoder Decoder(Encoded);
+		bool bDecoded = Decoder.Decode(Decoded);
+		DecodeTime += FPlatformTime::Seconds() - DecodeStartTime;
+		check(bDecoded && Decoder.IsFinished());
+	}
+
+	double RawBytes = static_cast<double>(VoxelsNum) * sizeof(VoxelType);
+	double EncodedBytes = FMath::Max(Encoded.Num(), 1);
+	double EncodeSeconds = FMath::Max(EncodeTime / Iterations, UE_DOUBLE_SMALL_NUMBER);
+	double DecodeSeconds = FMath::Max(DecodeTime / Iterations, UE_DOUBLE_SMALL_NUMBER);
+	UE_LOG(LogVoxelEngine, Display, TEXT("RLE column codec benchmark: %d chunks, %lld voxels, %d iterations"), Chunks.Num(), VoxelsNum, Iterations);
+	UE_LOG(LogVoxelEngine, Display, TEXT("  Encoded size %3.2f KB, %3.1fx smaller than raw bytes, %3.1fx smaller than paletted storage (%3.2f KB)"),
+		EncodedBytes / 1024.0, RawBytes / EncodedBytes, PalettedSize / EncodedBytes, PalettedSize / 1024.0);
+	UE_LOG(LogVoxelEngine, Display, TEXT("  Encode %3.2f ms, %3.2f GB/s. Decode %3.2f ms, %3.2f GB/s"),
+		EncodeSeconds * 1000, RawBytes / EncodeSeconds / 1e9, DecodeSeconds * 1000, RawBytes / DecodeSeconds / 1e9);
+}
+
+void FVoxelBenchmarks::BenchmarkVoxelTypeWidth(const AVoxelWorld* VoxelWorld, int32 Iterations)
+{
+	check(VoxelWorld);
+	Iterations = FMath::Max(Iterations, 1);
+
+	int32 ChunkSide = VoxelWorld->GetChunkSide();
+	FIntVector Size = VoxelWorld->GetWorldSizeVoxel();
+	if (Size.X <= 0 || Size.Y <= 0 || Size.Z <= 0)
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("BenchmarkVoxelTypeWidth failed: Voxel World is not initialized or streams chunks"));
+		return;
+	}
+
+	TArray<int32> Heights;
+	Heights.SetNumUninitialized(Size.X * Size.Y);
+	for (int32 Y = 0; Y < Size.Y; Y++)
+	{
+		for (int32 X = 0; X < Size.X; X++)
+		{
+			float NoiseValue = USimplexNoise::Noise(X * 0.01f, Y * 0.01f);
+			Heights[Y * Size.X + X] = Size.Z / 2 + NoiseValue * Size.Z / 4;
+		}
+	}
+
+	// Same palette sizes for every width, wide IDs above 255 go through the hashed palette lookup
+	const uint8 NarrowTypes[3] = { 1, 2, 3 };
+	const uint16 NarrowWideTypes[3] = { 1, 2, 3 };
+	const uint16 WideTypes[3] = { 257, 1030, 40000 };
+
+	UE_LOG(LogVoxelEngine, Display, TEXT("Voxel type width benchmark: %d x %d x %d voxels, chunk side %d, %d iterations, world uses %d-bit IDs"),
+		Size.X, Size.Y, Size.Z, ChunkSide, Iterations, VOXEL_TYPE_ID_BITS);
+	BenchmarkTypeWidth<uint8>(TEXT("8-bit"), Size, ChunkSide, Heights, NarrowTypes, Iterations);
+	BenchmarkTypeWidth<uint16>(TEXT("16-bit, IDs below 256"), Size, ChunkSide, Heights, NarrowWideTypes, Iterations);
+	BenchmarkTypeWidth<uint16>(TEXT("16-bit, IDs above 255"), Size, ChunkSide, Heights, WideTypes, Iterations);
+}
+
+void FVoxelBenchmarks::BenchmarkBinaryMeshing(AVoxelWorld* VoxelWorld, int32 Iterations)
+{
+	check(VoxelWorld);
+	Iterations = FMath::Max(Iterations, 1);
+
+	TArray<UVoxelChunk*> Chunks;
+	VoxelWorld->GetLoadedChunks(Chunks);
+	if (Chunks.IsEmpty())
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("BenchmarkBinaryMeshing failed: no chunks are loaded"));
+		return;
+	}
+	if (VoxelWorld->GetChunkSide() > UVoxelChunk::MaxBinaryMeshingChunkSide)
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("BenchmarkBinaryMeshing failed: ChunkSide %d is too large for binary meshing"), VoxelWorld->GetChunkSide());
+		return;
+	}
+
+	// Both kernels mesh the same live chunks into a scratch mesh, section mesh components are left untouched
+	FDynamicMesh3 Mesh;
+	const TCHAR* KernelNames[] = { TEXT("ProcessVoxels"), TEXT("Binary") };
+	double KernelTimes[] = { 0, 0 };
+	int64 KernelVisibleFaces[] = { 0, 0 };
+	for (int32 I = 0; I < Iterations; I++)
+	{
+		for (int32 Kernel = 0; Kernel < 2; Kernel++)
+		{
+			int64 VisibleFaces = 0;
+			double StartTime = FPlatformTime::Seconds();
+			for (UVoxelChunk* Chunk : Chunks)
+			{
+				check(Chunk);
+				for (int32 SectionIndex = 0; SectionIndex < Chunk->GetSectionsNum(); SectionIndex++)
+				{
+					FVoxelMeshBuffers& Buffers = FVoxelMeshBuffers::GetScratch();
+					VisibleFaces += Chunk->BuildSectionMesh(SectionIndex, Buffers, Kernel == 1);
+					Chunk->GetMeshBuilder().InitializeMesh(Mesh);
+					Buffers.AppendToMesh(Mesh);
+				}
+			}
+			KernelTimes[Kernel] += FPlatformTime::Seconds() - StartTime;
+			KernelVisibleFaces[Kernel] = VisibleFaces;
+		}
+	}
+
+	UE_LOG(LogVoxelEngine, Display, TEXT("Binary meshing benchmark: %d chunks, %d iterations"), Chunks.Num(), Iterations);
+	for (int32 Kernel = 0; Kernel < 2; Kernel++)
+	{
+		double PassSeconds = FMath::Max(KernelTimes[Kernel] / Iterations, UE_DOUBLE_SMALL_NUMBER);
+		UE_LOG(LogVoxelEngine, Display, TEXT("  [%s] %3.2f ms per pass, %3.1f chunks/s, %lld visible faces"),
+			KernelNames[Kernel], PassSeconds * 1000, Chunks.Num() / PassSeconds, KernelVisibleFaces[Kernel]);
+	}
+	if (KernelVisibleFaces[0] != KernelVisibleFaces[1])
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("BenchmarkBinaryMeshing: kernels disagree on visible faces"));
+	}
+}
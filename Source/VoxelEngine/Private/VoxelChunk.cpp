@@ -4,160 +4,1484 @@
 #include "VoxelChunk.h"
 #include "VoxelWorld.h"
 #include "DrawDebugHelpers.h"
-#include <array>
 #include "DynamicMesh/DynamicMesh3.h"
-#include "DynamicMesh/MeshAttributeUtil.h"
 #include "DynamicMesh/DynamicMeshAttributeSet.h"
 #include "VoxelEngine/VoxelEngine.h"
+#include "VoxelRunLengthCodec.h"
+#include "VoxelEpoch.h"
+#include "VoxelMeshCache.h"
 
+namespace
+{
+	// Region file payload: chunk header, then for every section a header, the palette padded to 8 bytes and the packed words
+	struct FChunkPayloadHeader
+	{
+		uint32 SectionsNum;
+		uint32 Reserved;
+	};
+
+	struct FSectionPayloadHeader
+	{
+		int32 VoxelsNum;
+		uint8 BitsPerVoxel;
+		uint8 Reserved;
+		uint16 PaletteSize;
+	};
+
+	// Delta payload: header, then storage indices of edited voxels and the voxel types written over the generator output.
+	// Storage index is SectionIndex * ChunkSide^3 + index inside the section.
+	struct FChunkDeltaHeader
+	{
+		uint32 EditsNum;
+		uint32 Reserved;
+	};
+}
+
+// Sets default values for this component's properties
+UVoxelChunk::UVoxelChunk()
+{
+	PrimaryComponentTick.bCanEverTick = true;
+	PrimaryComponentTick.bStartWithTickEnabled = false;
+}
+
+// Called when the game starts
+void UVoxelChunk::BeginPlay()
+{
+	Super::BeginPlay();
+
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+
+	FIntVector MinVoxel;
+	FIntVector MaxVoxel;
+	GetVoxelBoundingBox(MinVoxel, MaxVoxel);
+	FVector Location = FVector(MinVoxel.X, MinVoxel.Y, MinVoxel.Z) * VoxelWorld->GetVoxelSizeWorld();
+	SetRelativeLocation(Location);	
+	SetComponentTickEnabled(bDebugDrawDimensions);
+
+	int32 ChunkSide = VoxelWorld->GetChunkSide();
+	int32 SectionsNum = FMath::DivideAndRoundUp(VoxelWorld->GetWorldHeight(), ChunkSide);
+	SectionMeshComponents.SetNum(SectionsNum * 6);
+	SectionVisibleVoxels.SetNum(SectionsNum);
+	SectionTrianglesNum.SetNumZeroed(SectionsNum);
+	SectionPerFaceTrianglesNum.SetNumZeroed(SectionsNum);
+	SectionMeshTasks.SetNum(SectionsNum);
+	SectionMeshTaskEvents.SetNum(SectionsNum);
+	// Direction meshes are created once the section has faces in that direction
+	SectionVisibleDirections.Init(0x3f, SectionsNum);
+	for (int32 SectionIndex = 0; SectionIndex < SectionsNum; SectionIndex++)
+	{
+		int32 SectionHeight = FMath::Min(ChunkSide, VoxelWorld->GetWorldHeight() - SectionIndex * ChunkSide);
+		SectionVisibleVoxels[SectionIndex].SetNum(ChunkSide * ChunkSide * SectionHeight, false);
+	}
+	DirtySections.Init(false, SectionsNum);
+	RebuildSections.Init(false, SectionsNum);
+	SectionQuads.SetNum(SectionsNum * 6);
+	PatchedSectionMeshes.Init(false, SectionsNum * 6);
+	GrownSectionMeshes.Init(false, SectionsNum * 6);
+}
+
+void UVoxelChunk::OnComponentDestroyed(bool bDestroyingHierarchy)
+{
+	for (UDynamicMeshComponent* SectionMeshComponent : SectionMeshComponents)
+	{
+		if (SectionMeshComponent)
+		{
+			SectionMeshComponent->DestroyComponent();
+		}
+	}
+	SectionMeshComponents.Empty();
+
+	// Mesh tasks read the world's voxel type set, which may be destroyed right after the chunk
+	CancelSectionMeshTasks();
+	UE::Tasks::Wait(CancelledMeshTaskEvents);
+	CancelledMeshTaskEvents.Empty();
+	SectionMeshTasks.Empty();
+	SectionMeshTaskEvents.Empty();
+
+	FVoxelChange DiscardedRequest;
+	while (VoxelChangeRequests.Dequeue(DiscardedRequest))
+	{
+	}
+	bChangeRequestsScheduled.store(false);
+	// Worker threads may still be reading the sections through a snapshot
+	FVoxelEpochs::Retire([RetiredSections = MoveTemp(Sections)]() mutable
+	{
+		RetiredSections.Empty();
+	});
+	Sections.Empty();
+	SectionVisibleVoxels.Empty();
+	SectionQuads.Empty();
+
+	Super::OnComponentDestroyed(bDestroyingHierarchy);
+}
+
+void UVoxelChunk::AllocateVoxels()
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+
+	CachedChunkSide = VoxelWorld->GetChunkSide();
+	CachedWorldHeight = VoxelWorld->GetWorldHeight();
+	CachedVoxelIndexing = VoxelWorld->GetVoxelIndexing();
+
+	int32 SectionsNum = (CachedWorldHeight + CachedChunkSide - 1) / CachedChunkSide;
+	Sections.Empty(SectionsNum);
+	for (int32 SectionIndex = 0; SectionIndex < SectionsNum; SectionIndex++)
+	{
+		int32 SectionHeight = FMath::Min(CachedChunkSide, CachedWorldHeight - SectionIndex * CachedChunkSide);
+		if (CachedVoxelIndexing == EVoxelIndexing::Morton)
+		{
+			SectionHeight = CachedChunkSide;
+		}
+		TUniquePtr<FVoxelPalettedStorage>& Section = Sections.Add_GetRef(MakeUnique<FVoxelPalettedStorage>());
+		Section->Initialize(CachedChunkSide * CachedChunkSide * SectionHeight, EmptyVoxelType);
+	}
+	SectionContentHashes.SetNumZeroed(SectionsNum);
+	SectionContentHashWrites.Init(MAX_uint64, SectionsNum);
+	bHasUnsavedVoxels.store(false, std::memory_order_relaxed);
+}
+
+bool UVoxelChunk::AllocateVoxelsFromPayload(TConstArrayView<uint8> Payload, TSharedPtr<IVoxelWordsOwner, ESPMode::ThreadSafe> PayloadOwner)
+{
+	AllocateVoxels();
+	check(IsAligned(Payload.GetData(), alignof(uint64)));
+
+	FChunkPayloadHeader ChunkHeader;
+	if (Payload.Num() < sizeof(ChunkHeader))
+	{
+		return false;
+	}
+	FMemory::Memcpy(&ChunkHeader, Payload.GetData(), sizeof(ChunkHeader));
+	if (ChunkHeader.SectionsNum != static_cast<uint32>(Sections.Num()))
+	{
+		return false;
+	}
+
+	int64 Offset = sizeof(ChunkHeader);
+	for (TUniquePtr<FVoxelPalettedStorage>& Section : Sections)
+	{
+		FSectionPayloadHeader SectionHeader;
+		if (Offset + static_cast<int64>(sizeof(SectionHeader)) > Payload.Num())
+		{
+			AllocateVoxels();
+			return false;
+		}
+		FMemory::Memcpy(&SectionHeader, Payload.GetData() + Offset, sizeof(SectionHeader));
+		Offset += sizeof(SectionHeader);
+
+		int32 BitsPerVoxel = SectionHeader.BitsPerVoxel;
+		int32 PaletteSize = SectionHeader.PaletteSize;
+		if (!FVoxelPalettedStorage::IsValidBitsPerVoxel(BitsPerVoxel) || SectionHeader.VoxelsNum != Section->Num() || PaletteSize < 1 || PaletteSize > (1 << BitsPerVoxel))
+		{
+			AllocateVoxels();
+			return false;
+		}
+
+		const VoxelType* Palette = reinterpret_cast<const VoxelType*>(Payload.GetData() + Offset);
+		Offset = Align(Offset + PaletteSize * static_cast<int64>(sizeof(VoxelType)), alignof(uint64));
+		int32 WordsNum = FVoxelPalettedStorage::GetWordsNum(SectionHeader.VoxelsNum, BitsPerVoxel);
+		if (Offset + WordsNum * static_cast<int64>(sizeof(uint64)) > Payload.Num())
+		{
+			AllocateVoxels();
+			return false;
+		}
+		const uint64* Words = reinterpret_cast<const uint64*>(Payload.GetData() + Offset);
+		Offset += WordsNum * sizeof(uint64);
+
+		Section->InitializeExternal(SectionHeader.VoxelsNum, BitsPerVoxel, MakeArrayView(Palette, PaletteSize), Words, PayloadOwner);
+	}
+	return true;
+}
+
+void UVoxelChunk::SerializeVoxels(TArray<uint8>& OutPayload) const
+{
+	OutPayload.Reset();
+	FChunkPayloadHeader ChunkHeader;
+	ChunkHeader.SectionsNum = Sections.Num();
+	ChunkHeader.Reserved = 0;
+	OutPayload.Append(reinterpret_cast<const uint8*>(&ChunkHeader), sizeof(ChunkHeader));
+
+	TArray<VoxelType> Palette;
+	TArray<uint64> Words;
+	for (const TUniquePtr<FVoxelPalettedStorage>& Section : Sections)
+	{
+		int32 BitsPerVoxel = 0;
+		Section->CopyPacked(BitsPerVoxel, Palette, Words);
+
+		FSectionPayloadHeader SectionHeader;
+		SectionHeader.VoxelsNum = Section->Num();
+		SectionHeader.BitsPerVoxel = BitsPerVoxel;
+		SectionHeader.Reserved = 0;
+		// A section never holds more distinct types than it has voxels
+		check(Palette.Num() <= MAX_uint16);
+		SectionHeader.PaletteSize = Palette.Num();
+		OutPayload.Append(reinterpret_cast<const uint8*>(&SectionHeader), sizeof(SectionHeader));
+		OutPayload.Append(reinterpret_cast<const uint8*>(Palette.GetData()), Palette.Num() * sizeof(VoxelType));
+		// Words stay 8-byte aligned so that loading can borrow them from the mapped file
+		OutPayload.AddZeroed(Align(OutPayload.Num(), alignof(uint64)) - OutPayload.Num());
+		OutPayload.Append(reinterpret_cast<const uint8*>(Words.GetData()), Words.Num() * sizeof(uint64));
+	}
+}
+
+void UVoxelChunk::SerializeVoxelDelta(const UVoxelChunk& Baseline, TArray<uint8>& OutPayload) const
+{
+	check(Baseline.Sections.Num() == Sections.Num());
+	int64 SectionStride = static_cast<int64>(CachedChunkSide) * CachedChunkSide * CachedChunkSide;
+
+	TArray<uint32> EditIndices;
+	TArray<VoxelType> EditTypes;
+	for (int32 SectionIndex = 0; SectionIndex < Sections.Num(); SectionIndex++)
+	{
+		const FVoxelPalettedStorage& Section = *Sections[SectionIndex];
+		const FVoxelPalettedStorage& BaselineSection = *Baseline.Sections[SectionIndex];
+		check(Section.Num() == BaselineSection.Num());
+
+		VoxelType UniformType;
+		VoxelType BaselineUniformType;
+		if (Section.IsUniform(UniformType) && BaselineSection.IsUniform(BaselineUniformType) && UniformType == BaselineUniformType)
+		{
+			continue;
+		}
+
+		for (int32 Index = 0; Index < Section.Num(); Index++)
+		{
+			VoxelType Type = Section.Get(Index);
+			if (Type != BaselineSection.Get(Index))
+			{
+				EditIndices.Add(static_cast<uint32>(SectionIndex * SectionStride + Index));
+				EditTypes.Add(Type);
+			}
+		}
+	}
+
+	OutPayload.Reset();
+	FChunkDeltaHeader DeltaHeader;
+	DeltaHeader.EditsNum = EditIndices.Num();
+	DeltaHeader.Reserved = 0;
+	OutPayload.Append(reinterpret_cast<const uint8*>(&DeltaHeader), sizeof(DeltaHeader));
+	OutPayload.Append(reinterpret_cast<const uint8*>(EditIndices.GetData()), EditIndices.Num() * sizeof(uint32));
+	OutPayload.Append(reinterpret_cast<const uint8*>(EditTypes.GetData()), EditTypes.Num() * sizeof(VoxelType));
+}
+
+int32 UVoxelChunk::ApplyVoxelDelta(TConstArrayView<uint8> Payload)
+{
+	FChunkDeltaHeader DeltaHeader;
+	if (Payload.Num() < sizeof(DeltaHeader))
+	{
+		return INDEX_NONE;
+	}
+	FMemory::Memcpy(&DeltaHeader, Payload.GetData(), sizeof(DeltaHeader));
+	int64 EditsNum = DeltaHeader.EditsNum;
+	if (sizeof(DeltaHeader) + EditsNum * (sizeof(uint32) + sizeof(VoxelType)) > static_cast<uint64>(Payload.Num()))
+	{
+		return INDEX_NONE;
+	}
+
+	const uint8* IndicesData = Payload.GetData() + sizeof(DeltaHeader);
+	const uint8* TypesData = IndicesData + EditsNum * sizeof(uint32);
+	int64 SectionStride = static_cast<int64>(CachedChunkSide) * CachedChunkSide * CachedChunkSide;
+	TArray<uint32> StorageIndices;
+	StorageIndices.SetNumUninitialized(EditsNum);
+	FMemory::Memcpy(StorageIndices.GetData(), IndicesData, EditsNum * sizeof(uint32));
+	TArray<VoxelType> Types;
+	Types.SetNumUninitialized(EditsNum);
+	FMemory::Memcpy(Types.GetData(), TypesData, EditsNum * sizeof(VoxelType));
+	// Validated up front so that a malformed payload leaves the generated voxels untouched
+	for (uint32 StorageIndex : StorageIndices)
+	{
+		int64 SectionIndex = StorageIndex / SectionStride;
+		if (SectionIndex >= Sections.Num() || StorageIndex % SectionStride >= static_cast<uint64>(Sections[SectionIndex]->Num()))
+		{
+			return INDEX_NONE;
+		}
+	}
+
+	for (int32 Edit = 0; Edit < StorageIndices.Num(); Edit++)
+	{
+		int32 SectionIndex = StorageIndices[Edit] / SectionStride;
+		int32 Index = StorageIndices[Edit] % SectionStride;
+		Sections[SectionIndex]->Set(Index, Types[Edit]);
+	}
+	bHasUnsavedVoxels.store(true, std::memory_order_release);
+	return StorageIndices.Num();
+}
+
+void UVoxelChunk::EncodeColumns(FVoxelRunLengthEncoder& Encoder) const
+{
+	// Non-uniform sections are unpacked once, so that columns read plain bytes instead of packed words
+	int32 LayerSize = CachedChunkSide * CachedChunkSide;
+	TArray<VoxelType> ChunkVoxels;
+	ChunkVoxels.SetNumUninitialized(LayerSize * CachedWorldHeight);
+	TArray<bool> SectionsUniform;
+	TArray<VoxelType> SectionsUniformType;
+	SectionsUniform.SetNumZeroed(Sections.Num());
+	SectionsUniformType.SetNumZeroed(Sections.Num());
+	for (int32 SectionIndex = 0; SectionIndex < Sections.Num(); SectionIndex++)
+	{
+		const FVoxelPalettedStorage& Section = *Sections[SectionIndex];
+		if (Section.IsUniform(SectionsUniformType[SectionIndex]))
+		{
+			SectionsUniform[SectionIndex] = true;
+			continue;
+		}
+		int32 SectionMinZ = SectionIndex * CachedChunkSide;
+		int32 SectionHeight = FMath::Min(CachedChunkSide, CachedWorldHeight - SectionMinZ);
+		for (int32 Z = 0; Z < SectionHeight; Z++)
+		{
+			for (int32 Y = 0; Y < CachedChunkSide; Y++)
+			{
+				for (int32 X = 0; X < CachedChunkSide; X++)
+				{
+					ChunkVoxels[(SectionMinZ + Z) * LayerSize + Y * CachedChunkSide + X] = Section.Get(LinearizeSectionCoordinate(X, Y, Z));
+				}
+			}
+		}
+	}
+
+	for (int32 Y = 0; Y < CachedChunkSide; Y++)
+	{
+		for (int32 X = 0; X < CachedChunkSide; X++)
+		{
+			for (int32 SectionIndex = 0; SectionIndex < Sections.Num(); SectionIndex++)
+			{
+				int32 SectionMinZ = SectionIndex * CachedChunkSide;
+				int32 SectionMaxZ = FMath::Min(SectionMinZ + CachedChunkSide, CachedWorldHeight);
+				if (SectionsUniform[SectionIndex])
+				{
+					Encoder.Append(SectionsUniformType[SectionIndex], SectionMaxZ - SectionMinZ);
+					continue;
+				}
+				for (int32 Z = SectionMinZ; Z < SectionMaxZ; Z++)
+				{
+					Encoder.Append(ChunkVoxels[Z * LayerSize + Y * CachedChunkSide + X]);
+				}
+			}
+		}
+	}
+}
+
+bool UVoxelChunk::DecodeColumns(FVoxelRunLengthDecoder& Decoder)
+{
+	// Decoded fully before writing, so that a truncated stream leaves the chunk untouched
+	int32 LayerSize = CachedChunkSide * CachedChunkSide;
+	TArray<VoxelType> ChunkVoxels;
+	ChunkVoxels.SetNumUninitialized(LayerSize * CachedWorldHeight);
+	for (int32 Y = 0; Y < CachedChunkSide; Y++)
+	{
+		for (int32 X = 0; X < CachedChunkSide; X++)
+		{
+			int32 Z = 0;
+			while (Z < CachedWorldHeight)
+			{
+				VoxelType Type;
+				int64 Count;
+				if (!Decoder.Read(CachedWorldHeight - Z, Type, Count))
+				{
+					return false;
+				}
+				for (int32 RunEnd = Z + Count; Z < RunEnd; Z++)
+				{
+					ChunkVoxels[Z * LayerSize + Y * CachedChunkSide + X] = Type;
+				}
+			}
+		}
+	}
+
+	for (int32 SectionIndex = 0; SectionIndex < Sections.Num(); SectionIndex++)
+	{
+		FVoxelPalettedStorage& Section = *Sections[SectionIndex];
+		int32 SectionMinZ = SectionIndex * CachedChunkSide;
+		int32 SectionHeight = FMath::Min(CachedChunkSide, CachedWorldHeight - SectionMinZ);
+		const VoxelType* SectionVoxels = ChunkVoxels.GetData() + SectionMinZ * LayerSize;
+		int32 SectionVoxelsNum = SectionHeight * LayerSize;
+
+		// Most decoded sections are uniform or dominated by the type of their first voxel
+		VoxelType FillType = SectionVoxels[0];
+		Section.Fill(FillType);
+		for (int32 Index = 0; Index < SectionVoxelsNum; Index++)
+		{
+			if (SectionVoxels[Index] != FillType)
+			{
+				int32 Z = Index / LayerSize;
+				int32 Y = (Index - Z * LayerSize) / CachedChunkSide;
+				int32 X = Index - Z * LayerSize - Y * CachedChunkSide;
+				Section.Set(LinearizeSectionCoordinate(X, Y, Z), SectionVoxels[Index]);
+			}
+		}
+	}
+	bHasUnsavedVoxels.store(true, std::memory_order_release);
+	return true;
+}
+
+bool UVoxelChunk::HasUnsavedVoxels() const
+{
+	return bHasUnsavedVoxels.load(std::memory_order_relaxed);
+}
+
+bool UVoxelChunk::ResetUnsavedVoxels()
+{
+	return bHasUnsavedVoxels.exchange(false, std::memory_order_acq_rel);
+}
+
+size_t UVoxelChunk::GetVoxelsNum() const
+{
+	size_t VoxelsNum = 0;
+	for (const TUniquePtr<FVoxelPalettedStorage>& Section : Sections)
+	{
+		VoxelsNum += Section->Num();
+	}
+	return VoxelsNum;
+}
+
+SIZE_T UVoxelChunk::GetVoxelsAllocatedSize() const
+{
+	SIZE_T AllocatedSize = 0;
+	for (const TUniquePtr<FVoxelPalettedStorage>& Section : Sections)
+	{
+		AllocatedSize += Section->GetAllocatedSize();
+	}
+	return AllocatedSize;
+}
+
+int32 UVoxelChunk::GetSectionsNum() const
+{
+	return Sections.Num();
+}
+
+int32 UVoxelChunk::GetUniformSectionsNum() const
+{
+	int32 UniformSectionsNum = 0;
+	for (const TUniquePtr<FVoxelPalettedStorage>& Section : Sections)
+	{
+		VoxelType UniformType;
+		if (Section->IsUniform(UniformType))
+		{
+			UniformSectionsNum++;
+		}
+	}
+	return UniformSectionsNum;
+}
+
+bool UVoxelChunk::IsSectionUniform(int32 SectionIndex, VoxelType& OutVoxelType) const
+{
+	check(Sections.IsValidIndex(SectionIndex));
+	return Sections[SectionIndex]->IsUniform(OutVoxelType);
+}
+
+const FVoxelPalettedStorage& UVoxelChunk::GetSectionStorage(int32 SectionIndex) const
+{
+	check(Sections.IsValidIndex(SectionIndex));
+	return *Sections[SectionIndex];
+}
+
+void UVoxelChunk::FillVoxels(const FIntVector& LocalMin, const FIntVector& LocalMax, VoxelType Desired)
+{
+	FIntVector Min(FMath::Max(LocalMin.X, 0), FMath::Max(LocalMin.Y, 0), FMath::Max(LocalMin.Z, 0));
+	FIntVector Max(FMath::Min(LocalMax.X, CachedChunkSide), FMath::Min(LocalMax.Y, CachedChunkSide), FMath::Min(LocalMax.Z, CachedWorldHeight));
+	if (Min.X >= Max.X || Min.Y >= Max.Y || Min.Z >= Max.Z)
+	{
+		return;
+	}
+
+	bool bCoversColumn = Min.X == 0 && Min.Y == 0 && Max.X == CachedChunkSide && Max.Y == CachedChunkSide;
+	for (int32 SectionIndex = Min.Z / CachedChunkSide; SectionIndex < Sections.Num() && SectionIndex * CachedChunkSide < Max.Z; SectionIndex++)
+	{
+		int32 SectionMinZ = SectionIndex * CachedChunkSide;
+		int32 SectionMaxZ = FMath::Min(SectionMinZ + CachedChunkSide, CachedWorldHeight);
+		FVoxelPalettedStorage& Section = *Sections[SectionIndex];
+		if (bCoversColumn && Min.Z <= SectionMinZ && Max.Z >= SectionMaxZ)
+		{
+			Section.Fill(Desired);
+			continue;
+		}
+
+		for (int32 Z = FMath::Max(Min.Z, SectionMinZ); Z < FMath::Min(Max.Z, SectionMaxZ); Z++)
+		{
+			for (int32 Y = Min.Y; Y < Max.Y; Y++)
+			{
+				for (int32 X = Min.X; X < Max.X; X++)
+				{
+					Section.Set(LinearizeSectionCoordinate(X, Y, Z - SectionMinZ), Desired);
+				}
+			}
+		}
+	}
+	bHasUnsavedVoxels.store(true, std::memory_order_release);
+}
+
+void UVoxelChunk::CompactVoxels()
+{
+	for (TUniquePtr<FVoxelPalettedStorage>& Section : Sections)
+	{
+		Section->Compact();
+	}
+}
+
+VoxelType UVoxelChunk::GetVoxel(const FIntVector& LocalCoord) const
+{
+	int32 SectionIndex = LocalCoord.Z / CachedChunkSide;
+	int32 SectionZ = LocalCoord.Z - SectionIndex * CachedChunkSide;
+	return Sections[SectionIndex]->Get(LinearizeSectionCoordinate(LocalCoord.X, LocalCoord.Y, SectionZ));
+}
+
+void UVoxelChunk::SetVoxel(const FIntVector& LocalCoord, VoxelType Desired)
+{
+	int32 SectionIndex = LocalCoord.Z / CachedChunkSide;
+	int32 SectionZ = LocalCoord.Z - SectionIndex * CachedChunkSide;
+	Sections[SectionIndex]->Set(LinearizeSectionCoordinate(LocalCoord.X, LocalCoord.Y, SectionZ), Desired);
+	bHasUnsavedVoxels.store(true, std::memory_order_release);
+}
+
+bool UVoxelChunk::CompareExchangeVoxel(const FIntVector& LocalCoord, VoxelType& Expected, VoxelType Desired)
+{
+	int32 SectionIndex = LocalCoord.Z / CachedChunkSide;
+	int32 SectionZ = LocalCoord.Z - SectionIndex * CachedChunkSide;
+	if (!Sections[SectionIndex]->CompareExchange(LinearizeSectionCoordinate(LocalCoord.X, LocalCoord.Y, SectionZ), Expected, Desired))
+	{
+		return false;
+	}
+	bHasUnsavedVoxels.store(true, std::memory_order_release);
+	return true;
+}
+
+void UVoxelChunk::GenerateMesh()
+{
+	for (int32 SectionIndex = 0; SectionIndex < Sections.Num(); SectionIndex++)
+	{
+		GenerateSectionMesh(SectionIndex);
+	}
+}
+
+void UVoxelChunk::GenerateSectionMesh(int32 SectionIndex)
+{
+	check(Sections.IsValidIndex(SectionIndex));
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+	// A running task would overwrite this mesh with older voxels
+	CancelSectionMeshTask(SectionIndex);
+
+	// Writes counted before the key is made tell whether the built mesh still matches it
+	uint64 WritesFinished = Sections[SectionIndex]->GetWritesFinished();
+	uint64 MeshKey = 0;
+	if (VoxelWorld->GetMeshCache())
+	{
+		MeshKey = GetSectionMeshKey(SectionIndex);
+		if (ApplyCachedSectionMesh(SectionIndex, MeshKey))
+		{
+			return;
+		}
+	}
+
+	ResetSectionMeshes(SectionIndex);
+	FVoxelMeshBuffers& Buffers = FVoxelMeshBuffers::GetScratch();
+	int32 VisibleFacesNum = BuildSectionMesh(SectionIndex, Buffers, VoxelWorld->IsBinaryMeshingEnabled());
+	AppendSectionMeshes(SectionIndex, Buffers);
+
+#if DO_CHECK
+	// Validating is as slow as building, so only the first synchronously built section of each chunk is checked
+	if (!bIsMeshValidated)
+	{
+		bIsMeshValidated = true;
+		CheckSectionMeshValidity(SectionIndex);
+	}
+#endif
+
+	// A write from another thread during the build may not be in the mesh
+	if (VoxelWorld->GetMeshCache() && Sections[SectionIndex]->GetWritesStarted() == WritesFinished)
+	{
+		AddCachedSectionMesh(SectionIndex, MeshKey, Buffers, VisibleFacesNum);
+	}
+	FinishSectionMesh(SectionIndex, VisibleFacesNum);
+	RebuildSections[SectionIndex] = false;
+}
+
+void UVoxelChunk::CheckSectionMeshValidity(int32 SectionIndex) const
+{
+	for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+	{
+		const UDynamicMeshComponent* SectionMeshComponent = SectionMeshComponents[GetSectionMeshIndex(SectionIndex, FaceIndex)];
+		if (!SectionMeshComponent)
+		{
+			continue;
+		}
+		const FDynamicMesh3& Mesh = *SectionMeshComponent->GetMesh();
+
+		UE::Geometry::FDynamicMesh3::FValidityOptions ValidityOptions;
+		UE::Geometry::EValidityCheckFailMode ValidityCheckFailMode = UE::Geometry::EValidityCheckFailMode::Ensure;
+		if (!Mesh.CheckValidity(ValidityOptions, ValidityCheckFailMode))
+		{
+			UE_LOG(LogVoxelEngine, Warning, TEXT("Chunk (%d, %d) section %d mesh failed validity check"), ChunkX, ChunkY, SectionIndex);
+		}
+
+		const UE::Geometry::FDynamicMeshColorOverlay* ColorOverlay = Mesh.Attributes()->PrimaryColors();
+		check(ColorOverlay);
+		if (!ColorOverlay->CheckValidity(false, ValidityCheckFailMode))
+		{
+			UE_LOG(LogVoxelEngine, Error, TEXT("Chunk (%d, %d) section %d mesh color overlay failed validity check"), ChunkX, ChunkY, SectionIndex);
+		}
+	}
+}
+
+void UVoxelChunk::ResetSectionMeshes(int32 SectionIndex)
+{
+	FVoxelMeshBuilder MeshBuilder = GetMeshBuilder();
+	for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+	{
+		int32 SectionMeshIndex = GetSectionMeshIndex(SectionIndex, FaceIndex);
+		SectionQuads[SectionMeshIndex].Invalidate();
+		UDynamicMeshComponent* SectionMeshComponent = SectionMeshComponents[SectionMeshIndex];
+		if (!SectionMeshComponent)
+		{
+			continue;
+		}
+		UDynamicMesh* MeshObj = SectionMeshComponent->GetDynamicMesh();
+		checkSlow(MeshObj);
+		MeshBuilder.InitializeMesh(MeshObj->GetMeshRef());
+	}
+}
+
+void UVoxelChunk::AppendSectionMeshes(int32 SectionIndex, const FVoxelMeshBuffers& Buffers)
+{
+	uint32 FaceMask = 0;
+	for (uint8 QuadFaceIndex : Buffers.QuadFaceIndices)
+	{
+		FaceMask |= 1u << QuadFaceIndex;
+	}
+
+	TArray<int32> QuadFaceKeys;
+	for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+	{
+		int32 SectionMeshIndex = GetSectionMeshIndex(SectionIndex, FaceIndex);
+		if (FaceMask & (1u << FaceIndex))
+		{
+			Buffers.AppendToMesh(GetOrCreateSectionMeshComponent(SectionMeshIndex)->GetDynamicMesh()->GetMeshRef(), FaceIndex);
+		}
+		Buffers.GetQuadFaceKeys(FaceIndex, QuadFaceKeys);
+		ResetSectionQuads(SectionMeshIndex, QuadFaceKeys);
+	}
+}
+
+UDynamicMeshComponent* UVoxelChunk::GetOrCreateSectionMeshComponent(int32 SectionMeshIndex)
+{
+	UDynamicMeshComponent*& SectionMeshComponent = SectionMeshComponents[SectionMeshIndex];
+	if (SectionMeshComponent)
+	{
+		return SectionMeshComponent;
+	}
+
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+	// Section meshes share the chunk origin, vertices keep chunk-local coordinates
+	SectionMeshComponent = NewObject<UDynamicMeshComponent>(this);
+	check(SectionMeshComponent);
+	// Directions culled for the camera may still face a light
+	SectionMeshComponent->bCastHiddenShadow = true;
+	SectionMeshComponent->SetHiddenInGame((SectionVisibleDirections[SectionMeshIndex / 6] & (1u << (SectionMeshIndex % 6))) == 0);
+	SectionMeshComponent->SetMaterial(0, VoxelWorld->GetVoxelChunkMaterial());
+	SectionMeshComponent->SetEnableFlatShading(true);
+	SectionMeshComponent->SetEnableWireframeRenderPass(bDebugDrawDimensions);
+	SectionMeshComponent->RegisterComponent();
+	FAttachmentTransformRules Rules(EAttachmentRule::KeepRelative, false);
+	SectionMeshComponent->AttachToComponent(this, Rules);
+	GetMeshBuilder().InitializeMesh(SectionMeshComponent->GetDynamicMesh()->GetMeshRef());
+	return SectionMeshComponent;
+}
+
+FVoxelMeshBuilder UVoxelChunk::GetMeshBuilder() const
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+
+	FVoxelMeshBuilder MeshBuilder;
+	MeshBuilder.VoxelSizeWorld = VoxelWorld->GetVoxelSizeWorld();
+	MeshBuilder.VoxelTypesNum = VoxelWorld->GetVoxelTypeSet()->GetVoxelTypes().Num();
+	MeshBuilder.MeshingMode = VoxelWorld->GetMeshingMode();
+	return MeshBuilder;
+}
+
+int32 UVoxelChunk::BuildSectionMesh(int32 SectionIndex, FVoxelMeshBuffers& Buffers, bool bBinaryKernel)
+{
+	check(Sections.IsValidIndex(SectionIndex));
+	TBitArray<FDefaultBitArrayAllocator>& VisibleVoxels = SectionVisibleVoxels[SectionIndex];
+	VisibleVoxels.Init(false, VisibleVoxels.Num());
+
+	FVoxelMeshBuilder MeshBuilder = GetMeshBuilder();
+	TArray<VoxelType> GreedyFaces;
+	// LOD cells are never merged
+	bool bIsGreedy = MeshBuilder.IsGreedy() && MeshLod == 0;
+	if (bIsGreedy)
+	{
+		GreedyFaces.SetNumZeroed(6 * VisibleVoxels.Num());
+	}
+	int32 VisibleFacesNum = 0;
+	if (MeshLod > 0)
+	{
+		VisibleFacesNum = AddSectionLodFaces(SectionIndex, MeshBuilder, Buffers);
+	}
+	else if (bBinaryKernel && CachedChunkSide <= MaxBinaryMeshingChunkSide)
+	{
+		VisibleFacesNum = ProcessVoxelsBinary(SectionIndex, MeshBuilder, Buffers, bIsGreedy ? &GreedyFaces : nullptr);
+	}
+	else
+	{
+		VisibleFacesNum = ProcessVoxels(SectionIndex, MeshBuilder, Buffers, bIsGreedy ? &GreedyFaces : nullptr);
+	}
+	if (bIsGreedy)
+	{
+		AddSectionGreedyFaces(SectionIndex, MeshBuilder, GreedyFaces, Buffers);
+	}
+	return VisibleFacesNum;
+}
+
+void UVoxelChunk::AddSectionGreedyFaces(int32 SectionIndex, const FVoxelMeshBuilder& MeshBuilder, TArray<VoxelType>& GreedyFaces, FVoxelMeshBuffers& Buffers) const
+{
+	int32 SectionMinZ = SectionIndex * CachedChunkSide;
+	FIntVector Dims(CachedChunkSide, CachedChunkSide, FMath::Min(CachedChunkSide, CachedWorldHeight - SectionMinZ));
+	check(Dims.X * Dims.Y * Dims.Z == SectionVisibleVoxels[SectionIndex].Num());
+	MeshBuilder.AddGreedyFaces(Buffers, GreedyFaces, Dims, SectionMinZ);
+}
+
+int32 UVoxelChunk::AddSectionLodFaces(int32 SectionIndex, const FVoxelMeshBuilder& MeshBuilder, FVoxelMeshBuffers& Buffers) const
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+
+	FIntVector ChunkMin;
+	FIntVector ChunkMax;
+	GetVoxelBoundingBox(ChunkMin, ChunkMax);
+	int32 SectionMinZ = SectionIndex * CachedChunkSide;
+	FVoxelLodCells LodCells;
+	LodCells.Build(CachedChunkSide, SectionMinZ, FMath::Min(CachedChunkSide, CachedWorldHeight - SectionMinZ), 1 << MeshLod,
+		[VoxelWorld, &ChunkMin](const FIntVector& LocalCoord)
+		{
+			FIntVector Coord = ChunkMin + LocalCoord;
+			return VoxelWorld->IsValidCoordinate(Coord) ? VoxelWorld->GetVoxel(Coord) : EmptyVoxelType;
+		},
+		[VoxelWorld](VoxelType Type)
+		{
+			return !VoxelWorld->IsVoxelTypeTransparent(Type);
+		});
+	return LodCells.AddFaces(MeshBuilder, Buffers);
+}
 
-void FVoxelChunkSecondaryTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
+void UVoxelChunk::SetMeshLod(int32 Lod)
 {
-	if (!IsValid(Target) || !IsValid(Target->GetOwner()))
+	if (Lod == MeshLod)
 	{
 		return;
 	}
-	if (Target->GetOwner()->IsPendingKillPending())
+	MeshLod = Lod;
+	MarkMeshRebuildRequired();
+}
+
+int32 UVoxelChunk::GetMeshLod() const
+{
+	return MeshLod;
+}
+
+void UVoxelChunk::FinishSectionMesh(int32 SectionIndex, int32 VisibleFacesNum)
+{
+	UpdateSectionMeshComponent(SectionIndex, VisibleFacesNum);
+	DirtySections[SectionIndex] = false;
+}
+
+TSharedRef<FVoxelReadSnapshot, ESPMode::ThreadSafe> UVoxelChunk::AcquireSectionSnapshot(int32 SectionIndex) const
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+
+	FIntVector ChunkMin;
+	FIntVector ChunkMax;
+	GetVoxelBoundingBox(ChunkMin, ChunkMax);
+	int32 SectionMinZ = SectionIndex * CachedChunkSide;
+	int32 SectionHeight = FMath::Min(CachedChunkSide, CachedWorldHeight - SectionMinZ);
+	// Faces on the section boundary depend on the voxels one step, or one LOD cell, outside of it
+	int32 Border = 1 << MeshLod;
+	FIntVector SnapshotMin(ChunkMin.X - Border, ChunkMin.Y - Border, SectionMinZ - Border);
+	FIntVector SnapshotMax(ChunkMax.X + Border, ChunkMax.Y + Border, SectionMinZ + SectionHeight + Border);
+	return VoxelWorld->AcquireReadSnapshot(SnapshotMin, SnapshotMax);
+}
+
+uint64 UVoxelChunk::GetSectionMeshKey(int32 SectionIndex)
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+
+	int32 ChunkSide = CachedChunkSide;
+	int32 SectionMinZ = SectionIndex * ChunkSide;
+	FIntVector SectionSize(ChunkSide, ChunkSide, FMath::Min(ChunkSide, CachedWorldHeight - SectionMinZ));
+	// Slabs outside the X and Y sides are read from the neighbouring chunks, each looked up once
+	const UVoxelChunk* Neighbours[] = {
+		VoxelWorld->GetChunk(FIntVector2(ChunkX - 1, ChunkY)),
+		VoxelWorld->GetChunk(FIntVector2(ChunkX + 1, ChunkY)),
+		VoxelWorld->GetChunk(FIntVector2(ChunkX, ChunkY - 1)),
+		VoxelWorld->GetChunk(FIntVector2(ChunkX, ChunkY + 1)) };
+	return FVoxelMeshCache::MakeSectionMeshKey(GetMeshBuilder(), SectionIndex, MeshLod, GetSectionContentHash(SectionIndex), SectionSize,
+		[this, VoxelWorld, &Neighbours, ChunkSide, SectionMinZ](int32 X, int32 Y, int32 Z)
+		{
+			int32 ChunkZ = SectionMinZ + Z;
+			if (ChunkZ < 0 || ChunkZ >= CachedWorldHeight)
+			{
+				return false;
+			}
+			const UVoxelChunk* Chunk = this;
+			if (X < 0 || X >= ChunkSide)
+			{
+				Chunk = Neighbours[X < 0 ? 0 : 1];
+				X -= X < 0 ? -ChunkSide : ChunkSide;
+			}
+			else if (Y < 0 || Y >= ChunkSide)
+			{
+				Chunk = Neighbours[Y < 0 ? 2 : 3];
+				Y -= Y < 0 ? -ChunkSide : ChunkSide;
+			}
+			return Chunk && !VoxelWorld->IsVoxelTypeTransparent(Chunk->GetVoxel(FIntVector(X, Y, ChunkZ)));
+		});
+}
+
+uint64 UVoxelChunk::GetSectionContentHash(int32 SectionIndex)
+{
+	const FVoxelPalettedStorage& Storage = *Sections[SectionIndex];
+	uint64 WritesFinished = Storage.GetWritesFinished();
+	if (SectionContentHashWrites[SectionIndex] == WritesFinished && Storage.GetWritesStarted() == WritesFinished)
+	{
+		return SectionContentHashes[SectionIndex];
+	}
+
+	uint64 Hash = FVoxelMeshCache::HashSectionVoxels(Storage);
+
+	// A write that overlapped the reads leaves the hash to be computed again on the next lookup
+	if (Storage.GetWritesStarted() == WritesFinished)
+	{
+		SectionContentHashes[SectionIndex] = Hash;
+		SectionContentHashWrites[SectionIndex] = WritesFinished;
+	}
+	return Hash;
+}
+
+bool UVoxelChunk::ApplyCachedSectionMesh(int32 SectionIndex, uint64 MeshKey)
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+	FVoxelMeshCache* MeshCache = VoxelWorld->GetMeshCache();
+	if (!MeshCache)
+	{
+		return false;
+	}
+	TSharedPtr<const FVoxelMeshCacheEntry, ESPMode::ThreadSafe> Entry = MeshCache->Find(MeshKey);
+	if (!Entry)
+	{
+		return false;
+	}
+
+	ResetSectionMeshes(SectionIndex);
+	AppendSectionMeshes(SectionIndex, Entry->Buffers);
+	SectionVisibleVoxels[SectionIndex] = Entry->VisibleVoxels;
+	FinishSectionMesh(SectionIndex, Entry->VisibleFacesNum);
+	RebuildSections[SectionIndex] = false;
+	return true;
+}
+
+void UVoxelChunk::AddCachedSectionMesh(int32 SectionIndex, uint64 MeshKey, FVoxelMeshBuffers Buffers, int32 VisibleFacesNum)
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+	FVoxelMeshCache* MeshCache = VoxelWorld->GetMeshCache();
+	if (!MeshCache)
 	{
 		return;
 	}
-	if (!Target->GetOwner()->AllowReceiveTickEventOnDedicatedServer() && IsRunningDedicatedServer())
+	TSharedRef<FVoxelMeshCacheEntry, ESPMode::ThreadSafe> Entry = MakeShared<FVoxelMeshCacheEntry, ESPMode::ThreadSafe>();
+	Entry->Buffers = MoveTemp(Buffers);
+	Entry->VisibleVoxels = SectionVisibleVoxels[SectionIndex];
+	Entry->VisibleFacesNum = VisibleFacesNum;
+	MeshCache->Add(MeshKey, Entry);
+}
+
+void UVoxelChunk::UpdateSectionMeshComponent(int32 SectionIndex, int32 VisibleFacesNum)
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+
+	SectionTrianglesNum[SectionIndex] = 0;
+	for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+	{
+		UDynamicMeshComponent* SectionMeshComponent = SectionMeshComponents[GetSectionMeshIndex(SectionIndex, FaceIndex)];
+		if (!SectionMeshComponent)
+		{
+			continue;
+		}
+		SectionMeshComponent->SetMaterial(0, VoxelWorld->GetVoxelChunkMaterial());
+		SectionMeshComponent->NotifyMeshUpdated();
+		SectionMeshComponent->SetEnableFlatShading(true);
+		SectionTrianglesNum[SectionIndex] += SectionMeshComponent->GetDynamicMesh()->GetMeshRef().TriangleCount();
+	}
+	SectionPerFaceTrianglesNum[SectionIndex] = VisibleFacesNum * 2;
+}
+
+void UVoxelChunk::LaunchSectionMeshTask(int32 SectionIndex)
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+	CancelSectionMeshTask(SectionIndex);
+
+	TSharedRef<FVoxelReadSnapshot, ESPMode::ThreadSafe> Snapshot = AcquireSectionSnapshot(SectionIndex);
+	FIntVector ChunkMin;
+	FIntVector ChunkMax;
+	GetVoxelBoundingBox(ChunkMin, ChunkMax);
+	int32 SectionMinZ = SectionIndex * CachedChunkSide;
+	int32 SectionHeight = FMath::Min(CachedChunkSide, CachedWorldHeight - SectionMinZ);
+
+	TSharedPtr<FVoxelSectionMeshTask, ESPMode::ThreadSafe> Task = MakeShared<FVoxelSectionMeshTask, ESPMode::ThreadSafe>(
+		GetMeshBuilder(),
+		VoxelWorld->GetVoxelTypeSet(),
+		Snapshot,
+		ChunkMin,
+		CachedChunkSide,
+		SectionIndex,
+		SectionHeight,
+		MeshLod);
+	Task->SetKeepBuffers(VoxelWorld->GetMeshCache() != nullptr);
+	SectionMeshTasks[SectionIndex] = Task;
+	SectionMeshTaskEvents[SectionIndex] = UE::Tasks::Launch(UE_SOURCE_LOCATION, [Task]()
+	{
+		Task->Run();
+	}, UE::Tasks::ETaskPriority::BackgroundNormal);
+}
+
+void UVoxelChunk::CancelSectionMeshTask(int32 SectionIndex)
+{
+	if (!SectionMeshTasks.IsValidIndex(SectionIndex) || !SectionMeshTasks[SectionIndex])
 	{
 		return;
 	}
-	if ((TickType == LEVELTICK_ViewportsOnly) && !Target->GetOwner()->ShouldTickIfViewportsOnly())
+	SectionMeshTasks[SectionIndex]->Cancel();
+	SectionMeshTasks[SectionIndex].Reset();
+	// The task keeps running until it notices, it only has to be waited for before the chunk goes away
+	if (!SectionMeshTaskEvents[SectionIndex].IsCompleted())
+	{
+		CancelledMeshTaskEvents.Add(SectionMeshTaskEvents[SectionIndex]);
+	}
+	SectionMeshTaskEvents[SectionIndex] = UE::Tasks::FTask();
+}
+
+void UVoxelChunk::ApplySectionMeshTask(int32 SectionIndex)
+{
+	TSharedPtr<FVoxelSectionMeshTask, ESPMode::ThreadSafe> Task = MoveTemp(SectionMeshTasks[SectionIndex]);
+	SectionMeshTaskEvents[SectionIndex] = UE::Tasks::FTask();
+	check(Task && !Task->IsCancelled());
+
+	// Voxels changed while meshing, the change that did it may not have marked this section
+	if (Task->IsStale())
 	{
+		RebuildSections[SectionIndex] = true;
 		return;
 	}
 
-	FScopeCycleCounterUObject ActorScope(Target);
-	Target->TickSecondary(DeltaTime * Target->GetOwner()->CustomTimeDilation, TickType, CurrentThread, MyCompletionGraphEvent, this);
+	for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+	{
+		int32 SectionMeshIndex = GetSectionMeshIndex(SectionIndex, FaceIndex);
+		FDynamicMesh3& Mesh = Task->GetMesh(FaceIndex);
+		if (SectionMeshComponents[SectionMeshIndex] || Mesh.TriangleCount() > 0)
+		{
+			GetOrCreateSectionMeshComponent(SectionMeshIndex)->GetDynamicMesh()->GetMeshRef() = MoveTemp(Mesh);
+		}
+		ResetSectionQuads(SectionMeshIndex, Task->GetQuadFaceKeys(FaceIndex));
+	}
+	SectionVisibleVoxels[SectionIndex] = MoveTemp(Task->GetVisibleVoxels());
+	UpdateSectionMeshComponent(SectionIndex, Task->GetVisibleFacesNum());
+	// The task made the key on the worker, the mesh is only copied into the cache if it isn't there yet
+	FVoxelMeshCache* MeshCache = GetOwner<AVoxelWorld>()->GetMeshCache();
+	if (MeshCache && !MeshCache->Find(Task->GetMeshKey()))
+	{
+		AddCachedSectionMesh(SectionIndex, Task->GetMeshKey(), MoveTemp(Task->GetBuffers()), Task->GetVisibleFacesNum());
+	}
+
+	UE_LOG(LogVoxelEngine, Verbose, TEXT("Chunk (%d, %d) section %d mesh built in %3.2f milliseconds on a worker, %d triangles (%d per-face)"),
+		ChunkX, ChunkY, SectionIndex, Task->GetBuildMilliseconds(), SectionTrianglesNum[SectionIndex], SectionPerFaceTrianglesNum[SectionIndex]);
 }
 
-FString FVoxelChunkSecondaryTickFunction::DiagnosticMessage()
+void UVoxelChunk::ResetSectionQuads(int32 SectionMeshIndex, TConstArrayView<int32> QuadFaceKeys)
 {
-	return FString();
+	PatchedSectionMeshes[SectionMeshIndex] = false;
+	GrownSectionMeshes[SectionMeshIndex] = false;
+	// Merged quads and LOD cells cover several faces and can't be patched
+	if (GetMeshBuilder().IsGreedy() || MeshLod > 0)
+	{
+		SectionQuads[SectionMeshIndex].Invalidate();
+		return;
+	}
+	SectionQuads[SectionMeshIndex].Reset(QuadFaceKeys);
 }
 
+bool UVoxelChunk::PatchVoxelFaces(const FIntVector& LocalCoord)
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+
+	int32 SectionIndex;
+	int32 VoxelIndex = GetSectionVisibilityIndex(LocalCoord, SectionIndex);
+	// Quads of all six direction meshes are reset together
+	if (!Sections.IsValidIndex(SectionIndex) || !SectionQuads[GetSectionMeshIndex(SectionIndex, 0)].IsValid())
+	{
+		return false;
+	}
+	// A pending remesh replaces the mesh anyway, and a running task's mesh would lose the patch
+	if (DirtySections[SectionIndex] || RebuildSections[SectionIndex] || SectionMeshTasks[SectionIndex])
+	{
+		return false;
+	}
 
-// Sets default values for this component's properties
-UVoxelChunk::UVoxelChunk()
+	FIntVector ChunkMin;
+	FIntVector ChunkMax;
+	GetVoxelBoundingBox(ChunkMin, ChunkMax);
+	FIntVector VoxelWorldCoord = ChunkMin + LocalCoord;
+	TStaticArray<bool, 6> FacesVisibility;
+	bool bIsOpaque = !VoxelWorld->IsVoxelTransparent(VoxelWorldCoord);
+	if (bIsOpaque)
+	{
+		CheckVoxelSidesVisibility(VoxelWorldCoord, FacesVisibility);
+	}
+
+	FVoxelMeshBuilder MeshBuilder = GetMeshBuilder();
+	FVoxelMeshBuffers& Quad = FVoxelMeshBuffers::GetScratch();
+	VoxelType VoxelTypeId = GetVoxel(LocalCoord);
+	int32 SectionVoxelsNum = SectionVisibleVoxels[SectionIndex].Num();
+	bool bHasVisibleFaces = false;
+	for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+	{
+		int32 SectionMeshIndex = GetSectionMeshIndex(SectionIndex, FaceIndex);
+		FVoxelSectionQuads& Quads = SectionQuads[SectionMeshIndex];
+		int32 FaceKey = FVoxelSectionQuads::GetFaceKey(FaceIndex, VoxelIndex, SectionVoxelsNum);
+		if (!bIsOpaque || !FacesVisibility[FaceIndex])
+		{
+			// A direction without a mesh has no faces to remove
+			UDynamicMeshComponent* SectionMeshComponent = SectionMeshComponents[SectionMeshIndex];
+			if (SectionMeshComponent && Quads.RemoveFace(SectionMeshComponent->GetDynamicMesh()->GetMeshRef(), FaceKey))
+			{
+				PatchedSectionMeshes[SectionMeshIndex] = true;
+			}
+			continue;
+		}
+		bHasVisibleFaces = true;
+		Quad.Reset();
+		MeshBuilder.AddFace(Quad, VoxelTypeId, LocalCoord.X, LocalCoord.Y, LocalCoord.Z, FaceIndex, FaceKey);
+		FDynamicMesh3& Mesh = GetOrCreateSectionMeshComponent(SectionMeshIndex)->GetDynamicMesh()->GetMeshRef();
+		if (Quads.SetFace(Mesh, FaceKey, Quad))
+		{
+			GrownSectionMeshes[SectionMeshIndex] = true;
+		}
+		PatchedSectionMeshes[SectionMeshIndex] = true;
+	}
+	SectionVisibleVoxels[SectionIndex][VoxelIndex] = bHasVisibleFaces;
+	VoxelWorld->ScheduleChunkPatchNotification(this);
+	return true;
+}
+
+void UVoxelChunk::NotifyPatchedSections()
 {
-	PrimaryComponentTick.bCanEverTick = true;
-	SecondaryComponentTick.TickGroup = TG_LastDemotable;
-	SecondaryComponentTick.bCanEverTick = true;
-	SecondaryComponentTick.bStartWithTickEnabled = true;
-	SecondaryComponentTick.TickInterval = 0.1;
+	for (TConstSetBitIterator<> It(PatchedSectionMeshes); It; ++It)
+	{
+		int32 SectionMeshIndex = It.GetIndex();
+		UDynamicMeshComponent* SectionMeshComponent = SectionMeshComponents[SectionMeshIndex];
+		checkSlow(SectionMeshComponent);
+		// Appended quads change the index buffer, otherwise rewriting vertex buffers is enough
+		if (GrownSectionMeshes[SectionMeshIndex])
+		{
+			SectionMeshComponent->NotifyMeshUpdated();
+		}
+		else
+		{
+			SectionMeshComponent->FastNotifyVertexAttributesUpdated(EMeshRenderAttributeFlags::AllVertexAttribs);
+		}
+
+		int32 SectionIndex = SectionMeshIndex / 6;
+		SectionTrianglesNum[SectionIndex] = 0;
+		SectionPerFaceTrianglesNum[SectionIndex] = 0;
+		for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+		{
+			int32 DirectionMeshIndex = GetSectionMeshIndex(SectionIndex, FaceIndex);
+			if (SectionMeshComponents[DirectionMeshIndex])
+			{
+				SectionTrianglesNum[SectionIndex] += SectionMeshComponents[DirectionMeshIndex]->GetDynamicMesh()->GetMeshRef().TriangleCount();
+			}
+			SectionPerFaceTrianglesNum[SectionIndex] += SectionQuads[DirectionMeshIndex].GetFacesNum() * 2;
+		}
+	}
+	PatchedSectionMeshes.Init(false, PatchedSectionMeshes.Num());
+	GrownSectionMeshes.Init(false, GrownSectionMeshes.Num());
 }
 
-// Called when the game starts
-void UVoxelChunk::BeginPlay()
+void UVoxelChunk::CullFaceDirections(TConstArrayView<FVector> ViewLocations)
 {
-	Super::BeginPlay();
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	checkSlow(VoxelWorld);
+
+	FBox ChunkBox = GetWorldBoundingBox();
+	double SectionHeightWorld = CachedChunkSide * VoxelWorld->GetVoxelSizeWorld();
+	int32 SectionsNum = SectionMeshComponents.Num() / 6;
+	for (int32 SectionIndex = 0; SectionIndex < SectionsNum; SectionIndex++)
+	{
+		FVector Min(ChunkBox.Min.X, ChunkBox.Min.Y, ChunkBox.Min.Z + SectionIndex * SectionHeightWorld);
+		FVector Max(ChunkBox.Max.X, ChunkBox.Max.Y, FMath::Min(ChunkBox.Max.Z, Min.Z + SectionHeightWorld));
+		// A face can only be seen from the side its normal points to, so a direction is visible if
+		// some view is past the section's farthest plane of that direction: top, bottom, front, back, left, right
+		uint32 VisibleDirections = ViewLocations.IsEmpty() ? 0x3f : 0;
+		for (const FVector& ViewLocation : ViewLocations)
+		{
+			VisibleDirections |= (ViewLocation.Z > Min.Z) << 0;
+			VisibleDirections |= (ViewLocation.Z < Max.Z) << 1;
+			VisibleDirections |= (ViewLocation.X > Min.X) << 2;
+			VisibleDirections |= (ViewLocation.X < Max.X) << 3;
+			VisibleDirections |= (ViewLocation.Y < Max.Y) << 4;
+			VisibleDirections |= (ViewLocation.Y > Min.Y) << 5;
+		}
+		// Kept for direction meshes created later
+		SectionVisibleDirections[SectionIndex] = VisibleDirections;
+		for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+		{
+			UDynamicMeshComponent* SectionMeshComponent = SectionMeshComponents[GetSectionMeshIndex(SectionIndex, FaceIndex)];
+			if (!SectionMeshComponent)
+			{
+				continue;
+			}
+			bool bHidden = (VisibleDirections & (1u << FaceIndex)) == 0;
+			if (SectionMeshComponent->bHiddenInGame != bHidden)
+			{
+				SectionMeshComponent->SetHiddenInGame(bHidden);
+			}
+		}
+	}
+}
 
+int32 UVoxelChunk::ProcessVoxels(int32 SectionIndex, const FVoxelMeshBuilder& MeshBuilder, FVoxelMeshBuffers& Buffers, TArray<VoxelType>* GreedyFaces)
+{
 	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
 	check(VoxelWorld);
 
-	if (!IsTemplate() && SecondaryComponentTick.bCanEverTick)
+	int32 ChunkSide = CachedChunkSide;
+	int32 SectionMinZ = SectionIndex * ChunkSide;
+	int32 SectionHeight = FMath::Min(ChunkSide, CachedWorldHeight - SectionMinZ);
+
+	VoxelType UniformType;
+	bool bIsUniform = Sections[SectionIndex]->IsUniform(UniformType);
+	// Transparent voxels have no faces, enclosed opaque sections have no visible faces
+	if (bIsUniform && (VoxelWorld->IsVoxelTypeTransparent(UniformType) || IsSectionEnclosed(SectionIndex)))
 	{
-		SecondaryComponentTick.Target = this;
-		SecondaryComponentTick.SetTickFunctionEnable(
-			SecondaryComponentTick.bStartWithTickEnabled);
-		SecondaryComponentTick.RegisterTickFunction(VoxelWorld->GetLevel());
+		return 0;
 	}
 
-	FIntVector MinVoxel;
-	FIntVector MaxVoxel;
-	GetVoxelBoundingBox(MinVoxel, MaxVoxel);
-	FVector Location = FVector(MinVoxel.X, MinVoxel.Y, MinVoxel.Z) * VoxelWorld->GetVoxelSizeWorld();
-	SetRelativeLocation(Location);	
+	FVoxelPaddedSection& Padded = FVoxelPaddedSection::GetScratch();
+	FillPaddedSection(SectionIndex, Padded);
+
+	int32 VisibleFacesNum = 0;
+	TBitArray<FDefaultBitArrayAllocator>& VisibleVoxels = SectionVisibleVoxels[SectionIndex];
+	for (int32 Z = 0; Z < SectionHeight; Z++)
+	{
+		bool bIsCap = Z == 0 || Z == SectionHeight - 1;
+		for (int32 Y = 0; Y < ChunkSide; Y++)
+		{
+			// Interior voxels of a uniform opaque section are hidden by their neighbours, only the boundary can have visible faces
+			bool bIsBoundaryRow = bIsCap || Y == 0 || Y == ChunkSide - 1;
+			int32 XStep = bIsUniform && !bIsBoundaryRow ? FMath::Max(ChunkSide - 1, 1) : 1;
+			for (int32 X = 0; X < ChunkSide; X += XStep)
+			{
+				uint32 FaceMask = Padded.GetVisibleFaceMask(X, Y, Z);
+				if (FaceMask == 0)
+				{
+					continue;
+				}
+				int32 VoxelIndex = LinearizeCoordinate(X, Y, Z);
+				VisibleVoxels[VoxelIndex] = true;
+				VisibleFacesNum += FMath::CountBits(FaceMask);
+				VoxelType VoxelTypeId = Padded.Get(X, Y, Z);
+				for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+				{
+					if ((FaceMask & (1u << FaceIndex)) == 0)
+					{
+						continue;
+					}
+					if (GreedyFaces)
+					{
+						(*GreedyFaces)[FaceIndex * VisibleVoxels.Num() + VoxelIndex] = VoxelTypeId;
+					}
+					else
+					{
+						MeshBuilder.AddFace(Buffers, VoxelTypeId, X, Y, SectionMinZ + Z, FaceIndex, FVoxelSectionQuads::GetFaceKey(FaceIndex, VoxelIndex, VisibleVoxels.Num()));
+					}
+				}
+			}
+		}
+	}
+	return VisibleFacesNum;
+}
+
+void UVoxelChunk::FillPaddedSection(int32 SectionIndex, FVoxelPaddedSection& Padded) const
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+
+	int32 ChunkSide = CachedChunkSide;
+	int32 SectionMinZ = SectionIndex * ChunkSide;
+	int32 SectionHeight = FMath::Min(ChunkSide, CachedWorldHeight - SectionMinZ);
+	const FVoxelPalettedStorage& Section = *Sections[SectionIndex];
+	Padded.Initialize(ChunkSide, SectionHeight);
+
+	VoxelType UniformType;
+	if (Section.IsUniform(UniformType))
+	{
+		bool bIsOpaque = !VoxelWorld->IsVoxelTypeTransparent(UniformType);
+		for (int32 Z = 0; Z < SectionHeight; Z++)
+		{
+			for (int32 Y = 0; Y < ChunkSide; Y++)
+			{
+				for (int32 X = 0; X < ChunkSide; X++)
+				{
+					Padded.Set(X, Y, Z, UniformType, bIsOpaque);
+				}
+			}
+		}
+	}
+	else if (CachedVoxelIndexing == EVoxelIndexing::Morton)
+	{
+		// Copied in storage order to walk the section's voxel block sequentially, padding above the world is skipped
+		uint32 SectionVoxelsNum = ChunkSide * ChunkSide * ChunkSide;
+		for (uint32 MortonCode = 0; MortonCode < SectionVoxelsNum; MortonCode++)
+		{
+			int32 X;
+			int32 Y;
+			int32 Z;
+			FVoxelMorton::Decode(MortonCode, X, Y, Z);
+			if (Z < SectionHeight)
+			{
+				VoxelType Type = Section.Get(MortonCode);
+				Padded.Set(X, Y, Z, Type, !VoxelWorld->IsVoxelTypeTransparent(Type));
+			}
+		}
+	}
+	else
+	{
+		for (int32 Z = 0; Z < SectionHeight; Z++)
+		{
+			for (int32 Y = 0; Y < ChunkSide; Y++)
+			{
+				for (int32 X = 0; X < ChunkSide; X++)
+				{
+					VoxelType Type = Section.Get(LinearizeSectionCoordinate(X, Y, Z));
+					Padded.Set(X, Y, Z, Type, !VoxelWorld->IsVoxelTypeTransparent(Type));
+				}
+			}
+		}
+	}
+
+	ForEachSectionBorderVoxel(SectionIndex, [&Padded, VoxelWorld](int32 X, int32 Y, int32 Z, VoxelType Type)
+	{
+		Padded.Set(X, Y, Z, Type, !VoxelWorld->IsVoxelTypeTransparent(Type));
+	});
+}
+
+template<typename VisitorType>
+void UVoxelChunk::ForEachSectionBorderVoxel(int32 SectionIndex, VisitorType&& Visit) const
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+
+	int32 ChunkSide = CachedChunkSide;
+	int32 SectionMinZ = SectionIndex * ChunkSide;
+	int32 SectionHeight = FMath::Min(ChunkSide, CachedWorldHeight - SectionMinZ);
+
+	// Layers of the sections above and below, the world outside the height range is not visited
+	for (int32 BorderZ : { -1, SectionHeight })
+	{
+		int32 ChunkZ = SectionMinZ + BorderZ;
+		if (ChunkZ < 0 || ChunkZ >= CachedWorldHeight)
+		{
+			continue;
+		}
+		for (int32 Y = 0; Y < ChunkSide; Y++)
+		{
+			for (int32 X = 0; X < ChunkSide; X++)
+			{
+				Visit(X, Y, BorderZ, GetVoxel(FIntVector(X, Y, ChunkZ)));
+			}
+		}
+	}
+
+	// Sides of the four neighbouring chunks are read from the chunks directly, missing chunks are not visited
+	const FIntVector2 NeighbourOffsets[] = { FIntVector2(-1, 0), FIntVector2(1, 0), FIntVector2(0, -1), FIntVector2(0, 1) };
+	for (const FIntVector2& Offset : NeighbourOffsets)
+	{
+		UVoxelChunk* Neighbour = VoxelWorld->GetChunk(FIntVector2(ChunkX + Offset.X, ChunkY + Offset.Y));
+		if (!Neighbour)
+		{
+			continue;
+		}
+		// Border voxel I runs along the side, the neighbour's voxel is on the opposite side of that chunk
+		int32 BorderX = Offset.X < 0 ? -1 : ChunkSide;
+		int32 BorderY = Offset.Y < 0 ? -1 : ChunkSide;
+		int32 NeighbourX = Offset.X < 0 ? ChunkSide - 1 : 0;
+		int32 NeighbourY = Offset.Y < 0 ? ChunkSide - 1 : 0;
+		for (int32 Z = 0; Z < SectionHeight; Z++)
+		{
+			for (int32 I = 0; I < ChunkSide; I++)
+			{
+				if (Offset.X != 0)
+				{
+					Visit(BorderX, I, Z, Neighbour->GetVoxel(FIntVector(NeighbourX, I, SectionMinZ + Z)));
+				}
+				else
+				{
+					Visit(I, BorderY, Z, Neighbour->GetVoxel(FIntVector(I, NeighbourY, SectionMinZ + Z)));
+				}
+			}
+		}
+	}
+}
+
+int32 UVoxelChunk::ProcessVoxelsBinary(int32 SectionIndex, const FVoxelMeshBuilder& MeshBuilder, FVoxelMeshBuffers& Buffers, TArray<VoxelType>* GreedyFaces)
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+	const UVoxelTypeSet* VoxelTypeSet = VoxelWorld->GetVoxelTypeSet();
+	check(VoxelTypeSet);
+
+	int32 ChunkSide = CachedChunkSide;
+	check(ChunkSide <= MaxBinaryMeshingChunkSide);
+	int32 SectionMinZ = SectionIndex * ChunkSide;
+	int32 SectionHeight = FMath::Min(ChunkSide, CachedWorldHeight - SectionMinZ);
+	const FVoxelPalettedStorage& Section = *Sections[SectionIndex];
+
+	VoxelType UniformType;
+	bool bIsUniform = Section.IsUniform(UniformType);
+	if (bIsUniform && (VoxelWorld->IsVoxelTypeTransparent(UniformType) || IsSectionEnclosed(SectionIndex)))
+	{
+		return 0;
+	}
+
+	FVoxelOpacityRows OpacityRows;
+	OpacityRows.Initialize(ChunkSide, SectionHeight);
+	uint64 FullRow = OpacityRows.GetFullRow();
+
+	for (int32 Z = 0; Z < SectionHeight; Z++)
+	{
+		for (int32 Y = 0; Y < ChunkSide; Y++)
+		{
+			if (bIsUniform)
+			{
+				OpacityRows.GetRow(Y, Z) = FullRow;
+				continue;
+			}
+			uint64 Row = 0;
+			for (int32 X = 0; X < ChunkSide; X++)
+			{
+				VoxelType Type = Section.Get(LinearizeSectionCoordinate(X, Y, Z));
+				Row |= uint64(!VoxelTypeSet->HasTypeFlags(Type, EVoxelTypeFlags::Transparent)) << X;
+			}
+			OpacityRows.GetRow(Y, Z) = Row;
+		}
+	}
+
+	// Layers of the sections above and below and sides of the neighbouring chunks, rows start out transparent
+	ForEachSectionBorderVoxel(SectionIndex, [&OpacityRows, VoxelWorld, ChunkSide](int32 X, int32 Y, int32 Z, VoxelType Type)
+	{
+		uint64 bIsOpaque = !VoxelWorld->IsVoxelTypeTransparent(Type);
+		if (X < 0)
+		{
+			OpacityRows.OpaqueMinX[Z] |= bIsOpaque << Y;
+		}
+		else if (X == ChunkSide)
+		{
+			OpacityRows.OpaquePlusX[Z] |= bIsOpaque << Y;
+		}
+		else
+		{
+			OpacityRows.GetRow(Y, Z) |= bIsOpaque << X;
+		}
+	});
+
+	// A face is visible where an opaque voxel meets a transparent one
+	int32 VisibleFacesNum = 0;
+	TBitArray<FDefaultBitArrayAllocator>& VisibleVoxels = SectionVisibleVoxels[SectionIndex];
+	OpacityRows.ForEachVisibleVoxel([&](int32 X, int32 Y, int32 Z, uint32 FaceMask)
+	{
+		int32 VoxelIndex = LinearizeCoordinate(X, Y, Z);
+		VisibleVoxels[VoxelIndex] = true;
+		VisibleFacesNum += FMath::CountBits(FaceMask);
+		VoxelType VoxelTypeId = bIsUniform ? UniformType : Section.Get(LinearizeSectionCoordinate(X, Y, Z));
+		for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+		{
+			if ((FaceMask & (1u << FaceIndex)) == 0)
+			{
+				continue;
+			}
+			if (GreedyFaces)
+			{
+				(*GreedyFaces)[FaceIndex * VisibleVoxels.Num() + VoxelIndex] = VoxelTypeId;
+			}
+			else
+			{
+				MeshBuilder.AddFace(Buffers, VoxelTypeId, X, Y, SectionMinZ + Z, FaceIndex, FVoxelSectionQuads::GetFaceKey(FaceIndex, VoxelIndex, VisibleVoxels.Num()));
+			}
+		}
+	});
+	return VisibleFacesNum;
+}
 
-	DynamicMeshComponent = NewObject<UDynamicMeshComponent>(this);
-	check(DynamicMeshComponent);
-	DynamicMeshComponent->RegisterComponent();
-	FAttachmentTransformRules Rules(EAttachmentRule::KeepRelative, false);
-	DynamicMeshComponent->AttachToComponent(this, Rules);
+bool UVoxelChunk::IsSectionUniformOpaque(int32 SectionIndex) const
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	checkSlow(VoxelWorld);
 
-	VisibleVoxelIndices.SetNum(VoxelWorld->GetChunkSide() * VoxelWorld->GetChunkSide() * VoxelWorld->GetWorldHeight(), false);
-	GenerateMesh();
+	VoxelType UniformType;
+	return Sections[SectionIndex]->IsUniform(UniformType) && !VoxelWorld->IsVoxelTypeTransparent(UniformType);
 }
 
-void UVoxelChunk::GenerateMesh()
+bool UVoxelChunk::IsSectionEnclosed(int32 SectionIndex) const
 {
 	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
-	check(VoxelWorld);
+	checkSlow(VoxelWorld);
 
-	checkSlow(DynamicMeshComponent);
-	UDynamicMesh* MeshObj = DynamicMeshComponent->GetDynamicMesh();
-	checkSlow(MeshObj);
-	FDynamicMesh3& Mesh = MeshObj->GetMeshRef();
-	VisibleVoxelIndices.Init(false, VisibleVoxelIndices.Num());
-	Mesh.Clear();
-	Mesh.EnableVertexUVs(FVector2f(0, 0));
-	Mesh.EnableVertexColors(FVector3f(1, 1, 1));
-	Mesh.EnableAttributes();
-	Mesh.Attributes()->EnablePrimaryColors();
-
-	ProcessVoxels();
-	bool bIsValid = true;
-	
-	UE::Geometry::FDynamicMesh3::FValidityOptions ValidityOptions;
-	UE::Geometry::EValidityCheckFailMode ValidityCheckFailMode = UE::Geometry::EValidityCheckFailMode::Ensure;
-	bIsValid = Mesh.CheckValidity(ValidityOptions, ValidityCheckFailMode);
-	if (bIsValid)
-	{
-		UE_LOG(LogTemp, Display, TEXT("Dynamic Mesh passed validity check"));
-	}
-	else
-	{
-		UE_LOG(LogTemp, Warning, TEXT("Dynamic Mesh failed validity check"));
-	}
-	
-	UE::Geometry::FDynamicMeshColorOverlay* ColorOverlay = Mesh.Attributes()->PrimaryColors();
-	check(ColorOverlay);
-	
-	bIsValid = ColorOverlay->CheckValidity(false, ValidityCheckFailMode);
-	if (bIsValid)
+	// Outside of the world counts as transparent, so sections on the world boundary are never enclosed
+	if (SectionIndex == 0 || SectionIndex == Sections.Num() - 1)
 	{
-		UE_LOG(LogTemp, Display, TEXT("Dynamic Mesh Color Overlay passed validity check"));
+		return false;
 	}
-	else
+	if (!IsSectionUniformOpaque(SectionIndex - 1) || !IsSectionUniformOpaque(SectionIndex + 1))
 	{
-		UE_LOG(LogTemp, Error, TEXT("Dynamic Mesh  Color Overlay failed validity check"));
-		return;
+		return false;
 	}
-	
-	bIsValid = UE::Geometry::CopyVertexUVsToOverlay(Mesh, *Mesh.Attributes()->PrimaryUV());
-	check(bIsValid);
-	bIsValid = CopyVertexColorsToOverlay(Mesh, *Mesh.Attributes()->PrimaryColors(), false);
-	check(bIsValid);
-	DynamicMeshComponent->SetMaterial(0, VoxelWorld->GetVoxelChunkMaterial());
-	DynamicMeshComponent->NotifyMeshUpdated();
-	DynamicMeshComponent->SetEnableFlatShading(true);
-	bIsMeshDirty = false;
-}
 
-void UVoxelChunk::ProcessVoxels()
-{
-	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
-	check(VoxelWorld);
+	FIntVector ChunkMin;
+	FIntVector ChunkMax;
+	GetVoxelBoundingBox(ChunkMin, ChunkMax);
+	int32 SectionMinZ = SectionIndex * CachedChunkSide;
 
-	int32 ChunkSide = VoxelWorld->GetChunkSide();
-	int32 WorldHeightVoxel = VoxelWorld->GetWorldHeight();
+	const FIntVector NeighbourChunkVoxels[] =
+	{
+		FIntVector(ChunkMin.X - 1, ChunkMin.Y, SectionMinZ),
+		FIntVector(ChunkMax.X, ChunkMin.Y, SectionMinZ),
+		FIntVector(ChunkMin.X, ChunkMin.Y - 1, SectionMinZ),
+		FIntVector(ChunkMin.X, ChunkMax.Y, SectionMinZ)
+	};
 
-	for (int X = 0; X < ChunkSide; X++)
+	for (const FIntVector& NeighbourVoxel : NeighbourChunkVoxels)
 	{
-		for (int Y = 0; Y < ChunkSide; Y++)
+		if (!VoxelWorld->IsValidCoordinate(NeighbourVoxel))
 		{
-			for (int Z = 0; Z < WorldHeightVoxel; Z++)
-			{
-				ProcessVoxel(X, Y, Z);
-			}
+			return false;
+		}
+		UVoxelChunk* Neighbour = VoxelWorld->GetChunkFromVoxelCoord(NeighbourVoxel);
+		if (!Neighbour || !Neighbour->IsSectionUniformOpaque(SectionIndex))
+		{
+			return false;
 		}
 	}
+
+	return true;
 }
 
-void UVoxelChunk::ProcessVoxel(int32 X, int32 Y, int32 Z)
+int32 UVoxelChunk::ProcessVoxel(int32 X, int32 Y, int32 Z, const FVoxelMeshBuilder& MeshBuilder, FVoxelMeshBuffers& Buffers, TArray<VoxelType>* GreedyFaces)
 {
 	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
 	checkSlow(VoxelWorld);
@@ -173,28 +1497,37 @@ void UVoxelChunk::ProcessVoxel(int32 X, int32 Y, int32 Z)
 
 	if (VoxelWorld->IsVoxelTransparent(CoordTranslated))
 	{
-		return;
+		return 0;
 	}
 
-	const Voxel& Voxel = VoxelWorld->GetVoxel(CoordTranslated);
-
-	VoxelWorld->IsVoxelTransparent(CoordTranslated);
+	VoxelType VoxelTypeId = GetVoxel(FIntVector(X, Y, Z));
 
 	TStaticArray<bool, 6> FacesVisibility;
 	int VisibleFacesNum = CheckVoxelSidesVisibility(CoordTranslated, FacesVisibility);
+	if (VisibleFacesNum == 0)
+	{
+		return 0;
+	}
+
+	int32 SectionIndex;
+	int32 VoxelIndex = GetSectionVisibilityIndex(FIntVector(X, Y, Z), SectionIndex);
+	SectionVisibleVoxels[SectionIndex][VoxelIndex] = true;
 	for (int I = 0; I < FacesVisibility.Num(); I++)
 	{
-		if (FacesVisibility[I])
+		if (!FacesVisibility[I])
 		{
-			AddFaceData(Voxel, X, Y, Z, I);
-			VisibleFacesNum++;
+			continue;
+		}
+		if (GreedyFaces)
+		{
+			(*GreedyFaces)[I * SectionVisibleVoxels[SectionIndex].Num() + VoxelIndex] = VoxelTypeId;
+		}
+		else
+		{
+			MeshBuilder.AddFace(Buffers, VoxelTypeId, X, Y, Z, I, FVoxelSectionQuads::GetFaceKey(I, VoxelIndex, SectionVisibleVoxels[SectionIndex].Num()));
 		}
 	}
-	if (VisibleFacesNum > 0)
-	{
-		int32 VoxelIndex = LinearizeCoordinate(X, Y, Z);
-		VisibleVoxelIndices[VoxelIndex] = true;
-	}
+	return VisibleFacesNum;
 }
 
 bool UVoxelChunk::IsFaceVisible(int32 X, int32 Y, int32 Z) const
@@ -205,236 +1538,69 @@ bool UVoxelChunk::IsFaceVisible(int32 X, int32 Y, int32 Z) const
 	return VoxelWorld->IsVoxelTransparent(FIntVector(X, Y, Z));
 }
 
-void UVoxelChunk::AddFaceData(const Voxel& Voxel, int32 X, int32 Y, int32 Z, int FaceIndex)
+int32 UVoxelChunk::LinearizeSectionCoordinate(int32 X, int32 Y, int32 SectionZ) const
 {
-	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
-	check(VoxelWorld);
-	double VoxelSizeWorld = VoxelWorld->GetVoxelSizeWorld();
-	check(DynamicMeshComponent);
-	UDynamicMesh* MeshObject = DynamicMeshComponent->GetDynamicMesh();
-	check(MeshObject);
-	FDynamicMesh3& Mesh = MeshObject->GetMeshRef();
-	auto* UvLayer = Mesh.Attributes()->GetUVLayer(0);
-	check(UvLayer);
-	UE::Geometry::FDynamicMeshColorOverlay* ColorOverlay = Mesh.Attributes()->PrimaryColors();
-	check(ColorOverlay);
-
-	int32 VoxelTypeInt = Voxel.VoxelTypeId - 1;
-	int32 VoxelTypeNum = VoxelWorld->GetVoxelTypeSet()->GetVoxelTypes().Num();
-	float UMin = static_cast<float>(FaceIndex) / 6;
-	float UMax = static_cast<float>(FaceIndex + 1) / 6;
-	float VMin = static_cast<float>(VoxelTypeInt) / VoxelTypeNum;
-	float VMax = static_cast<float>(VoxelTypeInt + 1) / VoxelTypeNum;
-
-	TStaticArray<UE::Geometry::FVertexInfo, 4> VertexInfos;
-	for (int I = 0; I < VertexInfos.Num(); I++)
-	{
-		VertexInfos[I].bHaveC = true;
-		VertexInfos[I].bHaveUV = true;
-	}
-
-	if (FaceIndex == 0) // Top
-	{
-		VertexInfos[0].Position = FVector(X, Y, Z + 1) * VoxelSizeWorld;
-		VertexInfos[1].Position = FVector(X + 1, Y, Z + 1) * VoxelSizeWorld;
-		VertexInfos[2].Position = FVector(X + 1, Y + 1, Z + 1) * VoxelSizeWorld;
-		VertexInfos[3].Position = FVector(X, Y + 1, Z + 1) * VoxelSizeWorld;
-
-		VertexInfos[0].UV = FVector2f(UMin, VMax);
-		VertexInfos[1].UV = FVector2f(UMin, VMin);
-		VertexInfos[2].UV = FVector2f(UMax, VMin);
-		VertexInfos[3].UV = FVector2f(UMax, VMax);
-	}
-	else if (FaceIndex == 1) // Bottom
-	{
-		VertexInfos[0].Position = FVector(X + 1, Y, Z) * VoxelSizeWorld;
-		VertexInfos[1].Position = FVector(X, Y, Z) * VoxelSizeWorld;
-		VertexInfos[2].Position = FVector(X, Y + 1, Z) * VoxelSizeWorld;
-		VertexInfos[3].Position = FVector(X + 1, Y + 1, Z) * VoxelSizeWorld;
-
-		VertexInfos[0].UV = FVector2f(UMin, VMax);
-		VertexInfos[1].UV = FVector2f(UMin, VMin);
-		VertexInfos[2].UV = FVector2f(UMax, VMin);
-		VertexInfos[3].UV = FVector2f(UMax, VMax);
-	}
-	else if (FaceIndex == 2) // Front
-	{
-		VertexInfos[0].Position = FVector(X + 1, Y, Z + 1) * VoxelSizeWorld;
-		VertexInfos[1].Position = FVector(X + 1, Y, Z) * VoxelSizeWorld;
-		VertexInfos[2].Position = FVector(X + 1, Y + 1, Z) * VoxelSizeWorld;
-		VertexInfos[3].Position = FVector(X + 1, Y + 1, Z + 1) * VoxelSizeWorld;
-
-		VertexInfos[0].UV = FVector2f(UMin, VMin);
-		VertexInfos[1].UV = FVector2f(UMin, VMax);
-		VertexInfos[2].UV = FVector2f(UMax, VMax);
-		VertexInfos[3].UV = FVector2f(UMax, VMin);
-	}
-	else if (FaceIndex == 3) // Back
-	{
-		VertexInfos[0].Position = FVector(X, Y, Z) * VoxelSizeWorld;
-		VertexInfos[1].Position = FVector(X, Y, Z + 1) * VoxelSizeWorld;
-		VertexInfos[2].Position = FVector(X, Y + 1, Z + 1) * VoxelSizeWorld;
-		VertexInfos[3].Position = FVector(X, Y + 1, Z) * VoxelSizeWorld;
-
-		VertexInfos[0].UV = FVector2f(UMin, VMax);
-		VertexInfos[1].UV = FVector2f(UMin, VMin);
-		VertexInfos[2].UV = FVector2f(UMax, VMin);
-		VertexInfos[3].UV = FVector2f(UMax, VMax);
-	}
-	else if (FaceIndex == 4) // Left
-	{
-		VertexInfos[0].Position = FVector(X, Y, Z) * VoxelSizeWorld;
-		VertexInfos[1].Position = FVector(X + 1, Y, Z) * VoxelSizeWorld;
-		VertexInfos[2].Position = FVector(X + 1, Y, Z + 1) * VoxelSizeWorld;
-		VertexInfos[3].Position = FVector(X, Y, Z + 1) * VoxelSizeWorld;
-
-		VertexInfos[0].UV = FVector2f(UMax, VMax);
-		VertexInfos[1].UV = FVector2f(UMin, VMax);
-		VertexInfos[2].UV = FVector2f(UMin, VMin);
-		VertexInfos[3].UV = FVector2f(UMax, VMin);
-	}
-	else if (FaceIndex == 5) // Right
-	{
-		VertexInfos[0].Position = FVector(X,		Y + 1, Z	) * VoxelSizeWorld;
-		VertexInfos[1].Position = FVector(X,		Y + 1, Z + 1) * VoxelSizeWorld;
-		VertexInfos[2].Position = FVector(X + 1, Y + 1, Z + 1) * VoxelSizeWorld;
-		VertexInfos[3].Position = FVector(X + 1, Y + 1, Z	) * VoxelSizeWorld;
-
-		VertexInfos[0].UV = FVector2f(UMin, VMax);
-		VertexInfos[1].UV = FVector2f(UMin, VMin);
-		VertexInfos[2].UV = FVector2f(UMax, VMin);
-		VertexInfos[3].UV = FVector2f(UMax, VMax);
-	}
-
-	int32 VertexIdMin = Mesh.MaxVertexID();
-	int32 TriangleIdMin = Mesh.MaxTriangleID();
-
-	Mesh.BeginUnsafeVerticesInsert();
-	for (int I = 0; I < VertexInfos.Num(); I++)
-	{
-		UE::Geometry::EMeshResult InsertResult = Mesh.InsertVertex(VertexIdMin + I, VertexInfos[I], true);
-		if (InsertResult != UE::Geometry::EMeshResult::Ok)
-		{
-			UE_LOG(LogVoxelEngine, Error, TEXT("Failed to insert vertex %s to index %d: error code %d"), *VertexInfos[I].Position.ToString(), VertexIdMin + I, static_cast<int32>(InsertResult));
-		}
-	}
-	Mesh.EndUnsafeVerticesInsert();
-
-	UE::Geometry::FIndex3i Tri1(VertexIdMin + 2, VertexIdMin + 1, VertexIdMin);
-	UE::Geometry::FIndex3i Tri2(VertexIdMin + 3, VertexIdMin + 2, VertexIdMin);
-	Mesh.BeginUnsafeTrianglesInsert();
-	UE::Geometry::EMeshResult TriInsertResult = Mesh.InsertTriangle(TriangleIdMin, Tri1, 0, true);
-	if (TriInsertResult != UE::Geometry::EMeshResult::Ok)
-	{
-		UE_LOG(LogVoxelEngine, Error, TEXT("Failed to insert triangle (%d, %d, %d) to index %d: error code %d"), Tri1.A, Tri1.B, Tri1.C, TriangleIdMin, static_cast<int32>(TriInsertResult));
-	}
-	TriInsertResult = Mesh.InsertTriangle(TriangleIdMin + 1, Tri2, 0, true);
-	if (TriInsertResult != UE::Geometry::EMeshResult::Ok)
-	{
-		UE_LOG(LogVoxelEngine, Error, TEXT("Failed to insert triangle (%d, %d, %d) to index %d: error code %d"), Tri2.A, Tri2.B, Tri2.C, TriangleIdMin + 1, static_cast<int32>(TriInsertResult));
-	}
-	Mesh.EndUnsafeTrianglesInsert();
+	checkSlow(CachedChunkSide > 0);
+	return FVoxelSectionIndexing::Linearize(CachedVoxelIndexing, CachedChunkSide, X, Y, SectionZ);
+}
 
-	// TODO Remove this Grass hack
-	if (FaceIndex == 0 && Voxel.VoxelTypeId == 1)
-	{
-		FVector3f VertexColor{ 0.4, 1, 0.4 };
-		Mesh.SetVertexColor(VertexIdMin, VertexColor);
-		Mesh.SetVertexColor(VertexIdMin + 1, VertexColor);
-		Mesh.SetVertexColor(VertexIdMin + 2, VertexColor);
-		Mesh.SetVertexColor(VertexIdMin + 3, VertexColor);
-	}
-	else
-	{
-		FVector3f VertexColor{ 1, 1, 1 };
-		Mesh.SetVertexColor(VertexIdMin, VertexColor);
-		Mesh.SetVertexColor(VertexIdMin + 1, VertexColor);
-		Mesh.SetVertexColor(VertexIdMin + 2, VertexColor);
-		Mesh.SetVertexColor(VertexIdMin + 3, VertexColor);
-	}
+int32 UVoxelChunk::GetSectionVisibilityIndex(const FIntVector& LocalCoord, int32& OutSectionIndex) const
+{
+	checkSlow(CachedChunkSide > 0);
+	OutSectionIndex = LocalCoord.Z / CachedChunkSide;
+	return LinearizeCoordinate(LocalCoord.X, LocalCoord.Y, LocalCoord.Z - OutSectionIndex * CachedChunkSide);
 }
 
 int32 UVoxelChunk::LinearizeCoordinate(int32 X, int32 Y, int32 Z) const
 {
-	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
-	check(VoxelWorld);
-	int32 ChunkSide = VoxelWorld->GetChunkSide();
+	checkSlow(CachedChunkSide > 0);
 	int32 Result =
-		static_cast<int32>(Z * ChunkSide * ChunkSide) +
-		static_cast<int32>(Y * ChunkSide) +
+		static_cast<int32>(Z * CachedChunkSide * CachedChunkSide) +
+		static_cast<int32>(Y * CachedChunkSide) +
 		static_cast<int32>(X);
 	return Result;
 }
 
 FIntVector UVoxelChunk::DelinearizeCoordinate(int32 LinearCoord) const
 {
-	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
-	check(VoxelWorld);
-	int32 ChunkSide = VoxelWorld->GetChunkSide();
+	checkSlow(CachedChunkSide > 0);
+	int32 ChunkSide = CachedChunkSide;
 	int32 X = LinearCoord % (ChunkSide);
 	int32 Y = (LinearCoord / (ChunkSide)) % (ChunkSide);
 	int32 Z = LinearCoord / ((ChunkSide) * (ChunkSide));
 	return FIntVector(X, Y, Z);
 }
 
-void UVoxelChunk::ProcessChangeRequest(const FVoxelChange& Request)
-{
-	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
-	check(VoxelWorld);
-
-	if (Request.ChangeToVoxelType == Request.ExpectedVoxelType)
-	{
-		return;
-	}
-
-	FIntVector ChunkMin;
-	FIntVector ChunkMax;
-	GetVoxelBoundingBox(ChunkMin, ChunkMax);
-
-	FIntVector LocalCoord = Request.Coordinate - ChunkMin;
-	int32 VoxelIndex = LinearizeCoordinate(LocalCoord.X, LocalCoord.Y, LocalCoord.Z);
-
-	UpdateVoxelVisibility(Request.Coordinate, true);
-
-	bIsMeshDirty = true;
-}
-
-
-bool UVoxelChunk::CopyVertexColorsToOverlay(const FDynamicMesh3& Mesh, UE::Geometry::FDynamicMeshColorOverlay& ColorOverlayOut, bool bCompactElements)
+void UVoxelChunk::UpdateAffectedVoxels(TArray<FIntVector>& LocalCoords, EVoxelChangeRenderPriority Priority)
 {
-	if (!Mesh.HasVertexColors())
-	{
-		return false;
-	}
-
-	if (ColorOverlayOut.ElementCount() > 0)
-	{
-		ColorOverlayOut.ClearElements();
-	}
-
-	ColorOverlayOut.BeginUnsafeElementsInsert();
-	for (int32 Vid : Mesh.VertexIndicesItr())
+	// Walk the voxels in section storage order, Z slowest
+	LocalCoords.Sort([](const FIntVector& A, const FIntVector& B)
 	{
-		auto Color = Mesh.GetVertexColor(Vid);
-		std::array<float, 4> ColorArray{ Color.X, Color.Y, Color.Z, 1};
-		ColorOverlayOut.InsertElement(Vid, ColorArray.data(), true);
-	}
-	ColorOverlayOut.EndUnsafeElementsInsert();
+		if (A.Z != B.Z)
+		{
+			return A.Z < B.Z;
+		}
+		return A.Y != B.Y ? A.Y < B.Y : A.X < B.X;
+	});
 
-	for (int32 Tid : Mesh.TriangleIndicesItr())
+	// Per-face section meshes are patched in place, other sections are remeshed once the batch is done
+	TBitArray<FDefaultBitArrayAllocator> SectionsToRemesh(false, Sections.Num());
+	for (const FIntVector& LocalCoord : LocalCoords)
 	{
-		ColorOverlayOut.SetTriangle(Tid, Mesh.GetTriangle(Tid));
+		UpdateVoxelVisibility(LocalCoord);
+		int32 SectionIndex = LocalCoord.Z / CachedChunkSide;
+		if (!SectionsToRemesh[SectionIndex] && !PatchVoxelFaces(LocalCoord))
+		{
+			SectionsToRemesh[SectionIndex] = true;
+		}
 	}
-
-	if (bCompactElements)
+	for (TConstSetBitIterator<> It(SectionsToRemesh); It; ++It)
 	{
-		UE::Geometry::FCompactMaps CompactMaps;
-		ColorOverlayOut.CompactInPlace(CompactMaps);
+		MarkSectionDirty(It.GetIndex() * CachedChunkSide, Priority);
 	}
-
-	return true;
 }
 
+
 int UVoxelChunk::CheckVoxelSidesVisibility(const FIntVector& CoordTranslated, TStaticArray<bool, 6>& SideVisilityFlags)
 {
 	SideVisilityFlags[0] = IsFaceVisible(CoordTranslated.X, CoordTranslated.Y, CoordTranslated.Z + 1); // Top
@@ -455,91 +1621,226 @@ int UVoxelChunk::CheckVoxelSidesVisibility(const FIntVector& CoordTranslated, TS
 	return VisibleFacesNum;
 }
 
-void UVoxelChunk::UpdateVoxelVisibility(const FIntVector& VoxelWorldCoord, bool bUpdateNeighbours)
+void UVoxelChunk::UpdateVoxelVisibility(const FIntVector& LocalCoord)
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	checkSlow(VoxelWorld);
+
+	FIntVector ChunkMin;
+	FIntVector ChunkMax;
+	GetVoxelBoundingBox(ChunkMin, ChunkMax);
+	FIntVector VoxelWorldCoord = ChunkMin + LocalCoord;
+	int32 SectionIndex;
+	int32 Index = GetSectionVisibilityIndex(LocalCoord, SectionIndex);
+	TStaticArray<bool, 6> SidesFlags;
+	SectionVisibleVoxels[SectionIndex][Index] = !VoxelWorld->IsVoxelTransparent(VoxelWorldCoord) && CheckVoxelSidesVisibility(VoxelWorldCoord, SidesFlags) > 0;
+}
+
+
+// Called every frame
+void UVoxelChunk::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	if (bDebugDrawDimensions)
+	{
+		AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+		checkSlow(VoxelWorld);
+		FBox3d Bbox = GetWorldBoundingBox();
+		DrawDebugBox(GetWorld(), Bbox.GetCenter(), Bbox.GetExtent(), FColor::Green);
+	}
+}
+
+void UVoxelChunk::ProcessChangeRequests()
 {
 	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
 	check(VoxelWorld);
-	if (!VoxelWorld->IsValidCoordinate(VoxelWorldCoord))
+
+	// Cleared before draining, so a change queued after the last dequeue schedules the chunk again
+	bChangeRequestsScheduled.store(false);
+
+	// Repeated coordinates collapse into one change, the batch is rendered with its most urgent priority
+	TSet<FIntVector> ChangedCoords;
+	EVoxelChangeRenderPriority Priority = EVoxelChangeRenderPriority::AnyTime;
+	FVoxelChange ChangeRequest;
+	while (VoxelChangeRequests.Dequeue(ChangeRequest))
 	{
-		return;
+		if (ChangeRequest.ChangeToVoxelType == ChangeRequest.ExpectedVoxelType)
+		{
+			continue;
+		}
+		ChangedCoords.Add(ChangeRequest.Coordinate);
+		Priority = FMath::Min(Priority, ChangeRequest.Priority);
 	}
-	UVoxelChunk* VoxelOwner = VoxelWorld->GetChunkFromVoxelCoord(VoxelWorldCoord);
-	if (VoxelOwner == this)
+	if (ChangedCoords.IsEmpty())
 	{
-		FIntVector ChunkMin;
-		FIntVector ChunkMax;
-		GetVoxelBoundingBox(ChunkMin, ChunkMax);
+		return;
+	}
 
-		FIntVector LocalCoord = VoxelWorldCoord - ChunkMin;
-		int32 Index = LinearizeCoordinate(LocalCoord.X, LocalCoord.Y, LocalCoord.Z);
-		TStaticArray<bool, 6> SidesFlags;
-		int VisibleFacesNum = CheckVoxelSidesVisibility(VoxelWorldCoord, SidesFlags);
-		bool bOldVisibility = VisibleVoxelIndices[Index];
-		bool bNewVisibility = !VoxelWorld->IsVoxelTransparent(VoxelWorldCoord) && VisibleFacesNum > 0;
-		if (bOldVisibility == bNewVisibility)
+	// Faces of changed voxels and their neighbours may change, neighbours can be in sections above, below or in other chunks.
+	// The union of affected voxels is grouped by owning chunk, so every voxel is updated once and every chunk is looked up once.
+	const FIntVector NeighbourOffsets[] =
+	{
+		FIntVector(0, 0, 0),
+		FIntVector(0, 0, 1),
+		FIntVector(0, 0, -1),
+		FIntVector(1, 0, 0),
+		FIntVector(-1, 0, 0),
+		FIntVector(0, 1, 0),
+		FIntVector(0, -1, 0)
+	};
+	TMap<FIntVector2, TSet<FIntVector>> AffectedCoordsByChunk;
+	for (const FIntVector& ChangedCoord : ChangedCoords)
+	{
+		for (const FIntVector& Offset : NeighbourOffsets)
 		{
-			return;
+			FIntVector AffectedCoord = ChangedCoord + Offset;
+			if (VoxelWorld->IsValidCoordinate(AffectedCoord))
+			{
+				AffectedCoordsByChunk.FindOrAdd(VoxelWorld->GetChunkCoordFromVoxelCoord(AffectedCoord)).Add(AffectedCoord);
+			}
 		}
-		
-		VisibleVoxelIndices[Index] = bNewVisibility;
+	}
 
-		if (!bUpdateNeighbours)
+	for (const TPair<FIntVector2, TSet<FIntVector>>& ChunkPair : AffectedCoordsByChunk)
+	{
+		UVoxelChunk* AffectedChunk = VoxelWorld->GetChunk(ChunkPair.Key);
+		if (!AffectedChunk)
 		{
-			return;
+			continue;
 		}
+		FIntVector AffectedChunkMin;
+		FIntVector AffectedChunkMax;
+		AffectedChunk->GetVoxelBoundingBox(AffectedChunkMin, AffectedChunkMax);
+		TArray<FIntVector> LocalCoords;
+		LocalCoords.Reserve(ChunkPair.Value.Num());
+		for (const FIntVector& AffectedCoord : ChunkPair.Value)
+		{
+			LocalCoords.Add(AffectedCoord - AffectedChunkMin);
+		}
+		AffectedChunk->UpdateAffectedVoxels(LocalCoords, Priority);
+	}
+}
 
-		TStaticArray<FIntVector, 6> NeighbourVoxelWorldCoords
+bool UVoxelChunk::UpdateMesh(double EndTimeSeconds)
+{
+	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+	check(VoxelWorld);
+	if (VoxelWorld->IsAsyncMeshingEnabled())
+	{
+		TickSectionMeshTasks(EndTimeSeconds);
+	}
+	else
+	{
+		int32 MeshedSectionsNum = 0;
+		// Meshing clears the flags, so iterate over copies
+		TBitArray<FDefaultBitArrayAllocator> SectionsToRebuild = RebuildSections;
+		for (TConstSetBitIterator<> It(SectionsToRebuild); It; ++It)
 		{
-			FIntVector(VoxelWorldCoord.X, VoxelWorldCoord.Y, VoxelWorldCoord.Z + 1),
-			FIntVector(VoxelWorldCoord.X, VoxelWorldCoord.Y, VoxelWorldCoord.Z - 1),
-			FIntVector(VoxelWorldCoord.X + 1, VoxelWorldCoord.Y, VoxelWorldCoord.Z),
-			FIntVector(VoxelWorldCoord.X - 1, VoxelWorldCoord.Y, VoxelWorldCoord.Z),
-			FIntVector(VoxelWorldCoord.X, VoxelWorldCoord.Y + 1, VoxelWorldCoord.Z),
-			FIntVector(VoxelWorldCoord.X, VoxelWorldCoord.Y - 1, VoxelWorldCoord.Z)
-		};
-		
-		for (const FIntVector& Coord : NeighbourVoxelWorldCoords)
+			if (MeshedSectionsNum > 0 && FPlatformTime::Seconds() >= EndTimeSeconds)
+			{
+				break;
+			}
+			int32 SectionIndex = It.GetIndex();
+			FDateTime StartTime = FDateTime::Now();
+			GenerateSectionMesh(SectionIndex);
+			FDateTime EndTime = FDateTime::Now();
+			FTimespan ElapsedTime = EndTime - StartTime;
+			UE_LOG(LogVoxelEngine, Verbose, TEXT("Chunk (%d, %d) section %d mesh rebuilt in %3.2f milliseconds, %d triangles (%d per-face)"),
+				ChunkX, ChunkY, SectionIndex, ElapsedTime.GetTotalMilliseconds(), SectionTrianglesNum[SectionIndex], SectionPerFaceTrianglesNum[SectionIndex]);
+			MeshedSectionsNum++;
+		}
+
+		TBitArray<FDefaultBitArrayAllocator> SectionsToRegenerate = DirtySections;
+		for (TConstSetBitIterator<> It(SectionsToRegenerate); It; ++It)
 		{
-			UpdateVoxelVisibility(Coord, false);
+			int32 SectionIndex = It.GetIndex();
+			// Sections left over from the rebuild loop are still marked for a rebuild and go first next time
+			if (RebuildSections[SectionIndex] || (MeshedSectionsNum > 0 && FPlatformTime::Seconds() >= EndTimeSeconds))
+			{
+				continue;
+			}
+			FDateTime StartTime = FDateTime::Now();
+			RegenerateSectionMesh(SectionIndex);
+			FDateTime EndTime = FDateTime::Now();
+			FTimespan ElapsedTime = EndTime - StartTime;
+			UE_LOG(LogVoxelEngine, Verbose, TEXT("Chunk (%d, %d) section %d mesh regenerated in %3.2f milliseconds"), ChunkX, ChunkY, SectionIndex, ElapsedTime.GetTotalMilliseconds());
+			MeshedSectionsNum++;
 		}
 	}
-	else
+
+	if (HasPendingMeshing())
 	{
-		VoxelOwner->UpdateVoxelVisibility(VoxelWorldCoord, bUpdateNeighbours);
-		VoxelOwner->bIsMeshDirty = true;
+		return false;
 	}
+	PendingRenderPriority = EVoxelChangeRenderPriority::AnyTime;
+	return true;
 }
 
+bool UVoxelChunk::HasPendingMeshing() const
+{
+	if (DirtySections.Contains(true) || RebuildSections.Contains(true) || !CancelledMeshTaskEvents.IsEmpty())
+	{
+		return true;
+	}
+	for (const TSharedPtr<FVoxelSectionMeshTask, ESPMode::ThreadSafe>& Task : SectionMeshTasks)
+	{
+		if (Task)
+		{
+			return true;
+		}
+	}
+	return false;
+}
 
-// Called every frame
-void UVoxelChunk::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+EVoxelChangeRenderPriority UVoxelChunk::GetPendingRenderPriority() const
 {
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	return PendingRenderPriority;
+}
 
-	if (bDebugDrawDimensions)
+void UVoxelChunk::TickSectionMeshTasks(double EndTimeSeconds)
+{
+	CancelledMeshTaskEvents.RemoveAllSwap([](const UE::Tasks::FTask& Event)
 	{
-		AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
-		checkSlow(VoxelWorld);
-		FBox3d Bbox = GetWorldBoundingBox();
-		DrawDebugBox(GetWorld(), Bbox.GetCenter(), Bbox.GetExtent(), FColor::Green);
+		return Event.IsCompleted();
+	});
+
+	// Swapping a finished mesh in is the expensive part on the game thread, so it counts against the budget like launches do
+	int32 HandledSectionsNum = 0;
+	for (int32 SectionIndex = 0; SectionIndex < SectionMeshTasks.Num(); SectionIndex++)
+	{
+		if (SectionMeshTasks[SectionIndex] && SectionMeshTaskEvents[SectionIndex].IsCompleted())
+		{
+			if (HandledSectionsNum > 0 && FPlatformTime::Seconds() >= EndTimeSeconds)
+			{
+				return;
+			}
+			ApplySectionMeshTask(SectionIndex);
+			HandledSectionsNum++;
+		}
 	}
 
-	FVoxelChange ChangeRequest;
-	while (VoxelChangeRequests.Dequeue(ChangeRequest))
+	// Tasks always rebuild the whole section, so dirty and rebuild requests are the same here
+	TBitArray<FDefaultBitArrayAllocator> SectionsToMesh = TBitArray<FDefaultBitArrayAllocator>::BitwiseOR(RebuildSections, DirtySections, EBitwiseOperatorFlags::MaxSize);
+	for (TConstSetBitIterator<> It(SectionsToMesh); It; ++It)
 	{
-		ProcessChangeRequest(ChangeRequest);
+		if (HandledSectionsNum > 0 && FPlatformTime::Seconds() >= EndTimeSeconds)
+		{
+			return;
+		}
+		int32 SectionIndex = It.GetIndex();
+		LaunchSectionMeshTask(SectionIndex);
+		RebuildSections[SectionIndex] = false;
+		DirtySections[SectionIndex] = false;
+		HandledSectionsNum++;
 	}
 }
 
-void UVoxelChunk::TickSecondary(float DeltaTime, ELevelTick LevelTick, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent, FVoxelChunkSecondaryTickFunction* TickFunction)
+void UVoxelChunk::CancelSectionMeshTasks()
 {
-	if (bIsMeshDirty)
+	for (int32 SectionIndex = 0; SectionIndex < SectionMeshTasks.Num(); SectionIndex++)
 	{
-		FDateTime StartTime = FDateTime::Now();
-		RegenerateMesh();
-		FDateTime EndTime = FDateTime::Now();
-		FTimespan ElapsedTime = EndTime - StartTime;
-		UE_LOG(LogVoxelEngine, Display, TEXT("Chunk (%d, %d) mesh regenerated in %3.2f milliseconds"), ChunkX, ChunkY, ElapsedTime.GetTotalMilliseconds());
+		CancelSectionMeshTask(SectionIndex);
 	}
 }
 
@@ -553,7 +1854,7 @@ int32 UVoxelChunk::GetChunkSide() const
 void UVoxelChunk::GetChunkIndex(int32& OutX, int32& OutY) const
 {
 	OutX = ChunkX;
-	OutY = OutY;
+	OutY = ChunkY;
 }
 
 void UVoxelChunk::SetChunkIndex(int32 X, int32 Y)
@@ -595,9 +1896,16 @@ void UVoxelChunk::GetVoxelBoundingBox(FIntVector& OutMin, FIntVector& OutMax) co
 
 void UVoxelChunk::SetDrawWireframe(bool bEnabled)
 {
-	check(DynamicMeshComponent);
-	DynamicMeshComponent->SetEnableWireframeRenderPass(bEnabled);
+	for (UDynamicMeshComponent* SectionMeshComponent : SectionMeshComponents)
+	{
+		if (SectionMeshComponent)
+		{
+			SectionMeshComponent->SetEnableWireframeRenderPass(bEnabled);
+		}
+	}
 	bDebugDrawDimensions = bEnabled;
+	// Bounds are drawn from the chunk tick, which is otherwise off
+	SetComponentTickEnabled(bEnabled);
 }
 
 bool UVoxelChunk::GetDrawWireframe() const
@@ -605,44 +1913,91 @@ bool UVoxelChunk::GetDrawWireframe() const
 	return bDebugDrawDimensions;
 }
 
+void UVoxelChunk::GetMeshTrianglesNum(int32& OutTrianglesNum, int32& OutPerFaceTrianglesNum) const
+{
+	OutTrianglesNum = 0;
+	OutPerFaceTrianglesNum = 0;
+	for (int32 SectionIndex = 0; SectionIndex < SectionTrianglesNum.Num(); SectionIndex++)
+	{
+		OutTrianglesNum += SectionTrianglesNum[SectionIndex];
+		OutPerFaceTrianglesNum += SectionPerFaceTrianglesNum[SectionIndex];
+	}
+}
+
 void UVoxelChunk::MarkMeshDirty()
 {
-	bIsMeshDirty = true;
+	CancelSectionMeshTasks();
+	DirtySections.SetRange(0, DirtySections.Num(), true);
+	GetOwner<AVoxelWorld>()->ScheduleChunkMeshing(this);
+}
+
+void UVoxelChunk::MarkMeshRebuildRequired()
+{
+	CancelSectionMeshTasks();
+	RebuildSections.SetRange(0, RebuildSections.Num(), true);
+	GetOwner<AVoxelWorld>()->ScheduleChunkMeshing(this);
+}
+
+void UVoxelChunk::MarkSectionDirty(int32 LocalZ, EVoxelChangeRenderPriority Priority)
+{
+	checkSlow(CachedChunkSide > 0);
+	int32 SectionIndex = LocalZ / CachedChunkSide;
+	if (DirtySections.IsValidIndex(SectionIndex))
+	{
+		// The running task meshes voxels from before this change
+		CancelSectionMeshTask(SectionIndex);
+		DirtySections[SectionIndex] = true;
+		// Lower values are more urgent
+		PendingRenderPriority = FMath::Min(PendingRenderPriority, Priority);
+		GetOwner<AVoxelWorld>()->ScheduleChunkMeshing(this);
+	}
 }
 
 EVoxelChangeResult UVoxelChunk::ChangeVoxelRendering(const FVoxelChange& VoxelChange)
 {
 	VoxelChangeRequests.Enqueue(VoxelChange);
+	if (!bChangeRequestsScheduled.exchange(true))
+	{
+		AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
+		check(VoxelWorld);
+		VoxelWorld->ScheduleChunkChangeRequests(this);
+	}
 	return EVoxelChangeResult::Executed;
 }
 
-void UVoxelChunk::RegenerateMesh()
+void UVoxelChunk::RegenerateSectionMesh(int32 SectionIndex)
 {
-	AVoxelWorld* VoxelWorld = GetOwner<AVoxelWorld>();
-	check(VoxelWorld);
+	// LOD meshes don't track visible voxels
+	if (MeshLod > 0)
+	{
+		GenerateSectionMesh(SectionIndex);
+		return;
+	}
 
-	checkSlow(DynamicMeshComponent);
-	UDynamicMesh* MeshObj = DynamicMeshComponent->GetDynamicMesh();
-	checkSlow(MeshObj);
-	FDynamicMesh3& Mesh = MeshObj->GetMeshRef();
+	ResetSectionMeshes(SectionIndex);
 
-	Mesh.Clear();
-	Mesh.EnableVertexUVs(FVector2f(0, 0));
-	Mesh.EnableVertexColors(FVector3f(1, 1, 1));
-	Mesh.EnableAttributes();
-	Mesh.Attributes()->EnablePrimaryColors();
+	// Only voxels that were visible are revisited, greedy merging then runs over their faces
+	FVoxelMeshBuilder MeshBuilder = GetMeshBuilder();
+	FVoxelMeshBuffers& Buffers = FVoxelMeshBuffers::GetScratch();
+	TArray<VoxelType> GreedyFaces;
+	bool bIsGreedy = MeshBuilder.IsGreedy();
+	if (bIsGreedy)
+	{
+		GreedyFaces.SetNumZeroed(6 * SectionVisibleVoxels[SectionIndex].Num());
+	}
 
-	for (TConstSetBitIterator<> It(VisibleVoxelIndices); It; ++It) 
+	int32 SectionMinZ = SectionIndex * CachedChunkSide;
+	int32 VisibleFacesNum = 0;
+	for (TConstSetBitIterator<> It(SectionVisibleVoxels[SectionIndex]); It; ++It) 
+	{
+		FIntVector VoxelSectionCoord = DelinearizeCoordinate(It.GetIndex());
+		VisibleFacesNum += ProcessVoxel(VoxelSectionCoord.X, VoxelSectionCoord.Y, SectionMinZ + VoxelSectionCoord.Z, MeshBuilder, Buffers, bIsGreedy ? &GreedyFaces : nullptr);
+	}
+	if (bIsGreedy)
 	{
-		FIntVector VoxelLocalCoord = DelinearizeCoordinate(It.GetIndex());
-		ProcessVoxel(VoxelLocalCoord.X, VoxelLocalCoord.Y, VoxelLocalCoord.Z);
+		AddSectionGreedyFaces(SectionIndex, MeshBuilder, GreedyFaces, Buffers);
 	}
+	AppendSectionMeshes(SectionIndex, Buffers);
 	
-	bool bIsValid = UE::Geometry::CopyVertexUVsToOverlay(Mesh, *Mesh.Attributes()->PrimaryUV());
-	check(bIsValid);
-	bIsValid = CopyVertexColorsToOverlay(Mesh, *Mesh.Attributes()->PrimaryColors(), false);
-	check(bIsValid);
-	DynamicMeshComponent->NotifyMeshUpdated();
-	bIsMeshDirty = false;
+	FinishSectionMesh(SectionIndex, VisibleFacesNum);
 }
-
@@ -3,6 +3,7 @@
 
 #include "VoxelEngineCheatManager.h"
 #include "VoxelWorld.h"
+#include "VoxelBenchmarks.h"
 #include "Kismet/GameplayStatics.h"
 #include "Misc/DateTime.h"
 
@@ -51,3 +52,73 @@ void UVoxelEngineCheatManager::RegenerateChunkMeshes()
 
 	VoxelWorld->RegenerateChunkMeshes();
 }
+
+void UVoxelEngineCheatManager::ReportMeshCacheStats()
+{
+	TArray<AActor*> FoundActors;
+	UGameplayStatics::GetAllActorsOfClass(GetWorld(), AVoxelWorld::StaticClass(), FoundActors);
+	check(FoundActors.Num() == 1);
+	AVoxelWorld* VoxelWorld = Cast<AVoxelWorld>(FoundActors[0]);
+
+	VoxelWorld->LogMeshCacheStats();
+}
+
+void UVoxelEngineCheatManager::BenchmarkVoxelStorageLayout(int32 Iterations)
+{
+	TArray<AActor*> FoundActors;
+	UGameplayStatics::GetAllActorsOfClass(GetWorld(), AVoxelWorld::StaticClass(), FoundActors);
+	check(FoundActors.Num() == 1);
+	AVoxelWorld* VoxelWorld = Cast<AVoxelWorld>(FoundActors[0]);
+
+	FVoxelBenchmarks::BenchmarkStorageLayout(VoxelWorld, Iterations);
+}
+
+void UVoxelEngineCheatManager::BenchmarkChunkMeshing(int32 Iterations)
+{
+	TArray<AActor*> FoundActors;
+	UGameplayStatics::GetAllActorsOfClass(GetWorld(), AVoxelWorld::StaticClass(), FoundActors);
+	check(FoundActors.Num() == 1);
+	AVoxelWorld* VoxelWorld = Cast<AVoxelWorld>(FoundActors[0]);
+
+	FVoxelBenchmarks::BenchmarkChunkMeshing(VoxelWorld, Iterations);
+}
+
+void UVoxelEngineCheatManager::BenchmarkVoxelIndexing(int32 Iterations)
+{
+	TArray<AActor*> FoundActors;
+	UGameplayStatics::GetAllActorsOfClass(GetWorld(), AVoxelWorld::StaticClass(), FoundActors);
+	check(FoundActors.Num() == 1);
+	AVoxelWorld* VoxelWorld = Cast<AVoxelWorld>(FoundActors[0]);
+
+	FVoxelBenchmarks::BenchmarkVoxelIndexing(VoxelWorld, Iterations);
+}
+
+void UVoxelEngineCheatManager::BenchmarkRunLengthCodec(int32 Iterations)
+{
+	TArray<AActor*> FoundActors;
+	UGameplayStatics::GetAllActorsOfClass(GetWorld(), AVoxelWorld::StaticClass(), FoundActors);
+	check(FoundActors.Num() == 1);
+	AVoxelWorld* VoxelWorld = Cast<AVoxelWorld>(FoundActors[0]);
+
+	FVoxelBenchmarks::BenchmarkRunLengthCodec(VoxelWorld, Iterations);
+}
+
+void UVoxelEngineCheatManager::BenchmarkVoxelTypeWidth(int32 Iterations)
+{
+	TArray<AActor*> FoundActors;
+	UGameplayStatics::GetAllActorsOfClass(GetWorld(), AVoxelWorld::StaticClass(), FoundActors);
+	check(FoundActors.Num() == 1);
+	AVoxelWorld* VoxelWorld = Cast<AVoxelWorld>(FoundActors[0]);
+
+	FVoxelBenchmarks::BenchmarkVoxelTypeWidth(VoxelWorld, Iterations);
+}
+
+void UVoxelEngineCheatManager::BenchmarkBinaryMeshing(int32 Iterations)
+{
+	TArray<AActor*> FoundActors;
+	UGameplayStatics::GetAllActorsOfClass(GetWorld(), AVoxelWorld::StaticClass(), FoundActors);
+	check(FoundActors.Num() == 1);
+	AVoxelWorld* VoxelWorld = Cast<AVoxelWorld>(FoundActors[0]);
+
+	FVoxelBenchmarks::BenchmarkBinaryMeshing(VoxelWorld, Iterations);
+}
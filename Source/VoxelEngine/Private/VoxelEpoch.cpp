@@ -0,0 +1,133 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VoxelEpoch.h"
+#include "Misc/ScopeLock.h"
+#include "HAL/CriticalSection.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTLS.h"
+#include <atomic>
+
+namespace
+{
+	// Epoch 0 marks a free reader slot
+	std::atomic<uint64> GlobalEpoch{ 1 };
+
+	struct alignas(PLATFORM_CACHE_LINE_SIZE) FReaderSlot
+	{
+		std::atomic<uint64> PinnedEpoch{ 0 };
+	};
+
+	FReaderSlot ReaderSlots[FVoxelEpochs::MaxPinnedReaders];
+
+	struct FRetiredList
+	{
+		FCriticalSection Lock;
+		TArray<TPair<uint64, TUniqueFunction<void()>>> Entries;
+	};
+
+	FRetiredList RetiredList;
+}
+
+int32 FVoxelEpochs::Pin()
+{
+	// Threads start at different slots so that concurrent readers rarely contend
+	int32 FirstSlot = FPlatformTLS::GetCurrentThreadId() % MaxPinnedReaders;
+	while (true)
+	{
+		for (int32 Offset = 0; Offset < MaxPinnedReaders; Offset++)
+		{
+			int32 Slot = (FirstSlot + Offset) % MaxPinnedReaders;
+			std::atomic<uint64>& PinnedEpoch = ReaderSlots[Slot].PinnedEpoch;
+			uint64 Free = 0;
+			uint64 Epoch = GlobalEpoch.load(std::memory_order_seq_cst);
+			if (!PinnedEpoch.compare_exchange_strong(Free, Epoch, std::memory_order_seq_cst))
+			{
+				continue;
+			}
+
+			// Reclamation may have scanned the slots before the pin became visible, in which case it also advanced the epoch.
+			// Re-pinning the newer epoch before any pointer is loaded keeps the scan result valid.
+			uint64 CurrentEpoch = GlobalEpoch.load(std::memory_order_seq_cst);
+			while (CurrentEpoch != Epoch)
+			{
+				Epoch = CurrentEpoch;
+				PinnedEpoch.store(Epoch, std::memory_order_seq_cst);
+				CurrentEpoch = GlobalEpoch.load(std::memory_order_seq_cst);
+			}
+			return Slot;
+		}
+		FPlatformProcess::YieldThread();
+	}
+}
+
+void FVoxelEpochs::Unpin(int32 Slot)
+{
+	check(0 <= Slot && Slot < MaxPinnedReaders);
+	checkSlow(ReaderSlots[Slot].PinnedEpoch.load(std::memory_order_relaxed) != 0);
+	ReaderSlots[Slot].PinnedEpoch.store(0, std::memory_order_release);
+}
+
+uint64 FVoxelEpochs::GetCurrentEpoch()
+{
+	return GlobalEpoch.load(std::memory_order_acquire);
+}
+
+void FVoxelEpochs::Retire(TUniqueFunction<void()> Deleter)
+{
+	// Read-modify-write, so readers pinning a later epoch synchronize with the unpublishing that preceded it
+	uint64 Epoch = GlobalEpoch.fetch_add(0, std::memory_order_seq_cst);
+
+	FScopeLock Lock(&RetiredList.Lock);
+	RetiredList.Entries.Emplace(Epoch, MoveTemp(Deleter));
+}
+
+void FVoxelEpochs::AdvanceAndReclaim()
+{
+	check(IsInGameThread());
+
+	uint64 SafeEpoch = GlobalEpoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+	for (FReaderSlot& ReaderSlot : ReaderSlots)
+	{
+		uint64 PinnedEpoch = ReaderSlot.PinnedEpoch.load(std::memory_order_seq_cst);
+		if (PinnedEpoch != 0)
+		{
+			SafeEpoch = FMath::Min(SafeEpoch, PinnedEpoch);
+		}
+	}
+
+	TArray<TUniqueFunction<void()>> Reclaimable;
+	{
+		FScopeLock Lock(&RetiredList.Lock);
+		for (int32 Index = RetiredList.Entries.Num() - 1; Index >= 0; Index--)
+		{
+			if (RetiredList.Entries[Index].Key < SafeEpoch)
+			{
+				Reclaimable.Add(MoveTemp(RetiredList.Entries[Index].Value));
+				RetiredList.Entries.RemoveAtSwap(Index, EAllowShrinking::No);
+			}
+		}
+	}
+
+	// Deleters run outside the lock, they may free a lot of memory
+	for (TUniqueFunction<void()>& Deleter : Reclaimable)
+	{
+		Deleter();
+	}
+}
+
+int32 FVoxelEpochs::GetRetiredNum()
+{
+	FScopeLock Lock(&RetiredList.Lock);
+	return RetiredList.Entries.Num();
+}
+
+FVoxelEpochGuard::FVoxelEpochGuard()
+	: Slot(FVoxelEpochs::Pin())
+{
+}
+
+FVoxelEpochGuard::~FVoxelEpochGuard()
+{
+	FVoxelEpochs::Unpin(Slot);
+}
@@ -0,0 +1,119 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VoxelMeshCache.h"
+#include "Algo/AllOf.h"
+
+SIZE_T FVoxelMeshCacheEntry::GetAllocatedSize() const
+{
+	return Buffers.GetAllocatedSize() + VisibleVoxels.GetAllocatedSize();
+}
+
+FVoxelMeshCache::FVoxelMeshCache(SIZE_T InMaxAllocatedSize)
+	: MaxAllocatedSize(InMaxAllocatedSize)
+{
+}
+
+TSharedPtr<const FVoxelMeshCacheEntry, ESPMode::ThreadSafe> FVoxelMeshCache::Find(uint64 Key)
+{
+	FSlot* Slot = Slots.Find(Key);
+	if (!Slot)
+	{
+		Misses++;
+		return nullptr;
+	}
+	Hits++;
+	Slot->LastUse = ++UseCounter;
+	return Slot->Entry;
+}
+
+void FVoxelMeshCache::Add(uint64 Key, TSharedRef<const FVoxelMeshCacheEntry, ESPMode::ThreadSafe> Entry)
+{
+	SIZE_T EntrySize = Entry->GetAllocatedSize();
+	if (EntrySize > MaxAllocatedSize)
+	{
+		return;
+	}
+	if (FSlot* Existing = Slots.Find(Key))
+	{
+		AllocatedSize -= Existing->AllocatedSize;
+	}
+	Slots.Add(Key, FSlot{ Entry, EntrySize, ++UseCounter });
+	AllocatedSize += EntrySize;
+	if (AllocatedSize > MaxAllocatedSize)
+	{
+		Evict();
+	}
+}
+
+void FVoxelMeshCache::Empty()
+{
+	Slots.Empty();
+	AllocatedSize = 0;
+}
+
+FVoxelMeshCacheStats FVoxelMeshCache::GetStats() const
+{
+	FVoxelMeshCacheStats Stats;
+	Stats.Hits = Hits;
+	Stats.Misses = Misses;
+	Stats.Evictions = Evictions;
+	Stats.EntriesNum = Slots.Num();
+	Stats.AllocatedSize = AllocatedSize;
+	return Stats;
+}
+
+uint64 FVoxelMeshCache::HashSectionVoxels(const FVoxelPalettedStorage& Storage)
+{
+	int32 BitsPerVoxel;
+	TArray<VoxelType> Palette;
+	TArray<uint64> Words;
+	Storage.CopyPacked(BitsPerVoxel, Palette, Words);
+	if (BitsPerVoxel == 0)
+	{
+		return FXxHash64::HashBuffer(Palette.GetData(), sizeof(VoxelType)).Hash;
+	}
+
+	// Decoded from one copy of the words, the palette order depends on the order of writes and isn't hashed
+	TArray<VoxelType> Voxels;
+	Voxels.SetNumUninitialized(Storage.Num());
+	int32 VoxelsPerWordLog2 = FMath::FloorLog2(64 / BitsPerVoxel);
+	uint64 EntryMask = (uint64(1) << BitsPerVoxel) - 1;
+	for (int32 Index = 0; Index < Voxels.Num(); Index++)
+	{
+		uint64 Word = Words[Index >> VoxelsPerWordLog2];
+		uint32 Shift = (Index & ((1 << VoxelsPerWordLog2) - 1)) * BitsPerVoxel;
+		Voxels[Index] = Palette[(Word >> Shift) & EntryMask];
+	}
+
+	VoxelType UniformType = Voxels[0];
+	bool bIsUniform = Algo::AllOf(Voxels, [UniformType](VoxelType Type) { return Type == UniformType; });
+	if (bIsUniform)
+	{
+		return FXxHash64::HashBuffer(&UniformType, sizeof(UniformType)).Hash;
+	}
+	return FXxHash64::HashBuffer(Voxels.GetData(), Voxels.Num() * sizeof(VoxelType)).Hash;
+}
+
+void FVoxelMeshCache::Evict()
+{
+	TArray<TPair<uint64, uint64>> SlotsByUse;
+	SlotsByUse.Reserve(Slots.Num());
+	for (const TPair<uint64, FSlot>& SlotPair : Slots)
+	{
+		SlotsByUse.Emplace(SlotPair.Value.LastUse, SlotPair.Key);
+	}
+	SlotsByUse.Sort([](const TPair<uint64, uint64>& A, const TPair<uint64, uint64>& B) { return A.Key < B.Key; });
+
+	SIZE_T TargetSize = MaxAllocatedSize / 4 * 3;
+	for (const TPair<uint64, uint64>& SlotByUse : SlotsByUse)
+	{
+		if (AllocatedSize <= TargetSize)
+		{
+			break;
+		}
+		FSlot Slot = Slots.FindAndRemoveChecked(SlotByUse.Value);
+		AllocatedSize -= Slot.AllocatedSize;
+		Evictions++;
+	}
+}
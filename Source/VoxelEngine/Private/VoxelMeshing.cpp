@@ -0,0 +1,730 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VoxelMeshing.h"
+#include "VoxelEngine/VoxelEngine.h"
+#include "VoxelMeshCache.h"
+#include "VoxelReadSnapshot.h"
+#include "VoxelTypeSet.h"
+
+bool FVoxelMeshBuilder::IsGreedy() const
+{
+	return MeshingMode == EVoxelMeshingMode::Greedy;
+}
+
+void FVoxelMeshBuilder::InitializeMesh(FDynamicMesh3& Mesh) const
+{
+	// UVs and colors only live in the overlays, FVoxelMeshBuffers::AppendToMesh fills them directly
+	Mesh.Clear();
+	Mesh.EnableAttributes();
+	Mesh.Attributes()->EnablePrimaryColors();
+	// Tiled UVs carry the atlas tile origin in a second layer
+	Mesh.Attributes()->SetNumUVLayers(IsGreedy() ? 2 : 1);
+}
+
+void FVoxelMeshBuilder::AddFace(FVoxelMeshBuffers& Buffers, VoxelType VoxelTypeId, int32 X, int32 Y, int32 Z, int32 FaceIndex, int32 FaceKey, const FIntVector& Size, bool bTiledUVs) const
+{
+	int32 VoxelTypeInt = VoxelTypeId - 1;
+	float UMin = static_cast<float>(FaceIndex) / 6;
+	float UMax = static_cast<float>(FaceIndex + 1) / 6;
+	float VMin = static_cast<float>(VoxelTypeInt) / VoxelTypesNum;
+	float VMax = static_cast<float>(VoxelTypeInt + 1) / VoxelTypesNum;
+	FVector2f TileOrigin(UMin, VMin);
+	if (bTiledUVs)
+	{
+		// Tile-local UVs count voxels across the quad: U runs along Y for top, bottom, front and back faces and along X otherwise,
+		// V runs along X for top and bottom faces and along Z otherwise
+		UMin = 0;
+		UMax = FaceIndex < 4 ? Size.Y : Size.X;
+		VMin = 0;
+		VMax = FaceIndex < 2 ? Size.X : Size.Z;
+	}
+	float X0 = static_cast<float>(X * VoxelSizeWorld);
+	float Y0 = static_cast<float>(Y * VoxelSizeWorld);
+	float Z0 = static_cast<float>(Z * VoxelSizeWorld);
+	float X1 = static_cast<float>((X + Size.X) * VoxelSizeWorld);
+	float Y1 = static_cast<float>((Y + Size.Y) * VoxelSizeWorld);
+	float Z1 = static_cast<float>((Z + Size.Z) * VoxelSizeWorld);
+
+	TStaticArray<FVector3f, 4> Positions;
+	TStaticArray<FVector2f, 4> UVs;
+	if (FaceIndex == 0) // Top
+	{
+		Positions[0] = FVector3f(X0, Y0, Z1);
+		Positions[1] = FVector3f(X1, Y0, Z1);
+		Positions[2] = FVector3f(X1, Y1, Z1);
+		Positions[3] = FVector3f(X0, Y1, Z1);
+
+		UVs[0] = FVector2f(UMin, VMax);
+		UVs[1] = FVector2f(UMin, VMin);
+		UVs[2] = FVector2f(UMax, VMin);
+		UVs[3] = FVector2f(UMax, VMax);
+	}
+	else if (FaceIndex == 1) // Bottom
+	{
+		Positions[0] = FVector3f(X1, Y0, Z0);
+		Positions[1] = FVector3f(X0, Y0, Z0);
+		Positions[2] = FVector3f(X0, Y1, Z0);
+		Positions[3] = FVector3f(X1, Y1, Z0);
+
+		UVs[0] = FVector2f(UMin, VMax);
+		UVs[1] = FVector2f(UMin, VMin);
+		UVs[2] = FVector2f(UMax, VMin);
+		UVs[3] = FVector2f(UMax, VMax);
+	}
+	else if (FaceIndex == 2) // Front
+	{
+		Positions[0] = FVector3f(X1, Y0, Z1);
+		Positions[1] = FVector3f(X1, Y0, Z0);
+		Positions[2] = FVector3f(X1, Y1, Z0);
+		Positions[3] = FVector3f(X1, Y1, Z1);
+
+		UVs[0] = FVector2f(UMin, VMin);
+		UVs[1] = FVector2f(UMin, VMax);
+		UVs[2] = FVector2f(UMax, VMax);
+		UVs[3] = FVector2f(UMax, VMin);
+	}
+	else if (FaceIndex == 3) // Back
+	{
+		Positions[0] = FVector3f(X0, Y0, Z0);
+		Positions[1] = FVector3f(X0, Y0, Z1);
+		Positions[2] = FVector3f(X0, Y1, Z1);
+		Positions[3] = FVector3f(X0, Y1, Z0);
+
+		UVs[0] = FVector2f(UMin, VMax);
+		UVs[1] = FVector2f(UMin, VMin);
+		UVs[2] = FVector2f(UMax, VMin);
+		UVs[3] = FVector2f(UMax, VMax);
+	}
+	else if (FaceIndex == 4) // Left
+	{
+		Positions[0] = FVector3f(X0, Y0, Z0);
+		Positions[1] = FVector3f(X1, Y0, Z0);
+		Positions[2] = FVector3f(X1, Y0, Z1);
+		Positions[3] = FVector3f(X0, Y0, Z1);
+
+		UVs[0] = FVector2f(UMax, VMax);
+		UVs[1] = FVector2f(UMin, VMax);
+		UVs[2] = FVector2f(UMin, VMin);
+		UVs[3] = FVector2f(UMax, VMin);
+	}
+	else if (FaceIndex == 5) // Right
+	{
+		Positions[0] = FVector3f(X0, Y1, Z0);
+		Positions[1] = FVector3f(X0, Y1, Z1);
+		Positions[2] = FVector3f(X1, Y1, Z1);
+		Positions[3] = FVector3f(X1, Y1, Z0);
+
+		UVs[0] = FVector2f(UMin, VMax);
+		UVs[1] = FVector2f(UMin, VMin);
+		UVs[2] = FVector2f(UMax, VMin);
+		UVs[3] = FVector2f(UMax, VMax);
+	}
+
+	int32 VertexIdMin = Buffers.Positions.Num();
+	Buffers.Positions.Append(Positions.GetData(), Positions.Num());
+	Buffers.UVs.Append(UVs.GetData(), UVs.Num());
+	Buffers.Triangles.Add(UE::Geometry::FIndex3i(VertexIdMin + 2, VertexIdMin + 1, VertexIdMin));
+	Buffers.Triangles.Add(UE::Geometry::FIndex3i(VertexIdMin + 3, VertexIdMin + 2, VertexIdMin));
+	Buffers.QuadFaceKeys.Add(FaceKey);
+	Buffers.QuadFaceIndices.Add(static_cast<uint8>(FaceIndex));
+	if (bTiledUVs)
+	{
+		Buffers.TileOrigins.Add(TileOrigin);
+		Buffers.TileOrigins.Add(TileOrigin);
+		Buffers.TileOrigins.Add(TileOrigin);
+		Buffers.TileOrigins.Add(TileOrigin);
+	}
+
+	// TODO Remove this Grass hack
+	FVector3f VertexColor = FaceIndex == 0 && VoxelTypeId == 1 ? FVector3f(0.4f, 1, 0.4f) : FVector3f(1, 1, 1);
+	Buffers.Colors.Add(VertexColor);
+	Buffers.Colors.Add(VertexColor);
+	Buffers.Colors.Add(VertexColor);
+	Buffers.Colors.Add(VertexColor);
+}
+
+void FVoxelMeshBuilder::AddGreedyFaces(FVoxelMeshBuffers& Buffers, TArray<VoxelType>& GreedyFaces, const FIntVector& Dims, int32 SectionMinZ) const
+{
+	FIntVector Strides(1, Dims.X, Dims.X * Dims.Y);
+	int32 FacesPerDirection = Dims.X * Dims.Y * Dims.Z;
+	check(GreedyFaces.Num() == 6 * FacesPerDirection);
+
+	for (int FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+	{
+		// Faces merge inside planes perpendicular to their normal: Z for top and bottom, X for front and back, Y for left and right
+		int32 NormalAxis = FaceIndex < 2 ? 2 : (FaceIndex < 4 ? 0 : 1);
+		int32 AxisU = (NormalAxis + 1) % 3;
+		int32 AxisV = (NormalAxis + 2) % 3;
+		int32 StrideU = Strides[AxisU];
+		int32 StrideV = Strides[AxisV];
+		VoxelType* Faces = GreedyFaces.GetData() + FaceIndex * FacesPerDirection;
+
+		for (int32 Layer = 0; Layer < Dims[NormalAxis]; Layer++)
+		{
+			for (int32 V = 0; V < Dims[AxisV]; V++)
+			{
+				int32 U = 0;
+				while (U < Dims[AxisU])
+				{
+					FIntVector Coord;
+					Coord[NormalAxis] = Layer;
+					Coord[AxisU] = U;
+					Coord[AxisV] = V;
+					int32 FirstIndex = Coord.X * Strides.X + Coord.Y * Strides.Y + Coord.Z * Strides.Z;
+					VoxelType Type = Faces[FirstIndex];
+					if (Type == EmptyVoxelType)
+					{
+						U++;
+						continue;
+					}
+
+					// Widest run along U, then every following row along V that repeats it completely
+					int32 Width = 1;
+					while (U + Width < Dims[AxisU] && Faces[FirstIndex + Width * StrideU] == Type)
+					{
+						Width++;
+					}
+					int32 Height = 1;
+					for (; V + Height < Dims[AxisV]; Height++)
+					{
+						int32 RowIndex = FirstIndex + Height * StrideV;
+						bool bIsRowMatching = true;
+						for (int32 I = 0; I < Width && bIsRowMatching; I++)
+						{
+							bIsRowMatching = Faces[RowIndex + I * StrideU] == Type;
+						}
+						if (!bIsRowMatching)
+						{
+							break;
+						}
+					}
+
+					for (int32 Row = 0; Row < Height; Row++)
+					{
+						for (int32 I = 0; I < Width; I++)
+						{
+							Faces[FirstIndex + Row * StrideV + I * StrideU] = EmptyVoxelType;
+						}
+					}
+
+					FIntVector Size(1, 1, 1);
+					Size[AxisU] = Width;
+					Size[AxisV] = Height;
+					AddFace(Buffers, Type, Coord.X, Coord.Y, SectionMinZ + Coord.Z, FaceIndex, INDEX_NONE, Size, true);
+					U += Width;
+				}
+			}
+		}
+	}
+}
+
+FVoxelMeshBuffers& FVoxelMeshBuffers::GetScratch()
+{
+	// Every meshing thread keeps its arrays, so building a section reuses the memory of the previous one
+	static thread_local FVoxelMeshBuffers Scratch;
+	Scratch.Reset();
+	return Scratch;
+}
+
+void FVoxelMeshBuffers::Reset()
+{
+	Positions.Reset();
+	UVs.Reset();
+	TileOrigins.Reset();
+	Colors.Reset();
+	Triangles.Reset();
+	QuadFaceKeys.Reset();
+	QuadFaceIndices.Reset();
+}
+
+int32 FVoxelMeshBuffers::GetQuadsNum() const
+{
+	return Positions.Num() / 4;
+}
+
+SIZE_T FVoxelMeshBuffers::GetAllocatedSize() const
+{
+	return Positions.GetAllocatedSize() + UVs.GetAllocatedSize() + TileOrigins.GetAllocatedSize() + Colors.GetAllocatedSize()
+		+ Triangles.GetAllocatedSize() + QuadFaceKeys.GetAllocatedSize() + QuadFaceIndices.GetAllocatedSize();
+}
+
+void FVoxelMeshBuffers::AppendToMesh(FDynamicMesh3& Mesh, int32 FaceIndex) const
+{
+	check(UVs.Num() == Positions.Num() && Colors.Num() == Positions.Num());
+	check(TileOrigins.Num() == 0 || TileOrigins.Num() == Positions.Num());
+	check(QuadFaceIndices.Num() == GetQuadsNum() && Triangles.Num() == 2 * GetQuadsNum());
+	check(Mesh.HasAttributes() && Mesh.VertexCount() == Mesh.MaxVertexID());
+
+	// Quads don't share vertices, so every vertex has its own overlay elements and element IDs match vertex IDs
+	UE::Geometry::FDynamicMeshUVOverlay* UVOverlay = Mesh.Attributes()->PrimaryUV();
+	UE::Geometry::FDynamicMeshColorOverlay* ColorOverlay = Mesh.Attributes()->PrimaryColors();
+	check(UVOverlay && ColorOverlay);
+	check(UVOverlay->MaxElementID() == Mesh.MaxVertexID() && ColorOverlay->MaxElementID() == Mesh.MaxVertexID());
+	UE::Geometry::FDynamicMeshUVOverlay* TileOriginLayer = nullptr;
+	if (TileOrigins.Num() > 0)
+	{
+		TileOriginLayer = Mesh.Attributes()->GetUVLayer(1);
+		check(TileOriginLayer && TileOriginLayer->MaxElementID() == Mesh.MaxVertexID());
+	}
+
+	for (int32 QuadIndex = 0; QuadIndex < GetQuadsNum(); QuadIndex++)
+	{
+		if (FaceIndex != INDEX_NONE && QuadFaceIndices[QuadIndex] != FaceIndex)
+		{
+			continue;
+		}
+
+		// Quad vertices keep their order, only the base moves
+		int32 VertexIdBase = Mesh.MaxVertexID() - QuadIndex * 4;
+		for (int32 Index = QuadIndex * 4; Index < QuadIndex * 4 + 4; Index++)
+		{
+			Mesh.AppendVertex(FVector3d(Positions[Index]));
+			UVOverlay->AppendElement(UVs[Index]);
+			ColorOverlay->AppendElement(FVector4f(Colors[Index], 1));
+			if (TileOriginLayer)
+			{
+				TileOriginLayer->AppendElement(TileOrigins[Index]);
+			}
+		}
+
+		for (int32 Index = QuadIndex * 2; Index < QuadIndex * 2 + 2; Index++)
+		{
+			const UE::Geometry::FIndex3i& Triangle = Triangles[Index];
+			UE::Geometry::FIndex3i MeshTriangle(Triangle.A + VertexIdBase, Triangle.B + VertexIdBase, Triangle.C + VertexIdBase);
+			int32 TriangleId = Mesh.AppendTriangle(MeshTriangle);
+			check(TriangleId >= 0);
+			UVOverlay->SetTriangle(TriangleId, MeshTriangle);
+			ColorOverlay->SetTriangle(TriangleId, MeshTriangle);
+			if (TileOriginLayer)
+			{
+				TileOriginLayer->SetTriangle(TriangleId, MeshTriangle);
+			}
+		}
+	}
+}
+
+void FVoxelMeshBuffers::GetQuadFaceKeys(int32 FaceIndex, TArray<int32>& OutQuadFaceKeys) const
+{
+	OutQuadFaceKeys.Reset();
+	for (int32 QuadIndex = 0; QuadIndex < GetQuadsNum(); QuadIndex++)
+	{
+		if (QuadFaceIndices[QuadIndex] == FaceIndex)
+		{
+			OutQuadFaceKeys.Add(QuadFaceKeys[QuadIndex]);
+		}
+	}
+}
+
+void FVoxelSectionQuads::Reset(TConstArrayView<int32> QuadFaceKeys)
+{
+	FaceQuads.Reset();
+	FaceQuads.Reserve(QuadFaceKeys.Num());
+	for (int32 QuadIndex = 0; QuadIndex < QuadFaceKeys.Num(); QuadIndex++)
+	{
+		check(QuadFaceKeys[QuadIndex] != INDEX_NONE);
+		FaceQuads.Add(QuadFaceKeys[QuadIndex], QuadIndex);
+	}
+	FreeQuads.Reset();
+	QuadsNum = QuadFaceKeys.Num();
+	bIsValid = true;
+}
+
+void FVoxelSectionQuads::Invalidate()
+{
+	FaceQuads.Empty();
+	FreeQuads.Empty();
+	QuadsNum = 0;
+	bIsValid = false;
+}
+
+bool FVoxelSectionQuads::IsValid() const
+{
+	return bIsValid;
+}
+
+int32 FVoxelSectionQuads::GetFacesNum() const
+{
+	return FaceQuads.Num();
+}
+
+bool FVoxelSectionQuads::SetFace(FDynamicMesh3& Mesh, int32 FaceKey, const FVoxelMeshBuffers& Quad)
+{
+	check(bIsValid && Quad.GetQuadsNum() == 1);
+	if (const int32* QuadIndex = FaceQuads.Find(FaceKey))
+	{
+		WriteQuad(Mesh, *QuadIndex, Quad);
+		return false;
+	}
+	if (FreeQuads.Num() > 0)
+	{
+		int32 QuadIndex = FreeQuads.Pop(EAllowShrinking::No);
+		FaceQuads.Add(FaceKey, QuadIndex);
+		WriteQuad(Mesh, QuadIndex, Quad);
+		return false;
+	}
+
+	check(Mesh.MaxVertexID() == QuadsNum * 4);
+	Quad.AppendToMesh(Mesh);
+	FaceQuads.Add(FaceKey, QuadsNum);
+	QuadsNum++;
+	return true;
+}
+
+bool FVoxelSectionQuads::RemoveFace(FDynamicMesh3& Mesh, int32 FaceKey)
+{
+	int32 QuadIndex;
+	if (!FaceQuads.RemoveAndCopyValue(FaceKey, QuadIndex))
+	{
+		return false;
+	}
+	// Zero-area triangles are not rasterized, topology stays as it is until the slot is reused
+	int32 VertexIdMin = QuadIndex * 4;
+	FVector3d CollapsedPosition = Mesh.GetVertex(VertexIdMin);
+	for (int32 I = 1; I < 4; I++)
+	{
+		Mesh.SetVertex(VertexIdMin + I, CollapsedPosition);
+	}
+	FreeQuads.Add(QuadIndex);
+	return true;
+}
+
+void FVoxelSectionQuads::WriteQuad(FDynamicMesh3& Mesh, int32 QuadIndex, const FVoxelMeshBuffers& Quad)
+{
+	UE::Geometry::FDynamicMeshUVOverlay* UVOverlay = Mesh.Attributes()->PrimaryUV();
+	UE::Geometry::FDynamicMeshColorOverlay* ColorOverlay = Mesh.Attributes()->PrimaryColors();
+	check(UVOverlay && ColorOverlay);
+
+	// Quads are always wound the same way, only vertex data differs between faces
+	int32 VertexIdMin = QuadIndex * 4;
+	for (int32 I = 0; I < 4; I++)
+	{
+		Mesh.SetVertex(VertexIdMin + I, FVector3d(Quad.Positions[I]));
+		UVOverlay->SetElement(VertexIdMin + I, Quad.UVs[I]);
+		ColorOverlay->SetElement(VertexIdMin + I, FVector4f(Quad.Colors[I], 1));
+	}
+}
+
+void FVoxelOpacityRows::Initialize(int32 InChunkSide, int32 InSectionHeight)
+{
+	check(InChunkSide > 0 && InChunkSide <= 64);
+	ChunkSide = InChunkSide;
+	SectionHeight = InSectionHeight;
+	RowsPerLayer = ChunkSide + 2;
+	Rows.Reset();
+	Rows.SetNumZeroed(RowsPerLayer * (SectionHeight + 2));
+	OpaqueMinX.Reset();
+	OpaqueMinX.SetNumZeroed(SectionHeight);
+	OpaquePlusX.Reset();
+	OpaquePlusX.SetNumZeroed(SectionHeight);
+}
+
+int32 FVoxelOpacityRows::GetChunkSide() const
+{
+	return ChunkSide;
+}
+
+int32 FVoxelOpacityRows::GetSectionHeight() const
+{
+	return SectionHeight;
+}
+
+uint64 FVoxelOpacityRows::GetFullRow() const
+{
+	return ChunkSide == 64 ? ~uint64(0) : (uint64(1) << ChunkSide) - 1;
+}
+
+FVoxelPaddedSection& FVoxelPaddedSection::GetScratch()
+{
+	static thread_local FVoxelPaddedSection Scratch;
+	return Scratch;
+}
+
+void FVoxelPaddedSection::Initialize(int32 InChunkSide, int32 InSectionHeight)
+{
+	check(InChunkSide > 0 && InSectionHeight > 0);
+	ChunkSide = InChunkSide;
+	SectionHeight = InSectionHeight;
+	StrideY = ChunkSide + 2;
+	StrideZ = StrideY * StrideY;
+	int32 PaddedVoxelsNum = StrideZ * (SectionHeight + 2);
+	Types.Reset();
+	Types.SetNumUninitialized(PaddedVoxelsNum);
+	for (VoxelType& Type : Types)
+	{
+		Type = EmptyVoxelType;
+	}
+	Opacity.Reset();
+	Opacity.SetNumZeroed(PaddedVoxelsNum);
+}
+
+int32 FVoxelPaddedSection::GetChunkSide() const
+{
+	return ChunkSide;
+}
+
+int32 FVoxelPaddedSection::GetSectionHeight() const
+{
+	return SectionHeight;
+}
+
+int32 FVoxelLodCells::AddFaces(const FVoxelMeshBuilder& MeshBuilder, FVoxelMeshBuffers& Buffers) const
+{
+	// Neighbour cell offsets in face order: top, bottom, front, back, left, right
+	static const FIntVector FaceNormals[6] = {
+		FIntVector(0, 0, 1), FIntVector(0, 0, -1), FIntVector(1, 0, 0), FIntVector(-1, 0, 0), FIntVector(0, -1, 0), FIntVector(0, 1, 0) };
+
+	int32 FacesNum = 0;
+	for (int32 CellZ = 0; CellZ < CellsNum.Z; CellZ++)
+	{
+		int32 CellHeight = CellZ == CellsNum.Z - 1 ? SectionHeight - CellZ * LodScale : LodScale;
+		FIntVector Size(LodScale, LodScale, CellHeight);
+		for (int32 CellY = 0; CellY < CellsNum.Y; CellY++)
+		{
+			for (int32 CellX = 0; CellX < CellsNum.X; CellX++)
+			{
+				VoxelType Type = GetCell(CellX, CellY, CellZ);
+				if (Type == EmptyVoxelType)
+				{
+					continue;
+				}
+				bool bIsTopVisible = GetCell(CellX, CellY, CellZ + 1) == EmptyVoxelType;
+				for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+				{
+					FIntVector Neighbour = FIntVector(CellX, CellY, CellZ) + FaceNormals[FaceIndex];
+					bool bIsSkirt = FaceIndex >= 2 && bIsTopVisible
+						&& (Neighbour.X < 0 || Neighbour.X == CellsNum.X || Neighbour.Y < 0 || Neighbour.Y == CellsNum.Y);
+					if (!bIsSkirt && GetCell(Neighbour.X, Neighbour.Y, Neighbour.Z) != EmptyVoxelType)
+					{
+						continue;
+					}
+					MeshBuilder.AddFace(Buffers, Type, CellX * LodScale, CellY * LodScale, SectionMinZ + CellZ * LodScale, FaceIndex, INDEX_NONE, Size, MeshBuilder.IsGreedy());
+					FacesNum++;
+				}
+			}
+		}
+	}
+	return FacesNum;
+}
+
+FVoxelSectionMeshTask::FVoxelSectionMeshTask(
+	const FVoxelMeshBuilder& InMeshBuilder,
+	const UVoxelTypeSet* InVoxelTypeSet,
+	TSharedRef<FVoxelReadSnapshot, ESPMode::ThreadSafe> InSnapshot,
+	const FIntVector& InChunkMin,
+	int32 InChunkSide,
+	int32 InSectionIndex,
+	int32 InSectionHeight,
+	int32 InMeshLod)
+	: MeshBuilder(InMeshBuilder)
+	, VoxelTypeSet(InVoxelTypeSet)
+	, Snapshot(InSnapshot)
+	, ChunkMin(InChunkMin)
+	, ChunkSide(InChunkSide)
+	, SectionIndex(InSectionIndex)
+	, SectionHeight(InSectionHeight)
+	, MeshLod(InMeshLod)
+{
+	check(VoxelTypeSet);
+}
+
+void FVoxelSectionMeshTask::SetKeepBuffers(bool bInKeepBuffers)
+{
+	bKeepBuffers = bInKeepBuffers;
+}
+
+void FVoxelSectionMeshTask::Run()
+{
+	FDateTime StartTime = FDateTime::Now();
+	if (MeshLod > 0)
+	{
+		RunLod(StartTime);
+		return;
+	}
+	int32 SectionMinZ = SectionIndex * ChunkSide;
+	int32 SectionVoxelsNum = ChunkSide * ChunkSide * SectionHeight;
+	FIntVector SectionMin = ChunkMin + FIntVector(0, 0, SectionMinZ);
+
+	// Voxel types of the section are kept while the rows are filled, so that faces don't read the snapshot again
+	TArray<VoxelType> SectionVoxels;
+	SectionVoxels.SetNumUninitialized(SectionVoxelsNum);
+	FVoxelOpacityRows OpacityRows;
+	OpacityRows.Initialize(ChunkSide, SectionHeight);
+	auto IsOpaque = [this, &SectionMin](int32 X, int32 Y, int32 Z) -> uint64
+	{
+		return !VoxelTypeSet->HasTypeFlags(Snapshot->GetVoxel(SectionMin + FIntVector(X, Y, Z)), EVoxelTypeFlags::Transparent);
+	};
+
+	for (int32 Z = -1; Z <= SectionHeight; Z++)
+	{
+		if (IsCancelled())
+		{
+			return;
+		}
+		bool bIsBorderLayer = Z < 0 || Z == SectionHeight;
+		for (int32 Y = -1; Y <= ChunkSide; Y++)
+		{
+			bool bIsBorderRow = bIsBorderLayer || Y < 0 || Y == ChunkSide;
+			uint64 Row = 0;
+			for (int32 X = 0; X < ChunkSide; X++)
+			{
+				if (bIsBorderRow)
+				{
+					Row |= IsOpaque(X, Y, Z) << X;
+					continue;
+				}
+				VoxelType Type = Snapshot->GetVoxel(SectionMin + FIntVector(X, Y, Z));
+				SectionVoxels[(Z * ChunkSide + Y) * ChunkSide + X] = Type;
+				Row |= uint64(!VoxelTypeSet->HasTypeFlags(Type, EVoxelTypeFlags::Transparent)) << X;
+			}
+			OpacityRows.GetRow(Y, Z) = Row;
+			if (!bIsBorderRow)
+			{
+				OpacityRows.OpaqueMinX[Z] |= IsOpaque(-1, Y, Z) << Y;
+				OpacityRows.OpaquePlusX[Z] |= IsOpaque(ChunkSide, Y, Z) << Y;
+			}
+		}
+	}
+
+	FVoxelMeshBuffers& Buffers = FVoxelMeshBuffers::GetScratch();
+	VisibleVoxels.Init(false, SectionVoxelsNum);
+	TArray<VoxelType> GreedyFaces;
+	if (MeshBuilder.IsGreedy())
+	{
+		GreedyFaces.SetNumZeroed(6 * SectionVoxelsNum);
+	}
+	VisibleFacesNum = 0;
+	OpacityRows.ForEachVisibleVoxel([&](int32 X, int32 Y, int32 Z, uint32 FaceMask)
+	{
+		int32 VoxelIndex = (Z * ChunkSide + Y) * ChunkSide + X;
+		VisibleVoxels[VoxelIndex] = true;
+		VisibleFacesNum += FMath::CountBits(FaceMask);
+		for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+		{
+			if ((FaceMask & (1u << FaceIndex)) == 0)
+			{
+				continue;
+			}
+			if (MeshBuilder.IsGreedy())
+			{
+				GreedyFaces[FaceIndex * SectionVoxelsNum + VoxelIndex] = SectionVoxels[VoxelIndex];
+			}
+			else
+			{
+				MeshBuilder.AddFace(Buffers, SectionVoxels[VoxelIndex], X, Y, SectionMinZ + Z, FaceIndex, FVoxelSectionQuads::GetFaceKey(FaceIndex, VoxelIndex, SectionVoxelsNum));
+			}
+		}
+	});
+
+	if (IsCancelled())
+	{
+		return;
+	}
+	if (MeshBuilder.IsGreedy())
+	{
+		MeshBuilder.AddGreedyFaces(Buffers, GreedyFaces, FIntVector(ChunkSide, ChunkSide, SectionHeight), SectionMinZ);
+	}
+	FinishMesh(Buffers, StartTime);
+}
+
+void FVoxelSectionMeshTask::RunLod(const FDateTime& StartTime)
+{
+	FVoxelLodCells LodCells;
+	LodCells.Build(ChunkSide, SectionIndex * ChunkSide, SectionHeight, 1 << MeshLod,
+		[this](const FIntVector& LocalCoord)
+		{
+			return Snapshot->GetVoxel(ChunkMin + LocalCoord);
+		},
+		[this](VoxelType Type)
+		{
+			return !VoxelTypeSet->HasTypeFlags(Type, EVoxelTypeFlags::Transparent);
+		});
+	if (IsCancelled())
+	{
+		return;
+	}
+
+	FVoxelMeshBuffers& Buffers = FVoxelMeshBuffers::GetScratch();
+	VisibleVoxels.Init(false, ChunkSide * ChunkSide * SectionHeight);
+	VisibleFacesNum = LodCells.AddFaces(MeshBuilder, Buffers);
+	FinishMesh(Buffers, StartTime);
+}
+
+void FVoxelSectionMeshTask::FinishMesh(const FVoxelMeshBuffers& Buffers, const FDateTime& StartTime)
+{
+	for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+	{
+		MeshBuilder.InitializeMesh(Meshes[FaceIndex]);
+		Buffers.AppendToMesh(Meshes[FaceIndex], FaceIndex);
+		Buffers.GetQuadFaceKeys(FaceIndex, QuadFaceKeys[FaceIndex]);
+	}
+	if (bKeepBuffers)
+	{
+		// Scratch buffers are reused by the next section, so they are copied
+		KeptBuffers = Buffers;
+		FIntVector SectionMin = ChunkMin + FIntVector(0, 0, SectionIndex * ChunkSide);
+		const FVoxelPalettedStorage* Storage = Snapshot->GetSectionStorage(SectionMin);
+		uint64 ContentHash = Storage ? FVoxelMeshCache::HashSectionVoxels(*Storage) : 0;
+		MeshKey = FVoxelMeshCache::MakeSectionMeshKey(MeshBuilder, SectionIndex, MeshLod, ContentHash, FIntVector(ChunkSide, ChunkSide, SectionHeight),
+			[this, &SectionMin](int32 X, int32 Y, int32 Z)
+			{
+				return !VoxelTypeSet->HasTypeFlags(Snapshot->GetVoxel(SectionMin + FIntVector(X, Y, Z)), EVoxelTypeFlags::Transparent);
+			});
+	}
+	BuildMilliseconds = (FDateTime::Now() - StartTime).GetTotalMilliseconds();
+}
+
+void FVoxelSectionMeshTask::Cancel()
+{
+	bCancelled.store(true, std::memory_order_relaxed);
+}
+
+bool FVoxelSectionMeshTask::IsCancelled() const
+{
+	return bCancelled.load(std::memory_order_relaxed);
+}
+
+bool FVoxelSectionMeshTask::IsStale() const
+{
+	return Snapshot->IsStale();
+}
+
+int32 FVoxelSectionMeshTask::GetSectionIndex() const
+{
+	return SectionIndex;
+}
+
+FDynamicMesh3& FVoxelSectionMeshTask::GetMesh(int32 FaceIndex)
+{
+	return Meshes[FaceIndex];
+}
+
+TBitArray<FDefaultBitArrayAllocator>& FVoxelSectionMeshTask::GetVisibleVoxels()
+{
+	return VisibleVoxels;
+}
+
+TArray<int32>& FVoxelSectionMeshTask::GetQuadFaceKeys(int32 FaceIndex)
+{
+	return QuadFaceKeys[FaceIndex];
+}
+
+int32 FVoxelSectionMeshTask::GetVisibleFacesNum() const
+{
+	return VisibleFacesNum;
+}
+
+double FVoxelSectionMeshTask::GetBuildMilliseconds() const
+{
+	return BuildMilliseconds;
+}
+
+FVoxelMeshBuffers& FVoxelSectionMeshTask::GetBuffers()
+{
+	return KeptBuffers;
+}
+
+uint64 FVoxelSectionMeshTask::GetMeshKey() const
+{
+	return MeshKey;
+}
@@ -0,0 +1,546 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VoxelPalettedStorage.h"
+#include "VoxelEpoch.h"
+#include "Misc/ScopeLock.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformMemory.h"
+
+#if PLATFORM_LINUX
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	std::atomic<bool> bLargePagesEnabled{ false };
+
+	// Brackets a write for readers validating snapshots. Started is raised before the write can become visible,
+	// Finished only after it is.
+	struct FScopedWriteCount
+	{
+		std::atomic<uint64>& WritesFinished;
+
+		FScopedWriteCount(std::atomic<uint64>& WritesStarted, std::atomic<uint64>& InWritesFinished)
+			: WritesFinished(InWritesFinished)
+		{
+			WritesStarted.fetch_add(1, std::memory_order_seq_cst);
+		}
+
+		~FScopedWriteCount()
+		{
+			WritesFinished.fetch_add(1, std::memory_order_release);
+		}
+	};
+}
+
+template<typename InVoxelType>
+TVoxelPalettedStorage<InVoxelType>::FPackedBuffer::~FPackedBuffer()
+{
+	if (!ExternalWordsOwner)
+	{
+		FreeWords(Words, WordsNum);
+	}
+}
+
+template<typename InVoxelType>
+SIZE_T TVoxelPalettedStorage<InVoxelType>::FPackedBuffer::GetAllocatedSize() const
+{
+	return sizeof(FPackedBuffer) + Palette.GetAllocatedSize() + (ExternalWordsOwner ? 0 : WordsNum * sizeof(uint64));
+}
+
+template<typename InVoxelType>
+TVoxelPalettedStorage<InVoxelType>::TVoxelPalettedStorage()
+{
+}
+
+template<typename InVoxelType>
+TVoxelPalettedStorage<InVoxelType>::~TVoxelPalettedStorage()
+{
+	Reset();
+}
+
+template<typename InVoxelType>
+void TVoxelPalettedStorage<InVoxelType>::Initialize(int32 InVoxelsNum, InVoxelType FillType)
+{
+	Reset();
+
+	VoxelsNum = InVoxelsNum;
+	FPackedBuffer* Packed = AllocateBuffer(VoxelsNum, 0);
+	Packed->Palette.Add(FillType);
+	Buffer.store(Packed, std::memory_order_release);
+}
+
+template<typename InVoxelType>
+void TVoxelPalettedStorage<InVoxelType>::InitializeExternal(int32 InVoxelsNum, int32 BitsPerVoxel, TConstArrayView<InVoxelType> Palette, const uint64* Words, TSharedPtr<IVoxelWordsOwner, ESPMode::ThreadSafe> WordsOwner)
+{
+	check(IsValidBitsPerVoxel(BitsPerVoxel) && Palette.Num() > 0 && Palette.Num() <= (1 << BitsPerVoxel));
+	check(BitsPerVoxel == 0 || (Words && WordsOwner && IsAligned(Words, alignof(uint64))));
+	Reset();
+
+	VoxelsNum = InVoxelsNum;
+	// Palette is small and always owned, only words are borrowed
+	FPackedBuffer* Packed = AllocateBuffer(VoxelsNum, 0);
+	Packed->Palette.Initialize(1 << BitsPerVoxel);
+	if (BitsPerVoxel > 0)
+	{
+		Packed->BitsPerVoxel = BitsPerVoxel;
+		Packed->VoxelsPerWordLog2 = FMath::FloorLog2(64 / BitsPerVoxel);
+		Packed->EntryMask = (uint64(1) << BitsPerVoxel) - 1;
+		Packed->WordsNum = GetWordsNum(VoxelsNum, BitsPerVoxel);
+		// Borrowed words are only ever loaded from, writers copy them first
+		Packed->Words = reinterpret_cast<std::atomic<uint64>*>(const_cast<uint64*>(Words));
+		Packed->ExternalWordsOwner = MoveTemp(WordsOwner);
+	}
+	for (InVoxelType Type : Palette)
+	{
+		Packed->Palette.Add(Type);
+	}
+	Buffer.store(Packed, std::memory_order_release);
+}
+
+template<typename InVoxelType>
+void TVoxelPalettedStorage<InVoxelType>::Reset()
+{
+	delete Buffer.exchange(nullptr);
+	VoxelsNum = 0;
+}
+
+template<typename InVoxelType>
+int32 TVoxelPalettedStorage<InVoxelType>::Num() const
+{
+	return VoxelsNum;
+}
+
+template<typename InVoxelType>
+InVoxelType TVoxelPalettedStorage<InVoxelType>::Get(int32 Index) const
+{
+	checkSlow(0 <= Index && Index < VoxelsNum);
+	const FPackedBuffer* Packed = Buffer.load(std::memory_order_acquire);
+	checkSlow(Packed);
+	return Packed->Palette.Get(ReadEntry(*Packed, Index));
+}
+
+template<typename InVoxelType>
+void TVoxelPalettedStorage<InVoxelType>::Set(int32 Index, InVoxelType Desired)
+{
+	Write(Index, nullptr, Desired);
+}
+
+template<typename InVoxelType>
+bool TVoxelPalettedStorage<InVoxelType>::CompareExchange(int32 Index, InVoxelType& Expected, InVoxelType Desired)
+{
+	return Write(Index, &Expected, Desired);
+}
+
+template<typename InVoxelType>
+void TVoxelPalettedStorage<InVoxelType>::Fill(InVoxelType FillType)
+{
+	FScopedWriteCount WriteCount(WritesStarted, WritesFinished);
+	FScopeLock Lock(&RepackLock);
+	BeginExclusiveWrite();
+
+	FPackedBuffer* NewPacked = AllocateBuffer(VoxelsNum, 0);
+	NewPacked->Palette.Add(FillType);
+
+	EndExclusiveWrite(NewPacked);
+}
+
+template<typename InVoxelType>
+void TVoxelPalettedStorage<InVoxelType>::Compact()
+{
+	FScopeLock Lock(&RepackLock);
+	BeginExclusiveWrite();
+
+	FPackedBuffer* OldPacked = Buffer.load(std::memory_order_relaxed);
+	int32 OldPaletteSize = OldPacked->Palette.Num();
+
+	TArray<int32> EntryUsage;
+	EntryUsage.SetNumZeroed(OldPaletteSize);
+	for (int32 Index = 0; Index < VoxelsNum; Index++)
+	{
+		EntryUsage[ReadEntry(*OldPacked, Index)]++;
+	}
+
+	TArray<uint64> EntryRemap;
+	EntryRemap.SetNumZeroed(OldPaletteSize);
+	int32 NewPaletteSize = 0;
+	for (int32 Entry = 0; Entry < OldPaletteSize; Entry++)
+	{
+		if (EntryUsage[Entry] > 0)
+		{
+			EntryRemap[Entry] = NewPaletteSize++;
+		}
+	}
+
+	int32 NewBitsPerVoxel = GetBitsForPaletteSize(NewPaletteSize);
+	if (NewPaletteSize == OldPaletteSize && NewBitsPerVoxel == OldPacked->BitsPerVoxel)
+	{
+		EndExclusiveWrite(nullptr);
+		return;
+	}
+
+	FPackedBuffer* NewPacked = AllocateBuffer(VoxelsNum, NewBitsPerVoxel);
+	for (int32 Entry = 0; Entry < OldPaletteSize; Entry++)
+	{
+		if (EntryUsage[Entry] > 0)
+		{
+			NewPacked->Palette.Add(OldPacked->Palette.Get(Entry));
+		}
+	}
+
+	if (NewBitsPerVoxel > 0)
+	{
+		int32 NewVoxelsPerWord = 1 << NewPacked->VoxelsPerWordLog2;
+		for (int32 WordIndex = 0; WordIndex < NewPacked->WordsNum; WordIndex++)
+		{
+			uint64 NewWord = 0;
+			int32 FirstVoxel = WordIndex * NewVoxelsPerWord;
+			int32 LastVoxel = FMath::Min(FirstVoxel + NewVoxelsPerWord, VoxelsNum);
+			for (int32 Index = FirstVoxel; Index < LastVoxel; Index++)
+			{
+				NewWord |= EntryRemap[ReadEntry(*OldPacked, Index)] << ((Index - FirstVoxel) * NewBitsPerVoxel);
+			}
+			NewPacked->Words[WordIndex].store(NewWord, std::memory_order_relaxed);
+		}
+	}
+
+	EndExclusiveWrite(NewPacked);
+}
+
+template<typename InVoxelType>
+bool TVoxelPalettedStorage<InVoxelType>::IsUniform(InVoxelType& OutVoxelType) const
+{
+	const FPackedBuffer* Packed = Buffer.load(std::memory_order_acquire);
+	if (!Packed || Packed->BitsPerVoxel != 0)
+	{
+		return false;
+	}
+	OutVoxelType = Packed->Palette.Get(0);
+	return true;
+}
+
+template<typename InVoxelType>
+int32 TVoxelPalettedStorage<InVoxelType>::GetBitsPerVoxel() const
+{
+	const FPackedBuffer* Packed = Buffer.load(std::memory_order_acquire);
+	return Packed ? Packed->BitsPerVoxel : 0;
+}
+
+template<typename InVoxelType>
+int32 TVoxelPalettedStorage<InVoxelType>::GetPaletteSize() const
+{
+	const FPackedBuffer* Packed = Buffer.load(std::memory_order_acquire);
+	return Packed ? Packed->Palette.Num() : 0;
+}
+
+int32 FVoxelPackedWords::GetWordsNum(int32 InVoxelsNum, int32 BitsPerVoxel)
+{
+	if (BitsPerVoxel == 0)
+	{
+		return 0;
+	}
+	int32 VoxelsPerWord = 1 << FMath::FloorLog2(64 / BitsPerVoxel);
+	return (InVoxelsNum + VoxelsPerWord - 1) / VoxelsPerWord;
+}
+
+template<typename InVoxelType>
+void TVoxelPalettedStorage<InVoxelType>::CopyPacked(int32& OutBitsPerVoxel, TArray<InVoxelType>& OutPalette, TArray<uint64>& OutWords) const
+{
+	const FPackedBuffer* Packed = Buffer.load(std::memory_order_acquire);
+	check(Packed);
+	OutBitsPerVoxel = Packed->BitsPerVoxel;
+
+	// Words first: every entry a word references was added to the palette before the word was written
+	OutWords.SetNumUninitialized(Packed->WordsNum);
+	for (int32 WordIndex = 0; WordIndex < Packed->WordsNum; WordIndex++)
+	{
+		OutWords[WordIndex] = Packed->Words[WordIndex].load(std::memory_order_acquire);
+	}
+
+	int32 PaletteSize = Packed->Palette.Num();
+	OutPalette.SetNumUninitialized(PaletteSize);
+	for (int32 Entry = 0; Entry < PaletteSize; Entry++)
+	{
+		OutPalette[Entry] = Packed->Palette.Get(Entry);
+	}
+}
+
+template<typename InVoxelType>
+SIZE_T TVoxelPalettedStorage<InVoxelType>::GetAllocatedSize() const
+{
+	SIZE_T Size = sizeof(*this);
+	const FPackedBuffer* Packed = Buffer.load(std::memory_order_acquire);
+	if (Packed)
+	{
+		Size += Packed->GetAllocatedSize();
+	}
+	return Size;
+}
+
+template<typename InVoxelType>
+uint64 TVoxelPalettedStorage<InVoxelType>::GetWritesStarted() const
+{
+	return WritesStarted.load(std::memory_order_acquire);
+}
+
+template<typename InVoxelType>
+uint64 TVoxelPalettedStorage<InVoxelType>::GetWritesFinished() const
+{
+	return WritesFinished.load(std::memory_order_acquire);
+}
+
+template<typename InVoxelType>
+int32 TVoxelPalettedStorage<InVoxelType>::GetBitsForPaletteSize(int32 PaletteSize)
+{
+	if (PaletteSize <= 1)
+	{
+		return 0;
+	}
+	if (PaletteSize <= 2)
+	{
+		return 1;
+	}
+	if (PaletteSize <= 4)
+	{
+		return 2;
+	}
+	if (PaletteSize <= 16)
+	{
+		return 4;
+	}
+	if (PaletteSize <= 256)
+	{
+		return 8;
+	}
+	check(PaletteSize <= MaxPaletteSize);
+	return 16;
+}
+
+template<typename InVoxelType>
+bool TVoxelPalettedStorage<InVoxelType>::IsValidBitsPerVoxel(int32 BitsPerVoxel)
+{
+	bool bIsPowerOfTwo = BitsPerVoxel == 0 || FMath::IsPowerOfTwo(BitsPerVoxel);
+	return bIsPowerOfTwo && BitsPerVoxel <= MaxBitsPerVoxel;
+}
+
+template<typename InVoxelType>
+typename TVoxelPalettedStorage<InVoxelType>::FPackedBuffer* TVoxelPalettedStorage<InVoxelType>::AllocateBuffer(int32 InVoxelsNum, int32 BitsPerVoxel)
+{
+	check(IsValidBitsPerVoxel(BitsPerVoxel));
+	FPackedBuffer* Packed = new FPackedBuffer();
+	Packed->BitsPerVoxel = BitsPerVoxel;
+	Packed->Palette.Initialize(1 << BitsPerVoxel);
+	if (BitsPerVoxel == 0)
+	{
+		// Uniform: the only palette entry is implied, nothing to store
+		return Packed;
+	}
+	Packed->VoxelsPerWordLog2 = FMath::FloorLog2(64 / BitsPerVoxel);
+	Packed->EntryMask = (uint64(1) << BitsPerVoxel) - 1;
+	Packed->WordsNum = GetWordsNum(InVoxelsNum, BitsPerVoxel);
+	Packed->Words = AllocateWords(Packed->WordsNum);
+	return Packed;
+}
+
+std::atomic<uint64>* FVoxelPackedWords::AllocateWords(int32 WordsNum)
+{
+	static_assert(sizeof(std::atomic<uint64>) == sizeof(uint64), "Packed words must have no atomic overhead");
+	SIZE_T Size = WordsNum * sizeof(uint64);
+	if (Size < LargeWordsAllocationSize)
+	{
+		return static_cast<std::atomic<uint64>*>(FMemory::MallocZeroed(Size, alignof(uint64)));
+	}
+
+	// Fresh OS pages are already zeroed, so large buffers skip the memset and are only committed on first touch
+	void* Pages = FPlatformMemory::BinnedAllocFromOS(Size);
+	check(Pages);
+#if PLATFORM_LINUX && defined(MADV_HUGEPAGE)
+	constexpr SIZE_T HugePageSize = 2 * 1024 * 1024;
+	if (bLargePagesEnabled.load(std::memory_order_relaxed) && Size >= HugePageSize)
+	{
+		madvise(Pages, Size, MADV_HUGEPAGE);
+	}
+#endif
+	return static_cast<std::atomic<uint64>*>(Pages);
+}
+
+void FVoxelPackedWords::FreeWords(std::atomic<uint64>* Words, int32 WordsNum)
+{
+	if (!Words)
+	{
+		return;
+	}
+	SIZE_T Size = WordsNum * sizeof(uint64);
+	if (Size < LargeWordsAllocationSize)
+	{
+		FMemory::Free(Words);
+	}
+	else
+	{
+		FPlatformMemory::BinnedFreeToOS(Words, Size);
+	}
+}
+
+void FVoxelPackedWords::SetLargePagesEnabled(bool bEnabled)
+{
+	bLargePagesEnabled.store(bEnabled, std::memory_order_relaxed);
+}
+
+template<typename InVoxelType>
+bool TVoxelPalettedStorage<InVoxelType>::Write(int32 Index, InVoxelType* Expected, InVoxelType Desired)
+{
+	checkSlow(0 <= Index && Index < VoxelsNum);
+	FScopedWriteCount WriteCount(WritesStarted, WritesFinished);
+
+	// Lock-free path. Writers announce themselves before checking the re-packing flag,
+	// re-packing raises the flag before waiting for announced writers, so the two never overlap.
+	ActiveWriters.fetch_add(1, std::memory_order_seq_cst);
+	if (!bRepacking.load(std::memory_order_seq_cst))
+	{
+		FPackedBuffer* Packed = Buffer.load(std::memory_order_acquire);
+		int32 DesiredEntry = Packed->Palette.Find(Desired);
+		if (DesiredEntry != INDEX_NONE && static_cast<uint64>(DesiredEntry) <= Packed->EntryMask && !Packed->ExternalWordsOwner)
+		{
+			bool bWritten = WriteEntry(*Packed, Index, Expected, DesiredEntry);
+			ActiveWriters.fetch_sub(1, std::memory_order_release);
+			return bWritten;
+		}
+	}
+	ActiveWriters.fetch_sub(1, std::memory_order_release);
+
+	// Desired type is not in the palette yet, words are borrowed or re-packing is in progress
+	FScopeLock Lock(&RepackLock);
+	FPackedBuffer* Borrowed = Buffer.load(std::memory_order_relaxed);
+	if (Borrowed->ExternalWordsOwner)
+	{
+		// Copy-on-write at the same bit width
+		Repack(Borrowed->BitsPerVoxel);
+	}
+	uint64 DesiredEntry = FindOrAddPaletteEntry(Desired);
+	FPackedBuffer* Packed = Buffer.load(std::memory_order_acquire);
+	return WriteEntry(*Packed, Index, Expected, DesiredEntry);
+}
+
+template<typename InVoxelType>
+bool TVoxelPalettedStorage<InVoxelType>::WriteEntry(FPackedBuffer& Packed, int32 Index, InVoxelType* Expected, uint64 DesiredEntry)
+{
+	uint64 ExpectedEntry = 0;
+	if (Expected)
+	{
+		int32 ExpectedLookup = Packed.Palette.Find(*Expected);
+		if (ExpectedLookup == INDEX_NONE)
+		{
+			*Expected = Packed.Palette.Get(ReadEntry(Packed, Index));
+			return false;
+		}
+		ExpectedEntry = ExpectedLookup;
+	}
+
+	if (Packed.BitsPerVoxel == 0)
+	{
+		// Uniform storage only accepts writes of its single type, which change nothing
+		checkSlow(DesiredEntry == 0 && ExpectedEntry == 0);
+		return true;
+	}
+
+	std::atomic<uint64>& Word = Packed.Words[Index >> Packed.VoxelsPerWordLog2];
+	uint32 Shift = (Index & ((1 << Packed.VoxelsPerWordLog2) - 1)) * Packed.BitsPerVoxel;
+	uint64 OldWord = Word.load(std::memory_order_relaxed);
+	while (true)
+	{
+		uint64 CurrentEntry = (OldWord >> Shift) & Packed.EntryMask;
+		if (Expected && CurrentEntry != ExpectedEntry)
+		{
+			*Expected = Packed.Palette.Get(CurrentEntry);
+			return false;
+		}
+
+		uint64 NewWord = (OldWord & ~(Packed.EntryMask << Shift)) | (DesiredEntry << Shift);
+		if (Word.compare_exchange_weak(OldWord, NewWord, std::memory_order_acq_rel, std::memory_order_relaxed))
+		{
+			return true;
+		}
+	}
+}
+
+template<typename InVoxelType>
+uint64 TVoxelPalettedStorage<InVoxelType>::FindOrAddPaletteEntry(InVoxelType Type)
+{
+	FPackedBuffer* Packed = Buffer.load(std::memory_order_relaxed);
+	int32 Entry = Packed->Palette.Find(Type);
+	if (Entry != INDEX_NONE)
+	{
+		return Entry;
+	}
+
+	Entry = Packed->Palette.Num();
+	if (static_cast<uint64>(Entry) > Packed->EntryMask)
+	{
+		Repack(FMath::Max(Packed->BitsPerVoxel * 2, 1));
+		Packed = Buffer.load(std::memory_order_relaxed);
+	}
+
+	Packed->Palette.Add(Type);
+	return Entry;
+}
+
+template<typename InVoxelType>
+void TVoxelPalettedStorage<InVoxelType>::Repack(int32 NewBitsPerVoxel)
+{
+	BeginExclusiveWrite();
+
+	FPackedBuffer* OldPacked = Buffer.load(std::memory_order_relaxed);
+	FPackedBuffer* NewPacked = AllocateBuffer(VoxelsNum, NewBitsPerVoxel);
+	int32 OldPaletteSize = OldPacked->Palette.Num();
+	for (int32 Entry = 0; Entry < OldPaletteSize; Entry++)
+	{
+		NewPacked->Palette.Add(OldPacked->Palette.Get(Entry));
+	}
+
+	if (OldPacked->BitsPerVoxel > 0)
+	{
+		int32 NewVoxelsPerWord = 1 << NewPacked->VoxelsPerWordLog2;
+		for (int32 WordIndex = 0; WordIndex < NewPacked->WordsNum; WordIndex++)
+		{
+			uint64 NewWord = 0;
+			int32 FirstVoxel = WordIndex * NewVoxelsPerWord;
+			int32 LastVoxel = FMath::Min(FirstVoxel + NewVoxelsPerWord, VoxelsNum);
+			for (int32 Index = FirstVoxel; Index < LastVoxel; Index++)
+			{
+				NewWord |= ReadEntry(*OldPacked, Index) << ((Index - FirstVoxel) * NewBitsPerVoxel);
+			}
+			NewPacked->Words[WordIndex].store(NewWord, std::memory_order_relaxed);
+		}
+	}
+
+	EndExclusiveWrite(NewPacked);
+}
+
+template<typename InVoxelType>
+void TVoxelPalettedStorage<InVoxelType>::BeginExclusiveWrite()
+{
+	bRepacking.store(true, std::memory_order_seq_cst);
+	while (ActiveWriters.load(std::memory_order_seq_cst) != 0)
+	{
+		FPlatformProcess::YieldThread();
+	}
+}
+
+template<typename InVoxelType>
+void TVoxelPalettedStorage<InVoxelType>::EndExclusiveWrite(FPackedBuffer* NewPacked)
+{
+	if (NewPacked)
+	{
+		FPackedBuffer* OldPacked = Buffer.exchange(NewPacked, std::memory_order_acq_rel);
+		// Pinned readers may still be reading the old buffer
+		FVoxelEpochs::Retire([OldPacked]()
+		{
+			delete OldPacked;
+		});
+	}
+	bRepacking.store(false, std::memory_order_seq_cst);
+}
+
+template class VOXELENGINE_API TVoxelPalettedStorage<uint8>;
+template class VOXELENGINE_API TVoxelPalettedStorage<uint16>;
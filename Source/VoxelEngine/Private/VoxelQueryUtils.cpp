@@ -104,9 +104,9 @@ bool UVoxelQueryUtils::CheckIfVoxelSatisfiesQueryFilter(AVoxelWorld* VoxelWorld,
 		return false;
 	}
 
-	Voxel& Voxel = VoxelWorld->GetVoxel(Coord);
+	VoxelType VoxelTypeId = VoxelWorld->GetVoxel(Coord);
 
-	if (Voxel.VoxelTypeId == EmptyVoxelType)
+	if (VoxelTypeId == EmptyVoxelType)
 	{
 #if VOXEL_OVERLAP_FILTER_DRAW_DEBUG_SHAPES
 		FVector Location = VoxelWorld->GetVoxelCenterWorld(Coord);
@@ -116,26 +116,28 @@ bool UVoxelQueryUtils::CheckIfVoxelSatisfiesQueryFilter(AVoxelWorld* VoxelWorld,
 		return false;
 	}
 
-	UVoxelData* Data = VoxelWorld->GetVoxelTypeSet()->GetVoxelDataByType(Voxel.VoxelTypeId);
+	EVoxelTypeFlags Flags = VoxelWorld->GetVoxelTypeSet()->GetTypeFlags(VoxelTypeId);
+	bool bIsTraversable = EnumHasAnyFlags(Flags, EVoxelTypeFlags::Traversable);
+	bool bIsTransparent = EnumHasAnyFlags(Flags, EVoxelTypeFlags::Transparent);
 
 	bool bPositivePass = true;
 	bool bNegativePass = true;
 	if (Params.Traversible == EVoxelLineTraceFilterMode::Positive)
 	{
-		bPositivePass &= Data->bIsTraversable;
+		bPositivePass &= bIsTraversable;
 	}
 	else if (Params.Traversible == EVoxelLineTraceFilterMode::Negative)
 	{
-		bNegativePass &= !Data->bIsTraversable;
+		bNegativePass &= !bIsTraversable;
 	}
 
 	if (Params.Transparent == EVoxelLineTraceFilterMode::Positive)
 	{
-		bPositivePass &= Data->bIsTransparent;
+		bPositivePass &= bIsTransparent;
 	}
 	else if (Params.Transparent == EVoxelLineTraceFilterMode::Negative)
 	{
-		bNegativePass &= !Data->bIsTransparent;
+		bNegativePass &= !bIsTransparent;
 	}
 
 	bool bPass = bPositivePass && bNegativePass;
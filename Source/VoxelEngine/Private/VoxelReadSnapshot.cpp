@@ -0,0 +1,65 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VoxelReadSnapshot.h"
+#include "VoxelPalettedStorage.h"
+
+const FIntVector& FVoxelReadSnapshot::GetMin() const
+{
+	return Min;
+}
+
+const FIntVector& FVoxelReadSnapshot::GetMax() const
+{
+	return Max;
+}
+
+bool FVoxelReadSnapshot::Contains(const FIntVector& Coord) const
+{
+	return Min.X <= Coord.X && Coord.X < Max.X
+		&& Min.Y <= Coord.Y && Coord.Y < Max.Y
+		&& Min.Z <= Coord.Z && Coord.Z < Max.Z;
+}
+
+VoxelType FVoxelReadSnapshot::GetVoxel(const FIntVector& Coord) const
+{
+	const FVoxelPalettedStorage* Storage = GetSectionStorage(Coord);
+	if (!Storage)
+	{
+		return EmptyVoxelType;
+	}
+
+	int32 ChunkX = FMath::DivideAndRoundDown(Coord.X, ChunkSide);
+	int32 ChunkY = FMath::DivideAndRoundDown(Coord.Y, ChunkSide);
+	int32 SectionIndex = Coord.Z / ChunkSide;
+	int32 LocalX = Coord.X - ChunkX * ChunkSide;
+	int32 LocalY = Coord.Y - ChunkY * ChunkSide;
+	int32 SectionZ = Coord.Z - SectionIndex * ChunkSide;
+	return Storage->Get(FVoxelSectionIndexing::Linearize(VoxelIndexing, ChunkSide, LocalX, LocalY, SectionZ));
+}
+
+const FVoxelPalettedStorage* FVoxelReadSnapshot::GetSectionStorage(const FIntVector& Coord) const
+{
+	if (!Contains(Coord))
+	{
+		return nullptr;
+	}
+
+	int32 ChunkX = FMath::DivideAndRoundDown(Coord.X, ChunkSide);
+	int32 ChunkY = FMath::DivideAndRoundDown(Coord.Y, ChunkSide);
+	int32 SectionIndex = Coord.Z / ChunkSide;
+	int32 ViewIndex = ((ChunkY - MinChunk.Y) * ChunksNumX + (ChunkX - MinChunk.X)) * SectionsNum + SectionIndex;
+	return SectionViews[ViewIndex].Storage;
+}
+
+bool FVoxelReadSnapshot::IsStale() const
+{
+	for (const FSectionView& View : SectionViews)
+	{
+		if (View.Storage && View.Storage->GetWritesStarted() != View.WritesFinished)
+		{
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,503 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VoxelRegionFile.h"
+#include "VoxelEngine/VoxelEngine.h"
+#include "HAL/PlatformFileManager.h"
+#include "Async/MappedFileHandle.h"
+#include "Misc/ScopeLock.h"
+#include "Misc/Paths.h"
+
+namespace
+{
+	constexpr uint32 RegionFileMagic = 0x47525856; // "VXRG"
+	constexpr uint32 RegionFileVersion = 2;
+	// Payloads start on a page boundary, so borrowed words never share a page with another chunk
+	constexpr int64 RegionPayloadAlignment = 4096;
+	constexpr int32 RegionTableEntriesNum = FVoxelRegionStore::RegionSide * FVoxelRegionStore::RegionSide;
+
+	struct FRegionFileHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		int32 ChunkSide;
+		int32 WorldHeight;
+		int32 RegionSide;
+		uint8 VoxelIndexing;
+		uint8 SaveMode;
+		// 0 for 8-bit voxel type ids, so files written before wide ids stay valid
+		uint8 VoxelTypeSizeLog2;
+		uint8 Reserved;
+	};
+
+	// Offset 0 means the chunk was never saved
+	struct FRegionTableEntry
+	{
+		uint64 Offset;
+		uint32 Size;
+		uint32 Reserved;
+	};
+
+	constexpr int64 RegionPayloadsStart = Align(sizeof(FRegionFileHeader) + RegionTableEntriesNum * sizeof(FRegionTableEntry), RegionPayloadAlignment);
+	// Smaller files are not worth rewriting even if most of them is dead
+	constexpr int64 RegionCompactionMinDeadSize = 1024 * 1024;
+	// Windows maps files without sharing them for writing, a region file can't be appended to while any mapping of it is alive
+	constexpr bool bBorrowMappedPayloads = !PLATFORM_WINDOWS;
+
+	FRegionFileHeader MakeRegionFileHeader(const FVoxelRegionFormat& Format)
+	{
+		FRegionFileHeader Header;
+		FMemory::Memzero(Header);
+		Header.Magic = RegionFileMagic;
+		Header.Version = RegionFileVersion;
+		Header.ChunkSide = Format.ChunkSide;
+		Header.WorldHeight = Format.WorldHeight;
+		Header.RegionSide = FVoxelRegionStore::RegionSide;
+		Header.VoxelIndexing = Format.VoxelIndexing;
+		Header.SaveMode = Format.SaveMode;
+		Header.VoxelTypeSizeLog2 = FMath::FloorLog2(sizeof(VoxelType));
+		return Header;
+	}
+
+	bool IsRegionFileHeaderValid(const FRegionFileHeader& Header, const FVoxelRegionFormat& Format)
+	{
+		FRegionFileHeader Expected = MakeRegionFileHeader(Format);
+		return FMemory::Memcmp(&Header, &Expected, sizeof(FRegionFileHeader)) == 0;
+	}
+
+	int32 GetRegionTableIndex(const FIntVector2& ChunkCoord, const FIntVector2& RegionCoord)
+	{
+		int32 LocalX = ChunkCoord.X - RegionCoord.X * FVoxelRegionStore::RegionSide;
+		int32 LocalY = ChunkCoord.Y - RegionCoord.Y * FVoxelRegionStore::RegionSide;
+		return LocalY * FVoxelRegionStore::RegionSide + LocalX;
+	}
+
+	// Payload read into memory where region files can't stay mapped
+	class FRegionPayloadCopy : public IVoxelWordsOwner
+	{
+	public:
+		TArray<uint8> Bytes;
+	};
+}
+
+// Read-only mapping of a whole region file as it was when mapped
+class FVoxelRegionStore::FMappedRegionFile : public IVoxelWordsOwner
+{
+public:
+	TUniquePtr<IMappedFileHandle> Handle;
+	TUniquePtr<IMappedFileRegion> Region;
+
+	~FMappedRegionFile()
+	{
+		// Regions must be released before their file handle
+		Region.Reset();
+		Handle.Reset();
+	}
+
+	const FRegionTableEntry& GetTableEntry(int32 TableIndex) const
+	{
+		check(0 <= TableIndex && TableIndex < RegionTableEntriesNum);
+		const uint8* Table = Region->GetMappedPtr() + sizeof(FRegionFileHeader);
+		return reinterpret_cast<const FRegionTableEntry*>(Table)[TableIndex];
+	}
+};
+
+FVoxelRegionStore::FVoxelRegionStore(const FString& InDirectory, const FVoxelRegionFormat& InFormat)
+	: Directory(InDirectory), Format(InFormat)
+{
+}
+
+FVoxelRegionStore::~FVoxelRegionStore()
+{
+}
+
+bool FVoxelRegionStore::ReadChunk(const FIntVector2& ChunkCoord, TConstArrayView<uint8>& OutPayload, TSharedPtr<IVoxelWordsOwner, ESPMode::ThreadSafe>& OutOwner)
+{
+	if (!bBorrowMappedPayloads)
+	{
+		return ReadChunkCopy(ChunkCoord, OutPayload, OutOwner);
+	}
+
+	FIntVector2 RegionCoord = GetRegionCoord(ChunkCoord);
+
+	FScopeLock Lock(&RegionsLock);
+	TSharedPtr<FMappedRegionFile, ESPMode::ThreadSafe>* Cached = MappedRegions.Find(RegionCoord);
+	if (!Cached)
+	{
+		Cached = &MappedRegions.Add(RegionCoord, MapRegionFile(RegionCoord));
+		if (*Cached)
+		{
+			RegionFileMappings.FindOrAdd(RegionCoord).Add(*Cached);
+		}
+	}
+	const TSharedPtr<FMappedRegionFile, ESPMode::ThreadSafe>& Mapped = *Cached;
+	if (!Mapped)
+	{
+		return false;
+	}
+
+	const FRegionTableEntry& Entry = Mapped->GetTableEntry(GetRegionTableIndex(ChunkCoord, RegionCoord));
+	if (Entry.Offset == 0)
+	{
+		return false;
+	}
+	if (Entry.Offset + Entry.Size > static_cast<uint64>(Mapped->Region->GetMappedSize()))
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("Region file %s is truncated, Chunk (%d, %d) will be regenerated"), *GetRegionFilePath(RegionCoord), ChunkCoord.X, ChunkCoord.Y);
+		return false;
+	}
+
+	OutPayload = TConstArrayView<uint8>(Mapped->Region->GetMappedPtr() + Entry.Offset, Entry.Size);
+	OutOwner = Mapped;
+	return true;
+}
+
+bool FVoxelRegionStore::ReadChunkCopy(const FIntVector2& ChunkCoord, TConstArrayView<uint8>& OutPayload, TSharedPtr<IVoxelWordsOwner, ESPMode::ThreadSafe>& OutOwner)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	FIntVector2 RegionCoord = GetRegionCoord(ChunkCoord);
+	FString Path = GetRegionFilePath(RegionCoord);
+
+	// The writer may be appending payloads, the lock only keeps its table updates and compaction out
+	FScopeLock Lock(&RegionsLock);
+	RecoverCompactedRegionFile(RegionCoord);
+	TUniquePtr<IFileHandle> ReadHandle(PlatformFile.OpenRead(*Path, true));
+	if (!ReadHandle)
+	{
+		return false;
+	}
+
+	FRegionFileHeader Header;
+	FRegionTableEntry Entry;
+	int32 TableIndex = GetRegionTableIndex(ChunkCoord, RegionCoord);
+	bool bIsTableRead = ReadHandle->Size() >= RegionPayloadsStart
+		&& ReadHandle->Read(reinterpret_cast<uint8*>(&Header), sizeof(Header))
+		&& IsRegionFileHeaderValid(Header, Format)
+		&& ReadHandle->Seek(sizeof(FRegionFileHeader) + TableIndex * sizeof(FRegionTableEntry))
+		&& ReadHandle->Read(reinterpret_cast<uint8*>(&Entry), sizeof(Entry));
+	if (!bIsTableRead || Entry.Offset == 0)
+	{
+		return false;
+	}
+	if (Entry.Offset + Entry.Size > static_cast<uint64>(ReadHandle->Size()))
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("Region file %s is truncated, Chunk (%d, %d) will be regenerated"), *Path, ChunkCoord.X, ChunkCoord.Y);
+		return false;
+	}
+
+	TSharedRef<FRegionPayloadCopy, ESPMode::ThreadSafe> PayloadCopy = MakeShared<FRegionPayloadCopy, ESPMode::ThreadSafe>();
+	PayloadCopy->Bytes.SetNumUninitialized(Entry.Size);
+	if (!ReadHandle->Seek(Entry.Offset) || !ReadHandle->Read(PayloadCopy->Bytes.GetData(), PayloadCopy->Bytes.Num()))
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("Failed to read Chunk (%d, %d) from region file %s"), ChunkCoord.X, ChunkCoord.Y, *Path);
+		return false;
+	}
+	OutPayload = PayloadCopy->Bytes;
+	OutOwner = PayloadCopy;
+	return true;
+}
+
+int32 FVoxelRegionStore::WriteChunks(TConstArrayView<FVoxelChunkPayload> Payloads)
+{
+	TMap<FIntVector2, TArray<const FVoxelChunkPayload*>> RegionPayloads;
+	for (const FVoxelChunkPayload& Payload : Payloads)
+	{
+		RegionPayloads.FindOrAdd(GetRegionCoord(Payload.ChunkCoord)).Add(&Payload);
+	}
+
+	int32 WrittenNum = 0;
+	for (const TPair<FIntVector2, TArray<const FVoxelChunkPayload*>>& Pair : RegionPayloads)
+	{
+		WrittenNum += WriteRegionChunks(Pair.Key, Pair.Value);
+	}
+	return WrittenNum;
+}
+
+const FString& FVoxelRegionStore::GetDirectory() const
+{
+	return Directory;
+}
+
+FIntVector2 FVoxelRegionStore::GetRegionCoord(const FIntVector2& ChunkCoord)
+{
+	return FIntVector2(FMath::DivideAndRoundDown(ChunkCoord.X, RegionSide), FMath::DivideAndRoundDown(ChunkCoord.Y, RegionSide));
+}
+
+FString FVoxelRegionStore::GetRegionFilePath(const FIntVector2& RegionCoord) const
+{
+	return FPaths::Combine(Directory, FString::Printf(TEXT("r.%d.%d.vxr"), RegionCoord.X, RegionCoord.Y));
+}
+
+FString FVoxelRegionStore::GetCompactedRegionFilePath(const FIntVector2& RegionCoord) const
+{
+	return GetRegionFilePath(RegionCoord) + TEXT(".compact");
+}
+
+TSharedPtr<FVoxelRegionStore::FMappedRegionFile, ESPMode::ThreadSafe> FVoxelRegionStore::MapRegionFile(const FIntVector2& RegionCoord) const
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	FString Path = GetRegionFilePath(RegionCoord);
+	RecoverCompactedRegionFile(RegionCoord);
+	if (!PlatformFile.FileExists(*Path))
+	{
+		return nullptr;
+	}
+
+	TSharedPtr<FMappedRegionFile, ESPMode::ThreadSafe> Mapped = MakeShared<FMappedRegionFile, ESPMode::ThreadSafe>();
+	Mapped->Handle.Reset(PlatformFile.OpenMapped(*Path));
+	if (!Mapped->Handle)
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("Failed to map region file %s"), *Path);
+		return nullptr;
+	}
+
+	int64 FileSize = Mapped->Handle->GetFileSize();
+	if (FileSize < RegionPayloadsStart)
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("Region file %s is too small, its chunks will be regenerated"), *Path);
+		return nullptr;
+	}
+
+	Mapped->Region.Reset(Mapped->Handle->MapRegion(0, FileSize));
+	if (!Mapped->Region)
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("Failed to map region file %s"), *Path);
+		return nullptr;
+	}
+
+	const FRegionFileHeader* Header = reinterpret_cast<const FRegionFileHeader*>(Mapped->Region->GetMappedPtr());
+	if (!IsRegionFileHeaderValid(*Header, Format))
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("Region file %s was saved with a different world layout, its chunks will be regenerated"), *Path);
+		return nullptr;
+	}
+	return Mapped;
+}
+
+int32 FVoxelRegionStore::WriteRegionChunks(const FIntVector2& RegionCoord, TConstArrayView<const FVoxelChunkPayload*> Payloads)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	FString Path = GetRegionFilePath(RegionCoord);
+	{
+		FScopeLock Lock(&RegionsLock);
+		RecoverCompactedRegionFile(RegionCoord);
+	}
+
+	// Readers only wait for the table update, payloads are appended past everything a table entry points to.
+	// A file without a valid header has no valid mapping that starting it over could break.
+	bool bIsFileValid = false;
+	{
+		TUniquePtr<IFileHandle> ReadHandle(PlatformFile.OpenRead(*Path));
+		FRegionFileHeader Header;
+		bIsFileValid = ReadHandle
+			&& ReadHandle->Size() >= RegionPayloadsStart
+			&& ReadHandle->Read(reinterpret_cast<uint8*>(&Header), sizeof(Header))
+			&& IsRegionFileHeaderValid(Header, Format);
+	}
+
+	if (!bIsFileValid)
+	{
+		PlatformFile.CreateDirectoryTree(*Directory);
+	}
+
+	TUniquePtr<IFileHandle> FileHandle(PlatformFile.OpenWrite(*Path, bIsFileValid, true));
+	if (!FileHandle)
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("Failed to open region file %s for writing"), *Path);
+		return 0;
+	}
+
+	if (!bIsFileValid)
+	{
+		// New or incompatible region file starts over with an empty table
+		TArray<uint8> Prologue;
+		Prologue.SetNumZeroed(RegionPayloadsStart);
+		FRegionFileHeader Header = MakeRegionFileHeader(Format);
+		FMemory::Memcpy(Prologue.GetData(), &Header, sizeof(Header));
+		if (!FileHandle->Write(Prologue.GetData(), Prologue.Num()))
+		{
+			UE_LOG(LogVoxelEngine, Error, TEXT("Failed to write region file %s header"), *Path);
+			return 0;
+		}
+	}
+
+	// Payloads are flushed before the table points at them, a crash leaves the previous payloads referenced
+	static const uint8 ZeroPadding[RegionPayloadAlignment] = {};
+	TArray<TPair<int32, FRegionTableEntry>> TableUpdates;
+	TableUpdates.Reserve(Payloads.Num());
+	for (const FVoxelChunkPayload* Payload : Payloads)
+	{
+		int64 FileSize = FileHandle->Size();
+		int64 Offset = Align(FileSize, RegionPayloadAlignment);
+		FileHandle->Seek(FileSize);
+		bool bWritten = (Offset == FileSize || FileHandle->Write(ZeroPadding, Offset - FileSize))
+			&& FileHandle->Write(Payload->Bytes.GetData(), Payload->Bytes.Num());
+		if (!bWritten)
+		{
+			UE_LOG(LogVoxelEngine, Error, TEXT("Failed to write Chunk (%d, %d) to region file %s"), Payload->ChunkCoord.X, Payload->ChunkCoord.Y, *Path);
+			continue;
+		}
+
+		FRegionTableEntry Entry;
+		Entry.Offset = Offset;
+		Entry.Size = Payload->Bytes.Num();
+		Entry.Reserved = 0;
+		TableUpdates.Emplace(GetRegionTableIndex(Payload->ChunkCoord, RegionCoord), Entry);
+	}
+	FileHandle->Flush(true);
+
+	{
+		// Mappings share the table with the file, readers must not see an entry half written
+		FScopeLock Lock(&RegionsLock);
+		for (const TPair<int32, FRegionTableEntry>& Update : TableUpdates)
+		{
+			FileHandle->Seek(sizeof(FRegionFileHeader) + Update.Key * sizeof(FRegionTableEntry));
+			FileHandle->Write(reinterpret_cast<const uint8*>(&Update.Value), sizeof(FRegionTableEntry));
+		}
+		// Chunks loaded from the old mapping keep it alive, new reads map the grown file
+		MappedRegions.Remove(RegionCoord);
+	}
+	FileHandle->Flush(true);
+	FileHandle.Reset();
+
+	CompactRegionFile(RegionCoord);
+	return TableUpdates.Num();
+}
+
+bool FVoxelRegionStore::IsRegionFileMapped(const FIntVector2& RegionCoord)
+{
+	TArray<TWeakPtr<FMappedRegionFile, ESPMode::ThreadSafe>>* Mappings = RegionFileMappings.Find(RegionCoord);
+	if (!Mappings)
+	{
+		return false;
+	}
+	Mappings->RemoveAllSwap([](const TWeakPtr<FMappedRegionFile, ESPMode::ThreadSafe>& Mapping) { return !Mapping.IsValid(); });
+	if (Mappings->IsEmpty())
+	{
+		RegionFileMappings.Remove(RegionCoord);
+		return false;
+	}
+	return true;
+}
+
+void FVoxelRegionStore::CompactRegionFile(const FIntVector2& RegionCoord)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	FString Path = GetRegionFilePath(RegionCoord);
+	FString CompactedPath = GetCompactedRegionFilePath(RegionCoord);
+
+	TUniquePtr<IFileHandle> ReadHandle(PlatformFile.OpenRead(*Path));
+	if (!ReadHandle)
+	{
+		return;
+	}
+	int64 FileSize = ReadHandle->Size();
+	TArray<FRegionTableEntry> Table;
+	Table.SetNumUninitialized(RegionTableEntriesNum);
+	if (!ReadHandle->Seek(sizeof(FRegionFileHeader)) || !ReadHandle->Read(reinterpret_cast<uint8*>(Table.GetData()), Table.Num() * sizeof(FRegionTableEntry)))
+	{
+		return;
+	}
+
+	// Payloads of rewritten chunks are dead, it only pays off to drop them once they are most of the file
+	int64 LiveSize = 0;
+	for (FRegionTableEntry& Entry : Table)
+	{
+		// Truncated payloads are regenerated by readers anyway
+		if (Entry.Offset != 0 && Entry.Offset + Entry.Size > static_cast<uint64>(FileSize))
+		{
+			FMemory::Memzero(Entry);
+		}
+		if (Entry.Offset != 0)
+		{
+			LiveSize += Align(static_cast<int64>(Entry.Size), RegionPayloadAlignment);
+		}
+	}
+	int64 DeadSize = FileSize - RegionPayloadsStart - LiveSize;
+	if (DeadSize <= LiveSize || DeadSize < RegionCompactionMinDeadSize)
+	{
+		return;
+	}
+	{
+		// Borrowed words must stay where the chunks point to, the file is compacted on a later write instead
+		FScopeLock Lock(&RegionsLock);
+		MappedRegions.Remove(RegionCoord);
+		if (IsRegionFileMapped(RegionCoord))
+		{
+			return;
+		}
+	}
+
+	TUniquePtr<IFileHandle> WriteHandle(PlatformFile.OpenWrite(*CompactedPath));
+	if (!WriteHandle)
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("Failed to open region file %s for compaction"), *CompactedPath);
+		return;
+	}
+
+	// The table goes in last, pointing at the payloads' new offsets
+	static const uint8 ZeroPadding[RegionPayloadAlignment] = {};
+	TArray<uint8> Prologue;
+	Prologue.SetNumZeroed(RegionPayloadsStart);
+	bool bWritten = WriteHandle->Write(Prologue.GetData(), Prologue.Num());
+	TArray<uint8> Payload;
+	for (int32 TableIndex = 0; TableIndex < Table.Num() && bWritten; TableIndex++)
+	{
+		FRegionTableEntry& Entry = Table[TableIndex];
+		if (Entry.Offset == 0)
+		{
+			continue;
+		}
+		int64 WrittenSize = WriteHandle->Size();
+		int64 Offset = Align(WrittenSize, RegionPayloadAlignment);
+		Payload.SetNumUninitialized(Entry.Size);
+		bWritten = ReadHandle->Seek(Entry.Offset)
+			&& ReadHandle->Read(Payload.GetData(), Payload.Num())
+			&& (Offset == WrittenSize || WriteHandle->Write(ZeroPadding, Offset - WrittenSize))
+			&& WriteHandle->Write(Payload.GetData(), Payload.Num());
+		Entry.Offset = Offset;
+	}
+	FRegionFileHeader Header = MakeRegionFileHeader(Format);
+	FMemory::Memcpy(Prologue.GetData(), &Header, sizeof(Header));
+	FMemory::Memcpy(Prologue.GetData() + sizeof(Header), Table.GetData(), Table.Num() * sizeof(FRegionTableEntry));
+	bWritten = bWritten
+		&& WriteHandle->Seek(0)
+		&& WriteHandle->Write(Prologue.GetData(), Prologue.Num())
+		&& WriteHandle->Flush(true);
+	int64 CompactedSize = WriteHandle->Size();
+	WriteHandle.Reset();
+	ReadHandle.Reset();
+	if (!bWritten)
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("Failed to compact region file %s"), *Path);
+		PlatformFile.DeleteFile(*CompactedPath);
+		return;
+	}
+
+	// Nothing can map the file while it is replaced, a reader that mapped it meanwhile makes the copy wait for a later write
+	FScopeLock Lock(&RegionsLock);
+	MappedRegions.Remove(RegionCoord);
+	if (IsRegionFileMapped(RegionCoord) || !PlatformFile.DeleteFile(*Path))
+	{
+		PlatformFile.DeleteFile(*CompactedPath);
+		return;
+	}
+	if (!PlatformFile.MoveFile(*Path, *CompactedPath))
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("Failed to replace region file %s with its compacted copy"), *Path);
+		return;
+	}
+	UE_LOG(LogVoxelEngine, Verbose, TEXT("Compacted region file %s from %lld to %lld bytes"), *Path, FileSize, CompactedSize);
+}
+
+void FVoxelRegionStore::RecoverCompactedRegionFile(const FIntVector2& RegionCoord) const
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	FString Path = GetRegionFilePath(RegionCoord);
+	FString CompactedPath = GetCompactedRegionFilePath(RegionCoord);
+	// The region file is only removed once its copy is complete
+	if (!PlatformFile.FileExists(*Path) && PlatformFile.FileExists(*CompactedPath))
+	{
+		PlatformFile.MoveFile(*Path, *CompactedPath);
+	}
+}
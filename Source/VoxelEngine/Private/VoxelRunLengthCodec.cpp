@@ -0,0 +1,148 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VoxelRunLengthCodec.h"
+
+namespace
+{
+	// Lengths are limited to 63 bits, which takes at most 9 varint bytes
+	constexpr int32 MaxVarintBytes = 9;
+	constexpr int32 TypeBytes = sizeof(VoxelType);
+}
+
+FVoxelRunLengthEncoder::FVoxelRunLengthEncoder(TArray<uint8>& InOutput)
+	: Output(InOutput)
+{
+}
+
+FVoxelRunLengthEncoder::~FVoxelRunLengthEncoder()
+{
+	Flush();
+}
+
+void FVoxelRunLengthEncoder::Flush()
+{
+	if (PendingCount <= 0)
+	{
+		return;
+	}
+
+	uint8 Run[TypeBytes + MaxVarintBytes];
+	int32 RunSize = 0;
+	for (int32 Byte = 0; Byte < TypeBytes; Byte++)
+	{
+		Run[RunSize++] = static_cast<uint8>(PendingType >> (8 * Byte));
+	}
+	uint64 Length = PendingCount - 1;
+	while (Length >= 0x80)
+	{
+		Run[RunSize++] = static_cast<uint8>(Length | 0x80);
+		Length >>= 7;
+	}
+	Run[RunSize++] = static_cast<uint8>(Length);
+	Output.Append(Run, RunSize);
+
+	EncodedVoxelsNum += PendingCount;
+	PendingCount = 0;
+}
+
+int64 FVoxelRunLengthEncoder::GetEncodedVoxelsNum() const
+{
+	return EncodedVoxelsNum + PendingCount;
+}
+
+FVoxelRunLengthDecoder::FVoxelRunLengthDecoder(TConstArrayView<uint8> InInput)
+	: Input(InInput)
+{
+}
+
+bool FVoxelRunLengthDecoder::Read(int64 MaxCount, VoxelType& OutType, int64& OutCount)
+{
+	if (RunRemaining == 0 && !ReadRunHeader())
+	{
+		return false;
+	}
+	OutType = RunType;
+	OutCount = FMath::Min(RunRemaining, MaxCount);
+	RunRemaining -= OutCount;
+	return true;
+}
+
+bool FVoxelRunLengthDecoder::Decode(TArrayView<VoxelType> Out)
+{
+	int64 Index = 0;
+	while (Index < Out.Num())
+	{
+		VoxelType Type;
+		int64 Count;
+		if (!Read(Out.Num() - Index, Type, Count))
+		{
+			return false;
+		}
+		if constexpr (TypeBytes == 1)
+		{
+			FMemory::Memset(Out.GetData() + Index, Type, Count);
+		}
+		else
+		{
+			for (int64 Fill = Index; Fill < Index + Count; Fill++)
+			{
+				Out[Fill] = Type;
+			}
+		}
+		Index += Count;
+	}
+	return true;
+}
+
+bool FVoxelRunLengthDecoder::IsMalformed() const
+{
+	return bMalformed;
+}
+
+bool FVoxelRunLengthDecoder::IsFinished() const
+{
+	return RunRemaining == 0 && Offset >= Input.Num();
+}
+
+bool FVoxelRunLengthDecoder::ReadRunHeader()
+{
+	if (bMalformed || Offset >= Input.Num())
+	{
+		return false;
+	}
+	if (Offset + TypeBytes > Input.Num())
+	{
+		bMalformed = true;
+		return false;
+	}
+
+	RunType = EmptyVoxelType;
+	for (int32 Byte = 0; Byte < TypeBytes; Byte++)
+	{
+		RunType |= static_cast<VoxelType>(Input[Offset++]) << (8 * Byte);
+	}
+	uint64 Length = 0;
+	for (int32 Byte = 0; Byte < MaxVarintBytes; Byte++)
+	{
+		if (Offset >= Input.Num())
+		{
+			bMalformed = true;
+			return false;
+		}
+		uint8 Value = Input[Offset++];
+		Length |= static_cast<uint64>(Value & 0x7f) << (7 * Byte);
+		if ((Value & 0x80) == 0)
+		{
+			if (Length >= static_cast<uint64>(MAX_int64))
+			{
+				bMalformed = true;
+				return false;
+			}
+			RunRemaining = static_cast<int64>(Length) + 1;
+			return true;
+		}
+	}
+	bMalformed = true;
+	return false;
+}
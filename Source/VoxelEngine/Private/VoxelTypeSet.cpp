@@ -4,6 +4,74 @@
 #include "VoxelTypeSet.h"
 #include "VoxelEngine/VoxelEngine.h"
 
+namespace
+{
+	// Empty voxels and types missing from the set behave like air
+	constexpr EVoxelTypeFlags EmptyTypeFlags = EVoxelTypeFlags::Transparent | EVoxelTypeFlags::Traversable;
+}
+
+UVoxelTypeSet::UVoxelTypeSet()
+{
+	for (std::atomic<uint8>& Flags : TypeFlags)
+	{
+		Flags.store(static_cast<uint8>(EmptyTypeFlags), std::memory_order_relaxed);
+	}
+}
+
+void UVoxelTypeSet::PostLoad()
+{
+	Super::PostLoad();
+	RebuildTypeTables();
+}
+
+#if WITH_EDITOR
+void UVoxelTypeSet::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+	RebuildTypeTables();
+}
+#endif
+
+void UVoxelTypeSet::RebuildTypeTables()
+{
+	check(IsInGameThread());
+
+	if (VoxelTypes.Num() >= MaxVoxelTypesNum)
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("Voxel Type Set %s has %d types, only %d fit into a voxel"), *GetName(), VoxelTypes.Num(), MaxVoxelTypesNum - 1);
+	}
+
+	TypesByName.Reset();
+	for (int32 Type = 0; Type < MaxVoxelTypesNum; Type++)
+	{
+		EVoxelTypeFlags Flags = EmptyTypeFlags;
+		int32 TypeIndex = Type - 1;
+		if (Type != EmptyVoxelType && VoxelTypes.IsValidIndex(TypeIndex) && VoxelTypes[TypeIndex])
+		{
+			const UVoxelData* Data = VoxelTypes[TypeIndex];
+			Flags = EVoxelTypeFlags::None;
+			if (Data->bIsTransparent)
+			{
+				Flags |= EVoxelTypeFlags::Transparent;
+			}
+			else
+			{
+				Flags |= EVoxelTypeFlags::OpaqueCube;
+			}
+			if (Data->bIsTraversable)
+			{
+				Flags |= EVoxelTypeFlags::Traversable;
+			}
+			else
+			{
+				Flags |= EVoxelTypeFlags::Solid;
+			}
+			TypesByName.FindOrAdd(Data->VoxelName, static_cast<VoxelType>(Type));
+		}
+		TypeFlags[Type].store(static_cast<uint8>(Flags), std::memory_order_relaxed);
+	}
+}
+
 const TArray<UVoxelData*>& UVoxelTypeSet::GetVoxelTypes() const
 {
 	return VoxelTypes;
@@ -11,12 +79,10 @@ const TArray<UVoxelData*>& UVoxelTypeSet::GetVoxelTypes() const
 
 UVoxelData* UVoxelTypeSet::GetVoxelDataByName(const FName& VoxelName) const
 {
-	for (UVoxelData* Voxel : VoxelTypes)
+	VoxelType Type = GetVoxelTypeByName(VoxelName);
+	if (Type != EmptyVoxelType)
 	{
-		if (Voxel->VoxelName == VoxelName)
-		{
-			return Voxel;
-		}
+		return GetVoxelDataByType(Type);
 	}
 
 	UE_LOG(LogVoxelEngine, Error, TEXT("Voxel Type with name %s was not found!"), *VoxelName.ToString());
@@ -30,15 +96,8 @@ UVoxelData* UVoxelTypeSet::GetVoxelDataByTypeId(int32 VoxelTypeId) const
 
 VoxelType UVoxelTypeSet::GetVoxelTypeByName(const FName& VoxelName) const
 {
-	for (int I = 0; I < VoxelTypes.Num(); I++)
-	{
-		if (VoxelTypes[I]->VoxelName == VoxelName)
-		{
-			return I + 1;
-		}
-	}
-
-	return EmptyVoxelType;
+	const VoxelType* Type = TypesByName.Find(VoxelName);
+	return Type ? *Type : EmptyVoxelType;
 }
 
 UVoxelData* UVoxelTypeSet::GetVoxelDataByType(VoxelType VoxelType) const
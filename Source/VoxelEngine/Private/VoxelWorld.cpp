@@ -6,6 +6,20 @@
 #include "SimplexNoise.h"
 #include "VoxelTextureAtlasGenerator.h"
 #include "VoxelEngine/VoxelEngine.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "Async/ParallelFor.h"
+#include "Misc/Paths.h"
+
+namespace
+{
+	// Copy of a payload that is still to be written, restored chunks borrow its words
+	class FVoxelPayloadCopy : public IVoxelWordsOwner
+	{
+	public:
+		TArray<uint8> Bytes;
+	};
+}
 
 void FVoxelWorldSecondaryTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
 {
@@ -49,29 +63,29 @@ AVoxelWorld::AVoxelWorld()
 
 void AVoxelWorld::DrawChunkWireframes(bool bEnabled)
 {
-	for (UVoxelChunk* Chunk : Chunks)
+	for (const TPair<FIntVector2, UVoxelChunk*>& ChunkPair : Chunks)
 	{
-		Chunk->SetDrawWireframe(bEnabled);
+		ChunkPair.Value->SetDrawWireframe(bEnabled);
 	}
 }
 
 void AVoxelWorld::DrawChunkWireframe(int32 ChunkX, int32 ChunkY, bool bEnabled)
 {
-	if (0 > ChunkX || ChunkX >= ChunkWorldDimensions.X || 0 > ChunkY || ChunkY >= ChunkWorldDimensions.Y)
+	UVoxelChunk* Chunk = GetChunk(FIntVector2(ChunkX, ChunkY));
+	if (!Chunk)
 	{
-		UE_LOG(LogVoxelEngine, Error, TEXT("DrawChunkWireframe failed: invalid chunk index (%d, %d)"), ChunkX, ChunkY);
+		UE_LOG(LogVoxelEngine, Error, TEXT("DrawChunkWireframe failed: chunk (%d, %d) is not loaded"), ChunkX, ChunkY);
 		return;
 	}
 
-	int32 ChunkIndex = LinearizeChunkCoordinate(FIntVector2(ChunkX, ChunkY));
-	Chunks[ChunkIndex]->SetDrawWireframe(bEnabled);
+	Chunk->SetDrawWireframe(bEnabled);
 }
 
 void AVoxelWorld::RegenerateChunkMeshes()
 {
-	for (UVoxelChunk* Chunk : Chunks)
+	for (const TPair<FIntVector2, UVoxelChunk*>& ChunkPair : Chunks)
 	{
-		Chunk->MarkMeshDirty();
+		ChunkPair.Value->MarkMeshDirty();
 	}
 }
 
@@ -82,6 +96,13 @@ FIntVector AVoxelWorld::GetWorldSizeVoxel() const
 
 FBox AVoxelWorld::GetBoundingBoxWorld() const
 {
+	if (bStreamChunks)
+	{
+		FVector Min = FVector(-UE_LARGE_WORLD_MAX, -UE_LARGE_WORLD_MAX, GetActorLocation().Z);
+		FVector Max = FVector(UE_LARGE_WORLD_MAX, UE_LARGE_WORLD_MAX, GetActorLocation().Z + WorldHeight * VoxelSizeWorld);
+		return FBox(Min, Max);
+	}
+
 	FIntVector WorldSizeVoxel = GetWorldSizeVoxel();
 	FVector WorldSize = FVector(WorldSizeVoxel) * VoxelSizeWorld;
 	return FBox(GetActorLocation(), GetActorLocation() + WorldSize);
@@ -92,11 +113,67 @@ void AVoxelWorld::BeginPlay()
 {
 	Super::BeginPlay();
 
+	// Tables built on load miss sets created at runtime and edits of their voxel data assets
+	if (!VoxelTypeSet)
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("BeginPlay() failed: VoxelTypeSet is nullptr"));
+		return;
+	}
+	VoxelTypeSet->RebuildTypeTables();
+
 	if (!InitializeMaterials())
 	{
 		return;
 	}
 
+	if (VoxelIndexing == EVoxelIndexing::Morton && (!FMath::IsPowerOfTwo(ChunkSide) || ChunkSide > (1 << FVoxelMorton::MaxBitsPerAxis)))
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("Morton voxel indexing requires power of two ChunkSide up to %d, got %d. Falling back to Linear indexing."), 1 << FVoxelMorton::MaxBitsPerAxis, ChunkSide);
+		VoxelIndexing = EVoxelIndexing::Linear;
+	}
+
+	if (bBinaryMeshing && ChunkSide > UVoxelChunk::MaxBinaryMeshingChunkSide)
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("Binary meshing requires ChunkSide up to %d, got %d. Falling back to per-voxel meshing."), UVoxelChunk::MaxBinaryMeshingChunkSide, ChunkSide);
+		bBinaryMeshing = false;
+	}
+	if (bAsyncMeshing && ChunkSide > UVoxelChunk::MaxBinaryMeshingChunkSide)
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("Async meshing requires ChunkSide up to %d, got %d. Falling back to game thread meshing."), UVoxelChunk::MaxBinaryMeshingChunkSide, ChunkSide);
+		bAsyncMeshing = false;
+	}
+
+	int32 ValidMaxMeshLod = FMath::Clamp(MaxMeshLod, 0, FMath::FloorLog2(ChunkSide));
+	while (ValidMaxMeshLod > 0 && ChunkSide % (1 << ValidMaxMeshLod) != 0)
+	{
+		ValidMaxMeshLod--;
+	}
+	if (ValidMaxMeshLod != MaxMeshLod)
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("LOD cells of 2^MaxMeshLod voxels must divide ChunkSide %d, MaxMeshLod reduced from %d to %d."), ChunkSide, MaxMeshLod, ValidMaxMeshLod);
+		MaxMeshLod = ValidMaxMeshLod;
+	}
+
+	FVoxelPalettedStorage::SetLargePagesEnabled(bUseLargePages);
+
+	if (MeshCacheSizeMB > 0)
+	{
+		MeshCache = MakeUnique<FVoxelMeshCache>(SIZE_T(MeshCacheSizeMB) * 1024 * 1024);
+	}
+
+	if (bPersistChunks)
+	{
+		FVoxelRegionFormat RegionFormat;
+		RegionFormat.ChunkSide = ChunkSide;
+		RegionFormat.WorldHeight = WorldHeight;
+		RegionFormat.VoxelIndexing = static_cast<uint8>(VoxelIndexing);
+		RegionFormat.SaveMode = static_cast<uint8>(ChunkSaveMode);
+		FString SaveDirectory = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("VoxelWorlds"), SaveName);
+		RegionStore = MakeShared<FVoxelRegionStore, ESPMode::ThreadSafe>(SaveDirectory, RegionFormat);
+		LastChunkSaveTime = GetWorld()->GetTimeSeconds();
+		UE_LOG(LogVoxelEngine, Display, TEXT("Voxel World chunks are persisted to %s"), *SaveDirectory);
+	}
+
 	if (!VoxelWorldGeneratorClass)
 	{
 		UE_LOG(LogVoxelEngine, Error, TEXT("Voxel World Generator class not set!"));
@@ -106,6 +183,18 @@ void AVoxelWorld::BeginPlay()
 	VoxelWorldGeneratorInstance = NewObject<UVoxelWorldGenerator>(this, VoxelWorldGeneratorClass, FName("VoxelWorldGeneratorInstance"));
 	check(VoxelWorldGeneratorInstance);
 
+	if (bStreamChunks)
+	{
+		if (ChunkUnloadRadius <= ChunkLoadRadius)
+		{
+			UE_LOG(LogVoxelEngine, Warning, TEXT("ChunkUnloadRadius %d is not greater than ChunkLoadRadius %d, chunks near the boundary will be reloaded repeatedly"), ChunkUnloadRadius, ChunkLoadRadius);
+		}
+
+		// Chunks are streamed in from Tick once streaming sources are known
+		ChunkWorldDimensions = FIntVector2(0, 0);
+		return;
+	}
+
 	FIntVector2 GeneratorWantsSize = VoxelWorldGeneratorInstance->GetWantedWorldSizeVoxels();
 	int32 ChunksX = GeneratorWantsSize.X / ChunkSide;
 	int32 ChunksY = GeneratorWantsSize.Y / ChunkSide;
@@ -119,29 +208,19 @@ void AVoxelWorld::BeginPlay()
 	}
 	ChunkWorldDimensions = FIntVector2(ChunksX, ChunksY);
 
-	UE_LOG(LogVoxelEngine, Display, TEXT("Allocating Voxel World memory..."));
-	FDateTime AllocStartTime = FDateTime::Now();
-	size_t Length = ChunkWorldDimensions.X * ChunkSide;
-	size_t Width = ChunkWorldDimensions.Y * ChunkSide;
-	size_t Height = WorldHeight;
-	size_t VoxelsNum = Length * Width * Height;
-
-	Voxels.reserve(VoxelsNum);
-
-	for (size_t I = 0; I < VoxelsNum; I++)
-	{
-		Voxels.emplace_back(EmptyVoxelType);
-	}
-
-	FDateTime AllocEndTime = FDateTime::Now();
-	FTimespan AllocElapsedTime = AllocEndTime - AllocStartTime;
-	UE_LOG(LogVoxelEngine, Display, TEXT("Voxel World memory allocated, %d voxels in total, %3.2f milliseconds"), Voxels.size(), AllocElapsedTime.GetTotalMilliseconds());
+	SpawnChunks();
 
 	UVoxelWorldGenerator::FVoxelWorlGenerationFinished Callback;
 	Callback.BindUFunction(this, FName("WorldGenerationFinishedCallback"));
 	VoxelWorldGeneratorInstance->GenerateWorld(this, Callback);
 }
 
+void AVoxelWorld::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	SaveChunks(true);
+	Super::EndPlay(EndPlayReason);
+}
+
 void AVoxelWorld::PostInitProperties()
 {
 	Super::PostInitProperties();
@@ -154,29 +233,437 @@ void AVoxelWorld::PostInitProperties()
 	}
 }
 
-void AVoxelWorld::WorldGenerationFinishedCallback()
+void AVoxelWorld::SpawnChunks()
 {
 	UE_LOG(LogVoxelEngine, Display, TEXT("Spawning Chunk components..."));
 	FDateTime ChunkSpawnStartTime = FDateTime::Now();
-	Chunks.SetNum(ChunkWorldDimensions.X * ChunkWorldDimensions.Y);
+	TArray<UVoxelChunk*> ChunksToAllocate;
+	ChunksToAllocate.Reserve(ChunkWorldDimensions.X * ChunkWorldDimensions.Y);
 	for (int32 Y = 0; Y < ChunkWorldDimensions.Y; Y++)
 	{
 		for (int32 X = 0; X < ChunkWorldDimensions.X; X++)
 		{
-			UVoxelChunk* Chunk = NewObject<UVoxelChunk>(this);
-			check(Chunk);
-			Chunk->SetChunkIndex(X, Y);
-
-			Chunk->RegisterComponent();
-			FAttachmentTransformRules Rules(EAttachmentRule::KeepRelative, false);
-			Chunk->AttachToComponent(RootComponent, Rules);
-			AddOwnedComponent(Chunk);
-			Chunks[LinearizeChunkCoordinate(FIntVector2(X, Y))] = Chunk;
+			ChunksToAllocate.Add(SpawnChunk(FIntVector2(X, Y)));
 		}
 	}
 	FDateTime ChunkSpawnEndTime = FDateTime::Now();
 	FTimespan ChunkSpawnElapsedTime = ChunkSpawnEndTime - ChunkSpawnStartTime;
-	UE_LOG(LogVoxelEngine, Display, TEXT("Spawned %d Chunk components, %3.2f milliseconds"), ChunkWorldDimensions.X * ChunkWorldDimensions.Y, ChunkSpawnElapsedTime.GetTotalMilliseconds());
+	UE_LOG(LogVoxelEngine, Display, TEXT("Spawned %d Chunk components, %3.2f milliseconds"), ChunksToAllocate.Num(), ChunkSpawnElapsedTime.GetTotalMilliseconds());
+
+	UE_LOG(LogVoxelEngine, Display, TEXT("Allocating Voxel World memory..."));
+	FDateTime AllocStartTime = FDateTime::Now();
+	TArray<bool> ChunksRestored;
+	ChunksRestored.SetNumZeroed(ChunksToAllocate.Num());
+	// Chunks own their sections, so they can be allocated independently. Saved chunks only map their region files here.
+	EParallelForFlags AllocFlags = bParallelChunkAllocation ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread;
+	ParallelFor(ChunksToAllocate.Num(), [this, &ChunksToAllocate, &ChunksRestored](int32 ChunkIndex)
+	{
+		UVoxelChunk* Chunk = ChunksToAllocate[ChunkIndex];
+		int32 ChunkX;
+		int32 ChunkY;
+		Chunk->GetChunkIndex(ChunkX, ChunkY);
+		ChunksRestored[ChunkIndex] = RestoreChunkVoxels(Chunk, FIntVector2(ChunkX, ChunkY));
+		if (!ChunksRestored[ChunkIndex])
+		{
+			Chunk->AllocateVoxels();
+		}
+	}, AllocFlags);
+
+	Chunks.Reserve(ChunksToAllocate.Num());
+	for (UVoxelChunk* Chunk : ChunksToAllocate)
+	{
+		int32 ChunkX;
+		int32 ChunkY;
+		Chunk->GetChunkIndex(ChunkX, ChunkY);
+		PublishChunk(FIntVector2(ChunkX, ChunkY), Chunk);
+	}
+
+	ChunksToGenerate.Reset();
+	for (int32 ChunkIndex = 0; ChunkIndex < ChunksToAllocate.Num(); ChunkIndex++)
+	{
+		if (!ChunksRestored[ChunkIndex])
+		{
+			ChunksToGenerate.Add(ChunksToAllocate[ChunkIndex]);
+		}
+	}
+
+	size_t VoxelsNum = 0;
+	SIZE_T AllocatedSize = 0;
+	for (UVoxelChunk* Chunk : ChunksToAllocate)
+	{
+		VoxelsNum += Chunk->GetVoxelsNum();
+		AllocatedSize += Chunk->GetVoxelsAllocatedSize();
+	}
+	FDateTime AllocEndTime = FDateTime::Now();
+	FTimespan AllocElapsedTime = AllocEndTime - AllocStartTime;
+	double AllocSeconds = FMath::Max(AllocElapsedTime.GetTotalSeconds(), UE_DOUBLE_SMALL_NUMBER);
+	UE_LOG(LogVoxelEngine, Display, TEXT("Voxel World memory allocated, %llu voxels in total, %3.2f MB, %3.2f milliseconds, %3.2f Mvoxels/s, %3.2f MB/s"),
+		static_cast<uint64>(VoxelsNum),
+		AllocatedSize / (1024.0 * 1024.0),
+		AllocElapsedTime.GetTotalMilliseconds(),
+		VoxelsNum / AllocSeconds / 1e6,
+		AllocatedSize / (1024.0 * 1024.0) / AllocSeconds);
+	if (RegionStore)
+	{
+		UE_LOG(LogVoxelEngine, Display, TEXT("Restored %d Chunks from region files, %d Chunks left to generate"), ChunksToAllocate.Num() - ChunksToGenerate.Num(), ChunksToGenerate.Num());
+	}
+}
+
+UVoxelChunk* AVoxelWorld::SpawnChunk(const FIntVector2& ChunkCoord)
+{
+	UVoxelChunk* Chunk = NewObject<UVoxelChunk>(this);
+	check(Chunk);
+	Chunk->SetChunkIndex(ChunkCoord.X, ChunkCoord.Y);
+
+	Chunk->RegisterComponent();
+	FAttachmentTransformRules Rules(EAttachmentRule::KeepRelative, false);
+	Chunk->AttachToComponent(RootComponent, Rules);
+	AddOwnedComponent(Chunk);
+	return Chunk;
+}
+
+void AVoxelWorld::PublishChunk(const FIntVector2& ChunkCoord, UVoxelChunk* Chunk)
+{
+	check(Chunk && Chunk->GetSectionsNum() > 0);
+	FWriteScopeLock WriteLock(ChunksLock);
+	Chunks.Add(ChunkCoord, Chunk);
+}
+
+void AVoxelWorld::UpdateChunkStreaming(int32 LoadBudget, int32 UnloadBudget)
+{
+	TArray<FIntVector2> SourceChunkCoords;
+	GetStreamingSourceChunkCoords(SourceChunkCoords);
+	if (SourceChunkCoords.IsEmpty())
+	{
+		return;
+	}
+
+	auto GetDistanceSquared = [&SourceChunkCoords](const FIntVector2& ChunkCoord)
+	{
+		int64 MinDistanceSquared = MAX_int64;
+		for (const FIntVector2& SourceCoord : SourceChunkCoords)
+		{
+			int64 DX = ChunkCoord.X - SourceCoord.X;
+			int64 DY = ChunkCoord.Y - SourceCoord.Y;
+			MinDistanceSquared = FMath::Min(MinDistanceSquared, DX * DX + DY * DY);
+		}
+		return MinDistanceSquared;
+	};
+
+	// Farthest chunks are unloaded first
+	int64 UnloadRadiusSquared = static_cast<int64>(ChunkUnloadRadius) * ChunkUnloadRadius;
+	TArray<TPair<int64, FIntVector2>> UnloadCandidates;
+	for (const TPair<FIntVector2, UVoxelChunk*>& ChunkPair : Chunks)
+	{
+		int64 DistanceSquared = GetDistanceSquared(ChunkPair.Key);
+		if (DistanceSquared > UnloadRadiusSquared)
+		{
+			UnloadCandidates.Emplace(DistanceSquared, ChunkPair.Key);
+		}
+	}
+	UnloadCandidates.Sort([](const TPair<int64, FIntVector2>& A, const TPair<int64, FIntVector2>& B) { return A.Key > B.Key; });
+	int32 UnloadsNum = FMath::Min(UnloadCandidates.Num(), UnloadBudget);
+	for (int32 I = 0; I < UnloadsNum; I++)
+	{
+		UnloadChunk(UnloadCandidates[I].Value);
+	}
+
+	// Nearest chunks are loaded first
+	int64 LoadRadiusSquared = static_cast<int64>(ChunkLoadRadius) * ChunkLoadRadius;
+	TSet<FIntVector2> LoadCandidatesSet;
+	TArray<TPair<int64, FIntVector2>> LoadCandidates;
+	for (const FIntVector2& SourceCoord : SourceChunkCoords)
+	{
+		for (int32 DY = -ChunkLoadRadius; DY <= ChunkLoadRadius; DY++)
+		{
+			for (int32 DX = -ChunkLoadRadius; DX <= ChunkLoadRadius; DX++)
+			{
+				FIntVector2 ChunkCoord(SourceCoord.X + DX, SourceCoord.Y + DY);
+				if (static_cast<int64>(DX) * DX + static_cast<int64>(DY) * DY > LoadRadiusSquared || Chunks.Contains(ChunkCoord))
+				{
+					continue;
+				}
+				bool bIsAlreadyCandidate = false;
+				LoadCandidatesSet.Add(ChunkCoord, &bIsAlreadyCandidate);
+				if (!bIsAlreadyCandidate)
+				{
+					LoadCandidates.Emplace(GetDistanceSquared(ChunkCoord), ChunkCoord);
+				}
+			}
+		}
+	}
+	LoadCandidates.Sort([](const TPair<int64, FIntVector2>& A, const TPair<int64, FIntVector2>& B) { return A.Key < B.Key; });
+	int32 LoadsNum = FMath::Min(LoadCandidates.Num(), LoadBudget);
+	for (int32 I = 0; I < LoadsNum; I++)
+	{
+		UVoxelChunk* Chunk = LoadChunk(LoadCandidates[I].Value);
+		// Meshed at the LOD of its distance right away instead of being remeshed on the next LOD update
+		if (MaxMeshLod > 0)
+		{
+			Chunk->SetMeshLod(SelectChunkMeshLod(0, FMath::Sqrt(static_cast<double>(LoadCandidates[I].Key))));
+		}
+	}
+
+	if (LoadsNum > 0 || UnloadsNum > 0)
+	{
+		UE_LOG(LogVoxelEngine, Verbose, TEXT("Chunk streaming: %d loaded, %d unloaded, %d pending, %d resident"), LoadsNum, UnloadsNum, LoadCandidates.Num() - LoadsNum, Chunks.Num());
+	}
+}
+
+void AVoxelWorld::GetStreamingSourceChunkCoords(TArray<FIntVector2>& OutChunkCoords) const
+{
+	for (const TWeakObjectPtr<AActor>& Source : StreamingSources)
+	{
+		if (Source.IsValid())
+		{
+			OutChunkCoords.AddUnique(GetChunkCoordFromVoxelCoord(GetVoxelCoordFromWorld(Source->GetActorLocation())));
+		}
+	}
+
+	TArray<FVector> ViewLocations;
+	GetLocalViewLocations(ViewLocations);
+	for (const FVector& ViewLocation : ViewLocations)
+	{
+		OutChunkCoords.AddUnique(GetChunkCoordFromVoxelCoord(GetVoxelCoordFromWorld(ViewLocation)));
+	}
+}
+
+void AVoxelWorld::GetLocalViewLocations(TArray<FVector>& OutViewLocations) const
+{
+	UWorld* World = GetWorld();
+	check(World);
+	for (FConstPlayerControllerIterator It = World->GetPlayerControllerIterator(); It; ++It)
+	{
+		APlayerController* PlayerController = It->Get();
+		if (!PlayerController || !PlayerController->IsLocalController())
+		{
+			continue;
+		}
+
+		FVector ViewLocation;
+		FRotator ViewRotation;
+		PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+		OutViewLocations.Add(ViewLocation);
+	}
+}
+
+void AVoxelWorld::UpdateChunkFaceCulling()
+{
+	TArray<FVector> ViewLocations;
+	GetLocalViewLocations(ViewLocations);
+
+	// Sections are culled against their bounds, which lie on section boundaries
+	int32 SectionsNum = FMath::DivideAndRoundUp(WorldHeight, ChunkSide);
+	TArray<FIntVector> ViewSectionCoords;
+	for (const FVector& ViewLocation : ViewLocations)
+	{
+		FIntVector VoxelCoord = GetVoxelCoordFromWorld(ViewLocation);
+		FIntVector2 ChunkCoord = GetChunkCoordFromVoxelCoord(VoxelCoord);
+		int32 SectionIndex = VoxelCoord.Z < 0 ? -1 : (VoxelCoord.Z >= WorldHeight ? SectionsNum : VoxelCoord.Z / ChunkSide);
+		ViewSectionCoords.Emplace(ChunkCoord.X, ChunkCoord.Y, SectionIndex);
+	}
+	if (ViewSectionCoords == LastViewSectionCoords)
+	{
+		return;
+	}
+	LastViewSectionCoords = MoveTemp(ViewSectionCoords);
+
+	for (const TPair<FIntVector2, UVoxelChunk*>& ChunkPair : Chunks)
+	{
+		ChunkPair.Value->CullFaceDirections(ViewLocations);
+	}
+}
+
+void AVoxelWorld::UpdateChunkMeshLods()
+{
+	TArray<FIntVector2> SourceChunkCoords;
+	GetStreamingSourceChunkCoords(SourceChunkCoords);
+	// Chunks loaded meanwhile got the LOD of their distance when they were loaded
+	if (SourceChunkCoords.IsEmpty() || SourceChunkCoords == LastLodSourceChunkCoords)
+	{
+		return;
+	}
+	LastLodSourceChunkCoords = SourceChunkCoords;
+
+	for (const TPair<FIntVector2, UVoxelChunk*>& ChunkPair : Chunks)
+	{
+		int64 MinDistanceSquared = MAX_int64;
+		for (const FIntVector2& SourceCoord : SourceChunkCoords)
+		{
+			int64 DX = ChunkPair.Key.X - SourceCoord.X;
+			int64 DY = ChunkPair.Key.Y - SourceCoord.Y;
+			MinDistanceSquared = FMath::Min(MinDistanceSquared, DX * DX + DY * DY);
+		}
+		UVoxelChunk* Chunk = ChunkPair.Value;
+		Chunk->SetMeshLod(SelectChunkMeshLod(Chunk->GetMeshLod(), FMath::Sqrt(static_cast<double>(MinDistanceSquared))));
+	}
+}
+
+double AVoxelWorld::GetMeshLodDistance(int32 Lod) const
+{
+	checkSlow(Lod > 0);
+	return MeshLodDistance * (1 << (Lod - 1));
+}
+
+int32 AVoxelWorld::SelectChunkMeshLod(int32 CurrentLod, double DistanceChunks) const
+{
+	int32 Lod = FMath::Clamp(CurrentLod, 0, MaxMeshLod);
+	while (Lod < MaxMeshLod && DistanceChunks > GetMeshLodDistance(Lod + 1) + MeshLodHysteresis)
+	{
+		Lod++;
+	}
+	while (Lod > 0 && DistanceChunks < GetMeshLodDistance(Lod) - MeshLodHysteresis)
+	{
+		Lod--;
+	}
+	return Lod;
+}
+
+UVoxelChunk* AVoxelWorld::LoadChunk(const FIntVector2& ChunkCoord)
+{
+	check(VoxelWorldGeneratorInstance);
+
+	UVoxelChunk* Chunk = SpawnChunk(ChunkCoord);
+
+	// The chunk may have been unloaded with voxels that are not written yet, they are restored from the payload in memory
+	const FVoxelChunkPayload* UnsavedPayload = UnsavedChunkCoords.Contains(ChunkCoord) ? FindUnsavedChunkPayload(ChunkCoord) : nullptr;
+	bool bRestored = RestoreChunkVoxels(Chunk, ChunkCoord, UnsavedPayload);
+	if (!bRestored)
+	{
+		Chunk->AllocateVoxels();
+	}
+	PublishChunk(ChunkCoord, Chunk);
+	if (!bRestored)
+	{
+		VoxelWorldGeneratorInstance->GenerateChunk(this, Chunk);
+		ReplayChunkDelta(Chunk, ChunkCoord);
+		Chunk->CompactVoxels();
+	}
+	Chunk->MarkMeshRebuildRequired();
+
+	// Border faces of loaded neighbours are now hidden by this chunk
+	TStaticArray<FIntVector2, 4> NeighbourCoords
+	{
+		FIntVector2(ChunkCoord.X - 1, ChunkCoord.Y),
+		FIntVector2(ChunkCoord.X + 1, ChunkCoord.Y),
+		FIntVector2(ChunkCoord.X, ChunkCoord.Y - 1),
+		FIntVector2(ChunkCoord.X, ChunkCoord.Y + 1)
+	};
+	for (const FIntVector2& NeighbourCoord : NeighbourCoords)
+	{
+		if (UVoxelChunk* Neighbour = GetChunk(NeighbourCoord))
+		{
+			Neighbour->MarkMeshDirty();
+		}
+	}
+
+	// Culling of loaded chunks is only updated when a view crosses a section boundary
+	if (bCullFaceDirections)
+	{
+		TArray<FVector> ViewLocations;
+		GetLocalViewLocations(ViewLocations);
+		Chunk->CullFaceDirections(ViewLocations);
+	}
+	return Chunk;
+}
+
+void AVoxelWorld::UnloadChunk(const FIntVector2& ChunkCoord)
+{
+	UVoxelChunk* Chunk = nullptr;
+	{
+		FWriteScopeLock WriteLock(ChunksLock);
+		if (!Chunks.RemoveAndCopyValue(ChunkCoord, Chunk))
+		{
+			return;
+		}
+	}
+
+	check(Chunk);
+	if (RegionStore && Chunk->ResetUnsavedVoxels())
+	{
+		FVoxelChunkPayload& Payload = PendingChunkPayloads.AddDefaulted_GetRef();
+		Payload.ChunkCoord = ChunkCoord;
+		Chunk->SerializeVoxels(Payload.Bytes);
+		UnsavedChunkCoords.Add(ChunkCoord);
+	}
+
+	// Releases voxels and the mesh component, the chunk object itself is garbage collected
+	ChunksToMesh.Remove(Chunk);
+	Chunk->DestroyComponent();
+
+	// Border voxels of loaded neighbours were hidden by this chunk and need a full visibility pass
+	TStaticArray<FIntVector2, 4> NeighbourCoords
+	{
+		FIntVector2(ChunkCoord.X - 1, ChunkCoord.Y),
+		FIntVector2(ChunkCoord.X + 1, ChunkCoord.Y),
+		FIntVector2(ChunkCoord.X, ChunkCoord.Y - 1),
+		FIntVector2(ChunkCoord.X, ChunkCoord.Y + 1)
+	};
+	for (const FIntVector2& NeighbourCoord : NeighbourCoords)
+	{
+		if (UVoxelChunk* Neighbour = GetChunk(NeighbourCoord))
+		{
+			Neighbour->MarkMeshRebuildRequired();
+		}
+	}
+}
+
+void AVoxelWorld::WorldGenerationFinishedCallback()
+{
+	UE_LOG(LogVoxelEngine, Display, TEXT("Compacting Chunk voxels..."));
+	FDateTime CompactionStartTime = FDateTime::Now();
+	int32 SectionsNum = 0;
+	int32 UniformSectionsNum = 0;
+	if (RegionStore && ChunkSaveMode == EVoxelChunkSaveMode::Delta)
+	{
+		FDateTime ReplayStartTime = FDateTime::Now();
+		int32 ReplayedEditsNum = 0;
+		for (UVoxelChunk* Chunk : ChunksToGenerate)
+		{
+			int32 ChunkX;
+			int32 ChunkY;
+			Chunk->GetChunkIndex(ChunkX, ChunkY);
+			ReplayedEditsNum += ReplayChunkDelta(Chunk, FIntVector2(ChunkX, ChunkY));
+		}
+		FTimespan ReplayElapsedTime = FDateTime::Now() - ReplayStartTime;
+		UE_LOG(LogVoxelEngine, Display, TEXT("Replayed %d saved voxel edits, %3.2f milliseconds"), ReplayedEditsNum, ReplayElapsedTime.GetTotalMilliseconds());
+	}
+
+	// Restored chunks were compacted before saving and keep borrowing their mapped words
+	for (UVoxelChunk* Chunk : ChunksToGenerate)
+	{
+		Chunk->CompactVoxels();
+		SectionsNum += Chunk->GetSectionsNum();
+		UniformSectionsNum += Chunk->GetUniformSectionsNum();
+	}
+	ChunksToGenerate.Empty();
+	FDateTime CompactionEndTime = FDateTime::Now();
+	FTimespan CompactionElapsedTime = CompactionEndTime - CompactionStartTime;
+	UE_LOG(LogVoxelEngine, Display, TEXT("Compacted %d Chunk sections, %d are uniform, %3.2f milliseconds"), SectionsNum, UniformSectionsNum, CompactionElapsedTime.GetTotalMilliseconds());
+
+	UE_LOG(LogVoxelEngine, Display, TEXT("Generating Chunk meshes..."));
+	FDateTime MeshingStartTime = FDateTime::Now();
+	if (MaxMeshLod > 0)
+	{
+		LastLodSourceChunkCoords.Reset();
+		UpdateChunkMeshLods();
+	}
+	for (const TPair<FIntVector2, UVoxelChunk*>& ChunkPair : Chunks)
+	{
+		ChunkPair.Value->GenerateMesh();
+	}
+	FDateTime MeshingEndTime = FDateTime::Now();
+	FTimespan MeshingElapsedTime = MeshingEndTime - MeshingStartTime;
+	UE_LOG(LogVoxelEngine, Display, TEXT("Generated %d Chunk meshes, %3.2f milliseconds"), Chunks.Num(), MeshingElapsedTime.GetTotalMilliseconds());
+
+	SIZE_T VoxelsAllocatedSize = 0;
+	size_t VoxelsNum = 0;
+	for (const TPair<FIntVector2, UVoxelChunk*>& ChunkPair : Chunks)
+	{
+		VoxelsAllocatedSize += ChunkPair.Value->GetVoxelsAllocatedSize();
+		VoxelsNum += ChunkPair.Value->GetVoxelsNum();
+	}
+	UE_LOG(LogVoxelEngine, Display, TEXT("Voxel World memory after generation: %3.2f MB, %1.3f bytes per voxel"), VoxelsAllocatedSize / (1024.0 * 1024.0), VoxelsNum > 0 ? static_cast<double>(VoxelsAllocatedSize) / VoxelsNum : 0.0);
 }
 
 bool AVoxelWorld::InitializeMaterials()
@@ -205,6 +692,10 @@ bool AVoxelWorld::InitializeMaterials()
 	DynamicMaterialInstance->SetTextureParameterValue("SpecularAtlas", RenderingSettings->SpecularAtlas);
 	DynamicMaterialInstance->SetTextureParameterValue("EmissiveAtlas", RenderingSettings->EmissiveAtlas);
 	DynamicMaterialInstance->SetTextureParameterValue("NormalAtlas", RenderingSettings->NormalAtlas);
+	// Greedy quads span many voxels, the material repeats the atlas tile: UV = UV1 + frac(UV0) * AtlasTileSize
+	DynamicMaterialInstance->SetScalarParameterValue("TiledAtlasUVs", MeshingMode == EVoxelMeshingMode::Greedy ? 1.0f : 0.0f);
+	DynamicMaterialInstance->SetScalarParameterValue("AtlasTileSizeU", 1.0f / 6);
+	DynamicMaterialInstance->SetScalarParameterValue("AtlasTileSizeV", 1.0f / FMath::Max(VoxelTypeSet->GetVoxelTypes().Num(), 1));
 	return true;
 }
 
@@ -213,91 +704,241 @@ void AVoxelWorld::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
+	// Frees palette buffers and unloaded sections that no snapshot can see anymore
+	FVoxelEpochs::AdvanceAndReclaim();
+
+	ProcessChunkChangeRequests();
+
+	if (RegionStore && GetWorld()->GetTimeSeconds() - LastChunkSaveTime >= ChunkSaveIntervalSeconds)
+	{
+		SaveChunks(false);
+	}
+
+	if (MaxMeshLod > 0)
+	{
+		UpdateChunkMeshLods();
+	}
+	if (bCullFaceDirections)
+	{
+		UpdateChunkFaceCulling();
+	}
+
+	if (!bStreamChunks || !VoxelWorldGeneratorInstance)
+	{
+		return;
+	}
+
+	if (bInitialChunksStreamed)
+	{
+		UpdateChunkStreaming(MaxChunkLoadsPerFrame, MaxChunkUnloadsPerFrame);
+		return;
+	}
+
+	// The initial view radius is loaded at once, later frames are budgeted
+	FDateTime StreamingStartTime = FDateTime::Now();
+	UpdateChunkStreaming(MAX_int32, MAX_int32);
+	if (Chunks.IsEmpty())
+	{
+		return;
+	}
+	bInitialChunksStreamed = true;
+	FDateTime StreamingEndTime = FDateTime::Now();
+	FTimespan StreamingElapsedTime = StreamingEndTime - StreamingStartTime;
+
+	SIZE_T VoxelsAllocatedSize = 0;
+	for (const TPair<FIntVector2, UVoxelChunk*>& ChunkPair : Chunks)
+	{
+		VoxelsAllocatedSize += ChunkPair.Value->GetVoxelsAllocatedSize();
+	}
+	UE_LOG(LogVoxelEngine, Display, TEXT("Streamed in %d initial Chunks, %3.2f MB of voxels, %3.2f milliseconds"), Chunks.Num(), VoxelsAllocatedSize / (1024.0 * 1024.0), StreamingElapsedTime.GetTotalMilliseconds());
 }
 
 void AVoxelWorld::TickSecondary(float DeltaTime, ELevelTick LevelTick, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent, FVoxelWorldSecondaryTickFunction* TickFunction)
 {
+	// Chunks have processed this frame's voxel changes by now
+	UpdateChunkMeshes();
 }
 
-uint64 AVoxelWorld::LinearizeCoordinate(int32 X, int32 Y, int32 Z) const
+void AVoxelWorld::ScheduleChunkMeshing(UVoxelChunk* Chunk)
 {
-	checkSlow(0 <= X && X <= ChunkWorldDimensions.X * ChunkSide);
-	checkSlow(0 <= Y && Y <= ChunkWorldDimensions.Y * ChunkSide);
-	checkSlow(0 <= Z && Z <= WorldHeight);
+	check(Chunk);
+	ChunksToMesh.Add(Chunk);
+}
 
-	uint64 Result = 
-		static_cast<size_t>(Z * ChunkWorldDimensions.X * ChunkSide * ChunkWorldDimensions.Y * ChunkSide) +
-		static_cast<size_t>(Y * (ChunkWorldDimensions.X * ChunkSide)) +
-		static_cast<size_t>(X);
-	check(Result < Voxels.size());
-	return Result;
+void AVoxelWorld::ScheduleChunkChangeRequests(UVoxelChunk* Chunk)
+{
+	check(Chunk);
+	ChunksWithChangeRequests.Enqueue(Chunk);
 }
 
-FIntVector AVoxelWorld::DelinearizeCoordinate(uint64 LinearCoord) const
+void AVoxelWorld::ScheduleChunkPatchNotification(UVoxelChunk* Chunk)
 {
-	int32 X = LinearCoord % (ChunkWorldDimensions.X * ChunkSide);
-	int32 Y = (LinearCoord / (ChunkWorldDimensions.X * ChunkSide)) % (ChunkWorldDimensions.Y * ChunkSide);
-	int32 Z = LinearCoord / ((ChunkWorldDimensions.X * ChunkSide) * (ChunkWorldDimensions.Y * ChunkSide));
-	return FIntVector(X, Y, Z);
+	check(Chunk);
+	ChunksToNotify.Add(Chunk);
 }
 
-uint64 AVoxelWorld::LinearizeChunkCoordinate(const FIntVector2& ChunkCoord) const
+void AVoxelWorld::ProcessChunkChangeRequests()
 {
-	checkSlow(0 <= ChunkCoord.X && ChunkCoord.X <= ChunkWorldDimensions.X);
-	checkSlow(0 <= ChunkCoord.Y && ChunkCoord.Y <= ChunkWorldDimensions.Y);
-	uint64 Result =
-		static_cast<size_t>(ChunkCoord.Y * ChunkWorldDimensions.X) +
-		static_cast<size_t>(ChunkCoord.X);
-	checkSlow(Result < Chunks.Num());
-	return Result;
+	TWeakObjectPtr<UVoxelChunk> WeakChunk;
+	while (ChunksWithChangeRequests.Dequeue(WeakChunk))
+	{
+		if (UVoxelChunk* Chunk = WeakChunk.Get())
+		{
+			Chunk->ProcessChangeRequests();
+		}
+	}
+
+	// Changes patch faces of neighbouring chunks too, each patched chunk notifies rendering once
+	for (UVoxelChunk* Chunk : ChunksToNotify)
+	{
+		Chunk->NotifyPatchedSections();
+	}
+	ChunksToNotify.Reset();
 }
 
-FIntVector2 AVoxelWorld::DelinearizeChunkCoordinate(uint64 LinearCoord) const
+void AVoxelWorld::UpdateChunkMeshes()
 {
-	int32 X = LinearCoord % ChunkWorldDimensions.X;
-	int32 Y = LinearCoord / (ChunkWorldDimensions.X) % (ChunkWorldDimensions.Y);
-	return FIntVector2(X, Y);
+	if (ChunksToMesh.IsEmpty())
+	{
+		return;
+	}
+
+	struct FChunkMeshRequest
+	{
+		UVoxelChunk* Chunk;
+		EVoxelChangeRenderPriority Priority;
+		double DistanceSquared;
+	};
+
+	TArray<FVector> ViewLocations;
+	GetLocalViewLocations(ViewLocations);
+	// Rebuilt every frame, views move and urgent changes arrive between frames
+	TArray<FChunkMeshRequest> Queue;
+	Queue.Reserve(ChunksToMesh.Num());
+	for (UVoxelChunk* Chunk : ChunksToMesh)
+	{
+		FVector ChunkCenter = Chunk->GetWorldBoundingBox().GetCenter();
+		double DistanceSquared = ViewLocations.IsEmpty() ? 0 : TNumericLimits<double>::Max();
+		for (const FVector& ViewLocation : ViewLocations)
+		{
+			DistanceSquared = FMath::Min(DistanceSquared, FVector::DistSquared(ChunkCenter, ViewLocation));
+		}
+		Queue.Add(FChunkMeshRequest{ Chunk, Chunk->GetPendingRenderPriority(), DistanceSquared });
+	}
+	auto IsMoreUrgent = [](const FChunkMeshRequest& A, const FChunkMeshRequest& B)
+	{
+		if (A.Priority != B.Priority)
+		{
+			return A.Priority < B.Priority;
+		}
+		return A.DistanceSquared < B.DistanceSquared;
+	};
+	Queue.Heapify(IsMoreUrgent);
+
+	double EndTimeSeconds = FPlatformTime::Seconds() + MeshingBudgetMilliseconds / 1000.0;
+	bool bMeshedAny = false;
+	while (!Queue.IsEmpty())
+	{
+		FChunkMeshRequest Request;
+		Queue.HeapPop(Request, IsMoreUrgent);
+		bool bIsUrgent = Request.Priority != EVoxelChangeRenderPriority::AnyTime;
+		if (!bIsUrgent && bMeshedAny && FPlatformTime::Seconds() >= EndTimeSeconds)
+		{
+			break;
+		}
+		if (Request.Chunk->UpdateMesh(bIsUrgent ? TNumericLimits<double>::Max() : EndTimeSeconds))
+		{
+			ChunksToMesh.Remove(Request.Chunk);
+		}
+		bMeshedAny = true;
+	}
 }
 
 FIntVector2 AVoxelWorld::GetChunkCoordFromVoxelCoord(const FIntVector& Coord) const
 {
-	int32 ChunkX = Coord.X / ChunkSide;
-	int32 ChunkY = Coord.Y / ChunkSide;
+	int32 ChunkX = FMath::DivideAndRoundDown(Coord.X, ChunkSide);
+	int32 ChunkY = FMath::DivideAndRoundDown(Coord.Y, ChunkSide);
 	
 	return FIntVector2(ChunkX, ChunkY);
 }
 
-
 UVoxelChunk* AVoxelWorld::GetChunkFromVoxelCoord(const FIntVector& Coord) const
 {
+	return GetChunk(GetChunkCoordFromVoxelCoord(Coord));
+}
+
+UVoxelChunk* AVoxelWorld::GetChunk(const FIntVector2& ChunkCoord) const
+{
+	return Chunks.FindRef(ChunkCoord);
+}
+
+UVoxelChunk* AVoxelWorld::GetChunkAndLocalCoord(const FIntVector& Coord, FIntVector& OutLocalCoord) const
+{
+	checkSlow(IsValidCoordinate(Coord));
 	FIntVector2 ChunkCoord = GetChunkCoordFromVoxelCoord(Coord);
-	uint64 Index = LinearizeChunkCoordinate(ChunkCoord);
-	if (Index >= Chunks.Num())
+	OutLocalCoord = FIntVector(Coord.X - ChunkCoord.X * ChunkSide, Coord.Y - ChunkCoord.Y * ChunkSide, Coord.Z);
+	return GetChunk(ChunkCoord);
+}
+
+VoxelType AVoxelWorld::GetVoxel(const FIntVector& Coord) const
+{
+	FIntVector LocalCoord;
+	const UVoxelChunk* Chunk = GetChunkAndLocalCoord(Coord, LocalCoord);
+	if (!Chunk)
 	{
-		return nullptr;
+		return EmptyVoxelType;
 	}
-	return Chunks[Index];
+	return Chunk->GetVoxel(LocalCoord);
 }
 
-const Voxel& AVoxelWorld::GetVoxel(const FIntVector& Coord) const
+VoxelType AVoxelWorld::GetVoxel(int32 X, int32 Y, int32 Z) const
 {
-	size_t Index = LinearizeCoordinate(Coord.X, Coord.Y, Coord.Z);
-	return Voxels[Index];
+	return GetVoxel(FIntVector(X, Y, Z));
 }
 
-Voxel& AVoxelWorld::GetVoxel(const FIntVector& Coord)
+void AVoxelWorld::SetVoxel(const FIntVector& Coord, VoxelType Desired)
 {
-	return GetVoxel(Coord.X, Coord.Y, Coord.Z);
+	FIntVector LocalCoord;
+	UVoxelChunk* Chunk = GetChunkAndLocalCoord(Coord, LocalCoord);
+	if (!Chunk)
+	{
+		return;
+	}
+	Chunk->SetVoxel(LocalCoord, Desired);
 }
 
-Voxel& AVoxelWorld::GetVoxel(int32 X, int32 Y, int32 Z)
+void AVoxelWorld::FillVoxels(const FIntVector& Min, const FIntVector& Max, VoxelType Desired)
 {
-	size_t Index = LinearizeCoordinate(X, Y, Z);
-	return Voxels[Index];
+	if (Min.X >= Max.X || Min.Y >= Max.Y || Min.Z >= Max.Z)
+	{
+		return;
+	}
+
+	// Chunks clamp the box to their own bounds, chunks that are not loaded are skipped
+	FIntVector2 MinChunkCoord = GetChunkCoordFromVoxelCoord(Min);
+	FIntVector2 MaxChunkCoord = GetChunkCoordFromVoxelCoord(Max - FIntVector(1, 1, 1));
+	for (int32 ChunkY = MinChunkCoord.Y; ChunkY <= MaxChunkCoord.Y; ChunkY++)
+	{
+		for (int32 ChunkX = MinChunkCoord.X; ChunkX <= MaxChunkCoord.X; ChunkX++)
+		{
+			UVoxelChunk* Chunk = GetChunk(FIntVector2(ChunkX, ChunkY));
+			if (!Chunk)
+			{
+				continue;
+			}
+			FIntVector ChunkOrigin(ChunkX * ChunkSide, ChunkY * ChunkSide, 0);
+			Chunk->FillVoxels(Min - ChunkOrigin, Max - ChunkOrigin, Desired);
+		}
+	}
 }
 
 bool AVoxelWorld::IsValidCoordinate(const FIntVector& Coord) const
 {
+	if (bStreamChunks)
+	{
+		return 0 <= Coord.Z && Coord.Z < WorldHeight;
+	}
+
 	bool bIsValid = (0 <= Coord.X && Coord.X < ChunkWorldDimensions.X * ChunkSide);
 	if (!bIsValid)
 	{
@@ -319,38 +960,98 @@ EVoxelChangeResult AVoxelWorld::ChangeVoxel(FVoxelChange& VoxelChange)
 		return EVoxelChangeResult::Rejected;
 	}
 
-	Voxel& TargetVoxel = GetVoxel(VoxelChange.Coordinate);
+	// Keeps the chunk loaded until the change is queued for rendering
+	FReadScopeLock ReadLock(ChunksLock);
+	FIntVector LocalCoord;
+	UVoxelChunk* Chunk = GetChunkAndLocalCoord(VoxelChange.Coordinate, LocalCoord);
+	if (!Chunk)
+	{
+		return EVoxelChangeResult::Rejected;
+	}
+	return ChangeChunkVoxel(Chunk, LocalCoord, VoxelChange);
+}
 
+EVoxelChangeResult AVoxelWorld::ChangeVoxel(const FIntVector& Coord, int32 DesiredVoxelType)
+{
+	if (!IsValidCoordinate(Coord))
+	{
+		return EVoxelChangeResult::Rejected;
+	}
+
+	FReadScopeLock ReadLock(ChunksLock);
+	FIntVector LocalCoord;
+	UVoxelChunk* Chunk = GetChunkAndLocalCoord(Coord, LocalCoord);
+	if (!Chunk)
+	{
+		return EVoxelChangeResult::Rejected;
+	}
+	FVoxelChange ChangeRequest(Coord, Chunk->GetVoxel(LocalCoord), DesiredVoxelType);
+	return ChangeChunkVoxel(Chunk, LocalCoord, ChangeRequest);
+}
+
+EVoxelChangeResult AVoxelWorld::ChangeChunkVoxel(UVoxelChunk* Chunk, const FIntVector& LocalCoord, FVoxelChange& VoxelChange)
+{
 	if (VoxelChange.ExpectationMismatch == EVoxelChangeExpectationMismatch::Overwrite)
 	{
-		while (!TargetVoxel.VoxelTypeId.compare_exchange_strong(VoxelChange.ExpectedVoxelType, VoxelChange.ChangeToVoxelType))
+		while (!Chunk->CompareExchangeVoxel(LocalCoord, VoxelChange.ExpectedVoxelType, VoxelChange.ChangeToVoxelType))
 		{
 
 		}
 	}
 	else if (VoxelChange.ExpectationMismatch == EVoxelChangeExpectationMismatch::Cancel)
 	{
-		if (!TargetVoxel.VoxelTypeId.compare_exchange_strong(VoxelChange.ExpectedVoxelType, VoxelChange.ChangeToVoxelType))
+		if (!Chunk->CompareExchangeVoxel(LocalCoord, VoxelChange.ExpectedVoxelType, VoxelChange.ChangeToVoxelType))
 		{
 			return EVoxelChangeResult::ExpectationMismatch;
 		}
 	}
 
-	uint64 VoxelChunkIndex = LinearizeChunkCoordinate(GetChunkCoordFromVoxelCoord(VoxelChange.Coordinate));
-	check(0 <= VoxelChunkIndex && VoxelChunkIndex < Chunks.Num());
-	UVoxelChunk* Chunk = Chunks[VoxelChunkIndex];
 	return Chunk->ChangeVoxelRendering(VoxelChange);
 }
 
-EVoxelChangeResult AVoxelWorld::ChangeVoxel(const FIntVector& Coord, int32 DesiredVoxelType)
+TSharedRef<FVoxelReadSnapshot, ESPMode::ThreadSafe> AVoxelWorld::AcquireReadSnapshot(const FIntVector& Min, const FIntVector& Max) const
 {
-	if (!IsValidCoordinate(Coord))
+	// The epoch is pinned by the constructor, before any chunk is looked up, so unloading can't free sections the snapshot points to
+	TSharedRef<FVoxelReadSnapshot, ESPMode::ThreadSafe> Snapshot = MakeShareable(new FVoxelReadSnapshot());
+	Snapshot->ChunkSide = ChunkSide;
+	Snapshot->VoxelIndexing = VoxelIndexing;
+	Snapshot->Min = FIntVector(Min.X, Min.Y, FMath::Max(Min.Z, 0));
+	Snapshot->Max = FIntVector(FMath::Max(Max.X, Min.X), FMath::Max(Max.Y, Min.Y), FMath::Clamp(Max.Z, Snapshot->Min.Z, WorldHeight));
+	if (Snapshot->Min.X == Snapshot->Max.X || Snapshot->Min.Y == Snapshot->Max.Y || Snapshot->Min.Z >= Snapshot->Max.Z)
 	{
-		return EVoxelChangeResult::Rejected;
+		Snapshot->Max = Snapshot->Min;
+		return Snapshot;
 	}
-	VoxelType Expected = GetVoxel(Coord).VoxelTypeId;
-	FVoxelChange ChangeRequest(Coord, Expected, DesiredVoxelType);
-	return ChangeVoxel(ChangeRequest);
+
+	FIntVector2 MinChunk = GetChunkCoordFromVoxelCoord(Snapshot->Min);
+	FIntVector2 MaxChunk = GetChunkCoordFromVoxelCoord(Snapshot->Max - FIntVector(1, 1, 1));
+	int32 ChunksNumY = MaxChunk.Y - MinChunk.Y + 1;
+	Snapshot->MinChunk = MinChunk;
+	Snapshot->ChunksNumX = MaxChunk.X - MinChunk.X + 1;
+	Snapshot->SectionsNum = FMath::DivideAndRoundUp(WorldHeight, ChunkSide);
+	Snapshot->SectionViews.SetNumZeroed(Snapshot->ChunksNumX * ChunksNumY * Snapshot->SectionsNum);
+
+	int32 MinSection = Snapshot->Min.Z / ChunkSide;
+	int32 MaxSection = (Snapshot->Max.Z - 1) / ChunkSide;
+	FReadScopeLock ReadLock(ChunksLock);
+	for (int32 Y = 0; Y < ChunksNumY; Y++)
+	{
+		for (int32 X = 0; X < Snapshot->ChunksNumX; X++)
+		{
+			const UVoxelChunk* Chunk = Chunks.FindRef(FIntVector2(MinChunk.X + X, MinChunk.Y + Y));
+			if (!Chunk)
+			{
+				continue;
+			}
+			for (int32 SectionIndex = MinSection; SectionIndex <= MaxSection; SectionIndex++)
+			{
+				FVoxelReadSnapshot::FSectionView& View = Snapshot->SectionViews[(Y * Snapshot->ChunksNumX + X) * Snapshot->SectionsNum + SectionIndex];
+				View.Storage = &Chunk->GetSectionStorage(SectionIndex);
+				View.WritesFinished = View.Storage->GetWritesFinished();
+			}
+		}
+	}
+	return Snapshot;
 }
 
 void AVoxelWorld::GetChunkWorldDimensions(int32& OutX, int32& OutY) const
@@ -374,6 +1075,45 @@ double AVoxelWorld::GetVoxelSizeWorld() const
 	return VoxelSizeWorld;
 }
 
+EVoxelIndexing AVoxelWorld::GetVoxelIndexing() const
+{
+	return VoxelIndexing;
+}
+
+EVoxelMeshingMode AVoxelWorld::GetMeshingMode() const
+{
+	return MeshingMode;
+}
+
+bool AVoxelWorld::IsBinaryMeshingEnabled() const
+{
+	return bBinaryMeshing;
+}
+
+bool AVoxelWorld::IsAsyncMeshingEnabled() const
+{
+	return bAsyncMeshing;
+}
+
+FVoxelMeshCache* AVoxelWorld::GetMeshCache() const
+{
+	return MeshCache.Get();
+}
+
+void AVoxelWorld::LogMeshCacheStats() const
+{
+	if (!MeshCache)
+	{
+		UE_LOG(LogVoxelEngine, Display, TEXT("Mesh cache is disabled"));
+		return;
+	}
+	FVoxelMeshCacheStats Stats = MeshCache->GetStats();
+	int64 LookupsNum = Stats.Hits + Stats.Misses;
+	UE_LOG(LogVoxelEngine, Display, TEXT("Mesh cache: %lld hits, %lld misses (%3.1f%% hit rate), %lld evictions, %d entries, %3.2f of %d MB"),
+		Stats.Hits, Stats.Misses, LookupsNum > 0 ? 100.0 * Stats.Hits / LookupsNum : 0.0, Stats.Evictions,
+		Stats.EntriesNum, Stats.AllocatedSize / (1024.0 * 1024.0), MeshCacheSizeMB);
+}
+
 bool AVoxelWorld::IsVoxelTransparent(const FIntVector& Coord) const
 {
 	if (!IsValidCoordinate(Coord))
@@ -381,15 +1121,12 @@ bool AVoxelWorld::IsVoxelTransparent(const FIntVector& Coord) const
 		return true;
 	}
 	
-	const Voxel& Voxel = GetVoxel(Coord);
-	if (Voxel.VoxelTypeId == EmptyVoxelType)
-	{
-		return true;
-	}
+	return VoxelTypeSet->HasTypeFlags(GetVoxel(Coord), EVoxelTypeFlags::Transparent);
+}
 
-	UVoxelData* VoxelData = VoxelTypeSet->GetVoxelDataByType(Voxel.VoxelTypeId);
-	check(VoxelData);
-	return VoxelData->bIsTransparent;
+bool AVoxelWorld::IsVoxelTypeTransparent(VoxelType VoxelTypeId) const
+{
+	return VoxelTypeSet->HasTypeFlags(VoxelTypeId, EVoxelTypeFlags::Transparent);
 }
 
 bool AVoxelWorld::IsVoxelTransparentTypeOverride(const FIntVector& Coord, VoxelType VoxelType) const
@@ -399,9 +1136,7 @@ bool AVoxelWorld::IsVoxelTransparentTypeOverride(const FIntVector& Coord, VoxelT
 		return true;
 	}
 
-	UVoxelData* VoxelData = VoxelTypeSet->GetVoxelDataByType(VoxelType);
-	check(VoxelData);
-	return VoxelData->bIsTransparent;
+	return VoxelTypeSet->HasTypeFlags(VoxelType, EVoxelTypeFlags::Transparent);
 }
 
 bool AVoxelWorld::IsVoxelTraversable(const FIntVector& Coord) const
@@ -411,15 +1146,7 @@ bool AVoxelWorld::IsVoxelTraversable(const FIntVector& Coord) const
 		return true;
 	}
 
-	const Voxel& Voxel = GetVoxel(Coord);
-	if (Voxel.VoxelTypeId == EmptyVoxelType)
-	{
-		return true;
-	}
-
-	UVoxelData* VoxelData = VoxelTypeSet->GetVoxelDataByType(Voxel.VoxelTypeId);
-	check(VoxelData);
-	return VoxelData->bIsTraversable;
+	return VoxelTypeSet->HasTypeFlags(GetVoxel(Coord), EVoxelTypeFlags::Traversable);
 }
 
 UMaterialInterface* AVoxelWorld::GetVoxelChunkMaterial() const
@@ -443,7 +1170,7 @@ FIntVector AVoxelWorld::GetVoxelCoordFromWorld(const FVector& Location) const
 {
 	FVector LocationScaled = (Location - GetActorLocation()) / VoxelSizeWorld;
 	// return FIntVector(FMath::RoundToInt(LocationScaled.X), FMath::RoundToInt(LocationScaled.Y), FMath::RoundToInt(LocationScaled.Z));
-	return FIntVector(LocationScaled.X, LocationScaled.Y, LocationScaled.Z);
+	return FIntVector(FMath::FloorToInt(LocationScaled.X), FMath::FloorToInt(LocationScaled.Y), FMath::FloorToInt(LocationScaled.Z));
 }
 
 UVoxelTypeSet* AVoxelWorld::GetVoxelTypeSet() const
@@ -451,3 +1178,270 @@ UVoxelTypeSet* AVoxelWorld::GetVoxelTypeSet() const
 	return VoxelTypeSet;
 }
 
+bool AVoxelWorld::IsChunkStreamingEnabled() const
+{
+	return bStreamChunks;
+}
+
+void AVoxelWorld::AddStreamingSource(AActor* Source)
+{
+	if (!IsValid(Source))
+	{
+		UE_LOG(LogVoxelEngine, Error, TEXT("AddStreamingSource failed: Source is invalid"));
+		return;
+	}
+	StreamingSources.AddUnique(Source);
+}
+
+void AVoxelWorld::RemoveStreamingSource(AActor* Source)
+{
+	StreamingSources.Remove(Source);
+}
+
+void AVoxelWorld::GetLoadedChunks(TArray<UVoxelChunk*>& OutChunks) const
+{
+	Chunks.GenerateValueArray(OutChunks);
+}
+
+int32 AVoxelWorld::GetLoadedChunksNum() const
+{
+	return Chunks.Num();
+}
+
+void AVoxelWorld::GetChunksToGenerate(TArray<UVoxelChunk*>& OutChunks) const
+{
+	OutChunks = ChunksToGenerate;
+}
+
+bool AVoxelWorld::EncodeChunkColumns(const FIntVector2& ChunkCoord, FVoxelRunLengthEncoder& Encoder) const
+{
+	UVoxelChunk* Chunk = GetChunk(ChunkCoord);
+	if (!Chunk)
+	{
+		return false;
+	}
+	Chunk->EncodeColumns(Encoder);
+	return true;
+}
+
+bool AVoxelWorld::DecodeChunkColumns(const FIntVector2& ChunkCoord, FVoxelRunLengthDecoder& Decoder)
+{
+	UVoxelChunk* Chunk = GetChunk(ChunkCoord);
+	if (!Chunk)
+	{
+		return false;
+	}
+	if (!Chunk->DecodeColumns(Decoder))
+	{
+		return false;
+	}
+	Chunk->CompactVoxels();
+	Chunk->MarkMeshRebuildRequired();
+
+	// Border faces of neighbours depend on the decoded voxels
+	TStaticArray<FIntVector2, 4> NeighbourCoords
+	{
+		FIntVector2(ChunkCoord.X - 1, ChunkCoord.Y),
+		FIntVector2(ChunkCoord.X + 1, ChunkCoord.Y),
+		FIntVector2(ChunkCoord.X, ChunkCoord.Y - 1),
+		FIntVector2(ChunkCoord.X, ChunkCoord.Y + 1)
+	};
+	for (const FIntVector2& NeighbourCoord : NeighbourCoords)
+	{
+		if (UVoxelChunk* Neighbour = GetChunk(NeighbourCoord))
+		{
+			Neighbour->MarkMeshRebuildRequired();
+		}
+	}
+	return true;
+}
+
+void AVoxelWorld::SaveChunks(bool bWait)
+{
+	if (!RegionStore)
+	{
+		return;
+	}
+
+	if (!ChunkSaveTask.IsCompleted())
+	{
+		if (!bWait)
+		{
+			// Previous save is still writing, chunks stay unsaved until the next interval
+			return;
+		}
+		ChunkSaveTask.Wait();
+	}
+	LastChunkSaveTime = GetWorld()->GetTimeSeconds();
+
+	// Everything launched before is written, only the payloads launched now are unsaved
+	UnsavedChunkCoords.Reset();
+	SavingChunkPayloads.Reset();
+	TArray<FVoxelChunkPayload> Payloads = MoveTemp(PendingChunkPayloads);
+	PendingChunkPayloads.Reset();
+
+	// Serialized on the game thread so that unloading can't release sections mid-copy
+	for (const TPair<FIntVector2, UVoxelChunk*>& ChunkPair : Chunks)
+	{
+		if (ChunkPair.Value->ResetUnsavedVoxels())
+		{
+			FVoxelChunkPayload& Payload = Payloads.AddDefaulted_GetRef();
+			Payload.ChunkCoord = ChunkPair.Key;
+			ChunkPair.Value->SerializeVoxels(Payload.Bytes);
+		}
+	}
+	if (Payloads.IsEmpty())
+	{
+		return;
+	}
+
+	TSharedRef<const TArray<FVoxelChunkPayload>, ESPMode::ThreadSafe> SharedPayloads = MakeShared<TArray<FVoxelChunkPayload>, ESPMode::ThreadSafe>(MoveTemp(Payloads));
+	TSharedRef<const TArray<FVoxelChunkPayload>, ESPMode::ThreadSafe> WrittenPayloads = SharedPayloads;
+	bool bSerializeDeltasInTask = false;
+	if (ChunkSaveMode == EVoxelChunkSaveMode::Delta)
+	{
+		check(VoxelWorldGeneratorInstance);
+		if (!DeltaBaselineChunk)
+		{
+			DeltaBaselineChunk = NewObject<UVoxelChunk>(this, FName("DeltaBaselineChunk"));
+			DeltaEditedChunk = NewObject<UVoxelChunk>(this, FName("DeltaEditedChunk"));
+		}
+		// Generators that can't run beside the game thread regenerate baselines before the task is launched
+		bSerializeDeltasInTask = !bWait && VoxelWorldGeneratorInstance->CanGenerateChunksInParallel();
+		if (!bSerializeDeltasInTask)
+		{
+			TArray<FVoxelChunkPayload> DeltaPayloads;
+			SerializeChunkDeltas(*SharedPayloads, DeltaPayloads);
+			WrittenPayloads = MakeShared<TArray<FVoxelChunkPayload>, ESPMode::ThreadSafe>(MoveTemp(DeltaPayloads));
+		}
+	}
+
+	// The world outlives the task, ending play waits for it
+	auto WritePayloads = [this, Store = RegionStore, WrittenPayloads, bSerializeDeltasInTask]()
+	{
+		FDateTime SaveStartTime = FDateTime::Now();
+		TArray<FVoxelChunkPayload> DeltaPayloads;
+		if (bSerializeDeltasInTask)
+		{
+			SerializeChunkDeltas(*WrittenPayloads, DeltaPayloads);
+		}
+		int32 SavedNum = Store->WriteChunks(bSerializeDeltasInTask ? DeltaPayloads : *WrittenPayloads);
+		FTimespan SaveElapsedTime = FDateTime::Now() - SaveStartTime;
+		UE_LOG(LogVoxelEngine, Verbose, TEXT("Saved %d Chunks to %s, %3.2f milliseconds"), SavedNum, *Store->GetDirectory(), SaveElapsedTime.GetTotalMilliseconds());
+	};
+
+	if (bWait)
+	{
+		WritePayloads();
+		return;
+	}
+	// Chunks unloaded after being serialized here may be loaded again before the task writes them
+	SavingChunkPayloads = SharedPayloads;
+	for (const FVoxelChunkPayload& Payload : *SavingChunkPayloads)
+	{
+		UnsavedChunkCoords.Add(Payload.ChunkCoord);
+	}
+	ChunkSaveTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, MoveTemp(WritePayloads), UE::Tasks::ETaskPriority::BackgroundNormal);
+}
+
+const FVoxelChunkPayload* AVoxelWorld::FindUnsavedChunkPayload(const FIntVector2& ChunkCoord) const
+{
+	// Pending payloads were serialized after those being saved, later entries after earlier ones
+	for (int32 Index = PendingChunkPayloads.Num() - 1; Index >= 0; Index--)
+	{
+		if (PendingChunkPayloads[Index].ChunkCoord == ChunkCoord)
+		{
+			return &PendingChunkPayloads[Index];
+		}
+	}
+	if (SavingChunkPayloads)
+	{
+		for (int32 Index = SavingChunkPayloads->Num() - 1; Index >= 0; Index--)
+		{
+			if ((*SavingChunkPayloads)[Index].ChunkCoord == ChunkCoord)
+			{
+				return &(*SavingChunkPayloads)[Index];
+			}
+		}
+	}
+	return nullptr;
+}
+
+bool AVoxelWorld::RestoreChunkVoxels(UVoxelChunk* Chunk, const FIntVector2& ChunkCoord, const FVoxelChunkPayload* UnsavedPayload)
+{
+	// Unsaved payloads hold all voxels in both save modes
+	if (!RegionStore || (!UnsavedPayload && ChunkSaveMode != EVoxelChunkSaveMode::Full))
+	{
+		return false;
+	}
+
+	TConstArrayView<uint8> Payload;
+	TSharedPtr<IVoxelWordsOwner, ESPMode::ThreadSafe> PayloadOwner;
+	if (UnsavedPayload)
+	{
+		// The payload itself is released once written, the chunk borrows from a copy
+		TSharedRef<FVoxelPayloadCopy, ESPMode::ThreadSafe> PayloadCopy = MakeShared<FVoxelPayloadCopy, ESPMode::ThreadSafe>();
+		PayloadCopy->Bytes = UnsavedPayload->Bytes;
+		Payload = PayloadCopy->Bytes;
+		PayloadOwner = PayloadCopy;
+	}
+	else if (!RegionStore->ReadChunk(ChunkCoord, Payload, PayloadOwner))
+	{
+		return false;
+	}
+	if (!Chunk->AllocateVoxelsFromPayload(Payload, MoveTemp(PayloadOwner)))
+	{
+		UE_LOG(LogVoxelEngine, Warning, TEXT("Saved Chunk (%d, %d) doesn't match the world layout and will be regenerated"), ChunkCoord.X, ChunkCoord.Y);
+		return false;
+	}
+	return true;
+}
+
+int32 AVoxelWorld::ReplayChunkDelta(UVoxelChunk* Chunk, const FIntVector2& ChunkCoord)
+{
+	if (!RegionStore || ChunkSaveMode != EVoxelChunkSaveMode::Delta)
+	{
+		return 0;
+	}
+
+	int32 EditsNum = 0;
+	TConstArrayView<uint8> Payload;
+	TSharedPtr<IVoxelWordsOwner, ESPMode::ThreadSafe> PayloadOwner;
+	if (RegionStore->ReadChunk(ChunkCoord, Payload, PayloadOwner))
+	{
+		EditsNum = Chunk->ApplyVoxelDelta(Payload);
+		if (EditsNum == INDEX_NONE)
+		{
+			UE_LOG(LogVoxelEngine, Warning, TEXT("Saved delta of Chunk (%d, %d) is malformed, its edits are lost"), ChunkCoord.X, ChunkCoord.Y);
+			EditsNum = 0;
+		}
+	}
+
+	// Generator output is reproducible and the delta is already saved or about to be, only later edits need saving
+	Chunk->ResetUnsavedVoxels();
+	return EditsNum;
+}
+
+void AVoxelWorld::SerializeChunkDeltas(TConstArrayView<FVoxelChunkPayload> Payloads, TArray<FVoxelChunkPayload>& OutDeltaPayloads)
+{
+	check(DeltaBaselineChunk && DeltaEditedChunk);
+	OutDeltaPayloads.Reset(Payloads.Num());
+	for (const FVoxelChunkPayload& Payload : Payloads)
+	{
+		// Chunks may still be restored from the payload, the edited chunk borrows from a copy
+		TSharedRef<FVoxelPayloadCopy, ESPMode::ThreadSafe> PayloadCopy = MakeShared<FVoxelPayloadCopy, ESPMode::ThreadSafe>();
+		PayloadCopy->Bytes = Payload.Bytes;
+		DeltaEditedChunk->SetChunkIndex(Payload.ChunkCoord.X, Payload.ChunkCoord.Y);
+		verify(DeltaEditedChunk->AllocateVoxelsFromPayload(PayloadCopy->Bytes, PayloadCopy));
+
+		// Regenerating the baseline costs a generation pass per edited chunk, but keeps the save proportional to the edits
+		DeltaBaselineChunk->SetChunkIndex(Payload.ChunkCoord.X, Payload.ChunkCoord.Y);
+		DeltaBaselineChunk->AllocateVoxels();
+		VoxelWorldGeneratorInstance->GenerateChunk(this, DeltaBaselineChunk);
+
+		FVoxelChunkPayload& DeltaPayload = OutDeltaPayloads.AddDefaulted_GetRef();
+		DeltaPayload.ChunkCoord = Payload.ChunkCoord;
+		DeltaEditedChunk->SerializeVoxelDelta(*DeltaBaselineChunk, DeltaPayload.Bytes);
+	}
+	DeltaEditedChunk->AllocateVoxels();
+}
@@ -3,6 +3,7 @@
 
 #include "VoxelWorldGenerator.h"
 #include "VoxelWorld.h"
+#include "Async/ParallelFor.h"
 
 FIntVector2 UVoxelWorldGenerator::GetWantedWorldSizeVoxels() const
 {
@@ -11,5 +12,25 @@ FIntVector2 UVoxelWorldGenerator::GetWantedWorldSizeVoxels() const
 
 void UVoxelWorldGenerator::GenerateWorld(AVoxelWorld* VoxelWorld, const FVoxelWorlGenerationFinished& Callback)
 {
+	check(VoxelWorld);
+
+	TArray<UVoxelChunk*> Chunks;
+	VoxelWorld->GetChunksToGenerate(Chunks);
+	// First writes commit the section pages, so spreading chunks over workers also spreads the page faults
+	EParallelForFlags Flags = CanGenerateChunksInParallel() ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread;
+	ParallelFor(Chunks.Num(), [this, VoxelWorld, &Chunks](int32 ChunkIndex)
+	{
+		GenerateChunk(VoxelWorld, Chunks[ChunkIndex]);
+	}, Flags);
+
 	Callback.ExecuteIfBound();
 }
+
+void UVoxelWorldGenerator::GenerateChunk(AVoxelWorld* VoxelWorld, UVoxelChunk* Chunk)
+{
+}
+
+bool UVoxelWorldGenerator::CanGenerateChunksInParallel() const
+{
+	return false;
+}
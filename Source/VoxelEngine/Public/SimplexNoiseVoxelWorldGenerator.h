@@ -16,7 +16,8 @@ class VOXELENGINE_API USimplexNoiseVoxelWorldGenerator : public UVoxelWorldGener
 	
 public:
 	FIntVector2 GetWantedWorldSizeVoxels() const override;
-	void GenerateWorld(AVoxelWorld* VoxelWorld, const FVoxelWorlGenerationFinished& Callback) override;
+	void GenerateChunk(AVoxelWorld* VoxelWorld, UVoxelChunk* Chunk) override;
+	bool CanGenerateChunksInParallel() const override;
 
 private:
 	UPROPERTY(EditDefaultsOnly)
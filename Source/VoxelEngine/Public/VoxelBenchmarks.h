@@ -0,0 +1,38 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class AVoxelWorld;
+
+/**
+ * Synthetic voxel engine benchmarks. Results are written to LogVoxelEngine.
+ * Exposed as console commands through UVoxelEngineCheatManager.
+ */
+class VOXELENGINE_API FVoxelBenchmarks
+{
+public:
+	// Compares allocation, world generation, full-chunk visibility pass and memory of the legacy global Z-major layout, chunk-major layout and chunk-major paletted layout.
+	// World dimensions are taken from VoxelWorld, terrain is generated from the same simplex noise as the world generator.
+	static void BenchmarkStorageLayout(const AVoxelWorld* VoxelWorld, int32 Iterations);
+
+	// Times full mesh generation of every loaded chunk of the live world
+	static void BenchmarkChunkMeshing(AVoxelWorld* VoxelWorld, int32 Iterations);
+
+	// Compares linear and Morton section indexing on neighbour-heavy workloads: six-neighbour visibility pass, box overlap queries and collision sweeps.
+	// Uses paletted sections of the world's ChunkSide, rounded up to a power of two.
+	static void BenchmarkVoxelIndexing(const AVoxelWorld* VoxelWorld, int32 Iterations);
+
+	// Encodes columns of every loaded chunk with the RLE column codec and decodes them back into a plain buffer.
+	// Reports compression ratio against raw bytes and paletted storage, and throughput in raw voxel bytes.
+	static void BenchmarkRunLengthCodec(const AVoxelWorld* VoxelWorld, int32 Iterations);
+
+	// Compares 8-bit and 16-bit voxel type IDs on paletted chunk storage: layered terrain generation and a six-neighbour visibility pass
+	// with a per-type flag lookup. World dimensions are taken from VoxelWorld.
+	static void BenchmarkVoxelTypeWidth(const AVoxelWorld* VoxelWorld, int32 Iterations);
+
+	// Rebuilds every section of the loaded chunks with the per-voxel ProcessVoxels kernel and the binary row-mask kernel.
+	// Reports chunks per second of each, meshes are built into a scratch mesh.
+	static void BenchmarkBinaryMeshing(AVoxelWorld* VoxelWorld, int32 Iterations);
+};
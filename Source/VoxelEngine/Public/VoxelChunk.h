@@ -6,49 +6,48 @@
 #include "Components/SceneComponent.h"
 #include "DynamicMesh/DynamicMesh3.h"
 #include "Components/DynamicMeshComponent.h"
-#include "Voxel.h"
+#include "VoxelType.h"
+#include "VoxelPalettedStorage.h"
+#include "VoxelIndexing.h"
 #include "Containers/List.h"
 #include "VoxelChange.h"
 #include "Containers/BitArray.h"
+#include "VoxelRunLengthCodec.h"
+#include "VoxelMeshing.h"
+#include "Tasks/Task.h"
 #include "VoxelChunk.generated.h"
 
-USTRUCT()
-struct VOXELENGINE_API FVoxelChunkSecondaryTickFunction : public FActorComponentTickFunction
-{
-	GENERATED_USTRUCT_BODY()
-
-	class UVoxelChunk* Target;
-
-	virtual void ExecuteTick(
-		float DeltaTime,
-		ELevelTick TickType,
-		ENamedThreads::Type CurrentThread,
-		const FGraphEventRef& MyCompletionGraphEvent) override;
-
-	virtual FString DiagnosticMessage() override;
-};
-
-template<>
-struct TStructOpsTypeTraits<FVoxelChunkSecondaryTickFunction> : public TStructOpsTypeTraitsBase2<FVoxelChunkSecondaryTickFunction>
-{
-	enum
-	{
-		WithCopy = false
-	};
-};
-
 UCLASS( ClassGroup=(Custom), meta=(BlueprintSpawnableComponent) )
 class VOXELENGINE_API UVoxelChunk : public USceneComponent
 {
 	GENERATED_BODY()
 
 public:	
+	// Binary meshing keeps a row of voxels in a 64-bit mask
+	static constexpr int32 MaxBinaryMeshingChunkSide = 64;
+
 	// Sets default values for this component's properties
 	UVoxelChunk();
 
-	// Called every frame
+	// Chunks only tick while bDebugDrawDimensions is set, the world drives chunks with pending work
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
-	virtual void TickSecondary(float DeltaTime, ELevelTick LevelTick, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent, FVoxelChunkSecondaryTickFunction* TickFunction);
+
+	// Called by the world for chunks with queued voxel changes. Patches or marks dirty the section meshes the changes touch,
+	// including those of neighbouring chunks.
+	void ProcessChangeRequests();
+
+	// Notifies rendering of section meshes patched by ProcessChangeRequests
+	void NotifyPatchedSections();
+
+	// Called by the world's meshing scheduler. Meshes dirty sections, or applies and launches section tasks with async meshing,
+	// until EndTimeSeconds but at least one section. Returns true once no meshing work is left.
+	bool UpdateMesh(double EndTimeSeconds);
+
+	// Dirty sections, or section tasks still running
+	bool HasPendingMeshing() const;
+
+	// Most urgent render priority of the changes waiting to be meshed
+	EVoxelChangeRenderPriority GetPendingRenderPriority() const;
 
 	UFUNCTION(BlueprintCallable)
 	int32 GetChunkSide() const;
@@ -71,13 +70,104 @@ public:
 
 	void MarkMeshDirty();
 
+	// Unlike MarkMeshDirty, re-checks visibility of every voxel instead of only the visible ones
+	void MarkMeshRebuildRequired();
+
+	// Marks the section containing the chunk-local Z dirty, Priority of the change that made it dirty
+	void MarkSectionDirty(int32 LocalZ, EVoxelChangeRenderPriority Priority = EVoxelChangeRenderPriority::AnyTime);
+
+	// Thread-safe. Queues the change for ProcessChangeRequests on the next world tick.
 	EVoxelChangeResult ChangeVoxelRendering(const FVoxelChange& VoxelChange);
 
+	// Allocates voxel sections of this chunk, all sections start as uniform empty. Must be called before the world is generated.
+	void AllocateVoxels();
+
+	// Allocates sections that borrow packed words from a saved payload until they are first written.
+	// Returns false and leaves the chunk empty if the payload doesn't match the chunk layout.
+	bool AllocateVoxelsFromPayload(TConstArrayView<uint8> Payload, TSharedPtr<IVoxelWordsOwner, ESPMode::ThreadSafe> PayloadOwner);
+
+	// Region file payload of all sections
+	void SerializeVoxels(TArray<uint8>& OutPayload) const;
+
+	// Delta payload of the voxels that differ from Baseline, a chunk at the same coordinate freshly generated
+	void SerializeVoxelDelta(const UVoxelChunk& Baseline, TArray<uint8>& OutPayload) const;
+
+	// Replays a delta payload over freshly generated voxels. Returns the number of edits, or INDEX_NONE if the payload is malformed.
+	int32 ApplyVoxelDelta(TConstArrayView<uint8> Payload);
+
+	// Appends voxel columns to an RLE stream, columns ordered X fastest, each column bottom to top
+	void EncodeColumns(FVoxelRunLengthEncoder& Encoder) const;
+
+	// Reads columns written by EncodeColumns. Returns false and leaves voxels untouched if the stream ends early.
+	// Does not notify rendering.
+	bool DecodeColumns(FVoxelRunLengthDecoder& Decoder);
+
+	bool HasUnsavedVoxels() const;
+
+	// Clears the unsaved flag and returns whether it was set. Writes racing with serialization set it again.
+	bool ResetUnsavedVoxels();
+
+	size_t GetVoxelsNum() const;
+
+	SIZE_T GetVoxelsAllocatedSize() const;
+
+	// Sections are cubes of ChunkSide voxels stacked along Z, the topmost one may be shorter
+	int32 GetSectionsNum() const;
+
+	int32 GetUniformSectionsNum() const;
+
+	bool IsSectionUniform(int32 SectionIndex, VoxelType& OutVoxelType) const;
+
+	// Storage of a section, ordered according to the world voxel indexing
+	const FVoxelPalettedStorage& GetSectionStorage(int32 SectionIndex) const;
+
+	// Fills the chunk-local box [LocalMin, LocalMax) without notifying rendering. Fully covered sections become uniform.
+	void FillVoxels(const FIntVector& LocalMin, const FIntVector& LocalMax, VoxelType Desired);
+
+	// Shrinks section palettes to the types actually present, single-type sections become uniform
+	void CompactVoxels();
+
+	// Chunk-local coordinate access
+	VoxelType GetVoxel(const FIntVector& LocalCoord) const;
+
+	// Lock-free unless the voxel type is new to this chunk's palette. Does not notify rendering.
+	void SetVoxel(const FIntVector& LocalCoord, VoxelType Desired);
+
+	// Lock-free unless the voxel type is new to this chunk's palette. Does not notify rendering.
+	bool CompareExchangeVoxel(const FIntVector& LocalCoord, VoxelType& Expected, VoxelType Desired);
+
+	// Full rebuild: recalculates visibility of every voxel in the chunk
+	void GenerateMesh();
+
+	// Full rebuild of a single section
+	void GenerateSectionMesh(int32 SectionIndex);
+
+	// Face layout of this chunk's section meshes
+	FVoxelMeshBuilder GetMeshBuilder() const;
+
+	// Sections of LOD N are meshed from cells of 2^N voxels, see FVoxelLodCells. Changing it rebuilds the mesh.
+	void SetMeshLod(int32 Lod);
+	int32 GetMeshLod() const;
+
+	// Full rebuild of a section into Buffers instead of the section's mesh components, updates the section's visible voxels.
+	// The binary kernel is used if requested and ChunkSide fits into a row mask. Returns the number of visible faces.
+	int32 BuildSectionMesh(int32 SectionIndex, FVoxelMeshBuffers& Buffers, bool bBinaryKernel);
+
+	// Triangles of the current section meshes, and triangles per-face meshing produces for the same visible faces
+	void GetMeshTrianglesNum(int32& OutTrianglesNum, int32& OutPerFaceTrianglesNum) const;
+
+	// Hides section meshes of face directions that point away from every view location, no view shows all of them.
+	// Hidden meshes still cast shadows.
+	void CullFaceDirections(TConstArrayView<FVector> ViewLocations);
+
 
 protected:
 	// Called when the game starts
 	void BeginPlay() override;
 
+	// Releases voxels and the mesh component when the chunk is unloaded
+	void OnComponentDestroyed(bool bDestroyingHierarchy) override;
+
 private:
 	UPROPERTY(EditAnywhere)
 	bool bDebugDrawDimensions = false;
@@ -90,35 +180,126 @@ private:
 	UPROPERTY(VisibleAnywhere)
 	int32 ChunkY = 0;
 
-	UPROPERTY(VisibleAnywhere, Category = Tick)
-	FVoxelChunkSecondaryTickFunction SecondaryComponentTick;
+	UPROPERTY(VisibleAnywhere)
+	int32 CachedChunkSide = 0;
+	UPROPERTY(VisibleAnywhere)
+	int32 CachedWorldHeight = 0;
+	UPROPERTY(VisibleAnywhere)
+	EVoxelIndexing CachedVoxelIndexing = EVoxelIndexing::Linear;
 
 	UPROPERTY(VisibleAnywhere)
-	bool bIsMeshDirty = false;
+	int32 MeshLod = 0;
 
+	// Each section has its own mesh per face direction, so an edit only remeshes the sections it touches
+	// and directions facing away from the camera can be skipped. Indexed by GetSectionMeshIndex.
+	// Null until the section has faces in that direction, see GetOrCreateSectionMeshComponent.
 	UPROPERTY(VisibleAnywhere)
-	UDynamicMeshComponent* DynamicMeshComponent;
+	TArray<UDynamicMeshComponent*> SectionMeshComponents;
+	// Face direction bits of each section that were visible at the last culling
+	TArray<uint8> SectionVisibleDirections;
+	// Set once a section mesh of this chunk passed through CheckSectionMeshValidity
+	bool bIsMeshValidated = false;
+
+	// Section-local linear indices of voxels with at least one visible face
+	TArray<TBitArray<FDefaultBitArrayAllocator>> SectionVisibleVoxels;
+
+	// Quad slots of per-face section meshes, invalid for sections that can't be patched. Indexed like SectionMeshComponents.
+	TArray<FVoxelSectionQuads> SectionQuads;
+	// Section meshes patched since the last notification, and those whose patches appended quads
+	TBitArray<FDefaultBitArrayAllocator> PatchedSectionMeshes;
+	TBitArray<FDefaultBitArrayAllocator> GrownSectionMeshes;
 
-	// TDoubleLinkedList<int32> VisibleVoxelIndices;
-	TBitArray<FDefaultBitArrayAllocator> VisibleVoxelIndices;
+	TArray<int32> SectionTrianglesNum;
+	TArray<int32> SectionPerFaceTrianglesNum;
+
+	// Mesh being built on a worker per section, null if none. Cancelled tasks are dropped from here.
+	TArray<TSharedPtr<FVoxelSectionMeshTask, ESPMode::ThreadSafe>> SectionMeshTasks;
+	TArray<UE::Tasks::FTask> SectionMeshTaskEvents;
+	// Cancelled tasks that may still be running, waited for before the chunk is destroyed
+	TArray<UE::Tasks::FTask> CancelledMeshTaskEvents;
+
+	TBitArray<FDefaultBitArrayAllocator> DirtySections;
+	TBitArray<FDefaultBitArrayAllocator> RebuildSections;
+	EVoxelChangeRenderPriority PendingRenderPriority = EVoxelChangeRenderPriority::AnyTime;
 	TQueue<FVoxelChange, EQueueMode::Mpsc> VoxelChangeRequests;
+	// Set while the chunk is queued with the world for ProcessChangeRequests
+	std::atomic<bool> bChangeRequestsScheduled{ false };
 
-	void GenerateMesh();
-	void ProcessVoxels();
-	void ProcessVoxel(int32 X, int32 Y, int32 Z);
+	// Vertical sections of chunk-local voxels, ordered inside a section according to CachedVoxelIndexing.
+	// Morton sections always span a full cube so that every code of the section is addressable.
+	TArray<TUniquePtr<FVoxelPalettedStorage>> Sections;
+
+	// Hash of each section's voxels and the section's finished write count it was computed at,
+	// so that only sections written since the last lookup are hashed again
+	TArray<uint64> SectionContentHashes;
+	TArray<uint64> SectionContentHashWrites;
+
+	// Set after every voxel write, including generation
+	std::atomic<bool> bHasUnsavedVoxels{ false };
+
+	// Visible faces are added to Buffers, or recorded into GreedyFaces for AddGreedyFaces when it is set. Return the number of visible faces.
+	// ProcessVoxels meshes a padded copy of the section, ProcessVoxel looks a single voxel's neighbours up in the world.
+	int32 ProcessVoxels(int32 SectionIndex, const FVoxelMeshBuilder& MeshBuilder, FVoxelMeshBuffers& Buffers, TArray<VoxelType>* GreedyFaces);
+	int32 ProcessVoxel(int32 X, int32 Y, int32 Z, const FVoxelMeshBuilder& MeshBuilder, FVoxelMeshBuffers& Buffers, TArray<VoxelType>* GreedyFaces);
+	// Same output as ProcessVoxels, but faces of a whole row of voxels are found at once from 64-bit opacity masks
+	int32 ProcessVoxelsBinary(int32 SectionIndex, const FVoxelMeshBuilder& MeshBuilder, FVoxelMeshBuffers& Buffers, TArray<VoxelType>* GreedyFaces);
 	bool IsFaceVisible(int32 X, int32 Y, int32 Z) const;
-	void AddFaceData(const Voxel& Voxel, int32 X, int32 Y, int32 Z, int FaceIndex);
+	// Copies the section and the face-adjacent voxels of the sections and chunks around it
+	void FillPaddedSection(int32 SectionIndex, FVoxelPaddedSection& Padded) const;
+	// Calls Visit(X, Y, Z, Type) for the face-adjacent voxels around the section in section-local coordinates,
+	// skipping the outside of the world and chunks that are not loaded
+	template<typename VisitorType>
+	void ForEachSectionBorderVoxel(int32 SectionIndex, VisitorType&& Visit) const;
+	void AddSectionGreedyFaces(int32 SectionIndex, const FVoxelMeshBuilder& MeshBuilder, TArray<VoxelType>& GreedyFaces, FVoxelMeshBuffers& Buffers) const;
+	int32 AddSectionLodFaces(int32 SectionIndex, const FVoxelMeshBuilder& MeshBuilder, FVoxelMeshBuffers& Buffers) const;
+	static FORCEINLINE int32 GetSectionMeshIndex(int32 SectionIndex, int32 FaceIndex)
+	{
+		return SectionIndex * 6 + FaceIndex;
+	}
 	int32 LinearizeCoordinate(int32 X, int32 Y, int32 Z) const;
+	int32 LinearizeSectionCoordinate(int32 X, int32 Y, int32 SectionZ) const;
+	int32 GetSectionVisibilityIndex(const FIntVector& LocalCoord, int32& OutSectionIndex) const;
+	bool IsSectionUniformOpaque(int32 SectionIndex) const;
+	bool IsSectionEnclosed(int32 SectionIndex) const;
 	FIntVector DelinearizeCoordinate(int32 LinearCoord) const;
-	void ProcessChangeRequest(const FVoxelChange& Request);
-
-	bool CopyVertexColorsToOverlay(
-		const FDynamicMesh3& Mesh,
-		UE::Geometry::FDynamicMeshColorOverlay& ColorOverlayOut,
-		bool bCompactElements
-	);
+	// Recomputes visibility of changed voxels and their neighbours in this chunk, then patches their faces
+	// or marks their sections dirty once for the whole batch
+	void UpdateAffectedVoxels(TArray<FIntVector>& LocalCoords, EVoxelChangeRenderPriority Priority);
 
 	int CheckVoxelSidesVisibility(const FIntVector& VoxelWorldCoord, TStaticArray<bool, 6>& SideVisilityFlags);
-	void UpdateVoxelVisibility(const FIntVector& VoxelWorldCoord, bool bUpdateNeighbours);
-	void RegenerateMesh();
+	void UpdateVoxelVisibility(const FIntVector& LocalCoord);
+	void RegenerateSectionMesh(int32 SectionIndex);
+	void ResetSectionMeshes(int32 SectionIndex);
+	// Ensures on invalid direction meshes or color overlays of a section, only meant for checked builds
+	void CheckSectionMeshValidity(int32 SectionIndex) const;
+	// Creates the direction mesh with the chunk's material, culling and wireframe state, its mesh starts empty
+	UDynamicMeshComponent* GetOrCreateSectionMeshComponent(int32 SectionMeshIndex);
+	// Splits the buffers into the section's direction meshes
+	void AppendSectionMeshes(int32 SectionIndex, const FVoxelMeshBuffers& Buffers);
+	void FinishSectionMesh(int32 SectionIndex, int32 VisibleFacesNum);
+	// Covers the section and the voxels around it its faces depend on
+	TSharedRef<FVoxelReadSnapshot, ESPMode::ThreadSafe> AcquireSectionSnapshot(int32 SectionIndex) const;
+
+	// Mesh cache: synchronous rebuilds are looked up before they are meshed and added under the key they were looked up with,
+	// worker tasks make their own key and are looked up and added when applied. See FVoxelMeshCache::MakeSectionMeshKey.
+	uint64 GetSectionMeshKey(int32 SectionIndex);
+	uint64 GetSectionContentHash(int32 SectionIndex);
+	// Returns false on a miss or if the cache is disabled
+	bool ApplyCachedSectionMesh(int32 SectionIndex, uint64 MeshKey);
+	// Buffers must be the full rebuild that produced the section's current visible voxels
+	void AddCachedSectionMesh(int32 SectionIndex, uint64 MeshKey, FVoxelMeshBuffers Buffers, int32 VisibleFacesNum);
+	void UpdateSectionMeshComponent(int32 SectionIndex, int32 VisibleFacesNum);
+
+	// Edits rewrite only the faces of the changed voxel and its neighbours in the current section mesh
+	void ResetSectionQuads(int32 SectionMeshIndex, TConstArrayView<int32> QuadFaceKeys);
+	// Returns false if the voxel's section mesh can't be patched and has to be remeshed instead
+	bool PatchVoxelFaces(const FIntVector& LocalCoord);
+
+	// Async meshing: sections marked dirty are rebuilt by worker tasks from a read snapshot,
+	// finished meshes are swapped into the section mesh components when the world's meshing scheduler next updates the chunk
+	void TickSectionMeshTasks(double EndTimeSeconds);
+	void LaunchSectionMeshTask(int32 SectionIndex);
+	void CancelSectionMeshTask(int32 SectionIndex);
+	void CancelSectionMeshTasks();
+	void ApplySectionMeshTask(int32 SectionIndex);
 };
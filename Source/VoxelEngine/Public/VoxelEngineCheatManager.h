@@ -23,4 +23,25 @@ public:
 
 	UFUNCTION(Exec)
 	void RegenerateChunkMeshes();
+
+	UFUNCTION(Exec)
+	void ReportMeshCacheStats();
+
+	UFUNCTION(Exec)
+	void BenchmarkVoxelStorageLayout(int32 Iterations);
+
+	UFUNCTION(Exec)
+	void BenchmarkChunkMeshing(int32 Iterations);
+
+	UFUNCTION(Exec)
+	void BenchmarkVoxelIndexing(int32 Iterations);
+
+	UFUNCTION(Exec)
+	void BenchmarkRunLengthCodec(int32 Iterations);
+
+	UFUNCTION(Exec)
+	void BenchmarkVoxelTypeWidth(int32 Iterations);
+
+	UFUNCTION(Exec)
+	void BenchmarkBinaryMeshing(int32 Iterations);
 };
@@ -0,0 +1,46 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Function.h"
+
+/**
+ * Epoch-based reclamation of voxel memory read by worker threads without locks.
+ * Readers pin the current epoch for the duration of their reads. Memory unpublished while the epoch was E
+ * is retired with stamp E and freed only once every pinned epoch is newer than E.
+ * The game thread advances the epoch and reclaims once per frame, so game thread reads never need a pin.
+ */
+struct VOXELENGINE_API FVoxelEpochs
+{
+	static constexpr int32 MaxPinnedReaders = 256;
+
+	// Returns the reader slot to pass to Unpin. Waits if MaxPinnedReaders readers are already pinned.
+	static int32 Pin();
+
+	static void Unpin(int32 Slot);
+
+	static uint64 GetCurrentEpoch();
+
+	// Deleter runs once no pinned reader can still be using the memory. Must be called after the memory is unpublished.
+	static void Retire(TUniqueFunction<void()> Deleter);
+
+	// Game thread. Starts a new epoch and runs deleters of memory no reader can see anymore.
+	static void AdvanceAndReclaim();
+
+	static int32 GetRetiredNum();
+};
+
+// Pins the current epoch for the lifetime of the guard
+class VOXELENGINE_API FVoxelEpochGuard
+{
+public:
+	FVoxelEpochGuard();
+	~FVoxelEpochGuard();
+
+	FVoxelEpochGuard(const FVoxelEpochGuard&) = delete;
+	FVoxelEpochGuard& operator=(const FVoxelEpochGuard&) = delete;
+
+private:
+	int32 Slot;
+};
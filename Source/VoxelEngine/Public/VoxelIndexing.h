@@ -0,0 +1,69 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelIndexing.generated.h"
+
+UENUM(BlueprintType)
+enum class EVoxelIndexing : uint8
+{
+	// X is contiguous, then Y, then Z
+	Linear = 0,
+	// Bit-interleaved Z-order, neighbours along every axis stay close in memory. Requires power of two ChunkSide.
+	Morton = 1
+};
+
+// 3D Morton code of coordinates up to 10 bits per axis, enough for sections of up to 1024 voxels per side
+struct VOXELENGINE_API FVoxelMorton
+{
+	static constexpr int32 MaxBitsPerAxis = 10;
+
+	static FORCEINLINE uint32 Encode(uint32 X, uint32 Y, uint32 Z)
+	{
+		return SpreadBits(X) | (SpreadBits(Y) << 1) | (SpreadBits(Z) << 2);
+	}
+
+	static FORCEINLINE void Decode(uint32 Code, int32& OutX, int32& OutY, int32& OutZ)
+	{
+		OutX = CompactBits(Code);
+		OutY = CompactBits(Code >> 1);
+		OutZ = CompactBits(Code >> 2);
+	}
+
+private:
+	// Inserts two zero bits after each of the lower 10 bits
+	static FORCEINLINE uint32 SpreadBits(uint32 Value)
+	{
+		Value &= 0x000003ff;
+		Value = (Value | (Value << 16)) & 0xff0000ff;
+		Value = (Value | (Value << 8)) & 0x0300f00f;
+		Value = (Value | (Value << 4)) & 0x030c30c3;
+		Value = (Value | (Value << 2)) & 0x09249249;
+		return Value;
+	}
+
+	// Inverse of SpreadBits
+	static FORCEINLINE uint32 CompactBits(uint32 Value)
+	{
+		Value &= 0x09249249;
+		Value = (Value | (Value >> 2)) & 0x030c30c3;
+		Value = (Value | (Value >> 4)) & 0x0300f00f;
+		Value = (Value | (Value >> 8)) & 0xff0000ff;
+		Value = (Value | (Value >> 16)) & 0x000003ff;
+		return Value;
+	}
+};
+
+// Index of a section-local voxel inside its section storage
+struct VOXELENGINE_API FVoxelSectionIndexing
+{
+	static FORCEINLINE int32 Linearize(EVoxelIndexing Indexing, int32 ChunkSide, int32 X, int32 Y, int32 SectionZ)
+	{
+		if (Indexing == EVoxelIndexing::Morton)
+		{
+			return FVoxelMorton::Encode(X, Y, SectionZ);
+		}
+		return (SectionZ * ChunkSide + Y) * ChunkSide + X;
+	}
+};
@@ -0,0 +1,118 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/BitArray.h"
+#include "Hash/xxhash.h"
+#include "VoxelMeshing.h"
+#include "VoxelPalettedStorage.h"
+
+// Everything a section's mesh components are rebuilt from
+struct VOXELENGINE_API FVoxelMeshCacheEntry
+{
+	FVoxelMeshBuffers Buffers;
+	TBitArray<FDefaultBitArrayAllocator> VisibleVoxels;
+	int32 VisibleFacesNum = 0;
+
+	SIZE_T GetAllocatedSize() const;
+};
+
+struct VOXELENGINE_API FVoxelMeshCacheStats
+{
+	int64 Hits = 0;
+	int64 Misses = 0;
+	int64 Evictions = 0;
+	int32 EntriesNum = 0;
+	SIZE_T AllocatedSize = 0;
+};
+
+/**
+ * Built section meshes keyed by a hash of everything they were built from, see MakeSectionMeshKey.
+ * Sections whose voxels and surroundings match a cached key reuse its mesh instead of being remeshed,
+ * e.g. when all chunks are regenerated or an edit is undone. Least recently used entries are evicted once
+ * the cache grows past its size. Game thread only, keys can be made on any thread.
+ */
+class VOXELENGINE_API FVoxelMeshCache
+{
+public:
+	explicit FVoxelMeshCache(SIZE_T InMaxAllocatedSize);
+
+	// Null on a miss. Counts the lookup as a hit or a miss.
+	TSharedPtr<const FVoxelMeshCacheEntry, ESPMode::ThreadSafe> Find(uint64 Key);
+
+	// Replaces the entry of an existing key
+	void Add(uint64 Key, TSharedRef<const FVoxelMeshCacheEntry, ESPMode::ThreadSafe> Entry);
+
+	void Empty();
+
+	FVoxelMeshCacheStats GetStats() const;
+
+	// Any thread. Hash of a section's voxels in storage order, a uniform section hashes its type alone.
+	static uint64 HashSectionVoxels(const FVoxelPalettedStorage& Storage);
+
+	// Any thread. Key of a section mesh built with MeshBuilder from voxels hashed by HashSectionVoxels.
+	// Neighbours only decide which faces are visible, so IsOpaque(X, Y, Z) is asked about the slabs 2^MeshLod voxels
+	// thick outside each side of the section, in section-local coordinates. Voxels diagonal to the section never
+	// affect its faces. Vertices are chunk-local, so equal sections of different chunks share a key.
+	template<typename IsOpaqueType>
+	static uint64 MakeSectionMeshKey(const FVoxelMeshBuilder& MeshBuilder, int32 SectionIndex, int32 MeshLod,
+		uint64 ContentHash, const FIntVector& SectionSize, IsOpaqueType&& IsOpaque)
+	{
+		int32 Border = 1 << MeshLod;
+		TArray<uint64, TInlineAllocator<256>> ShellOpacity;
+		int32 ShellVoxelsNum = 0;
+		for (int32 Axis = 0; Axis < 3; Axis++)
+		{
+			for (int32 Side = 0; Side < 2; Side++)
+			{
+				FIntVector SlabMin = FIntVector::ZeroValue;
+				FIntVector SlabMax = SectionSize;
+				SlabMin[Axis] = Side == 0 ? -Border : SectionSize[Axis];
+				SlabMax[Axis] = SlabMin[Axis] + Border;
+				for (int32 Z = SlabMin.Z; Z < SlabMax.Z; Z++)
+				{
+					for (int32 Y = SlabMin.Y; Y < SlabMax.Y; Y++)
+					{
+						for (int32 X = SlabMin.X; X < SlabMax.X; X++)
+						{
+							if (ShellVoxelsNum % 64 == 0)
+							{
+								ShellOpacity.Add(0);
+							}
+							ShellOpacity.Last() |= uint64(IsOpaque(X, Y, Z)) << (ShellVoxelsNum % 64);
+							ShellVoxelsNum++;
+						}
+					}
+				}
+			}
+		}
+
+		int32 Layout[] = { SectionIndex, MeshLod, MeshBuilder.IsGreedy() ? 1 : 0 };
+		FXxHash64Builder Builder;
+		Builder.Update(&ContentHash, sizeof(ContentHash));
+		Builder.Update(ShellOpacity.GetData(), ShellOpacity.Num() * sizeof(uint64));
+		Builder.Update(Layout, sizeof(Layout));
+		return Builder.Finalize().Hash;
+	}
+
+private:
+	struct FSlot
+	{
+		TSharedRef<const FVoxelMeshCacheEntry, ESPMode::ThreadSafe> Entry;
+		SIZE_T AllocatedSize;
+		uint64 LastUse;
+	};
+
+	TMap<uint64, FSlot> Slots;
+	SIZE_T MaxAllocatedSize;
+	SIZE_T AllocatedSize = 0;
+	uint64 UseCounter = 0;
+	int64 Hits = 0;
+	int64 Misses = 0;
+	int64 Evictions = 0;
+
+	// Drops least recently used entries until the cache is back under three quarters of its size,
+	// so that eviction doesn't run again on every following insert
+	void Evict();
+};
@@ -0,0 +1,434 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DynamicMesh/DynamicMesh3.h"
+#include "DynamicMesh/DynamicMeshAttributeSet.h"
+#include "Containers/BitArray.h"
+#include "Containers/StaticArray.h"
+#include "VoxelType.h"
+#include <atomic>
+#include "VoxelMeshing.generated.h"
+
+class UVoxelTypeSet;
+class FVoxelReadSnapshot;
+
+UENUM(BlueprintType)
+enum class EVoxelMeshingMode : uint8
+{
+	// Two triangles for every visible voxel face
+	PerFace = 0,
+	// Coplanar faces of the same voxel type are merged into maximal rectangles.
+	// UV0 counts voxels across the quad and UV1 holds the atlas tile origin, the material tiles the atlas itself.
+	Greedy = 1
+};
+
+/**
+ * Flat vertex and index arrays of a section mesh, four vertices and two triangles per quad.
+ * Faces are written here first and copied into the FDynamicMesh3 in one pass.
+ */
+struct VOXELENGINE_API FVoxelMeshBuffers
+{
+	TArray<FVector3f> Positions;
+	TArray<FVector2f> UVs;
+	// Atlas tile origin per vertex, empty unless faces use tiled UVs
+	TArray<FVector2f> TileOrigins;
+	TArray<FVector3f> Colors;
+	TArray<UE::Geometry::FIndex3i> Triangles;
+	// Face key of every quad, see FVoxelSectionQuads. INDEX_NONE for merged quads.
+	TArray<int32> QuadFaceKeys;
+	// Face direction of every quad, section meshes keep each direction in its own mesh
+	TArray<uint8> QuadFaceIndices;
+
+	// Emptied buffers of the calling thread that keep their allocations between sections
+	static FVoxelMeshBuffers& GetScratch();
+
+	void Reset();
+
+	int32 GetQuadsNum() const;
+
+	SIZE_T GetAllocatedSize() const;
+
+	// Appends the quads facing FaceIndex, or all quads for INDEX_NONE, after those already in Mesh.
+	// Mesh must be prepared by FVoxelMeshBuilder::InitializeMesh and only ever be filled by this function.
+	void AppendToMesh(FDynamicMesh3& Mesh, int32 FaceIndex = INDEX_NONE) const;
+
+	// Face keys of the quads AppendToMesh appends for FaceIndex, in the same order
+	void GetQuadFaceKeys(int32 FaceIndex, TArray<int32>& OutQuadFaceKeys) const;
+};
+
+/**
+ * Quad slots of a per-face section mesh, so that voxel edits patch faces in place instead of remeshing.
+ * Quad N owns vertices 4N to 4N + 3 and triangles 2N and 2N + 1. Faces that become hidden leave their quad
+ * collapsed to a point on a free list, the next face that appears reuses it.
+ */
+struct VOXELENGINE_API FVoxelSectionQuads
+{
+	// Face key of a section-local voxel index
+	static FORCEINLINE int32 GetFaceKey(int32 FaceIndex, int32 VoxelIndex, int32 SectionVoxelsNum)
+	{
+		return FaceIndex * SectionVoxelsNum + VoxelIndex;
+	}
+
+	// Takes over a mesh freshly built from buffers with these quad face keys
+	void Reset(TConstArrayView<int32> QuadFaceKeys);
+
+	// The mesh no longer matches the slots, e.g. greedy meshing merged faces
+	void Invalidate();
+
+	bool IsValid() const;
+
+	// Quads currently showing a face
+	int32 GetFacesNum() const;
+
+	// Writes the single quad in Quad as the face's quad, reusing the face's slot or a free one when possible.
+	// Returns true if the quad was appended, which changes the mesh topology.
+	bool SetFace(FDynamicMesh3& Mesh, int32 FaceKey, const FVoxelMeshBuffers& Quad);
+
+	// Collapses the face's quad if it has one. Returns true if it had.
+	bool RemoveFace(FDynamicMesh3& Mesh, int32 FaceKey);
+
+private:
+	TMap<int32, int32> FaceQuads;
+	TArray<int32> FreeQuads;
+	int32 QuadsNum = 0;
+	bool bIsValid = false;
+
+	static void WriteQuad(FDynamicMesh3& Mesh, int32 QuadIndex, const FVoxelMeshBuffers& Quad);
+};
+
+/**
+ * Writes voxel faces into section mesh buffers. Holds no UObject references, so worker threads can use it.
+ * Vertices are in chunk-local coordinates.
+ */
+struct VOXELENGINE_API FVoxelMeshBuilder
+{
+	double VoxelSizeWorld = 100;
+	int32 VoxelTypesNum = 1;
+	EVoxelMeshingMode MeshingMode = EVoxelMeshingMode::PerFace;
+
+	bool IsGreedy() const;
+
+	// Prepares an empty mesh with the attributes section meshes use
+	void InitializeMesh(FDynamicMesh3& Mesh) const;
+
+	// Size is the quad extent in voxels, 1 along the face normal. FaceKey identifies unmerged faces for patching.
+	void AddFace(FVoxelMeshBuffers& Buffers, VoxelType VoxelTypeId, int32 X, int32 Y, int32 Z, int32 FaceIndex, int32 FaceKey = INDEX_NONE, const FIntVector& Size = FIntVector(1, 1, 1), bool bTiledUVs = false) const;
+
+	// GreedyFaces holds a voxel type per face direction and section voxel, EmptyVoxelType where no face is visible.
+	// Voxels are indexed like section visible voxels, Dims is the section size. Consumed while merging.
+	void AddGreedyFaces(FVoxelMeshBuffers& Buffers, TArray<VoxelType>& GreedyFaces, const FIntVector& Dims, int32 SectionMinZ) const;
+};
+
+/**
+ * Opacity of a section and a one voxel border around it, one 64-bit row along X per (Y, Z).
+ * Visible faces of a whole row are found at once with shifts and masks.
+ */
+struct VOXELENGINE_API FVoxelOpacityRows
+{
+	// ChunkSide must fit into a row
+	void Initialize(int32 InChunkSide, int32 InSectionHeight);
+
+	int32 GetChunkSide() const;
+	int32 GetSectionHeight() const;
+	uint64 GetFullRow() const;
+
+	// Bit X is set if voxel (X, Y, Z) is opaque. Y and Z range from -1 to include the neighbouring rows and layers.
+	FORCEINLINE uint64& GetRow(int32 Y, int32 Z)
+	{
+		return Rows[(Z + 1) * RowsPerLayer + Y + 1];
+	}
+
+	FORCEINLINE uint64 GetRow(int32 Y, int32 Z) const
+	{
+		return Rows[(Z + 1) * RowsPerLayer + Y + 1];
+	}
+
+	// Bit Y is set if the voxel just outside the section along X is opaque, indexed by section Z
+	TArray<uint64> OpaqueMinX;
+	TArray<uint64> OpaquePlusX;
+
+	// Calls Visit(X, Y, Z, FaceMask) for every voxel with a visible face, bit FaceIndex of FaceMask set for each visible face.
+	// Coordinates are section-local.
+	template<typename VisitorType>
+	void ForEachVisibleVoxel(VisitorType&& Visit) const
+	{
+		for (int32 Z = 0; Z < SectionHeight; Z++)
+		{
+			for (int32 Y = 0; Y < ChunkSide; Y++)
+			{
+				uint64 Row = GetRow(Y, Z);
+				if (Row == 0)
+				{
+					continue;
+				}
+				uint64 MinXBit = (OpaqueMinX[Z] >> Y) & 1;
+				uint64 PlusXBit = (OpaquePlusX[Z] >> Y) & 1;
+				TStaticArray<uint64, 6> FaceRows;
+				FaceRows[0] = Row & ~GetRow(Y, Z + 1); // Top
+				FaceRows[1] = Row & ~GetRow(Y, Z - 1); // Bottom
+				FaceRows[2] = Row & ~((Row >> 1) | (PlusXBit << (ChunkSide - 1))); // Front
+				FaceRows[3] = Row & ~((Row << 1) | MinXBit); // Back
+				FaceRows[4] = Row & ~GetRow(Y - 1, Z); // Left
+				FaceRows[5] = Row & ~GetRow(Y + 1, Z); // Right
+
+				uint64 VisibleRow = FaceRows[0] | FaceRows[1] | FaceRows[2] | FaceRows[3] | FaceRows[4] | FaceRows[5];
+				while (VisibleRow != 0)
+				{
+					int32 X = FMath::CountTrailingZeros64(VisibleRow);
+					VisibleRow &= VisibleRow - 1;
+
+					uint32 FaceMask = 0;
+					for (int32 FaceIndex = 0; FaceIndex < 6; FaceIndex++)
+					{
+						FaceMask |= static_cast<uint32>((FaceRows[FaceIndex] >> X) & 1) << FaceIndex;
+					}
+					Visit(X, Y, Z, FaceMask);
+				}
+			}
+		}
+	}
+
+private:
+	int32 ChunkSide = 0;
+	int32 SectionHeight = 0;
+	int32 RowsPerLayer = 0;
+	TArray<uint64> Rows;
+};
+
+/**
+ * Voxel types and opacity of a section and a one voxel border around it, copied once before meshing so that
+ * neighbour lookups are fixed offsets into flat arrays, without bounds checks or chunk lookups.
+ * Edges and corners of the border are never read and stay empty.
+ */
+struct VOXELENGINE_API FVoxelPaddedSection
+{
+	// Copy of the calling thread that keeps its allocations between sections, Initialize before use
+	static FVoxelPaddedSection& GetScratch();
+
+	// Sizes the copy and fills it with transparent EmptyVoxelType
+	void Initialize(int32 InChunkSide, int32 InSectionHeight);
+
+	int32 GetChunkSide() const;
+	int32 GetSectionHeight() const;
+
+	// X, Y and Z range from -1 to include the border
+	FORCEINLINE void Set(int32 X, int32 Y, int32 Z, VoxelType Type, bool bIsOpaque)
+	{
+		int32 Index = GetIndex(X, Y, Z);
+		Types[Index] = Type;
+		Opacity[Index] = bIsOpaque;
+	}
+
+	FORCEINLINE VoxelType Get(int32 X, int32 Y, int32 Z) const
+	{
+		return Types[GetIndex(X, Y, Z)];
+	}
+
+	// Bit FaceIndex is set for every face of an opaque voxel whose neighbour is transparent, zero for transparent voxels.
+	// Only voxels inside the section.
+	FORCEINLINE uint32 GetVisibleFaceMask(int32 X, int32 Y, int32 Z) const
+	{
+		const uint8* Voxel = Opacity.GetData() + GetIndex(X, Y, Z);
+		uint32 FaceMask =
+			(Voxel[StrideZ] ^ 1u) | // Top
+			(Voxel[-StrideZ] ^ 1u) << 1 | // Bottom
+			(Voxel[1] ^ 1u) << 2 | // Front
+			(Voxel[-1] ^ 1u) << 3 | // Back
+			(Voxel[-StrideY] ^ 1u) << 4 | // Left
+			(Voxel[StrideY] ^ 1u) << 5; // Right
+		return FaceMask & (0u - Voxel[0]);
+	}
+
+private:
+	int32 ChunkSide = 0;
+	int32 SectionHeight = 0;
+	int32 StrideY = 0;
+	int32 StrideZ = 0;
+	TArray<VoxelType> Types;
+	// 1 for opaque voxels
+	TArray<uint8> Opacity;
+
+	FORCEINLINE int32 GetIndex(int32 X, int32 Y, int32 Z) const
+	{
+		return (Z + 1) * StrideZ + (Y + 1) * StrideY + X + 1;
+	}
+};
+
+/**
+ * Downsampled section for distant chunks. Cells of LodScale^3 voxels take the most common opaque type of their voxels
+ * if at least half of them are opaque, and faces are emitted between opaque and empty cells. Opaque cells on the chunk's
+ * sides whose top is visible also get skirts, side faces pointing out of the chunk even if the neighbouring cell is opaque,
+ * which cover cracks against neighbour chunks meshed at a different LOD.
+ */
+struct VOXELENGINE_API FVoxelLodCells
+{
+	// GetVoxel(const FIntVector& LocalCoord) reads chunk-local voxels up to LodScale voxels outside the section,
+	// IsOpaque(VoxelType) tells opaque types apart. LodScale must divide ChunkSide.
+	template<typename GetVoxelType, typename IsOpaqueType>
+	void Build(int32 InChunkSide, int32 InSectionMinZ, int32 InSectionHeight, int32 InLodScale, GetVoxelType&& GetVoxel, IsOpaqueType&& IsOpaque)
+	{
+		check(InLodScale > 1 && InChunkSide % InLodScale == 0);
+		ChunkSide = InChunkSide;
+		SectionMinZ = InSectionMinZ;
+		SectionHeight = InSectionHeight;
+		LodScale = InLodScale;
+		CellsNum = FIntVector(ChunkSide / LodScale, ChunkSide / LodScale, FMath::DivideAndRoundUp(SectionHeight, LodScale));
+		Cells.Init(EmptyVoxelType, (CellsNum.X + 2) * (CellsNum.Y + 2) * (CellsNum.Z + 2));
+
+		TArray<TPair<VoxelType, int32>, TInlineAllocator<8>> TypeCounts;
+		for (int32 CellZ = -1; CellZ <= CellsNum.Z; CellZ++)
+		{
+			for (int32 CellY = -1; CellY <= CellsNum.Y; CellY++)
+			{
+				for (int32 CellX = -1; CellX <= CellsNum.X; CellX++)
+				{
+					// Only border cells sharing a face with the section are ever looked at
+					int32 OutsideAxesNum = (CellX < 0 || CellX == CellsNum.X) + (CellY < 0 || CellY == CellsNum.Y) + (CellZ < 0 || CellZ == CellsNum.Z);
+					if (OutsideAxesNum > 1)
+					{
+						continue;
+					}
+
+					FIntVector CellMin(CellX * LodScale, CellY * LodScale, SectionMinZ + CellZ * LodScale);
+					// The topmost cell of a section whose height is not a multiple of LodScale is cut off
+					int32 CellHeight = CellZ == CellsNum.Z - 1 ? SectionHeight - CellZ * LodScale : LodScale;
+					TypeCounts.Reset();
+					int32 OpaqueNum = 0;
+					for (int32 Z = 0; Z < CellHeight; Z++)
+					{
+						for (int32 Y = 0; Y < LodScale; Y++)
+						{
+							for (int32 X = 0; X < LodScale; X++)
+							{
+								VoxelType Type = GetVoxel(CellMin + FIntVector(X, Y, Z));
+								if (!IsOpaque(Type))
+								{
+									continue;
+								}
+								OpaqueNum++;
+								TPair<VoxelType, int32>* TypeCount = TypeCounts.FindByPredicate([Type](const TPair<VoxelType, int32>& Count) { return Count.Key == Type; });
+								if (TypeCount)
+								{
+									TypeCount->Value++;
+								}
+								else
+								{
+									TypeCounts.Emplace(Type, 1);
+								}
+							}
+						}
+					}
+					if (OpaqueNum * 2 < CellHeight * LodScale * LodScale)
+					{
+						continue;
+					}
+					TPair<VoxelType, int32> MostCommon = TypeCounts[0];
+					for (const TPair<VoxelType, int32>& TypeCount : TypeCounts)
+					{
+						if (TypeCount.Value > MostCommon.Value)
+						{
+							MostCommon = TypeCount;
+						}
+					}
+					GetCell(CellX, CellY, CellZ) = MostCommon.Key;
+				}
+			}
+		}
+	}
+
+	// Writes faces of the section's cells, vertices in chunk-local coordinates. Returns the number of faces.
+	int32 AddFaces(const FVoxelMeshBuilder& MeshBuilder, FVoxelMeshBuffers& Buffers) const;
+
+private:
+	int32 ChunkSide = 0;
+	int32 SectionMinZ = 0;
+	int32 SectionHeight = 0;
+	int32 LodScale = 1;
+	FIntVector CellsNum = FIntVector::ZeroValue;
+	// Cell types including a one cell border, EmptyVoxelType for mostly transparent cells
+	TArray<VoxelType> Cells;
+
+	FORCEINLINE VoxelType& GetCell(int32 CellX, int32 CellY, int32 CellZ)
+	{
+		return Cells[((CellZ + 1) * (CellsNum.Y + 2) + CellY + 1) * (CellsNum.X + 2) + CellX + 1];
+	}
+
+	FORCEINLINE VoxelType GetCell(int32 CellX, int32 CellY, int32 CellZ) const
+	{
+		return Cells[((CellZ + 1) * (CellsNum.Y + 2) + CellY + 1) * (CellsNum.X + 2) + CellX + 1];
+	}
+};
+
+/**
+ * Full rebuild of one section mesh on a worker thread. Voxels are read through a snapshot, so the task
+ * never touches the chunk, and the result is only swapped into the section's mesh component on the game thread.
+ */
+class VOXELENGINE_API FVoxelSectionMeshTask
+{
+public:
+	// The snapshot must cover the section and one voxel around it, or 2^MeshLod voxels for LOD meshes.
+	// The type set must outlive the task.
+	FVoxelSectionMeshTask(
+		const FVoxelMeshBuilder& InMeshBuilder,
+		const UVoxelTypeSet* InVoxelTypeSet,
+		TSharedRef<FVoxelReadSnapshot, ESPMode::ThreadSafe> InSnapshot,
+		const FIntVector& InChunkMin,
+		int32 InChunkSide,
+		int32 InSectionIndex,
+		int32 InSectionHeight,
+		int32 InMeshLod = 0);
+
+	// Keeps a copy of the buffers the meshes were built from and makes their mesh cache key from the snapshot,
+	// so that the game thread only looks the result up once it is applied. Call before Run.
+	void SetKeepBuffers(bool bInKeepBuffers);
+
+	// Any thread. Returns early once cancelled.
+	void Run();
+
+	// Any thread. A cancelled task's result must not be used.
+	void Cancel();
+	bool IsCancelled() const;
+
+	// True if voxels the mesh was built from were written after the snapshot was taken. Call once Run has finished.
+	bool IsStale() const;
+
+	int32 GetSectionIndex() const;
+	// Mesh of the faces pointing in FaceIndex direction
+	FDynamicMesh3& GetMesh(int32 FaceIndex);
+	// Section-local linear indices of voxels with at least one visible face, none for LOD meshes
+	TBitArray<FDefaultBitArrayAllocator>& GetVisibleVoxels();
+	// Face key of every quad of the FaceIndex direction mesh
+	TArray<int32>& GetQuadFaceKeys(int32 FaceIndex);
+	int32 GetVisibleFacesNum() const;
+	double GetBuildMilliseconds() const;
+	// Empty unless the task was asked to keep them
+	FVoxelMeshBuffers& GetBuffers();
+	// See FVoxelMeshCache::MakeSectionMeshKey, zero unless the buffers were kept
+	uint64 GetMeshKey() const;
+
+private:
+	FVoxelMeshBuilder MeshBuilder;
+	const UVoxelTypeSet* VoxelTypeSet;
+	TSharedRef<FVoxelReadSnapshot, ESPMode::ThreadSafe> Snapshot;
+	FIntVector ChunkMin;
+	int32 ChunkSide;
+	int32 SectionIndex;
+	int32 SectionHeight;
+	int32 MeshLod;
+	bool bKeepBuffers = false;
+
+	std::atomic<bool> bCancelled{ false };
+
+	TStaticArray<FDynamicMesh3, 6> Meshes;
+	TBitArray<FDefaultBitArrayAllocator> VisibleVoxels;
+	TStaticArray<TArray<int32>, 6> QuadFaceKeys;
+	int32 VisibleFacesNum = 0;
+	double BuildMilliseconds = 0;
+	FVoxelMeshBuffers KeptBuffers;
+	uint64 MeshKey = 0;
+
+	void RunLod(const FDateTime& StartTime);
+	void FinishMesh(const FVoxelMeshBuffers& Buffers, const FDateTime& StartTime);
+};
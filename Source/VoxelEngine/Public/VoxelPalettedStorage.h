@@ -0,0 +1,313 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelType.h"
+#include "HAL/CriticalSection.h"
+#include "Templates/SharedPointer.h"
+#include "Templates/UniquePtr.h"
+#include <atomic>
+
+// Keeps externally owned packed words alive, e.g. a memory-mapped region file
+class IVoxelWordsOwner
+{
+public:
+	virtual ~IVoxelWordsOwner() = default;
+};
+
+/**
+ * Palette of a packed buffer: voxel types in entry order and the reverse lookup.
+ * Entries are only added under the storage lock, lookups are lock-free.
+ * Wide voxel types use an open-addressing lookup sized to the palette capacity, so a buffer never pays for the whole ID range.
+ */
+template<typename InVoxelType>
+struct TVoxelPalette
+{
+	static constexpr int32 MaxSize = 1 << (sizeof(InVoxelType) * 8);
+
+	// Not thread-safe. Empties the palette, Capacity must be a power of two.
+	void Initialize(int32 InCapacity)
+	{
+		check(FMath::IsPowerOfTwo(InCapacity) && InCapacity <= MaxSize);
+		Capacity = InCapacity;
+		SlotMask = Capacity * 2 - 1;
+		Entries = MakeUnique<std::atomic<InVoxelType>[]>(Capacity);
+		Slots = MakeUnique<std::atomic<uint64>[]>(Capacity * 2);
+		Size.store(0, std::memory_order_relaxed);
+	}
+
+	FORCEINLINE int32 Num() const
+	{
+		return Size.load(std::memory_order_acquire);
+	}
+
+	FORCEINLINE InVoxelType Get(int32 Entry) const
+	{
+		return Entries[Entry].load(std::memory_order_relaxed);
+	}
+
+	// INDEX_NONE if the type is not in the palette
+	FORCEINLINE int32 Find(InVoxelType Type) const
+	{
+		for (uint32 Slot = GetHomeSlot(Type); ; Slot = (Slot + 1) & SlotMask)
+		{
+			uint64 Value = Slots[Slot].load(std::memory_order_acquire);
+			if (Value == 0)
+			{
+				return INDEX_NONE;
+			}
+			if (static_cast<InVoxelType>(Value >> 32) == Type)
+			{
+				return static_cast<int32>(Value & MAX_uint32) - 1;
+			}
+		}
+	}
+
+	// Single writer. The entry must be visible before any word can reference it.
+	void Add(InVoxelType Type)
+	{
+		int32 Entry = Size.load(std::memory_order_relaxed);
+		check(Entry < Capacity);
+		Entries[Entry].store(Type, std::memory_order_relaxed);
+		uint32 Slot = GetHomeSlot(Type);
+		while (Slots[Slot].load(std::memory_order_relaxed) != 0)
+		{
+			Slot = (Slot + 1) & SlotMask;
+		}
+		Slots[Slot].store((static_cast<uint64>(Type) << 32) | static_cast<uint64>(Entry + 1), std::memory_order_release);
+		Size.store(Entry + 1, std::memory_order_release);
+	}
+
+	SIZE_T GetAllocatedSize() const
+	{
+		return Capacity * (sizeof(std::atomic<InVoxelType>) + 2 * sizeof(std::atomic<uint64>));
+	}
+
+private:
+	std::atomic<int32> Size{ 0 };
+	int32 Capacity = 0;
+	uint32 SlotMask = 0;
+	TUniquePtr<std::atomic<InVoxelType>[]> Entries;
+	// Type << 32 | (Entry + 1), zero marks a free slot. Load factor stays at or below one half.
+	TUniquePtr<std::atomic<uint64>[]> Slots;
+
+	FORCEINLINE uint32 GetHomeSlot(InVoxelType Type) const
+	{
+		return (static_cast<uint32>(Type) * 0x9E3779B1u >> 16) & SlotMask;
+	}
+};
+
+// 8-bit types index the lookup directly, both tables live inline in the buffer
+template<>
+struct TVoxelPalette<uint8>
+{
+	static constexpr int32 MaxSize = 256;
+
+	TVoxelPalette()
+	{
+		for (int32 I = 0; I < MaxSize; I++)
+		{
+			Entries[I].store(EmptyVoxelType, std::memory_order_relaxed);
+			Lookup[I].store(INDEX_NONE, std::memory_order_relaxed);
+		}
+	}
+
+	void Initialize(int32 InCapacity)
+	{
+		check(FMath::IsPowerOfTwo(InCapacity) && InCapacity <= MaxSize);
+		checkSlow(Size.load(std::memory_order_relaxed) == 0);
+	}
+
+	FORCEINLINE int32 Num() const
+	{
+		return Size.load(std::memory_order_acquire);
+	}
+
+	FORCEINLINE uint8 Get(int32 Entry) const
+	{
+		return Entries[Entry].load(std::memory_order_relaxed);
+	}
+
+	FORCEINLINE int32 Find(uint8 Type) const
+	{
+		return Lookup[Type].load(std::memory_order_acquire);
+	}
+
+	void Add(uint8 Type)
+	{
+		int32 Entry = Size.load(std::memory_order_relaxed);
+		check(Entry < MaxSize);
+		Entries[Entry].store(Type, std::memory_order_relaxed);
+		Lookup[Type].store(static_cast<int16>(Entry), std::memory_order_release);
+		Size.store(Entry + 1, std::memory_order_release);
+	}
+
+	SIZE_T GetAllocatedSize() const
+	{
+		return 0;
+	}
+
+private:
+	std::atomic<int32> Size{ 0 };
+	std::atomic<uint8> Entries[MaxSize];
+	// Voxel type to palette entry, INDEX_NONE if the type is not in the palette
+	std::atomic<int16> Lookup[MaxSize];
+};
+
+// Packed word allocation shared by every voxel type width
+class VOXELENGINE_API FVoxelPackedWords
+{
+public:
+	// Number of packed words for the given voxel count and bit width
+	static int32 GetWordsNum(int32 VoxelsNum, int32 BitsPerVoxel);
+
+	// Word buffers of LargeWordsAllocationSize bytes or more are taken straight from the OS as zeroed pages.
+	// When enabled, buffers big enough to span a huge page are additionally hinted to be backed by huge pages where the platform supports it.
+	static void SetLargePagesEnabled(bool bEnabled);
+
+	static constexpr SIZE_T LargeWordsAllocationSize = 64 * 1024;
+
+protected:
+	// Returned words are zeroed, every voxel starts as palette entry 0
+	static std::atomic<uint64>* AllocateWords(int32 WordsNum);
+	static void FreeWords(std::atomic<uint64>* Words, int32 WordsNum);
+};
+
+/**
+ * Palette-compressed voxel storage, parameterized over the voxel type ID width.
+ * Every voxel stores an index into a palette of voxel types. Indices are bit-packed into 64-bit words,
+ * using 1, 2, 4, 8 or, for 16-bit types, 16 bits per voxel depending on the palette size.
+ * Storage holding a single voxel type is uniform: it uses 0 bits per voxel and allocates no words until the first differing write.
+ *
+ * Reads and writes of voxel types already present in the palette are lock-free: a write is a compare-and-swap of the containing word.
+ * Writing a new voxel type may grow the palette past the current bit width, in which case the storage is re-packed under a lock.
+ * Re-packing waits for in-flight lock-free writers to leave and sends new writers to the locked path until the new buffer is published.
+ * Replaced buffers are retired to FVoxelEpochs, so readers pinning an epoch never dereference freed memory.
+ * Every write is bracketed by counters that let readers validate what they read, see GetWritesStarted().
+ *
+ * Words may also be borrowed read-only from external memory. The first write copies them into owned memory like re-packing does.
+ */
+template<typename InVoxelType>
+class TVoxelPalettedStorage : public FVoxelPackedWords
+{
+public:
+	using FVoxelTypeId = InVoxelType;
+
+	static constexpr int32 MaxPaletteSize = TVoxelPalette<InVoxelType>::MaxSize;
+	static constexpr int32 MaxBitsPerVoxel = sizeof(InVoxelType) * 8;
+
+	TVoxelPalettedStorage();
+	~TVoxelPalettedStorage();
+
+	TVoxelPalettedStorage(const TVoxelPalettedStorage&) = delete;
+	TVoxelPalettedStorage& operator=(const TVoxelPalettedStorage&) = delete;
+
+	// Not thread-safe. Resets storage to VoxelsNum voxels of FillType.
+	void Initialize(int32 VoxelsNum, InVoxelType FillType);
+
+	// Not thread-safe. Resets storage to borrowed packed words, they are not copied until the first write.
+	// Words must be 8-byte aligned and stay valid while WordsOwner is referenced.
+	void InitializeExternal(int32 VoxelsNum, int32 BitsPerVoxel, TConstArrayView<InVoxelType> Palette, const uint64* Words, TSharedPtr<IVoxelWordsOwner, ESPMode::ThreadSafe> WordsOwner);
+
+	// Not thread-safe. Frees all memory.
+	void Reset();
+
+	int32 Num() const;
+
+	InVoxelType Get(int32 Index) const;
+
+	// Unconditionally writes the voxel type
+	void Set(int32 Index, InVoxelType Desired);
+
+	// Same semantics as std::atomic::compare_exchange_strong: on failure Expected receives the current voxel type
+	bool CompareExchange(int32 Index, InVoxelType& Expected, InVoxelType Desired);
+
+	// Makes every voxel FillType, storage becomes uniform. Blocks writers like re-packing does.
+	void Fill(InVoxelType FillType);
+
+	// Drops unused palette entries and shrinks bit width, storage becomes uniform if a single type is left. Blocks writers like re-packing does.
+	void Compact();
+
+	bool IsUniform(InVoxelType& OutVoxelType) const;
+
+	int32 GetBitsPerVoxel() const;
+
+	int32 GetPaletteSize() const;
+
+	static bool IsValidBitsPerVoxel(int32 BitsPerVoxel);
+
+	// Copies the packed representation. Concurrent writes may or may not be included.
+	void CopyPacked(int32& OutBitsPerVoxel, TArray<InVoxelType>& OutPalette, TArray<uint64>& OutWords) const;
+
+	// Borrowed words are not included
+	SIZE_T GetAllocatedSize() const;
+
+	// A reader that records GetWritesFinished() before reading and then sees GetWritesStarted() still equal to it
+	// has read the voxels exactly as they were when recorded: no write overlapped or followed the reads.
+	uint64 GetWritesStarted() const;
+
+	uint64 GetWritesFinished() const;
+
+private:
+	// Packed words and the palette they index. Palette only grows while the buffer is current,
+	// operations that reorder the palette publish a new buffer instead.
+	struct FPackedBuffer
+	{
+		std::atomic<uint64>* Words = nullptr;
+		int32 WordsNum = 0;
+		int32 BitsPerVoxel = 0;
+		int32 VoxelsPerWordLog2 = 0;
+		uint64 EntryMask = 0;
+		// Borrowed words are read-only and never freed by the buffer
+		TSharedPtr<IVoxelWordsOwner, ESPMode::ThreadSafe> ExternalWordsOwner;
+
+		// Holds up to 1 << BitsPerVoxel entries
+		TVoxelPalette<InVoxelType> Palette;
+
+		~FPackedBuffer();
+
+		SIZE_T GetAllocatedSize() const;
+	};
+
+	int32 VoxelsNum = 0;
+
+	std::atomic<FPackedBuffer*> Buffer{ nullptr };
+
+	std::atomic<int32> ActiveWriters{ 0 };
+	std::atomic<bool> bRepacking{ false };
+	FCriticalSection RepackLock;
+
+	std::atomic<uint64> WritesStarted{ 0 };
+	std::atomic<uint64> WritesFinished{ 0 };
+
+	static int32 GetBitsForPaletteSize(int32 PaletteSize);
+	static FPackedBuffer* AllocateBuffer(int32 VoxelsNum, int32 BitsPerVoxel);
+
+	FORCEINLINE static uint64 ReadEntry(const FPackedBuffer& Packed, int32 Index)
+	{
+		if (Packed.BitsPerVoxel == 0)
+		{
+			return 0;
+		}
+		uint64 Word = Packed.Words[Index >> Packed.VoxelsPerWordLog2].load(std::memory_order_acquire);
+		uint32 Shift = (Index & ((1 << Packed.VoxelsPerWordLog2) - 1)) * Packed.BitsPerVoxel;
+		return (Word >> Shift) & Packed.EntryMask;
+	}
+
+	// Expected == nullptr means unconditional write
+	bool Write(int32 Index, InVoxelType* Expected, InVoxelType Desired);
+	bool WriteEntry(FPackedBuffer& Packed, int32 Index, InVoxelType* Expected, uint64 DesiredEntry);
+
+	// Must be called under RepackLock
+	uint64 FindOrAddPaletteEntry(InVoxelType Type);
+	void Repack(int32 NewBitsPerVoxel);
+	void BeginExclusiveWrite();
+	void EndExclusiveWrite(FPackedBuffer* NewPacked);
+};
+
+// Both widths are compiled into the module, the world uses the configured one
+extern template class VOXELENGINE_API TVoxelPalettedStorage<uint8>;
+extern template class VOXELENGINE_API TVoxelPalettedStorage<uint16>;
+
+using FVoxelPalettedStorage = TVoxelPalettedStorage<VoxelType>;
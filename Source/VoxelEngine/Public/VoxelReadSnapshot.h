@@ -0,0 +1,68 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelType.h"
+#include "VoxelIndexing.h"
+#include "VoxelEpoch.h"
+#include "VoxelPalettedStorage.h"
+
+/**
+ * Read-only view of a voxel box for worker threads, see AVoxelWorld::AcquireReadSnapshot.
+ * Reads are lock-free and see the live voxels, writers are never blocked. The snapshot pins an epoch,
+ * so the sections it covers stay allocated even if their chunks are unloaded meanwhile.
+ *
+ * A reader that finishes its reads and then sees IsStale() return false has read the voxels exactly
+ * as they were when the snapshot was taken. Staleness is tracked per section, so writes elsewhere in
+ * a covered section also count. Chunks loaded after the snapshot was taken are not part of it.
+ *
+ * Memory retired while the snapshot exists is not freed, so snapshots should be short-lived.
+ */
+class VOXELENGINE_API FVoxelReadSnapshot
+{
+public:
+	FVoxelReadSnapshot(const FVoxelReadSnapshot&) = delete;
+	FVoxelReadSnapshot& operator=(const FVoxelReadSnapshot&) = delete;
+
+	// Covered voxel box [Min, Max)
+	const FIntVector& GetMin() const;
+	const FIntVector& GetMax() const;
+
+	bool Contains(const FIntVector& Coord) const;
+
+	// Voxels outside the snapshot and voxels of chunks that were not loaded are empty
+	VoxelType GetVoxel(const FIntVector& Coord) const;
+
+	// Storage of the section containing Coord, null where GetVoxel reads empty voxels
+	const FVoxelPalettedStorage* GetSectionStorage(const FIntVector& Coord) const;
+
+	// True once a write to a covered section started after the snapshot was taken,
+	// or if one was still in progress when it was taken
+	bool IsStale() const;
+
+private:
+	friend class AVoxelWorld;
+
+	struct FSectionView
+	{
+		// Null for sections of chunks that were not loaded and sections outside the Z range
+		const FVoxelPalettedStorage* Storage;
+		uint64 WritesFinished;
+	};
+
+	FVoxelReadSnapshot() = default;
+
+	FVoxelEpochGuard EpochGuard;
+
+	int32 ChunkSide = 0;
+	EVoxelIndexing VoxelIndexing = EVoxelIndexing::Linear;
+	FIntVector Min = FIntVector::ZeroValue;
+	FIntVector Max = FIntVector::ZeroValue;
+	FIntVector2 MinChunk = FIntVector2(0, 0);
+	int32 ChunksNumX = 0;
+	int32 SectionsNum = 0;
+
+	// Indexed by (ChunkY * ChunksNumX + ChunkX) * SectionsNum + SectionIndex, chunk coordinates relative to MinChunk
+	TArray<FSectionView> SectionViews;
+};
@@ -0,0 +1,88 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelPalettedStorage.h"
+#include "HAL/CriticalSection.h"
+
+// Layout parameters every region file of a world must agree on
+struct VOXELENGINE_API FVoxelRegionFormat
+{
+	int32 ChunkSide = 0;
+	int32 WorldHeight = 0;
+	uint8 VoxelIndexing = 0;
+	// Full payloads and deltas against the generator can't be mixed in one world
+	uint8 SaveMode = 0;
+
+	bool operator==(const FVoxelRegionFormat& Other) const = default;
+};
+
+// Serialized chunk voxels waiting to be written to their region file
+struct VOXELENGINE_API FVoxelChunkPayload
+{
+	FIntVector2 ChunkCoord;
+	TArray<uint8> Bytes;
+};
+
+/**
+ * Persists chunk payloads in region files of RegionSide x RegionSide chunks.
+ * A region file starts with a header and a table of payload offsets. Payloads are page-aligned,
+ * so chunks can borrow packed words straight from a read-only mapping of the file.
+ *
+ * Payloads are only ever appended: rewriting a chunk appends a new payload and then updates its table entry.
+ * Mappings taken before the update stay valid for the chunks still borrowing from them. Once most of a file
+ * is rewritten payloads, its live payloads are copied into a new file that replaces it when no mapping is left.
+ *
+ * Windows doesn't allow writing a file while it is mapped, so there payloads are read into memory instead of borrowed,
+ * at the cost of a copy of every loaded chunk.
+ */
+class VOXELENGINE_API FVoxelRegionStore
+{
+public:
+	static constexpr int32 RegionSide = 16;
+
+	FVoxelRegionStore(const FString& InDirectory, const FVoxelRegionFormat& InFormat);
+	~FVoxelRegionStore();
+
+	FVoxelRegionStore(const FVoxelRegionStore&) = delete;
+	FVoxelRegionStore& operator=(const FVoxelRegionStore&) = delete;
+
+	// Returns false if the chunk was never saved. OutPayload stays valid while OutOwner is referenced.
+	bool ReadChunk(const FIntVector2& ChunkCoord, TConstArrayView<uint8>& OutPayload, TSharedPtr<IVoxelWordsOwner, ESPMode::ThreadSafe>& OutOwner);
+
+	// Blocking, meant to be called from a background task, one writer at a time. Returns the number of chunks written.
+	int32 WriteChunks(TConstArrayView<FVoxelChunkPayload> Payloads);
+
+	const FString& GetDirectory() const;
+
+	static FIntVector2 GetRegionCoord(const FIntVector2& ChunkCoord);
+
+private:
+	class FMappedRegionFile;
+
+	FString Directory;
+	FVoxelRegionFormat Format;
+
+	// Serializes reads of the offset table with writes of the same region file, and mapping a file with replacing it
+	FCriticalSection RegionsLock;
+	// Null entries cache regions that have no valid file yet
+	TMap<FIntVector2, TSharedPtr<FMappedRegionFile, ESPMode::ThreadSafe>> MappedRegions;
+	// Every mapping taken of each region file, chunks may still borrow from those that are not cached anymore
+	TMap<FIntVector2, TArray<TWeakPtr<FMappedRegionFile, ESPMode::ThreadSafe>>> RegionFileMappings;
+
+	// ReadChunk on platforms that can't write mapped files
+	bool ReadChunkCopy(const FIntVector2& ChunkCoord, TConstArrayView<uint8>& OutPayload, TSharedPtr<IVoxelWordsOwner, ESPMode::ThreadSafe>& OutOwner);
+
+	FString GetRegionFilePath(const FIntVector2& RegionCoord) const;
+	// Where a region file is compacted into before it replaces the file
+	FString GetCompactedRegionFilePath(const FIntVector2& RegionCoord) const;
+	TSharedPtr<FMappedRegionFile, ESPMode::ThreadSafe> MapRegionFile(const FIntVector2& RegionCoord) const;
+	int32 WriteRegionChunks(const FIntVector2& RegionCoord, TConstArrayView<const FVoxelChunkPayload*> Payloads);
+	// Must be called under RegionsLock
+	bool IsRegionFileMapped(const FIntVector2& RegionCoord);
+	// Rewrites the region file with only its live payloads if most of it is dead and no mapping borrows from it
+	void CompactRegionFile(const FIntVector2& RegionCoord);
+	// A crash between removing a region file and moving its compacted copy in leaves only the copy. Must be called under RegionsLock.
+	void RecoverCompactedRegionFile(const FIntVector2& RegionCoord) const;
+};
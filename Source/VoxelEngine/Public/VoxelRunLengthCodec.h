@@ -0,0 +1,78 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelType.h"
+
+/**
+ * Run-length encoding of voxel streams, meant for terrain columns: long runs of a few types along Z.
+ * Every run is its voxel type (sizeof(VoxelType) bytes, little-endian) followed by the run length minus one
+ * as a LEB128 varint, so with 8-bit types runs of up to 128 voxels take two bytes.
+ * Streams carry no header, callers agree on the voxel count and type width.
+ */
+class VOXELENGINE_API FVoxelRunLengthEncoder
+{
+public:
+	// Runs are appended to Output, which must outlive the encoder
+	explicit FVoxelRunLengthEncoder(TArray<uint8>& InOutput);
+
+	// Flushes the pending run
+	~FVoxelRunLengthEncoder();
+
+	FVoxelRunLengthEncoder(const FVoxelRunLengthEncoder&) = delete;
+	FVoxelRunLengthEncoder& operator=(const FVoxelRunLengthEncoder&) = delete;
+
+	// Consecutive appends of the same type are merged into a single run
+	FORCEINLINE void Append(VoxelType Type, int64 Count = 1)
+	{
+		if (Count <= 0)
+		{
+			return;
+		}
+		if (PendingCount > 0 && PendingType != Type)
+		{
+			Flush();
+		}
+		PendingType = Type;
+		PendingCount += Count;
+	}
+
+	// Writes the pending run. Must be called before Output is read while the encoder is alive.
+	void Flush();
+
+	int64 GetEncodedVoxelsNum() const;
+
+private:
+	TArray<uint8>& Output;
+	VoxelType PendingType = EmptyVoxelType;
+	int64 PendingCount = 0;
+	int64 EncodedVoxelsNum = 0;
+};
+
+class VOXELENGINE_API FVoxelRunLengthDecoder
+{
+public:
+	// Input must outlive the decoder
+	explicit FVoxelRunLengthDecoder(TConstArrayView<uint8> InInput);
+
+	// Takes up to MaxCount voxels of the current run. Returns false at the end of the input or if the input is malformed.
+	bool Read(int64 MaxCount, VoxelType& OutType, int64& OutCount);
+
+	// Fills Out completely. Returns false if the input ends early or is malformed.
+	bool Decode(TArrayView<VoxelType> Out);
+
+	bool IsMalformed() const;
+
+	// True once every run has been read
+	bool IsFinished() const;
+
+private:
+	TConstArrayView<uint8> Input;
+	int32 Offset = 0;
+	VoxelType RunType = EmptyVoxelType;
+	int64 RunRemaining = 0;
+	bool bMalformed = false;
+
+	bool ReadRunHeader();
+};
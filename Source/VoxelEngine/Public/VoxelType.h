@@ -2,5 +2,28 @@
 
 #include "CoreMinimal.h"
 
-using VoxelType = uint8;
-constexpr VoxelType EmptyVoxelType = 0;
\ No newline at end of file
+// Voxel type id width, 8 or 16 bits. Set through PublicDefinitions in VoxelEngine.Build.cs
+#ifndef VOXEL_TYPE_ID_BITS
+#define VOXEL_TYPE_ID_BITS 8
+#endif
+
+template<int32 Bits>
+struct TVoxelTypeId;
+
+template<>
+struct TVoxelTypeId<8>
+{
+	using Type = uint8;
+};
+
+template<>
+struct TVoxelTypeId<16>
+{
+	using Type = uint16;
+};
+
+using VoxelType = TVoxelTypeId<VOXEL_TYPE_ID_BITS>::Type;
+constexpr VoxelType EmptyVoxelType = 0;
+
+// Number of distinct voxel types, EmptyVoxelType included
+constexpr int32 MaxVoxelTypesNum = 1 << (sizeof(VoxelType) * 8);
@@ -6,8 +6,22 @@
 #include "Engine/DataAsset.h"
 #include "VoxelData.h"
 #include "VoxelType.h"
+#include <atomic>
 #include "VoxelTypeSet.generated.h"
 
+// Per-type properties compiled from UVoxelData for hot-path tests
+enum class EVoxelTypeFlags : uint8
+{
+	None = 0,
+	Transparent = 1 << 0,
+	Traversable = 1 << 1,
+	// Occupies its voxel for collision
+	Solid = 1 << 2,
+	// Meshed as an opaque cube, faces towards transparent neighbours are visible
+	OpaqueCube = 1 << 3
+};
+ENUM_CLASS_FLAGS(EVoxelTypeFlags)
+
 /**
  * 
  */
@@ -20,7 +34,34 @@ private:
 	UPROPERTY(EditDefaultsOnly)
 	TArray<UVoxelData*> VoxelTypes;
 
+	// Indexed by voxel type, EmptyVoxelType included. Entries are atomic so that any thread may read while the game thread rebuilds.
+	std::atomic<uint8> TypeFlags[MaxVoxelTypesNum];
+
+	TMap<FName, VoxelType> TypesByName;
+
 public:
+	UVoxelTypeSet();
+
+	void PostLoad() override;
+
+#if WITH_EDITOR
+	void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
+	// Recompiles the flag table and the name lookup from VoxelTypes. Game thread, worlds call it when they begin play.
+	void RebuildTypeTables();
+
+	FORCEINLINE EVoxelTypeFlags GetTypeFlags(VoxelType Type) const
+	{
+		return static_cast<EVoxelTypeFlags>(TypeFlags[Type].load(std::memory_order_relaxed));
+	}
+
+	// True if the type has all of Flags
+	FORCEINLINE bool HasTypeFlags(VoxelType Type, EVoxelTypeFlags Flags) const
+	{
+		return EnumHasAllFlags(GetTypeFlags(Type), Flags);
+	}
+
 	UFUNCTION(BlueprintCallable)
 	const TArray<UVoxelData*>& GetVoxelTypes() const;
 
@@ -35,6 +76,7 @@ public:
 	UVoxelData* GetVoxelDataByType(VoxelType VoxelType) const;
 
 #if WITH_EDITOR
+	// RebuildTypeTables must be called once the changes are done
 	UFUNCTION(BlueprintCallable)
 	TArray<UVoxelData*>& GetVoxelTypesMutable();
 #endif
@@ -4,19 +4,33 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
-#include "Voxel.h"
+#include "VoxelType.h"
 #include "VoxelChunk.h"
 #include "VoxelWorldGenerator.h"
-#include <vector>
 #include "VoxelTypeSet.h"
 #include "Engine/TextureRenderTarget2D.h"
 #include "Materials/MaterialInstanceDynamic.h"
 #include "VoxelRenderingSettings.h"
 #include "VoxelChange.h"
+#include "VoxelIndexing.h"
+#include "Misc/ScopeRWLock.h"
+#include "VoxelRegionFile.h"
+#include "VoxelReadSnapshot.h"
+#include "VoxelMeshCache.h"
+#include "Tasks/Task.h"
 #include "VoxelWorld.generated.h"
 
 class AVoxelWorld;
 
+UENUM(BlueprintType)
+enum class EVoxelChunkSaveMode : uint8
+{
+	// Chunks are saved whole and mapped back on load, generation is skipped
+	Full = 0,
+	// Only voxels differing from the generator output are saved and replayed over a fresh generation on load
+	Delta = 1
+};
+
 USTRUCT()
 struct VOXELENGINE_API FVoxelWorldSecondaryTickFunction : public FActorTickFunction
 {
@@ -60,6 +74,7 @@ public:
 	UFUNCTION(BlueprintCallable)
 	void RegenerateChunkMeshes();
 
+	// Size of a fixed world. Streamed worlds are unbounded horizontally and report zero X and Y.
 	UFUNCTION(BlueprintCallable)
 	FIntVector GetWorldSizeVoxel() const;
 
@@ -78,10 +93,41 @@ public:
 	UFUNCTION(BlueprintCallable)
 	double GetVoxelSizeWorld() const;
 
+	// Voxel order inside chunk sections
+	UFUNCTION(BlueprintCallable)
+	EVoxelIndexing GetVoxelIndexing() const;
+
+	UFUNCTION(BlueprintCallable)
+	EVoxelMeshingMode GetMeshingMode() const;
+
+	bool IsBinaryMeshingEnabled() const;
+
+	bool IsAsyncMeshingEnabled() const;
+
+	// Null if the mesh cache is disabled
+	FVoxelMeshCache* GetMeshCache() const;
+
+	UFUNCTION(BlueprintCallable)
+	void LogMeshCacheStats() const;
+
+	// Queues a chunk with dirty sections for the meshing scheduler, see MeshingBudgetMilliseconds
+	void ScheduleChunkMeshing(UVoxelChunk* Chunk);
+
+	// Thread-safe. Queues a chunk with voxel changes waiting to be rendered for the next tick.
+	void ScheduleChunkChangeRequests(UVoxelChunk* Chunk);
+
+	// Queues a chunk whose section meshes were patched while processing changes
+	void ScheduleChunkPatchNotification(UVoxelChunk* Chunk);
+
+	// LOD a chunk at DistanceChunks from the nearest streaming source should be meshed at, given its current LOD
+	int32 SelectChunkMeshLod(int32 CurrentLod, double DistanceChunks) const;
+
 	bool IsVoxelTransparent(const FIntVector& Coord) const;
 
 	bool IsVoxelTransparentTypeOverride(const FIntVector& Coord, VoxelType VoxelType) const;
 
+	bool IsVoxelTypeTransparent(VoxelType VoxelTypeId) const;
+
 	bool IsVoxelTraversable(const FIntVector& Coord) const;
 
 	UFUNCTION(BlueprintCallable)
@@ -99,36 +145,73 @@ public:
 	UFUNCTION(BlueprintCallable)
 	UVoxelTypeSet* GetVoxelTypeSet() const;
 
-	void Tick(float DeltaTime) override;
-	virtual void TickSecondary(float DeltaTime, ELevelTick LevelTick, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent, FVoxelWorldSecondaryTickFunction* TickFunction);
+	UFUNCTION(BlueprintCallable)
+	bool IsChunkStreamingEnabled() const;
 
-	uint64 LinearizeCoordinate(int32 X, int32 Y, int32 Z) const;
-	FIntVector DelinearizeCoordinate(uint64 LinearCoord) const;
+	// Chunks are streamed around registered sources in addition to local player view points
+	UFUNCTION(BlueprintCallable)
+	void AddStreamingSource(AActor* Source);
+
+	UFUNCTION(BlueprintCallable)
+	void RemoveStreamingSource(AActor* Source);
+
+	void GetLoadedChunks(TArray<UVoxelChunk*>& OutChunks) const;
+
+	int32 GetLoadedChunksNum() const;
+
+	// Chunks of a fixed world that were not restored from region files
+	void GetChunksToGenerate(TArray<UVoxelChunk*>& OutChunks) const;
+
+	// Appends voxel columns of a loaded chunk to an RLE stream, for saving, copying or sending chunks. Returns false if the chunk is not loaded.
+	bool EncodeChunkColumns(const FIntVector2& ChunkCoord, FVoxelRunLengthEncoder& Encoder) const;
+
+	// Reads one chunk of columns from an RLE stream into a loaded chunk and rebuilds its mesh.
+	// Returns false if the chunk is not loaded, in which case the stream is not advanced, or if the stream ends early.
+	bool DecodeChunkColumns(const FIntVector2& ChunkCoord, FVoxelRunLengthDecoder& Decoder);
+
+	// Writes chunks with unsaved voxels to region files in the background. bWait blocks until everything is written.
+	UFUNCTION(BlueprintCallable)
+	void SaveChunks(bool bWait);
 
-	uint64 LinearizeChunkCoordinate(const FIntVector2& ChunkCoord) const;
-	FIntVector2 DelinearizeChunkCoordinate(uint64 LinearCoord) const;
+	void Tick(float DeltaTime) override;
+	virtual void TickSecondary(float DeltaTime, ELevelTick LevelTick, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent, FVoxelWorldSecondaryTickFunction* TickFunction);
 
 	FIntVector2 GetChunkCoordFromVoxelCoord(const FIntVector& Coord) const;
+
+	// Returns nullptr if the chunk is not loaded
 	UVoxelChunk* GetChunkFromVoxelCoord(const FIntVector& Coord) const;
+	UVoxelChunk* GetChunk(const FIntVector2& ChunkCoord) const;
 
-	const Voxel& GetVoxel(const FIntVector& Coord) const;
+	// Voxel lookups are routed to the voxel block of the owning chunk. Voxels of chunks that are not loaded are empty.
+	// Game thread only, other threads read through a snapshot.
+	VoxelType GetVoxel(const FIntVector& Coord) const;
 
-	Voxel& GetVoxel(const FIntVector& Coord);
+	VoxelType GetVoxel(int32 X, int32 Y, int32 Z) const;
 
-	Voxel& GetVoxel(int32 X, int32 Y, int32 Z);
+	// Writes voxel type without notifying chunk rendering. Intended for world generators.
+	void SetVoxel(const FIntVector& Coord, VoxelType Desired);
+
+	// Fills the box [Min, Max) without notifying chunk rendering. Intended for world generators.
+	void FillVoxels(const FIntVector& Min, const FIntVector& Max, VoxelType Desired);
 
 	bool IsValidCoordinate(const FIntVector& Coord) const;
 
-	// Thread-safe and lock-free way to change voxel type
+	// Thread-safe way to change voxel type. Writers share the chunk map lock and only block while a chunk is being loaded or
+	// unloaded, the voxel itself is written lock-free. Briefly locks the chunk when the voxel type is new to the chunk palette
+	// and the palette has to be re-packed. Changes of chunks that are not loaded are rejected.
 	EVoxelChangeResult ChangeVoxel(FVoxelChange& VoxelChange);
 
-	// Thread-safe and lock-free way to change voxel type. Exposed to Blueprints.
+	// Thread-safe way to change voxel type, expecting the current type. Blocks like the overload above. Exposed to Blueprints.
 	UFUNCTION(BlueprintCallable)
 	EVoxelChangeResult ChangeVoxel(const FIntVector& Coord, int32 DesiredVoxelType);
 
+	// Thread-safe. Read-only view of the voxels in [Min, Max) for meshing, pathfinding and queries on worker threads.
+	TSharedRef<FVoxelReadSnapshot, ESPMode::ThreadSafe> AcquireReadSnapshot(const FIntVector& Min, const FIntVector& Max) const;
+
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 	virtual void PostInitProperties() override;
 
 private:
@@ -141,6 +224,59 @@ private:
 	UPROPERTY(EditDefaultsOnly)
 	double VoxelSizeWorld = 100;
 
+	// Morton indexing falls back to Linear if ChunkSide is not a power of two
+	UPROPERTY(EditDefaultsOnly)
+	EVoxelIndexing VoxelIndexing = EVoxelIndexing::Linear;
+
+	// Greedy meshing needs a chunk material that tiles the atlas, see EVoxelMeshingMode
+	UPROPERTY(EditDefaultsOnly, Category = Rendering)
+	EVoxelMeshingMode MeshingMode = EVoxelMeshingMode::PerFace;
+
+	// Full section rebuilds find visible faces from 64-bit opacity rows instead of per-voxel neighbour lookups.
+	// Requires ChunkSide up to UVoxelChunk::MaxBinaryMeshingChunkSide.
+	UPROPERTY(EditDefaultsOnly, Category = Rendering)
+	bool bBinaryMeshing = true;
+
+	// Edited sections are remeshed by worker tasks and swapped in once done, instead of on the game thread.
+	// Tasks use binary meshing, so this has the same ChunkSide limit.
+	UPROPERTY(EditDefaultsOnly, Category = Rendering)
+	bool bAsyncMeshing = true;
+
+	// Section meshes of face directions that point away from every local view are not drawn
+	UPROPERTY(EditDefaultsOnly, Category = Rendering)
+	bool bCullFaceDirections = true;
+
+	// Distant chunks are meshed from cells of up to 2^MaxMeshLod voxels, see FVoxelLodCells. 0 disables LOD meshes.
+	// The cell size must divide ChunkSide.
+	UPROPERTY(EditDefaultsOnly, Category = Rendering)
+	int32 MaxMeshLod = 0;
+
+	// Distance in chunks where LOD 1 starts, every further LOD starts at twice the distance of the previous one
+	UPROPERTY(EditDefaultsOnly, Category = Rendering)
+	float MeshLodDistance = 4.0f;
+
+	// Chunks switch LOD only this many chunks past the LOD distance, so that moving along it doesn't remesh them every frame
+	UPROPERTY(EditDefaultsOnly, Category = Rendering)
+	float MeshLodHysteresis = 0.5f;
+
+	// Game thread time spent meshing scheduled chunks per frame, nearest chunks first. Changes with SameFrame or Immidiate
+	// render priority are meshed regardless, and at least one section is meshed every frame.
+	UPROPERTY(EditDefaultsOnly, Category = Rendering)
+	float MeshingBudgetMilliseconds = 4.0f;
+
+	// Built section meshes are kept by the hash of their voxels and surroundings, so that sections that come back
+	// to an earlier state, e.g. after an undone edit or a full remesh, reuse them. 0 disables the cache.
+	UPROPERTY(EditDefaultsOnly, Category = Rendering)
+	int32 MeshCacheSizeMB = 64;
+
+	// Allocates and generates chunks of a fixed world across worker threads
+	UPROPERTY(EditDefaultsOnly, Category = Memory)
+	bool bParallelChunkAllocation = true;
+
+	// Hints the OS to back large voxel buffers with huge pages. Only has effect on platforms exposing the hint.
+	UPROPERTY(EditDefaultsOnly, Category = Memory)
+	bool bUseLargePages = false;
+
 	UPROPERTY(EditDefaultsOnly)
 	TSubclassOf<UVoxelWorldGenerator> VoxelWorldGeneratorClass;
 
@@ -150,8 +286,87 @@ private:
 	UPROPERTY(EditDefaultsOnly)
 	UVoxelRenderingSettings* RenderingSettings = nullptr;
 
+	// Fixed worlds take their size from the generator and load every chunk at BeginPlay
+	UPROPERTY(EditDefaultsOnly, Category = Streaming)
+	bool bStreamChunks = false;
+
+	// Radii are measured in chunks around each streaming source
+	UPROPERTY(EditDefaultsOnly, Category = Streaming)
+	int32 ChunkLoadRadius = 8;
+
+	// Must be greater than ChunkLoadRadius to avoid chunks being loaded and unloaded on every move
+	UPROPERTY(EditDefaultsOnly, Category = Streaming)
+	int32 ChunkUnloadRadius = 10;
+
+	UPROPERTY(EditDefaultsOnly, Category = Streaming)
+	int32 MaxChunkLoadsPerFrame = 2;
+
+	UPROPERTY(EditDefaultsOnly, Category = Streaming)
+	int32 MaxChunkUnloadsPerFrame = 4;
+
+	// Saved chunks are mapped from region files instead of being generated
+	UPROPERTY(EditDefaultsOnly, Category = Persistence)
+	bool bPersistChunks = false;
+
+	// Region files are stored in Saved/VoxelWorlds/<SaveName>
+	UPROPERTY(EditDefaultsOnly, Category = Persistence)
+	FString SaveName = TEXT("Default");
+
+	UPROPERTY(EditDefaultsOnly, Category = Persistence)
+	float ChunkSaveIntervalSeconds = 5.0f;
+
+	// Delta saves scale with the number of edits, but require a deterministic generator
+	UPROPERTY(EditDefaultsOnly, Category = Persistence)
+	EVoxelChunkSaveMode ChunkSaveMode = EVoxelChunkSaveMode::Full;
+
 	UPROPERTY(VisibleAnywhere)
-	TArray<UVoxelChunk*> Chunks;
+	TMap<FIntVector2, UVoxelChunk*> Chunks;
+
+	// Guards the chunk map against ChangeVoxel calls from other threads while chunks are streamed.
+	// Only the game thread modifies the map, so game thread lookups don't take the lock.
+	mutable FRWLock ChunksLock;
+
+	TArray<TWeakObjectPtr<AActor>> StreamingSources;
+
+	bool bInitialChunksStreamed = false;
+
+	UPROPERTY()
+	TArray<UVoxelChunk*> ChunksToGenerate;
+
+	TUniquePtr<FVoxelMeshCache> MeshCache;
+
+	// Chunks don't tick, only chunks with pending work are driven by the world.
+	// Chunks with dirty sections or section tasks in flight. Chunks are referenced by the chunk map while loaded.
+	TSet<UVoxelChunk*> ChunksToMesh;
+	// Chunks with queued voxel changes, filled from any thread. Unloaded chunks turn null.
+	TQueue<TWeakObjectPtr<UVoxelChunk>, EQueueMode::Mpsc> ChunksWithChangeRequests;
+	// Chunks patched while processing changes of this tick
+	TSet<UVoxelChunk*> ChunksToNotify;
+
+	// Chunk X, chunk Y and section of each local view at the last face culling, culling only changes when they do.
+	// Sections below and above the world are -1 and the sections count.
+	TArray<FIntVector> LastViewSectionCoords;
+	// Streaming source chunks at the last LOD update, distances and so LODs only change when they do
+	TArray<FIntVector2> LastLodSourceChunkCoords;
+
+	TSharedPtr<FVoxelRegionStore, ESPMode::ThreadSafe> RegionStore;
+	UE::Tasks::FTask ChunkSaveTask;
+	double LastChunkSaveTime = 0;
+
+	// Unregistered chunks that the save task computes deltas with, the edited one restored from a full payload
+	UPROPERTY()
+	UVoxelChunk* DeltaBaselineChunk = nullptr;
+	UPROPERTY()
+	UVoxelChunk* DeltaEditedChunk = nullptr;
+
+	// Payloads of unloaded chunks waiting for the next save. All payloads in memory hold every voxel, in delta mode they are
+	// turned into deltas when written.
+	TArray<FVoxelChunkPayload> PendingChunkPayloads;
+	// Payloads of the last launched save, kept until the next one so that chunks can be restored from them while they are written
+	TSharedPtr<const TArray<FVoxelChunkPayload>, ESPMode::ThreadSafe> SavingChunkPayloads;
+
+	// Chunks whose payloads may not be written yet, loading them restores their voxels from memory instead
+	TSet<FIntVector2> UnsavedChunkCoords;
 
 	UPROPERTY(VisibleAnywhere, Category = Tick)
 	FVoxelWorldSecondaryTickFunction SecondaryActorTick;
@@ -165,11 +380,44 @@ private:
 	UPROPERTY()
 	UVoxelWorldGenerator* VoxelWorldGeneratorInstance = nullptr;
 
-	std::vector<Voxel> Voxels;
-
 	UFUNCTION()
 	void WorldGenerationFinishedCallback();
 
+	void SpawnChunks();
+	UVoxelChunk* SpawnChunk(const FIntVector2& ChunkCoord);
+	// Chunks are published once their voxels are allocated, other threads may look them up from then on
+	void PublishChunk(const FIntVector2& ChunkCoord, UVoxelChunk* Chunk);
+
+	void UpdateChunkStreaming(int32 LoadBudget, int32 UnloadBudget);
+	void GetStreamingSourceChunkCoords(TArray<FIntVector2>& OutChunkCoords) const;
+	// View points of local player controllers
+	void GetLocalViewLocations(TArray<FVector>& OutViewLocations) const;
+	void UpdateChunkFaceCulling();
+	void ProcessChunkChangeRequests();
+	// Meshes scheduled chunks by render priority and distance to local views within the frame budget
+	void UpdateChunkMeshes();
+	void UpdateChunkMeshLods();
+	double GetMeshLodDistance(int32 Lod) const;
+	UVoxelChunk* LoadChunk(const FIntVector2& ChunkCoord);
+	void UnloadChunk(const FIntVector2& ChunkCoord);
+
+	// Newest payload of a chunk in UnsavedChunkCoords, null if there is none
+	const FVoxelChunkPayload* FindUnsavedChunkPayload(const FIntVector2& ChunkCoord) const;
+
+	// Allocates chunk voxels from UnsavedPayload or else its region file, returns false if the chunk was never saved
+	bool RestoreChunkVoxels(UVoxelChunk* Chunk, const FIntVector2& ChunkCoord, const FVoxelChunkPayload* UnsavedPayload = nullptr);
+
+	// Replays the saved delta on a freshly generated chunk, returns the number of replayed edits
+	int32 ReplayChunkDelta(UVoxelChunk* Chunk, const FIntVector2& ChunkCoord);
+
+	// Diffs full payloads against regenerated generator output. Runs in the save task if the generator can run on worker threads.
+	void SerializeChunkDeltas(TConstArrayView<FVoxelChunkPayload> Payloads, TArray<FVoxelChunkPayload>& OutDeltaPayloads);
+
+	UVoxelChunk* GetChunkAndLocalCoord(const FIntVector& Coord, FIntVector& OutLocalCoord) const;
+
+	// Writes a change to a chunk looked up under ChunksLock, which the caller holds
+	EVoxelChangeResult ChangeChunkVoxel(UVoxelChunk* Chunk, const FIntVector& LocalCoord, FVoxelChange& VoxelChange);
+
 	bool InitializeMaterials();
 
 };
@@ -7,6 +7,7 @@
 #include "VoxelWorldGenerator.generated.h"
 
 class AVoxelWorld;
+class UVoxelChunk;
 
 UCLASS()
 class VOXELENGINE_API UVoxelWorldGenerator : public UObject
@@ -17,5 +18,13 @@ public:
 	DECLARE_DYNAMIC_DELEGATE(FVoxelWorlGenerationFinished);
 
 	virtual FIntVector2 GetWantedWorldSizeVoxels() const;
+
+	// Generates every chunk of a fixed world that was not restored from region files
 	virtual void GenerateWorld(AVoxelWorld* VoxelWorld, const FVoxelWorlGenerationFinished& Callback);
+
+	// Generates voxels of a single freshly allocated chunk. Must only depend on the chunk coordinate, streamed chunks are regenerated on every load.
+	virtual void GenerateChunk(AVoxelWorld* VoxelWorld, UVoxelChunk* Chunk);
+
+	// Generators whose GenerateChunk only touches the given chunk may generate a fixed world across worker threads
+	virtual bool CanGenerateChunksInParallel() const;
 };
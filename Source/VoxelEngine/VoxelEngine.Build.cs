@@ -12,6 +12,9 @@ public class VoxelEngine : ModuleRules
 
 		PrivateDependencyModuleNames.AddRange(new string[] {  });
 
+        // Uncomment to use 16-bit voxel type ids, for more than 256 voxel types
+        // PublicDefinitions.Add("VOXEL_TYPE_ID_BITS=16");
+
         // Uncomment if you are using Slate UI
         // PrivateDependencyModuleNames.AddRange(new string[] { "Slate", "SlateCore" });
 
@@ -1,4 +1,5 @@
 #include "VoxelEngine.h"
+#include "VoxelEpoch.h"
 
 #define LOCTEXT_NAMESPACE "VoxelEngine"
 
@@ -11,6 +12,8 @@ void FVoxelEngine::StartupModule()
 
 void FVoxelEngine::ShutdownModule()
 {
+    // No reader is pinned anymore, everything retired is freed
+    FVoxelEpochs::AdvanceAndReclaim();
     UE_LOG(LogVoxelEngine, Warning, TEXT("VoxelEngine: Log Ended"));
 }
 